@@ -0,0 +1,133 @@
+import java.io.FileWriter;
+import java.io.Writer;
+import java.lang.invoke.MethodHandle;
+import java.lang.invoke.MethodHandles;
+import java.lang.invoke.MethodType;
+import java.net.URL;
+import java.net.URLClassLoader;
+import java.nio.file.Paths;
+import java.util.Arrays;
+import java.util.Locale;
+
+/*
+ * Runtime benchmark of a class generated by rv2jvm. Runs hart 0 of the
+ * class in class_dir until the warmup time is over, then times every run
+ * for the measurement time and reports the millions of guest instructions
+ * per second (MIPS) of the median run as one JSON line.
+ *
+ * Usage: java RuntimeBench --instructions=n [options] class_dir
+ */
+public final class RuntimeBench {
+	private static final int MIN_ITERATIONS = 5;
+
+	private String kernel = "kernel";
+	private String config = "default";
+	private long instructions;
+	private long warmupMs = 2000;
+	private long measureMs = 3000;
+	private String output;
+	private String classDir;
+
+	private static void usage() {
+		System.err.println("Usage: java RuntimeBench --instructions=n "
+				   + "[--kernel=name] [--config=name] "
+				   + "[--warmup-ms=n] [--measure-ms=n] "
+				   + "[--output=file] class_dir");
+		System.exit(64);
+	}
+
+	private static String value(String arg) {
+		return arg.substring(arg.indexOf('=') + 1);
+	}
+
+	private void parse(String[] args) {
+		for (String arg : args) {
+			if (arg.startsWith("--kernel=")) {
+				kernel = value(arg);
+			} else if (arg.startsWith("--config=")) {
+				config = value(arg);
+			} else if (arg.startsWith("--instructions=")) {
+				instructions = Long.parseLong(value(arg));
+			} else if (arg.startsWith("--warmup-ms=")) {
+				warmupMs = Long.parseLong(value(arg));
+			} else if (arg.startsWith("--measure-ms=")) {
+				measureMs = Long.parseLong(value(arg));
+			} else if (arg.startsWith("--output=")) {
+				output = value(arg);
+			} else if (arg.startsWith("--") || classDir != null) {
+				usage();
+			} else {
+				classDir = arg;
+			}
+		}
+		if (classDir == null || instructions <= 0) {
+			usage();
+		}
+	}
+
+	/*
+	 * Every configuration compiles to a class named RvRuntime, each one
+	 * gets a loader of its own.
+	 */
+	private MethodHandle loadHart() throws Exception {
+		URL url = Paths.get(classDir).toUri().toURL();
+		URLClassLoader loader = new URLClassLoader(new URL[] { url },
+				RuntimeBench.class.getClassLoader());
+		Class<?> runtime = Class.forName("RvRuntime", true, loader);
+		return MethodHandles.publicLookup().findStatic(runtime, "hart",
+				MethodType.methodType(void.class, int.class));
+	}
+
+	private void run() throws Throwable {
+		MethodHandle hart = loadHart();
+
+		long warmups = 0;
+		long end = System.nanoTime() + warmupMs * 1_000_000L;
+		while (System.nanoTime() < end || warmups < MIN_ITERATIONS) {
+			hart.invokeExact(0);
+			warmups++;
+		}
+
+		long[] times = new long[64];
+		int iterations = 0;
+		end = System.nanoTime() + measureMs * 1_000_000L;
+		while (System.nanoTime() < end || iterations < MIN_ITERATIONS) {
+			long start = System.nanoTime();
+			hart.invokeExact(0);
+			long time = System.nanoTime() - start;
+			if (iterations == times.length) {
+				times = Arrays.copyOf(times, times.length * 2);
+			}
+			times[iterations++] = time;
+		}
+
+		times = Arrays.copyOf(times, iterations);
+		long total = 0;
+		for (long time : times) {
+			total += time;
+		}
+		Arrays.sort(times);
+		long median = times[iterations / 2];
+		// instructions per nanosecond times 1000
+		double mips = instructions * 1000.0 / median;
+		String line = String.format(Locale.ROOT,
+			"{\"kernel\":\"%s\",\"config\":\"%s\",\"instructions\":%d,"
+			+ "\"warmup_iterations\":%d,\"iterations\":%d,"
+			+ "\"min_ns\":%d,\"median_ns\":%d,\"mean_ns\":%d,"
+			+ "\"mips\":%.1f}",
+			kernel, config, instructions, warmups, iterations,
+			times[0], median, total / iterations, mips);
+		System.out.println(line);
+		if (output != null) {
+			try (Writer writer = new FileWriter(output, true)) {
+				writer.write(line + "\n");
+			}
+		}
+	}
+
+	public static void main(String[] args) throws Throwable {
+		RuntimeBench bench = new RuntimeBench();
+		bench.parse(args);
+		bench.run();
+	}
+}
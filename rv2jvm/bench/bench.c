@@ -0,0 +1,150 @@
+/*
+ * Compiler throughput benchmark driver.
+ *
+ * Compiles the given files with statistics enabled and prints one JSON
+ * object per run with wall time, CPU time, allocations, peak resident set
+ * size and output size of every phase. Each line is self-contained so
+ * result files can be concatenated and compared with bench/compare.sh.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "compiler.h"
+#include "darray.h"
+#include "options.h"
+#include "stats.h"
+
+static const char *phase_names[STATS_PHASE_COUNT] = {
+	[STATS_LEX] = "lex",
+	[STATS_PARSE] = "parse",
+	[STATS_SEMAN] = "seman",
+	[STATS_CODEGEN] = "codegen",
+};
+
+static void run_once(int filepaths_n, char **filepaths,
+		     struct compile_stats *stats)
+{
+	struct compile_options options = {
+		.stats = stats,
+		.ignore_class_limits = true
+	};
+	struct bytecode bytecode = { 0 };
+	compile(filepaths_n, filepaths, &options, &bytecode);
+	darray_free(bytecode);
+}
+
+static void print_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', out);
+		}
+		fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+static void print_result(FILE *out, const char *name, int repeat,
+			 int filepaths_n, struct compile_stats *best)
+{
+	uint64_t total_ns = 0;
+	fprintf(out, "{\"case\":");
+	print_string(out, name);
+	fprintf(out, ",\"files\":%d,\"input_bytes\":%zu,\"repeat\":%d",
+		filepaths_n, best->input_bytes, repeat);
+	fprintf(out, ",\"tokens\":%zu,\"ir_elements\":%zu", best->tokens,
+		best->ir_elements);
+	for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+		struct phase_stats *phase = &best->phases[i];
+		fprintf(out, ",\"%s_ns\":%lu,\"%s_cpu_ns\":%lu,"
+			"\"%s_allocations\":%lu,\"%s_peak_rss_kb\":%ld,"
+			"\"%s_output_bytes\":%zu",
+			phase_names[i], phase->wall_ns,
+			phase_names[i], phase->cpu_ns,
+			phase_names[i], phase->allocations,
+			phase_names[i], phase->peak_rss_kb,
+			phase_names[i], phase->output_size);
+		total_ns += phase->wall_ns;
+	}
+	fprintf(out, ",\"total_ns\":%lu,\"peak_rss_kb\":%ld}\n", total_ns,
+		best->phases[STATS_CODEGEN].peak_rss_kb);
+	fflush(out);
+}
+
+static void usage(const char *program)
+{
+	fprintf(stderr,
+		"Usage: %s [-n case_name] [-r repeat] [-o results] file...\n"
+		"  -n case_name  name recorded in the result (default \"bench\")\n"
+		"  -r repeat     number of runs, the fastest is kept (default 1)\n"
+		"  -o results    append the JSON result to this file instead of "
+		"stdout\n",
+		program);
+	exit(EX_USAGE);
+}
+
+int main(int argc, char *argv[])
+{
+	char *name = "bench";
+	char *results_path = NULL;
+	int repeat = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:r:o:")) != -1) {
+		switch (opt) {
+		case 'n':
+			name = optarg;
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'o':
+			results_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc || repeat < 1) {
+		usage(argv[0]);
+	}
+	int filepaths_n = argc - optind;
+	char **filepaths = &argv[optind];
+
+	struct compile_stats best = { 0 };
+	for (int r = 0; r < repeat; r++) {
+		struct compile_stats run = { 0 };
+		run_once(filepaths_n, filepaths, &run);
+		for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+			struct phase_stats *phase = &run.phases[i];
+			if (r != 0 && phase->wall_ns > best.phases[i].wall_ns) {
+				phase->wall_ns = best.phases[i].wall_ns;
+				phase->cpu_ns = best.phases[i].cpu_ns;
+			}
+		}
+		free_stats(&best);
+		best = run;
+	}
+
+	FILE *out = stdout;
+	if (results_path != NULL) {
+		out = fopen(results_path, "a");
+		if (out == NULL) {
+			fprintf(stderr, "Could not open file \"%s\" for writing.\n",
+				results_path);
+			exit(EX_IOERR);
+		}
+	}
+	print_result(out, name, repeat, filepaths_n, &best);
+	free_stats(&best);
+	if (out != stdout) {
+		fclose(out);
+	}
+	return 0;
+}
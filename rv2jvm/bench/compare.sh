@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Compare two result files written by bench/run.sh. Prints the per-phase
+# wall time ratio new/old for every case present in both files and marks
+# ratios above the threshold (default 1.10) as regressions.
+#
+# Usage: bench/compare.sh old.jsonl new.jsonl [threshold]
+
+if [ $# -lt 2 ]; then
+	echo "Usage: $0 old.jsonl new.jsonl [threshold]" >&2
+	exit 64
+fi
+
+awk -v threshold="${3:-1.10}" '
+function field(line, key,    rest) {
+	rest = line
+	if (!sub(".*\"" key "\":", "", rest)) {
+		return ""
+	}
+	sub(/[,}].*/, "", rest)
+	gsub(/"/, "", rest)
+	return rest
+}
+function case_name(line,    rest) {
+	rest = line
+	sub(/^\{"case":"/, "", rest)
+	sub(/",.*/, "", rest)
+	return rest
+}
+BEGIN {
+	split("lex parse seman codegen total", phases, " ")
+	regressions = 0
+}
+FNR == NR {
+	name = case_name($0)
+	for (i = 1; i <= 5; i++) {
+		old[name, phases[i]] = field($0, phases[i] "_ns")
+	}
+	old_rss[name] = field($0, "peak_rss_kb")
+	next
+}
+{
+	name = case_name($0)
+	if (!((name, "total") in old)) {
+		next
+	}
+	printf "%s\n", name
+	for (i = 1; i <= 5; i++) {
+		p = phases[i]
+		before = old[name, p]
+		after = field($0, p "_ns")
+		ratio = before > 0 ? after / before : 0
+		mark = ratio > threshold ? "  REGRESSION" : ""
+		if (mark != "") {
+			regressions++
+		}
+		printf "  %-8s %12.3f ms -> %12.3f ms  x%.2f%s\n", p,
+		       before / 1e6, after / 1e6, ratio, mark
+	}
+	printf "  %-8s %12d KB -> %12d KB\n", "rss", old_rss[name],
+	       field($0, "peak_rss_kb")
+}
+END {
+	exit regressions > 0 ? 1 : 0
+}
+' "$1" "$2"
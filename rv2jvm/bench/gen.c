@@ -0,0 +1,330 @@
+/*
+ * Synthetic RV32I assembly generator for compiler throughput benchmarks.
+ *
+ * Writes one or more .s files accepted by rv2jvm whose combined size or
+ * instruction count, label density and branch ratio are configurable. The
+ * same seed always produces the same programs, so runs can be compared with
+ * each other.
+ */
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+struct gen_options {
+	uint64_t size;
+	// instructions of all files, replaces size when not 0
+	uint64_t instructions;
+	int files;
+	double label_density;
+	double branch_ratio;
+	uint64_t seed;
+	char *prefix;
+};
+
+struct gen {
+	struct gen_options *options;
+	FILE *out;
+	uint64_t rng;
+	uint64_t written;
+	uint64_t instructions;
+	int file;
+	size_t labels_defined;
+	size_t labels_referenced;
+};
+
+static const char *r3_mnemonics[] = {
+	"add", "sub", "slt", "sltu", "and", "or", "xor", "sll", "srl", "sra"
+};
+
+static const char *r2_mnemonics[] = {
+	"addi", "slti", "sltiu", "andi", "ori", "xori"
+};
+
+static const char *shift_mnemonics[] = { "slli", "srli", "srai" };
+
+static const char *branch_mnemonics[] = {
+	"beq", "bne", "blt", "bge", "bltu", "bgeu"
+};
+
+static const char *load_mnemonics[] = { "lw", "lh", "lhu", "lb", "lbu" };
+
+static const char *store_mnemonics[] = { "sw", "sh", "sb" };
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/*
+ * xorshift64* keeps the output reproducible across libc implementations.
+ */
+static uint64_t next_random(struct gen *g)
+{
+	g->rng ^= g->rng >> 12;
+	g->rng ^= g->rng << 25;
+	g->rng ^= g->rng >> 27;
+	return g->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t random_below(struct gen *g, uint32_t bound)
+{
+	return (uint32_t)(next_random(g) >> 32) % bound;
+}
+
+static double random_unit(struct gen *g)
+{
+	return (double)(next_random(g) >> 11) / (double)(1ULL << 53);
+}
+
+static int32_t random_between(struct gen *g, int32_t low, int32_t high)
+{
+	return low + (int32_t)random_below(g, (uint32_t)(high - low + 1));
+}
+
+static unsigned random_register(struct gen *g)
+{
+	return random_below(g, 32);
+}
+
+static void emit(struct gen *g, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = vfprintf(g->out, format, args);
+	va_end(args);
+	if (n < 0) {
+		fprintf(stderr, "Failed to write generated program.\n");
+		exit(EX_IOERR);
+	}
+	g->written += n;
+}
+
+static void emit_label(struct gen *g)
+{
+	emit(g, "f%d_L%zu:\n", g->file, g->labels_defined);
+	g->labels_defined++;
+}
+
+/*
+ * Branch targets are either labels already defined in this file or one of
+ * the next few labels still to come. Pending labels are flushed at the end
+ * of the file, so every reference resolves.
+ */
+static size_t pick_target(struct gen *g)
+{
+	size_t target;
+	if (g->labels_defined > 0 && random_below(g, 2) == 0) {
+		target = random_below(g, g->labels_defined);
+	} else {
+		target = g->labels_defined + random_below(g, 8);
+	}
+	if (target + 1 > g->labels_referenced) {
+		g->labels_referenced = target + 1;
+	}
+	return target;
+}
+
+static void emit_branch(struct gen *g)
+{
+	size_t target = pick_target(g);
+	if (random_below(g, 8) == 0) {
+		emit(g, "\tj f%d_L%zu\n", g->file, target);
+		return;
+	}
+	const char *mnemonic =
+		branch_mnemonics[random_below(g, ARRAY_SIZE(branch_mnemonics))];
+	emit(g, "\t%s x%u, x%u, f%d_L%zu\n", mnemonic, random_register(g),
+	     random_register(g), g->file, target);
+}
+
+static void emit_straight_line(struct gen *g)
+{
+	uint32_t kind = random_below(g, 16);
+	if (kind < 6) {
+		const char *mnemonic =
+			r3_mnemonics[random_below(g, ARRAY_SIZE(r3_mnemonics))];
+		emit(g, "\t%s x%u, x%u, x%u\n", mnemonic, random_register(g),
+		     random_register(g), random_register(g));
+	} else if (kind < 11) {
+		const char *mnemonic =
+			r2_mnemonics[random_below(g, ARRAY_SIZE(r2_mnemonics))];
+		emit(g, "\t%s x%u, x%u, %d\n", mnemonic, random_register(g),
+		     random_register(g), random_between(g, -2048, 2047));
+	} else if (kind < 12) {
+		const char *mnemonic =
+			shift_mnemonics[random_below(g, ARRAY_SIZE(shift_mnemonics))];
+		emit(g, "\t%s x%u, x%u, %d\n", mnemonic, random_register(g),
+		     random_register(g), random_between(g, 0, 31));
+	} else if (kind < 13) {
+		emit(g, "\tlui x%u, %d\n", random_register(g),
+		     random_between(g, 0, 524287));
+	} else if (kind < 15) {
+		const char *mnemonic =
+			load_mnemonics[random_below(g, ARRAY_SIZE(load_mnemonics))];
+		emit(g, "\t%s x%u, %d(x%u)\n", mnemonic, random_register(g),
+		     random_between(g, 0, 2047), random_register(g));
+	} else {
+		const char *mnemonic =
+			store_mnemonics[random_below(g, ARRAY_SIZE(store_mnemonics))];
+		emit(g, "\t%s x%u, %d(x%u)\n", mnemonic, random_register(g),
+		     random_between(g, 0, 2047), random_register(g));
+	}
+}
+
+static bool file_done(struct gen *g, uint64_t size, uint64_t instructions)
+{
+	if (instructions != 0) {
+		return g->instructions >= instructions;
+	}
+	return g->written >= size;
+}
+
+static void generate_file(struct gen *g, uint64_t size, uint64_t instructions)
+{
+	g->written = 0;
+	g->instructions = 0;
+	g->labels_defined = 0;
+	g->labels_referenced = 0;
+
+	while (!file_done(g, size, instructions)) {
+		// labels never follow each other directly
+		if (g->labels_defined == 0 ||
+		    random_unit(g) < g->options->label_density) {
+			emit_label(g);
+		}
+		if (random_unit(g) < g->options->branch_ratio) {
+			emit_branch(g);
+		} else {
+			emit_straight_line(g);
+		}
+		g->instructions++;
+	}
+	// every label must be followed by an instruction
+	while (g->labels_defined < g->labels_referenced) {
+		emit_label(g);
+		emit(g, "\tnop\n");
+	}
+}
+
+static uint64_t parse_size(const char *arg)
+{
+	char *end;
+	uint64_t size = strtoull(arg, &end, 10);
+	switch (*end) {
+	case 'k':
+	case 'K':
+		size <<= 10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		size <<= 20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		size <<= 30;
+		end++;
+		break;
+	}
+	if (*end != '\0' || size == 0) {
+		fprintf(stderr, "Invalid size \"%s\".\n", arg);
+		exit(EX_USAGE);
+	}
+	return size;
+}
+
+static void usage(const char *program)
+{
+	fprintf(stderr,
+		"Usage: %s [-s size | -i instructions] [-f files] "
+		"[-l label_density] [-b branch_ratio] [-r seed] prefix\n"
+		"  -s size           total size of all files, e.g. 1K, 64M, 1G "
+		"(default 64K)\n"
+		"  -i instructions   total instructions of all files instead of "
+		"a size, e.g. 1M\n"
+		"  -f files          number of files to split the program into "
+		"(default 1)\n"
+		"  -l label_density  labels per instruction (default 0.1)\n"
+		"  -b branch_ratio   fraction of branch instructions "
+		"(default 0.15)\n"
+		"  -r seed           random seed (default 1)\n"
+		"Writes prefix_N.s for every file and prints the paths.\n",
+		program);
+	exit(EX_USAGE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct gen_options options = {
+		.size = 64 << 10,
+		.files = 1,
+		.label_density = 0.1,
+		.branch_ratio = 0.15,
+		.seed = 1,
+	};
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:i:f:l:b:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			options.size = parse_size(optarg);
+			break;
+		case 'i':
+			options.instructions = parse_size(optarg);
+			break;
+		case 'f':
+			options.files = atoi(optarg);
+			break;
+		case 'l':
+			options.label_density = atof(optarg);
+			break;
+		case 'b':
+			options.branch_ratio = atof(optarg);
+			break;
+		case 'r':
+			options.seed = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc || options.files < 1 ||
+	    options.label_density < 0 || options.label_density > 1 ||
+	    options.branch_ratio < 0 || options.branch_ratio > 1) {
+		usage(argv[0]);
+	}
+	options.prefix = argv[optind];
+
+	struct gen g = {
+		.options = &options,
+		.rng = options.seed * 0x9E3779B97F4A7C15ULL + 1,
+	};
+	uint64_t per_file = options.size / options.files;
+	if (per_file == 0) {
+		per_file = 1;
+	}
+	uint64_t instructions_per_file = options.instructions / options.files;
+	if (options.instructions != 0 && instructions_per_file == 0) {
+		instructions_per_file = 1;
+	}
+	for (g.file = 0; g.file < options.files; g.file++) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s_%d.s", options.prefix, g.file);
+		g.out = fopen(path, "wb");
+		if (g.out == NULL) {
+			fprintf(stderr, "Could not open file \"%s\" for writing.\n",
+				path);
+			exit(EX_IOERR);
+		}
+		generate_file(&g, per_file, instructions_per_file);
+		if (fclose(g.out) != 0) {
+			fprintf(stderr, "Could not write to file \"%s\".\n", path);
+			exit(EX_IOERR);
+		}
+		printf("%s\n", path);
+	}
+	return 0;
+}
@@ -0,0 +1,13 @@
+_start:
+	li x1, 0
+	li x2, 1000000
+	li x7, 0
+	li x8, 3
+loop:
+	addi x7, x7, 1
+	bne x7, x8, skip
+	li x7, 0
+	addi x9, x9, 1
+skip:
+	addi x1, x1, 1
+	bne x1, x2, loop
@@ -0,0 +1,15 @@
+_start:
+	li x5, 0
+	li x6, 250
+pass:
+	li x1, 0
+	li x2, 4096
+	li x3, 4096
+copy:
+	lb x4, 0(x1)
+	sb x4, 0(x2)
+	addi x1, x1, 1
+	addi x2, x2, 1
+	bne x1, x3, copy
+	addi x5, x5, 1
+	bne x5, x6, pass
@@ -0,0 +1,14 @@
+_start:
+	li x1, 0
+	li x2, 1000000
+loop:
+	jal x5, leaf
+back:
+	addi x1, x1, 1
+	bne x1, x2, loop
+	j end
+leaf:
+	addi x6, x6, 1
+	add x7, x7, x6
+	j back
+end:
@@ -0,0 +1,8 @@
+_start:
+	li x1, 0
+	li x2, 1000000
+	li x4, 0
+loop:
+	addi x1, x1, 1
+	add x4, x4, x1
+	bne x1, x2, loop
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# Run the compiler throughput matrix and append one JSON line per case to
+# $BENCH_RESULTS. Every parameter can be overridden from the environment,
+# e.g. BENCH_SIZES="1K 1G" BENCH_FILES=16 make bench.
+
+set -e
+
+cd "$(dirname "$0")"
+
+sizes=${BENCH_SIZES:-"1K 64K 1M 8M"}
+files=${BENCH_FILES:-"1 8"}
+label_densities=${BENCH_LABEL_DENSITY:-"0.1"}
+branch_ratios=${BENCH_BRANCH_RATIO:-"0.15"}
+repeat=${BENCH_REPEAT:-3}
+seed=${BENCH_SEED:-1}
+work=${BENCH_WORK:-out}
+results=${BENCH_RESULTS:-results/$(date +%Y%m%d-%H%M%S).jsonl}
+
+mkdir -p "$work" "$(dirname "$results")"
+
+for size in $sizes; do
+	for n in $files; do
+		for l in $label_densities; do
+			for b in $branch_ratios; do
+				name="size=$size,files=$n,labels=$l,branches=$b"
+				prefix="$work/prog"
+				rm -f "$prefix"_*.s
+				./gen -s "$size" -f "$n" -l "$l" -b "$b" -r "$seed" \
+					"$prefix" > /dev/null
+				./bench -n "$name" -r "$repeat" -o "$results" \
+					"$prefix"_*.s > /dev/null
+				tail -n 1 "$results"
+				rm -f "$prefix"_*.s
+			done
+		done
+	done
+done
+
+echo "Results written to bench/$results" >&2
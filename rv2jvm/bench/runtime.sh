@@ -0,0 +1,101 @@
+#!/bin/sh
+#
+# Compile every guest kernel under every codegen configuration, run it on the
+# local JVM with RuntimeBench and append one JSON line per kernel and
+# configuration to $BENCH_RESULTS. Kernels are listed in kernels/manifest and
+# configurations in configs; both can be narrowed from the environment, e.g.
+# BENCH_KERNELS="loop calls" BENCH_CONFIGS="default pgo" make bench-runtime.
+
+set -e
+
+cd "$(dirname "$0")"
+
+kernels=${BENCH_KERNELS:-$(awk '!/^#/ && NF { print $1 }' kernels/manifest)}
+configs=${BENCH_CONFIGS:-$(awk '!/^#/ && NF { print $1 }' configs)}
+warmup_ms=${BENCH_WARMUP_MS:-2000}
+measure_ms=${BENCH_MEASURE_MS:-3000}
+java=${JAVA:-java}
+javac=${JAVAC:-javac}
+work=${BENCH_WORK:-out/runtime}
+results=${BENCH_RESULTS:-results/runtime-$(date +%Y%m%d-%H%M%S).jsonl}
+
+mkdir -p "$work/harness" "$(dirname "$results")"
+"$javac" -d "$work/harness" RuntimeBench.java
+
+for kernel in $kernels; do
+	instructions=$(awk -v k="$kernel" '$1 == k { print $2 }' kernels/manifest)
+	if [ -z "$instructions" ]; then
+		echo "Unknown kernel $kernel" >&2
+		exit 64
+	fi
+	for config in $configs; do
+		if ! grep -q "^$config\( \|$\)" configs; then
+			echo "Unknown configuration $config" >&2
+			exit 64
+		fi
+		dir="$work/$kernel/$config"
+		mkdir -p "$dir"
+		flags=$(awk -v c="$config" '$1 == c { $1 = ""; print }' configs |
+			sed "s|@dir|$dir|g")
+		case " $flags " in
+		*" --profile-use="*)
+			# train on the kernel itself
+			profile=${flags##*--profile-use=}
+			profile=${profile%% *}
+			../rv2jvm --profile-generate="$profile" \
+				--output="$dir/RvRuntime.class" "kernels/$kernel.s"
+			"$java" -cp "$dir" RvRuntime
+			;;
+		esac
+		# shellcheck disable=SC2086
+		../rv2jvm $flags --output="$dir/RvRuntime.class" "kernels/$kernel.s"
+		"$java" -cp "$work/harness" RuntimeBench --kernel="$kernel" \
+			--config="$config" --instructions="$instructions" \
+			--warmup-ms="$warmup_ms" --measure-ms="$measure_ms" \
+			--output="$results" "$dir" > /dev/null
+		tail -n 1 "$results"
+	done
+done
+
+# guest MIPS of the median run, one row per kernel and a column per
+# configuration
+awk '
+function field(line, key,    rest) {
+	rest = line
+	if (!sub(".*\"" key "\":", "", rest)) {
+		return ""
+	}
+	sub(/[,}].*/, "", rest)
+	gsub(/"/, "", rest)
+	return rest
+}
+{
+	kernel = field($0, "kernel")
+	config = field($0, "config")
+	if (!(kernel in kernels)) {
+		kernels[kernel] = 1
+		kernel_order[++kernel_count] = kernel
+	}
+	if (!(config in configs)) {
+		configs[config] = 1
+		config_order[++config_count] = config
+	}
+	mips[kernel, config] = field($0, "mips")
+}
+END {
+	printf "%-12s", "MIPS"
+	for (j = 1; j <= config_count; j++) {
+		printf " %14s", config_order[j]
+	}
+	printf "\n"
+	for (i = 1; i <= kernel_count; i++) {
+		printf "%-12s", kernel_order[i]
+		for (j = 1; j <= config_count; j++) {
+			value = mips[kernel_order[i], config_order[j]]
+			printf " %14s", value == "" ? "-" : value
+		}
+		printf "\n"
+	}
+}' "$results"
+
+echo "Results written to bench/$results" >&2
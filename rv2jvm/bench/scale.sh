@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# Check that compile time and memory grow linearly with program size.
+# Compiles a program of $SCALE_INSTRUCTIONS instructions (default 10^6)
+# and one a tenth of it, and fails when the large one takes longer than
+# $SCALE_TIME_BUDGET_MS, peaks above $SCALE_RSS_BUDGET_KB or takes more
+# than $SCALE_RATIO_BUDGET times as long as the small one. A program with
+# more constants than a class holds must fail to compile instead of
+# wrapping the constant pool count.
+
+set -e
+
+cd "$(dirname "$0")"
+
+instructions=${SCALE_INSTRUCTIONS:-1000000}
+time_budget_ms=${SCALE_TIME_BUDGET_MS:-10000}
+rss_budget_kb=${SCALE_RSS_BUDGET_KB:-1048576}
+ratio_budget=${SCALE_RATIO_BUDGET:-20}
+seed=${BENCH_SEED:-1}
+work=${BENCH_WORK:-out}
+
+mkdir -p "$work"
+
+# prints the JSON result of compiling n instructions
+measure() {
+	prefix="$work/scale"
+	rm -f "$prefix"_*.s
+	./gen -i "$1" -r "$seed" "$prefix" > /dev/null
+	./bench -n "instructions=$1" "$prefix"_*.s 2> /dev/null
+	rm -f "$prefix"_*.s
+}
+
+# 70000 distinct li constants, each one an entry of the constant pool
+awk 'BEGIN {
+	print "_start:"
+	for (i = 0; i < 70000; i++) {
+		printf "\tli x5, %d\n", 100000 + i
+	}
+}' > "$work/scale_pool.s"
+if ../rv2jvm --output="$work/scale_pool.class" "$work/scale_pool.s" \
+	2> "$work/scale_pool.err" || ! grep -q constants "$work/scale_pool.err"
+then
+	echo "FAIL 70000 constants did not fail with a full constant pool"
+	exit 1
+fi
+rm -f "$work/scale_pool.s" "$work/scale_pool.err"
+
+small=$(measure $((instructions / 10)))
+large=$(measure "$instructions")
+echo "$small"
+echo "$large"
+
+printf '%s\n%s\n' "$small" "$large" | awk \
+	-v time_budget_ms="$time_budget_ms" \
+	-v rss_budget_kb="$rss_budget_kb" \
+	-v ratio_budget="$ratio_budget" '
+function field(line, key,    rest) {
+	rest = line
+	sub(".*\"" key "\":", "", rest)
+	sub(/[,}].*/, "", rest)
+	return rest + 0
+}
+NR == 1 {
+	small_ns = field($0, "total_ns")
+	next
+}
+{
+	large_ns = field($0, "total_ns")
+	rss_kb = field($0, "peak_rss_kb")
+	failed = 0
+	if (large_ns / 1e6 > time_budget_ms) {
+		printf "FAIL total %.0f ms over the budget of %d ms\n",
+			large_ns / 1e6, time_budget_ms
+		failed = 1
+	}
+	if (rss_kb > rss_budget_kb) {
+		printf "FAIL peak RSS %d KB over the budget of %d KB\n",
+			rss_kb, rss_budget_kb
+		failed = 1
+	}
+	ratio = small_ns > 0 ? large_ns / small_ns : 0
+	if (ratio > ratio_budget) {
+		printf "FAIL 10x the instructions took %.1fx as long, budget %s\n",
+			ratio, ratio_budget
+		failed = 1
+	}
+	if (!failed) {
+		printf "OK %.0f ms, %d KB, 10x the instructions took %.1fx as long\n",
+			large_ns / 1e6, rss_kb, ratio
+	}
+	exit failed
+}'
@@ -0,0 +1,197 @@
+import java.io.BufferedInputStream;
+import java.io.BufferedOutputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.IOException;
+import java.io.PrintStream;
+import java.lang.invoke.MethodHandle;
+import java.lang.invoke.MethodHandles;
+import java.lang.invoke.MethodType;
+import java.net.StandardProtocolFamily;
+import java.net.UnixDomainSocketAddress;
+import java.nio.channels.Channels;
+import java.nio.channels.ServerSocketChannel;
+import java.nio.channels.SocketChannel;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.util.HashMap;
+import java.util.Map;
+
+/*
+ * Resident runner for classes generated by rv2jvm. Runs the programs sent to
+ * a Unix socket in one long-lived JVM, so they skip JVM startup and share
+ * the JIT-compiled JDK classes. Every program gets a class loader of its
+ * own, which is dropped after the run, so its classes can unload again.
+ *
+ * Protocol, all integers are big endian u32 like the compile server's:
+ *   request:  class count, then for every class binary name length, name,
+ *             class file length, class file. main of the first one runs.
+ *   response: exit status, stdout length, stdout, stderr length, stderr
+ * The exit status is the one java would exit with, 1 for an uncaught
+ * exception. Programs run one at a time since System.out and System.err
+ * are redirected for each run.
+ *
+ * Usage: java RvRunner socket
+ */
+public final class RvRunner {
+	private static final int MAX_CLASSES = 65536;
+	private static final int MAX_LENGTH = 1 << 30;
+
+	private static final PrintStream log = System.err;
+
+	/*
+	 * Defines the classes of one program. Everything else comes from the
+	 * platform, not from the runner.
+	 */
+	private static final class ProgramLoader extends ClassLoader {
+		private final Map<String, byte[]> classes;
+
+		ProgramLoader(Map<String, byte[]> classes) {
+			super("rv2jvm-program", ClassLoader.getPlatformClassLoader());
+			this.classes = classes;
+		}
+
+		@Override
+		protected Class<?> findClass(String name)
+				throws ClassNotFoundException {
+			byte[] bytes = classes.get(name);
+			if (bytes == null) {
+				throw new ClassNotFoundException(name);
+			}
+			return defineClass(name, bytes, 0, bytes.length);
+		}
+	}
+
+	private static final class Result {
+		int status;
+		final ByteArrayOutputStream out = new ByteArrayOutputStream();
+		final ByteArrayOutputStream err = new ByteArrayOutputStream();
+	}
+
+	private static void usage() {
+		System.err.println("Usage: java RvRunner socket");
+		System.exit(64);
+	}
+
+	private static byte[] readBytes(DataInputStream in) throws IOException {
+		int length = in.readInt();
+		if (length < 0 || length > MAX_LENGTH) {
+			throw new IOException("Invalid length " + length);
+		}
+		byte[] bytes = new byte[length];
+		in.readFully(bytes);
+		return bytes;
+	}
+
+	private static void writeBytes(DataOutputStream out, byte[] bytes)
+			throws IOException {
+		out.writeInt(bytes.length);
+		out.write(bytes);
+	}
+
+	/*
+	 * Runs main on a thread of its own, like the launcher does, so nothing
+	 * the program leaves in thread locals keeps its loader alive.
+	 */
+	private static void runMain(Map<String, byte[]> classes, String name,
+				    Result result) {
+		PrintStream err = System.err;
+		try {
+			ClassLoader loader = new ProgramLoader(classes);
+			Class<?> program = Class.forName(name, true, loader);
+			MethodHandle main = MethodHandles.publicLookup().findStatic(
+				program, "main",
+				MethodType.methodType(void.class, String[].class));
+			main.invokeExact(new String[0]);
+		} catch (Throwable t) {
+			err.print("Exception in thread \"main\" ");
+			t.printStackTrace(err);
+			result.status = 1;
+		}
+	}
+
+	private static Result run(Map<String, byte[]> classes, String name)
+			throws InterruptedException {
+		Result result = new Result();
+		PrintStream out = System.out;
+		PrintStream err = System.err;
+		PrintStream programOut = new PrintStream(result.out, true);
+		PrintStream programErr = new PrintStream(result.err, true);
+		System.setOut(programOut);
+		System.setErr(programErr);
+		try {
+			Thread thread = new Thread(
+				() -> runMain(classes, name, result), "main");
+			thread.start();
+			thread.join();
+		} finally {
+			programOut.flush();
+			programErr.flush();
+			System.setOut(out);
+			System.setErr(err);
+		}
+		return result;
+	}
+
+	private static void serve(SocketChannel client)
+			throws IOException, InterruptedException {
+		DataInputStream in = new DataInputStream(
+			new BufferedInputStream(Channels.newInputStream(client)));
+		int count = in.readInt();
+		if (count <= 0 || count > MAX_CLASSES) {
+			throw new IOException("Invalid class count " + count);
+		}
+		Map<String, byte[]> classes = new HashMap<>();
+		String first = null;
+		for (int i = 0; i < count; i++) {
+			String name = new String(readBytes(in),
+						 StandardCharsets.UTF_8);
+			classes.put(name, readBytes(in));
+			if (first == null) {
+				first = name;
+			}
+		}
+
+		long start = System.nanoTime();
+		Result result = run(classes, first);
+		log.printf("%s: status %d in %d ms%n", first, result.status,
+			   (System.nanoTime() - start) / 1_000_000);
+
+		DataOutputStream out = new DataOutputStream(
+			new BufferedOutputStream(Channels.newOutputStream(client)));
+		out.writeInt(result.status);
+		writeBytes(out, result.out.toByteArray());
+		writeBytes(out, result.err.toByteArray());
+		out.flush();
+	}
+
+	public static void main(String[] args) throws Exception {
+		if (args.length != 1) {
+			usage();
+		}
+		Path path = Paths.get(args[0]);
+		Files.deleteIfExists(path);
+		ServerSocketChannel server =
+			ServerSocketChannel.open(StandardProtocolFamily.UNIX);
+		server.bind(UnixDomainSocketAddress.of(path));
+		Runtime.getRuntime().addShutdownHook(new Thread(() -> {
+			try {
+				Files.deleteIfExists(path);
+			} catch (IOException e) {
+				// nothing left to do on the way out
+			}
+		}));
+		log.println("Listening on " + path);
+
+		while (true) {
+			try (SocketChannel client = server.accept()) {
+				serve(client);
+			} catch (IOException e) {
+				log.println("Request failed: " + e.getMessage());
+			}
+		}
+	}
+}
@@ -0,0 +1,61 @@
+#include "alloc.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "error.h"
+
+// thread local, so that concurrent compilations do not share them
+static _Thread_local uint64_t allocations;
+static _Thread_local uint64_t allocated_bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size)
+{
+	allocations++;
+	allocated_bytes += size;
+	void *res = __real_malloc(size);
+	track_allocation(res);
+	return res;
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+	allocations++;
+	allocated_bytes += n * size;
+	void *res = __real_calloc(n, size);
+	track_allocation(res);
+	return res;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocations++;
+	allocated_bytes += size;
+	void *res = __real_realloc(ptr, size);
+	if (res != NULL) {
+		untrack_allocation(ptr);
+		track_allocation(res);
+	}
+	return res;
+}
+
+void __wrap_free(void *ptr)
+{
+	untrack_allocation(ptr);
+	__real_free(ptr);
+}
+
+uint64_t alloc_count(void)
+{
+	return allocations;
+}
+
+uint64_t alloc_bytes(void)
+{
+	return allocated_bytes;
+}
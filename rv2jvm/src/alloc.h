@@ -0,0 +1,18 @@
+#ifndef RV2JVM_ALLOC_H
+#define RV2JVM_ALLOC_H
+
+#include <stdint.h>
+
+/*
+ * The Makefile links with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+ * and --wrap=free, which sends every allocation through alloc.c. There it
+ * is counted for --stats and tracked for the recovery of its thread, see
+ * error.h. A build without those flags counts nothing and frees nothing
+ * on an error.
+ */
+
+// allocations made by this thread so far and the bytes they asked for
+uint64_t alloc_count(void);
+uint64_t alloc_bytes(void);
+
+#endif
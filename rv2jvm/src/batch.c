@@ -0,0 +1,224 @@
+#include "batch.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "compiler.h"
+#include "darray.h"
+#include "error.h"
+#include "file.h"
+#include "jar.h"
+
+/*
+ * Batch mode compiles the independent programs listed in a manifest on a
+ * pool of threads. Every line of the manifest describes one program:
+ *
+ *   class_name output_path source...
+ *
+ * Fields are separated by whitespace, blank lines and lines starting with
+ * '#' are ignored. With a JAR as output the classes are stored in it under
+ * their class names and the output paths are not used. Threads take the
+ * next program from a shared counter, so a few large programs do not hold
+ * up the rest of the batch.
+ */
+struct paths {
+	char **items;
+	size_t size;
+	size_t capacity;
+};
+
+struct program {
+	char *class_name;
+	char *output;
+	struct paths sources;
+};
+
+struct programs {
+	struct program *items;
+	size_t size;
+	size_t capacity;
+};
+
+struct batch {
+	struct programs programs;
+	struct compile_options *options;
+	struct jar *jar;
+	atomic_size_t next;
+	atomic_size_t failed;
+};
+
+static char *next_field(char **line)
+{
+	char *it = *line;
+	while (*it == ' ' || *it == '\t') {
+		it++;
+	}
+	if (*it == '\0') {
+		*line = it;
+		return NULL;
+	}
+	char *field = it;
+	while (*it != '\0' && *it != ' ' && *it != '\t') {
+		it++;
+	}
+	if (*it != '\0') {
+		*it++ = '\0';
+	}
+	*line = it;
+	return field;
+}
+
+/*
+ * Splits manifest in place, the programs point into its text.
+ */
+static void parse_manifest(char *path, char *manifest,
+			   struct programs *programs)
+{
+	size_t line_number = 0;
+	char *line = manifest;
+	while (line != NULL && *line != '\0') {
+		line_number++;
+		char *end = strchr(line, '\n');
+		if (end != NULL) {
+			*end = '\0';
+			if (end > line && end[-1] == '\r') {
+				end[-1] = '\0';
+			}
+		}
+
+		char *rest = line;
+		line = end != NULL ? end + 1 : NULL;
+		struct program program = { 0 };
+		program.class_name = next_field(&rest);
+		if (program.class_name == NULL || program.class_name[0] == '#') {
+			continue;
+		}
+		program.output = next_field(&rest);
+		char *source;
+		while ((source = next_field(&rest)) != NULL) {
+			darray_append(program.sources, source);
+		}
+		if (program.sources.size == 0) {
+			fprintf(stderr, "%s:%zu: Expected class name, output path "
+				"and at least one source.\n", path, line_number);
+			exit(EX_DATAERR);
+		}
+		darray_append((*programs), program);
+	}
+}
+
+/*
+ * Compiles and writes one program under a recovery, so that its errors are
+ * reported with its class name and the rest of the batch goes on.
+ */
+static bool compile_program(struct program *program, struct batch *batch)
+{
+	struct compile_options program_options = *batch->options;
+	program_options.class_name = program->class_name;
+
+	struct bytecode bytecode = { 0 };
+	struct recovery recovery;
+	begin_recovery(&recovery);
+	if (setjmp(recovery.env) == 0) {
+		compile(program->sources.size, program->sources.items,
+			&program_options, &bytecode);
+		if (batch->jar != NULL) {
+			jar_add_class(batch->jar, program->class_name,
+				      bytecode.items, bytecode.size);
+		} else {
+			write_file(program->output, bytecode.items,
+				   bytecode.size);
+		}
+	}
+	end_recovery(&recovery);
+
+	flockfile(stderr);
+	print_diagnostics(stderr, program->class_name, &recovery.diagnostics);
+	funlockfile(stderr);
+	free_diagnostics(&recovery.diagnostics);
+	if (recovery.status != 0) {
+		return false;
+	}
+	darray_free(bytecode);
+	return true;
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch *batch = arg;
+	for (;;) {
+		size_t i = atomic_fetch_add(&batch->next, 1);
+		if (i >= batch->programs.size) {
+			return NULL;
+		}
+		if (!compile_program(&batch->programs.items[i], batch)) {
+			atomic_fetch_add(&batch->failed, 1);
+		}
+	}
+}
+
+int run_batch(char *manifest_path, int jobs, struct compile_options *options,
+	      char *jar_path)
+{
+	char *manifest = read_file(manifest_path);
+	struct batch batch = { .options = options };
+	atomic_init(&batch.next, 0);
+	atomic_init(&batch.failed, 0);
+	parse_manifest(manifest_path, manifest, &batch.programs);
+	if (jar_path != NULL) {
+		batch.jar = jar_open(jar_path, NULL);
+	}
+
+	if (jobs <= 0) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if ((size_t)jobs > batch.programs.size) {
+		jobs = batch.programs.size;
+	}
+
+	pthread_t *threads = malloc(jobs * sizeof(*threads));
+	if (threads == NULL && jobs > 0) {
+		fprintf(stderr, "Failed to allocate memory for threads.\n");
+		exit(EXIT_FAILURE);
+	}
+	int started = 0;
+	for (; started < jobs; started++) {
+		if (pthread_create(&threads[started], NULL, batch_worker,
+				   &batch) != 0) {
+			break;
+		}
+	}
+	// without any threads the batch still runs, on this one
+	if (started == 0) {
+		batch_worker(&batch);
+	}
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	if (batch.jar != NULL) {
+		jar_close(batch.jar);
+	}
+
+	size_t failed = atomic_load(&batch.failed);
+	if (failed > 0) {
+		fprintf(stderr, "%zu of %zu programs failed.\n", failed,
+			batch.programs.size);
+	}
+
+	for (size_t i = 0; i < batch.programs.size; i++) {
+		darray_free(batch.programs.items[i].sources);
+	}
+	darray_free(batch.programs);
+	free(threads);
+	free(manifest);
+	return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
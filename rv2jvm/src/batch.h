@@ -0,0 +1,15 @@
+#ifndef RV2JVM_BATCH_H
+#define RV2JVM_BATCH_H
+
+#include "options.h"
+
+/*
+ * Writes every class to its own output path, or into one JAR at jar_path
+ * when that is not NULL. A program that fails does not stop the others,
+ * its errors are printed prefixed with its class name and the batch
+ * returns EXIT_FAILURE.
+ */
+int run_batch(char *manifest_path, int jobs, struct compile_options *options,
+	      char *jar_path);
+
+#endif
@@ -0,0 +1,486 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "darray.h"
+#include "error.h"
+#include "ir.h"
+#include "table.h"
+
+/*
+ * Cache files hold the parser output of one input file:
+ *
+ *   magic "RV2JVMIR", u32 format version,
+ *   u64 source key, u64 source length,
+ *   u32 string table size, u32 element count,
+ *   source bytes,
+ *   string table (NUL terminated names),
+ *   elements.
+ *
+ * The key only names the file, an entry is used when its source bytes
+ * match the input. All integers are little endian. Bump CACHE_FORMAT_VERSION whenever the
+ * encoding or the meaning of the IR changes.
+ */
+#define CACHE_MAGIC "RV2JVMIR"
+#define CACHE_MAGIC_LENGTH 8
+#define CACHE_FORMAT_VERSION 6
+#define CACHE_HEADER_SIZE (CACHE_MAGIC_LENGTH + 4 + 8 + 8 + 4 + 4)
+
+struct reader {
+	uint8_t *data;
+	size_t size;
+	size_t position;
+	bool failed;
+};
+
+struct string_offset {
+	uint32_t offset;
+};
+
+/*
+ * Compute 64 bit FNV-1a hash.
+ */
+static uint64_t hash_bytes(uint64_t hash, const void *bytes, size_t length)
+{
+	const uint8_t *b = bytes;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= b[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+/*
+ * Only options that change what the parser produces belong in the key.
+ * Trace level and statistics do not, so they are left out on purpose.
+ */
+static uint64_t hash_options(uint64_t hash, struct compile_options *options)
+{
+	(void)options;
+	uint32_t version = CACHE_FORMAT_VERSION;
+	return hash_bytes(hash, &version, sizeof(version));
+}
+
+uint64_t cache_key(char *source, size_t length,
+		   struct compile_options *options)
+{
+	uint64_t hash = hash_bytes(0xcbf29ce484222325, source, length);
+	return hash_options(hash, options);
+}
+
+static void cache_path(char *cache_dir, uint64_t key, char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016" PRIx64 ".ir", cache_dir, key);
+}
+
+static void put_u8(struct bytecode *out, uint8_t value)
+{
+	darray_append((*out), value);
+}
+
+static void put_u32(struct bytecode *out, uint32_t value)
+{
+	for (int i = 0; i < 4; i++) {
+		put_u8(out, value >> (i * 8));
+	}
+}
+
+static void put_u64(struct bytecode *out, uint64_t value)
+{
+	for (int i = 0; i < 8; i++) {
+		put_u8(out, value >> (i * 8));
+	}
+}
+
+static uint32_t intern(struct table *offsets, struct bytecode *strings,
+		       char *string)
+{
+	struct table_value *value = table_get(offsets, to_string_key(string));
+	if (value != NULL) {
+		return ((struct string_offset*)value->value)->offset;
+	}
+	struct string_offset *offset = malloc(sizeof(*offset));
+	if (offset == NULL) {
+		fail("Failed to allocate memory for string_offset.");
+	}
+	offset->offset = strings->size;
+	for (char *c = string; ; c++) {
+		put_u8(strings, *c);
+		if (*c == '\0') {
+			break;
+		}
+	}
+	table_set(offsets, to_string_key(string), offset);
+	return offset->offset;
+}
+
+static void put_operand(struct bytecode *out, struct table *offsets,
+			struct bytecode *strings, enum ir_operand_type type,
+			int32_t imm, char *label)
+{
+	put_u8(out, type);
+	if (type == OPERAND_IMM) {
+		put_u32(out, imm);
+	} else {
+		put_u32(out, intern(offsets, strings, label));
+	}
+}
+
+static void put_instruction(struct bytecode *out, struct table *offsets,
+			    struct bytecode *strings,
+			    struct ir_instruction *instruction)
+{
+	put_u8(out, instruction->type);
+	put_u8(out, instruction->mnemonic);
+	switch (instruction->type) {
+	case TYPE_R3:
+		put_u8(out, instruction->as.r3.rd);
+		put_u8(out, instruction->as.r3.rs1);
+		put_u8(out, instruction->as.r3.rs2);
+		break;
+	case TYPE_R2_OP:
+		put_u8(out, instruction->as.r2op.rd);
+		put_u8(out, instruction->as.r2op.rs1);
+		put_operand(out, offsets, strings, instruction->as.r2op.op_type,
+			    instruction->as.r2op.op.imm,
+			    instruction->as.r2op.op.label);
+		break;
+	case TYPE_R1_OP:
+		put_u8(out, instruction->as.r1op.rd);
+		put_operand(out, offsets, strings, instruction->as.r1op.op_type,
+			    instruction->as.r1op.op.imm,
+			    instruction->as.r1op.op.label);
+		break;
+	case TYPE_MEM:
+		put_u8(out, instruction->as.mem.rd);
+		put_u8(out, instruction->as.mem.rs1);
+		put_u32(out, instruction->as.mem.offset);
+		break;
+	case TYPE_AMO:
+		put_u8(out, instruction->as.amo.rd);
+		put_u8(out, instruction->as.amo.rs1);
+		put_u8(out, instruction->as.amo.rs2);
+		put_u8(out, instruction->as.amo.ordering);
+		break;
+	}
+}
+
+static void encode(struct ir_element *ir, struct bytecode *elements,
+		   struct bytecode *strings, uint32_t *count)
+{
+	struct table *offsets = table_create();
+	*count = 0;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		put_u8(elements, it->type);
+		switch (it->type) {
+		case IR_INSTRUCTION:
+			put_instruction(elements, offsets, strings,
+					&it->as.instruction);
+			break;
+		case IR_LABEL:
+			put_u32(elements, intern(offsets, strings,
+						 it->as.label.name));
+			break;
+		case IR_DIRECTIVE:
+			put_u32(elements, intern(offsets, strings,
+						 it->as.directive.name));
+			put_u32(elements, it->as.directive.operands.size);
+			for (size_t i = 0; i < it->as.directive.operands.size; i++) {
+				put_u32(elements,
+					intern(offsets, strings,
+					       it->as.directive.operands.items[i]));
+			}
+			break;
+		case IR_EOF:
+			break;
+		}
+		(*count)++;
+	}
+	table_free(offsets);
+}
+
+void cache_store(char *cache_dir, uint64_t key, char *source,
+		 size_t source_length, struct ir_element *ir)
+{
+	if (mkdir(cache_dir, 0777) != 0 && errno != EEXIST) {
+		warn("Warning: could not create cache directory \"%s\".",
+		     cache_dir);
+		return;
+	}
+
+	struct bytecode elements = { 0 };
+	struct bytecode strings = { 0 };
+	uint32_t count;
+	encode(ir, &elements, &strings, &count);
+
+	struct bytecode header = { 0 };
+	for (int i = 0; i < CACHE_MAGIC_LENGTH; i++) {
+		put_u8(&header, CACHE_MAGIC[i]);
+	}
+	put_u32(&header, CACHE_FORMAT_VERSION);
+	put_u64(&header, key);
+	put_u64(&header, source_length);
+	put_u32(&header, strings.size);
+	put_u32(&header, count);
+
+	// write to a temporary file first so readers never see partial entries
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp.XXXXXX", cache_dir);
+	int fd = mkstemp(tmp_path);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "wb");
+	bool written = file != NULL &&
+		fwrite(header.items, 1, header.size, file) == header.size &&
+		fwrite(source, 1, source_length, file) == source_length &&
+		fwrite(strings.items, 1, strings.size, file) == strings.size &&
+		fwrite(elements.items, 1, elements.size, file) == elements.size;
+	if (file != NULL && fclose(file) != 0) {
+		written = false;
+	}
+	char path[4096];
+	cache_path(cache_dir, key, path, sizeof(path));
+	if (!written || rename(tmp_path, path) != 0) {
+		warn("Warning: could not write cache entry \"%s\".", path);
+		if (fd >= 0) {
+			unlink(tmp_path);
+		}
+	}
+
+	darray_free(header);
+	darray_free(strings);
+	darray_free(elements);
+}
+
+static uint8_t get_u8(struct reader *r)
+{
+	if (r->position + 1 > r->size) {
+		r->failed = true;
+		return 0;
+	}
+	return r->data[r->position++];
+}
+
+static uint32_t get_u32(struct reader *r)
+{
+	uint32_t value = 0;
+	for (int i = 0; i < 4; i++) {
+		value |= (uint32_t)get_u8(r) << (i * 8);
+	}
+	return value;
+}
+
+static uint64_t get_u64(struct reader *r)
+{
+	uint64_t value = 0;
+	for (int i = 0; i < 8; i++) {
+		value |= (uint64_t)get_u8(r) << (i * 8);
+	}
+	return value;
+}
+
+static char *get_string(struct reader *r, char *strings, uint32_t size)
+{
+	uint32_t offset = get_u32(r);
+	if (offset >= size) {
+		r->failed = true;
+		return strings;
+	}
+	return strings + offset;
+}
+
+static void get_operand(struct reader *r, char *strings, uint32_t size,
+			enum ir_operand_type *type, int32_t *imm, char **label)
+{
+	*type = get_u8(r);
+	if (*type == OPERAND_IMM) {
+		*imm = (int32_t)get_u32(r);
+	} else {
+		*label = get_string(r, strings, size);
+	}
+}
+
+static void get_instruction(struct reader *r, char *strings, uint32_t size,
+			    struct ir_instruction *instruction)
+{
+	int32_t imm = 0;
+	char *label = NULL;
+	instruction->type = get_u8(r);
+	instruction->mnemonic = get_u8(r);
+	switch (instruction->type) {
+	case TYPE_R3:
+		instruction->as.r3.rd = get_u8(r);
+		instruction->as.r3.rs1 = get_u8(r);
+		instruction->as.r3.rs2 = get_u8(r);
+		break;
+	case TYPE_R2_OP:
+		instruction->as.r2op.rd = get_u8(r);
+		instruction->as.r2op.rs1 = get_u8(r);
+		get_operand(r, strings, size, &instruction->as.r2op.op_type,
+			    &imm, &label);
+		if (instruction->as.r2op.op_type == OPERAND_IMM) {
+			instruction->as.r2op.op.imm = imm;
+		} else {
+			instruction->as.r2op.op.label = label;
+		}
+		break;
+	case TYPE_R1_OP:
+		instruction->as.r1op.rd = get_u8(r);
+		get_operand(r, strings, size, &instruction->as.r1op.op_type,
+			    &imm, &label);
+		if (instruction->as.r1op.op_type == OPERAND_IMM) {
+			instruction->as.r1op.op.imm = imm;
+		} else {
+			instruction->as.r1op.op.label = label;
+		}
+		break;
+	case TYPE_MEM:
+		instruction->as.mem.rd = get_u8(r);
+		instruction->as.mem.rs1 = get_u8(r);
+		instruction->as.mem.offset = (int32_t)get_u32(r);
+		break;
+	case TYPE_AMO:
+		instruction->as.amo.rd = get_u8(r);
+		instruction->as.amo.rs1 = get_u8(r);
+		instruction->as.amo.rs2 = get_u8(r);
+		instruction->as.amo.ordering = get_u8(r);
+		break;
+	default:
+		r->failed = true;
+		break;
+	}
+}
+
+static bool decode(struct reader *r, uint32_t count, char *strings,
+		   uint32_t size, struct ir_element *ir)
+{
+	for (uint32_t i = 0; i < count && !r->failed; i++) {
+		struct ir_element *element = &ir[i];
+		element->type = get_u8(r);
+		switch (element->type) {
+		case IR_INSTRUCTION:
+			get_instruction(r, strings, size,
+					&element->as.instruction);
+			break;
+		case IR_LABEL:
+			element->as.label.name = get_string(r, strings, size);
+			break;
+		case IR_DIRECTIVE: {
+			struct ir_directive *directive = &element->as.directive;
+			directive->name = get_string(r, strings, size);
+			uint32_t operands = get_u32(r);
+			if (operands > r->size - r->position) {
+				r->failed = true;
+				break;
+			}
+			directive->operands.items = NULL;
+			directive->operands.size = 0;
+			directive->operands.capacity = 0;
+			for (uint32_t j = 0; j < operands; j++) {
+				char *operand = get_string(r, strings, size);
+				darray_append(directive->operands, operand);
+			}
+			break;
+		}
+		default:
+			r->failed = true;
+			break;
+		}
+	}
+	ir[count].type = IR_EOF;
+	return !r->failed && r->position == r->size;
+}
+
+static bool read_entry(char *path, struct reader *r)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fileno(file), &st) != 0 || st.st_size < CACHE_HEADER_SIZE) {
+		fclose(file);
+		return false;
+	}
+	r->size = st.st_size;
+	r->data = malloc(r->size);
+	bool read = r->data != NULL &&
+		fread(r->data, 1, r->size, file) == r->size;
+	fclose(file);
+	if (!read) {
+		free(r->data);
+		return false;
+	}
+	return true;
+}
+
+bool cache_load(char *cache_dir, uint64_t key, char *source,
+		size_t source_length, struct cache_fragment *res)
+{
+	char path[4096];
+	cache_path(cache_dir, key, path, sizeof(path));
+	struct reader r = { 0 };
+	if (!read_entry(path, &r)) {
+		return false;
+	}
+
+	bool valid = memcmp(r.data, CACHE_MAGIC, CACHE_MAGIC_LENGTH) == 0;
+	r.position = CACHE_MAGIC_LENGTH;
+	valid = valid && get_u32(&r) == CACHE_FORMAT_VERSION;
+	valid = valid && get_u64(&r) == key;
+	valid = valid && get_u64(&r) == source_length;
+	uint32_t strings_size = get_u32(&r);
+	uint32_t count = get_u32(&r);
+	// a matching key is not enough, the input must be the cached one
+	valid = valid && source_length <= r.size - r.position &&
+		memcmp(r.data + r.position, source, source_length) == 0;
+	r.position += valid ? source_length : 0;
+	valid = valid && strings_size <= r.size - r.position &&
+		count <= r.size - r.position;
+	// names are NUL terminated, so a valid table ends with one
+	valid = valid && (strings_size == 0 ||
+			  r.data[r.position + strings_size - 1] == '\0');
+	if (!valid) {
+		free(r.data);
+		return false;
+	}
+
+	res->strings = malloc(strings_size + 1);
+	// zeroed, so a partially decoded fragment is still safe to free
+	res->ir = calloc(count + 1, sizeof(*res->ir));
+	if (res->strings == NULL || res->ir == NULL) {
+		fail("Failed to allocate memory for cache entry.");
+	}
+	memcpy(res->strings, r.data + r.position, strings_size);
+	r.position += strings_size;
+	valid = decode(&r, count, res->strings, strings_size, res->ir);
+	free(r.data);
+	if (!valid) {
+		free_cache_fragment(res);
+		return false;
+	}
+	return true;
+}
+
+void free_cache_fragment(struct cache_fragment *fragment)
+{
+	if (fragment->ir != NULL) {
+		for (struct ir_element *it = fragment->ir; it->type != IR_EOF;
+		     it++) {
+			if (it->type == IR_DIRECTIVE) {
+				darray_free(it->as.directive.operands);
+			}
+		}
+	}
+	free(fragment->ir);
+	free(fragment->strings);
+	fragment->ir = NULL;
+	fragment->strings = NULL;
+}
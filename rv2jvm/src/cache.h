@@ -0,0 +1,28 @@
+#ifndef RV2JVM_CACHE_H
+#define RV2JVM_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ir.h"
+#include "options.h"
+
+/*
+ * Parsed IR of one input file as stored in the cache. Label names point
+ * into strings, which the fragment owns.
+ */
+struct cache_fragment {
+	struct ir_element *ir;
+	char *strings;
+};
+
+uint64_t cache_key(char *source, size_t length,
+		   struct compile_options *options);
+bool cache_load(char *cache_dir, uint64_t key, char *source,
+		size_t source_length, struct cache_fragment *res);
+void cache_store(char *cache_dir, uint64_t key, char *source,
+		 size_t source_length, struct ir_element *ir);
+void free_cache_fragment(struct cache_fragment *fragment);
+
+#endif
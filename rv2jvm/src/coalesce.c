@@ -0,0 +1,122 @@
+#include "coalesce.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "ir.h"
+#include "stack.h"
+
+#define DOUBLEWORD_SIZE 8
+
+uint8_t access_size(enum ir_instruction_mnemonic mnemonic)
+{
+	switch (mnemonic) {
+	case LW:
+	case SW:
+		return 4;
+	case LH:
+	case LHU:
+	case SH:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+static bool is_access(struct ir_element *it, uint8_t *stack_slots,
+		      size_t element)
+{
+	return it->type == IR_INSTRUCTION &&
+	       it->as.instruction.type == TYPE_MEM &&
+	       (stack_slots == NULL || stack_slots[element] == NO_STACK_SLOT);
+}
+
+static bool is_load(enum ir_instruction_mnemonic mnemonic)
+{
+	return mnemonic != SW && mnemonic != SH && mnemonic != SB;
+}
+
+/*
+ * Whether the length accesses from ir[i] are a run, the access at i being
+ * one that can start it.
+ */
+static bool is_run(struct ir_element *ir, uint8_t *stack_slots, size_t i,
+		   uint8_t length)
+{
+	struct ir_instruction *first = &ir[i].as.instruction;
+	uint8_t width = access_size(first->mnemonic);
+	for (size_t j = 1; j < length; j++) {
+		struct ir_instruction *previous = &ir[i + j - 1].as.instruction;
+		if (is_load(previous->mnemonic) &&
+		    previous->as.mem.rd == first->as.mem.rs1) {
+			return false;
+		}
+		if (!is_access(&ir[i + j], stack_slots, i + j)) {
+			return false;
+		}
+		struct ir_instruction *next = &ir[i + j].as.instruction;
+		if (next->mnemonic != first->mnemonic ||
+		    next->as.mem.rs1 != first->as.mem.rs1 ||
+		    next->as.mem.offset !=
+		    first->as.mem.offset + (int32_t)j * width) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// length of the longest run starting at ir[i], 1 if none does
+static uint8_t run_length(struct ir_element *ir, uint8_t *stack_slots,
+			  size_t i)
+{
+	struct ir_instruction *first = &ir[i].as.instruction;
+	uint8_t width = access_size(first->mnemonic);
+	for (uint8_t size = DOUBLEWORD_SIZE; size > width; size /= 2) {
+		if ((first->as.mem.offset & (size - 1)) == 0 &&
+		    is_run(ir, stack_slots, i, size / width)) {
+			return size / width;
+		}
+	}
+	return 1;
+}
+
+void find_access_runs(struct ir_element *ir, uint8_t *stack_slots,
+		      struct access_runs *runs)
+{
+	*runs = (struct access_runs) { 0 };
+	size_t elements = 0;
+	while (ir[elements].type != IR_EOF) {
+		elements++;
+	}
+	for (size_t i = 0; i < elements; i++) {
+		if (!is_access(&ir[i], stack_slots, i)) {
+			continue;
+		}
+		uint8_t length = run_length(ir, stack_slots, i);
+		if (length == 1) {
+			continue;
+		}
+		if (runs->length == NULL) {
+			runs->length = malloc(elements);
+			if (runs->length == NULL) {
+				fail("Failed to allocate memory for access runs.");
+			}
+			memset(runs->length, 1, elements);
+		}
+		runs->length[i] = length;
+		memset(&runs->length[i + 1], 0, length - 1);
+		uint8_t size = length * access_size(ir[i].as.instruction.mnemonic);
+		runs->doublewords |= size == DOUBLEWORD_SIZE;
+		i += length - 1;
+	}
+}
+
+void free_access_runs(struct access_runs *runs)
+{
+	free(runs->length);
+	*runs = (struct access_runs) { 0 };
+}
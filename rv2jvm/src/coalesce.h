@@ -0,0 +1,36 @@
+#ifndef RV2JVM_COALESCE_H
+#define RV2JVM_COALESCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ir.h"
+
+/*
+ * A run is a sequence of loads or of stores of one kind that follow each
+ * other with no label in between and access consecutive bytes from the
+ * same base register, lowest address first. A run of 2, 4 or 8 bytes
+ * whose first offset is a multiple of its size becomes one access of a
+ * half, word or doubleword, little endian like memory. Nothing runs
+ * between its loads or stores, so merging them changes only the number of
+ * accesses. A load writing the base register can only end a run.
+ */
+struct access_runs {
+	// loads or stores in the run every IR element starts, 0 for the
+	// ones in a run started before it, NULL when there are no runs
+	uint8_t *length;
+	// some run is a doubleword
+	bool doublewords;
+};
+
+// bytes a load or store accesses
+uint8_t access_size(enum ir_instruction_mnemonic mnemonic);
+/*
+ * Finds the runs of ir. Accesses stack_slots, which may be NULL, keeps in
+ * locals are in none.
+ */
+void find_access_runs(struct ir_element *ir, uint8_t *stack_slots,
+		      struct access_runs *runs);
+void free_access_runs(struct access_runs *runs);
+
+#endif
@@ -4,16 +4,40 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "coalesce.h"
 #include "darray.h"
+#include "emit.h"
+#include "error.h"
 #include "ir.h"
+#include "options.h"
+#include "profile.h"
+#include "separate.h"
+#include "stack.h"
+#include "stats.h"
 #include "table.h"
 
-#define DEBUG
+// largest constant_pool_count, one more than the constants of a class
+#define CONSTANT_POOL_LIMIT 65535
+// longest code attribute the JVM loads
+#define CODE_LENGTH_LIMIT 65535
+// name index, length and frame count; the largest frame is the first one
+#define STACK_MAP_TABLE_HEADER_SIZE 8
+#define STACK_MAP_FRAME_MAX_SIZE 6
+// bytecode of the longest guest instruction, a branch; only used to size
+// buffers, longer sequences still fit since the buffers grow as needed
+#define GUEST_INSTRUCTION_SIZE 17
+// guest code addresses are four times the instruction index, see idiom.c
+#define INSTRUCTION_SIZE 4
+// x0 to x31, then the load reservation of lr.w, see sc_method_code()
+#define REGISTER_FILE_SIZE 34
+#define RESERVATION_ADDRESS 32
+#define RESERVATION_VALUE 33
+// every hart starts with its id in a0, like firmware hands it to a kernel
+#define HARTID_REGISTER X10
+// hart keeps the stack slots in the locals past its temporary, see stack.h
+#define FIRST_STACK_SLOT_LOCAL 4
+#define ENTRY_LABEL "_start"
 
-#define CONSTANT_POOL_LIMIT 65536
-#define MEMORY_SIZE 8192
-
-#define THIS_CLASS_NAME "RvRuntime"
 #define THIS_CLASS "this_class"
 #define SUPER_CLASS_NAME "java/lang/Object"
 #define SUPER_CLASS "super_class"
@@ -31,6 +55,92 @@
 #define MEMORY_FIELD_NAME "memory"
 #define MEMORY_FIELD_NAMEANDTYPE "memory_nameandtype"
 #define MEMORY_FIELDREF "memory_fieldref"
+#define BYTE_ARRAY_DESCRIPTOR "[B"
+#define BYTE_BUFFER_DESCRIPTOR "L" BYTE_BUFFER ";"
+// descriptor of a method that takes memory, then the parameters in rest
+#define MEMORY_METHOD_DESCRIPTOR(c, rest) \
+	(mapped(c) ? "(" BYTE_BUFFER_DESCRIPTOR rest : "([B" rest)
+
+/*
+ * Little endian views of memory. Words are accessed through them, atomics
+ * included, halves with the short one and bytes directly. Runs of accesses
+ * that make up a doubleword use the long one, which only classes with such
+ * runs have. Mapped memory is a ByteBuffer, viewed through
+ * byteBufferViewVarHandle and accessed with get and put.
+ */
+#define VAR_HANDLE_DESCRIPTOR "L" VAR_HANDLE_CLASS_NAME ";"
+#define WORDS_FIELD_NAME "words"
+#define WORDS_FIELD_NAMEANDTYPE "words_nameandtype"
+#define WORDS_FIELDREF "words_fieldref"
+#define HALVES_FIELD_NAME "halves"
+#define HALVES_FIELD_NAMEANDTYPE "halves_nameandtype"
+#define HALVES_FIELDREF "halves_fieldref"
+#define DOUBLEWORDS_FIELD_NAME "doublewords"
+#define DOUBLEWORDS_FIELD_NAMEANDTYPE "doublewords_nameandtype"
+#define DOUBLEWORDS_FIELDREF "doublewords_fieldref"
+#define INT_ARRAY_CLASS "int_array_class"
+#define SHORT_ARRAY_CLASS "short_array_class"
+#define BYTE_ORDER_CLASS_NAME "java/nio/ByteOrder"
+#define BYTE_ORDER_CLASS "byte_order_class"
+#define LITTLE_ENDIAN_FIELD_NAMEANDTYPE "little_endian_nameandtype"
+#define LITTLE_ENDIAN_FIELDREF "little_endian_fieldref"
+#define METHOD_HANDLES "java/lang/invoke/MethodHandles"
+#define METHOD_HANDLES_CLASS "method_handles_class"
+#define BYTE_ARRAY_VIEW_METHOD_NAMEANDTYPE "byte_array_view_nameandtype"
+#define BYTE_ARRAY_VIEW_METHODREF "byte_array_view_methodref"
+#define BYTE_ARRAY_VIEW_METHOD_DESCRIPTOR \
+	"(Ljava/lang/Class;L" BYTE_ORDER_CLASS_NAME ";)" VAR_HANDLE_DESCRIPTOR
+
+// call site descriptors of the signature polymorphic VarHandle methods
+#define WORD_GET_NAMEANDTYPE "word_get_nameandtype"
+#define WORD_GET_METHODREF "word_get_methodref"
+#define WORD_SET_NAMEANDTYPE "word_set_nameandtype"
+#define WORD_SET_METHODREF "word_set_methodref"
+#define HALF_GET_NAMEANDTYPE "half_get_nameandtype"
+#define HALF_GET_METHODREF "half_get_methodref"
+#define HALF_SET_NAMEANDTYPE "half_set_nameandtype"
+#define HALF_SET_METHODREF "half_set_methodref"
+#define DOUBLEWORD_GET_NAMEANDTYPE "doubleword_get_nameandtype"
+#define DOUBLEWORD_GET_METHODREF "doubleword_get_methodref"
+#define DOUBLEWORD_SET_NAMEANDTYPE "doubleword_set_nameandtype"
+#define DOUBLEWORD_SET_METHODREF "doubleword_set_methodref"
+#define WORD_GET_VOLATILE_NAMEANDTYPE "word_get_volatile_nameandtype"
+#define WORD_GET_VOLATILE_METHODREF "word_get_volatile_methodref"
+#define WORD_CAS_NAMEANDTYPE "word_cas_nameandtype"
+#define WORD_CAS_METHODREF "word_cas_methodref"
+#define BUFFER_GET_NAMEANDTYPE "buffer_get_nameandtype"
+#define BUFFER_GET_METHODREF "buffer_get_methodref"
+#define BUFFER_PUT_NAMEANDTYPE "buffer_put_nameandtype"
+#define BUFFER_PUT_METHODREF "buffer_put_methodref"
+
+#define MATH "java/lang/Math"
+#define MATH_CLASS "math_class"
+#define MATH_MIN_NAMEANDTYPE "math_min_nameandtype"
+#define MATH_MIN_METHODREF "math_min_methodref"
+#define MATH_MAX_NAMEANDTYPE "math_max_nameandtype"
+#define MATH_MAX_METHODREF "math_max_methodref"
+#define INT_INT_INT_DESCRIPTOR "(II)I"
+#define MATH_MULTIPLY_FULL_NAMEANDTYPE "math_multiply_full_nameandtype"
+#define MATH_MULTIPLY_FULL_METHODREF "math_multiply_full_methodref"
+
+#define INTEGER "java/lang/Integer"
+#define INTEGER_CLASS "integer_class"
+#define TO_UNSIGNED_LONG_NAMEANDTYPE "to_unsigned_long_nameandtype"
+#define TO_UNSIGNED_LONG_METHODREF "to_unsigned_long_methodref"
+#define DIVIDE_UNSIGNED_NAMEANDTYPE "divide_unsigned_nameandtype"
+#define DIVIDE_UNSIGNED_METHODREF "divide_unsigned_methodref"
+#define REMAINDER_UNSIGNED_NAMEANDTYPE "remainder_unsigned_nameandtype"
+#define REMAINDER_UNSIGNED_METHODREF "remainder_unsigned_methodref"
+
+// helpers of the atomics, '$' keeps them apart from guest labels
+#define LR_METHOD_NAME "lr$w"
+#define LR_METHOD_DESCRIPTOR "([JI)I"
+#define LR_METHOD_NAMEANDTYPE "lr_nameandtype"
+#define LR_METHODREF "lr_methodref"
+#define SC_METHOD_NAME "sc$w"
+#define SC_METHOD_DESCRIPTOR "([JII)I"
+#define SC_METHOD_NAMEANDTYPE "sc_nameandtype"
+#define SC_METHODREF "sc_methodref"
 
 #define LONG_ARRAY_CLASS "long_array_class"
 #define LONG_ARRAY_DESCRIPTOR "[J"
@@ -38,12 +148,43 @@
 #define STRING_ARRAY_CLASS "string_array_class"
 #define STRING_ARRAY_DESCRIPTOR "[L" STRING_CLASS_NAME ";"
 
+#define RUNNABLE_CLASS_NAME "java/lang/Runnable"
+#define RUNNABLE_CLASS "runnable_class"
+#define THREAD_CLASS_NAME "java/lang/Thread"
+#define THREAD_CLASS "thread_class"
+#define VAR_HANDLE_CLASS_NAME "java/lang/invoke/VarHandle"
+#define VAR_HANDLE_CLASS "var_handle_class"
+
+#define HARTID_FIELD_NAME "hartid"
+#define HARTID_FIELD_DESCRIPTOR "I"
+#define HARTID_FIELD_NAMEANDTYPE "hartid_nameandtype"
+#define HARTID_FIELDREF "hartid_fieldref"
+
 #define INIT_METHOD_NAME "<init>"
 #define CLINIT_METHOD_NAME "<clinit>"
 #define MAIN_METHOD_NAME "main"
 #define MAIN_METHOD_DESCRIPTOR "(" STRING_ARRAY_DESCRIPTOR ")V"
 #define NO_ARGS_VOID_DESCRIPTOR "()V"
+#define INT_ARG_VOID_DESCRIPTOR "(I)V"
 #define INIT_METHOD_NAMEANDTYPE "init_method_nameandtype"
+#define RUN_METHOD_NAME "run"
+#define HART_METHOD_NAME "hart"
+#define HART_METHOD_NAMEANDTYPE "hart_method_nameandtype"
+#define HART_METHODREF "hart_methodref"
+#define THIS_INIT_METHOD_NAMEANDTYPE "this_init_method_nameandtype"
+#define THIS_INIT_METHODREF "this_init_methodref"
+#define OBJECT_INIT_METHOD_NAMEANDTYPE "object_init_method_nameandtype"
+#define OBJECT_INIT_METHODREF "object_init_methodref"
+
+#define THREAD_INIT_METHOD_NAMEANDTYPE "thread_init_method_nameandtype"
+#define THREAD_INIT_METHODREF "thread_init_methodref"
+#define THREAD_INIT_METHOD_DESCRIPTOR "(L" RUNNABLE_CLASS_NAME ";)V"
+#define THREAD_START_METHOD_NAMEANDTYPE "thread_start_method_nameandtype"
+#define THREAD_START_METHODREF "thread_start_methodref"
+#define THREAD_START_METHOD_NAME "start"
+#define THREAD_JOIN_METHOD_NAMEANDTYPE "thread_join_method_nameandtype"
+#define THREAD_JOIN_METHODREF "thread_join_methodref"
+#define THREAD_JOIN_METHOD_NAME "join"
 
 #define THREAD_LOCAL_GET_METHODREF "thread_local_get_methodref"
 #define THREAD_LOCAL_GET_METHOD_NAMEANDTYPE "thread_local_get_method_nameandtype"
@@ -55,6 +196,176 @@
 #define THREAD_LOCAL_SET_METHOD_NAME "set"
 #define THREAD_LOCAL_SET_METHOD_DESCRIPTOR "(L" SUPER_CLASS_NAME  ";)V"
 
+// VarHandle methods with one call site descriptor, see fence_methods
+#define COLD_METHOD_NAME "cold$"
+#define COLD_METHOD_DESCRIPTOR "(I[J)I"
+#define COLD_METHOD_NAMEANDTYPE "cold_method_nameandtype"
+#define COLD_METHODREF "cold_methodref"
+// where the hot method calls the cold one, '$' keeps it apart from labels
+#define COLD_DISPATCH_LABEL "$cold"
+
+/*
+ * A separately compiled file runs its code in run$ like the cold method
+ * does and has a stub per entry point, see separate.h.
+ */
+#define RUNTIME_CLASS "runtime_class"
+#define UNIT_METHOD_NAME "run$"
+#define UNIT_METHOD_NAMEANDTYPE "unit_method_nameandtype"
+#define UNIT_METHODREF "unit_methodref"
+#define ENTRY_METHOD_DESCRIPTOR "([J)I"
+
+#define PROFILE_FIELD_NAME "profile"
+#define PROFILE_FIELD_NAMEANDTYPE "profile_nameandtype"
+#define PROFILE_FIELDREF "profile_fieldref"
+#define PROFILE_PATH "profile_path"
+#define STRING_CLASS "string_class"
+
+/*
+ * The data segment is stored as String constants whose chars are its
+ * bytes, see find_data_chunks().
+ */
+#define GET_BYTES_NAMEANDTYPE "get_bytes_nameandtype"
+#define GET_BYTES_METHODREF "get_bytes_methodref"
+#define MAX_DATA_CHUNKS 1024
+#define MIN_DATA_GAP 16
+#define UTF8_LIMIT 65535
+#define BYTE_BUFFER "java/nio/ByteBuffer"
+#define BYTE_BUFFER_CLASS "byte_buffer_class"
+#define ALLOCATE_NAMEANDTYPE "allocate_nameandtype"
+#define ALLOCATE_METHODREF "allocate_methodref"
+#define AS_LONG_BUFFER_NAMEANDTYPE "as_long_buffer_nameandtype"
+#define AS_LONG_BUFFER_METHODREF "as_long_buffer_methodref"
+#define ARRAY_NAMEANDTYPE "array_nameandtype"
+#define ARRAY_METHODREF "array_methodref"
+#define LONG_BUFFER "java/nio/LongBuffer"
+#define LONG_BUFFER_CLASS "long_buffer_class"
+#define PUT_NAMEANDTYPE "put_nameandtype"
+#define PUT_METHODREF "put_methodref"
+#define PATHS "java/nio/file/Paths"
+#define PATHS_CLASS "paths_class"
+#define PATHS_GET_NAMEANDTYPE "paths_get_nameandtype"
+#define PATHS_GET_METHODREF "paths_get_methodref"
+#define FILES "java/nio/file/Files"
+#define FILES_CLASS "files_class"
+#define FILES_WRITE_NAMEANDTYPE "files_write_nameandtype"
+#define FILES_WRITE_METHODREF "files_write_methodref"
+#define OPEN_OPTION "java/nio/file/OpenOption"
+#define OPEN_OPTION_CLASS "open_option_class"
+
+/*
+ * Mapped memory, FileChannel.open(path, READ, WRITE, CREATE).map(mode, 0,
+ * max(size, memory size)).
+ */
+#define MEMORY_PATH "memory_path"
+#define FILE_CHANNEL "java/nio/channels/FileChannel"
+#define FILE_CHANNEL_CLASS "file_channel_class"
+#define FILE_CHANNEL_OPEN_NAMEANDTYPE "file_channel_open_nameandtype"
+#define FILE_CHANNEL_OPEN_METHODREF "file_channel_open_methodref"
+#define FILE_CHANNEL_SIZE_NAMEANDTYPE "file_channel_size_nameandtype"
+#define FILE_CHANNEL_SIZE_METHODREF "file_channel_size_methodref"
+#define FILE_CHANNEL_MAP_NAMEANDTYPE "file_channel_map_nameandtype"
+#define FILE_CHANNEL_MAP_METHODREF "file_channel_map_methodref"
+#define FILE_CHANNEL_CLOSE_NAMEANDTYPE "file_channel_close_nameandtype"
+#define FILE_CHANNEL_CLOSE_METHODREF "file_channel_close_methodref"
+#define MAP_MODE "java/nio/channels/FileChannel$MapMode"
+#define MAP_MODE_CLASS "map_mode_class"
+#define MAP_MODE_NAMEANDTYPE "map_mode_nameandtype"
+#define MAP_MODE_FIELDREF "map_mode_fieldref"
+#define STANDARD_OPEN_OPTION "java/nio/file/StandardOpenOption"
+#define STANDARD_OPEN_OPTION_CLASS "standard_open_option_class"
+#define STANDARD_OPEN_OPTION_DESCRIPTOR "L" STANDARD_OPEN_OPTION ";"
+#define OPEN_READ_NAMEANDTYPE "open_read_nameandtype"
+#define OPEN_READ_FIELDREF "open_read_fieldref"
+#define OPEN_WRITE_NAMEANDTYPE "open_write_nameandtype"
+#define OPEN_WRITE_FIELDREF "open_write_fieldref"
+#define OPEN_CREATE_NAMEANDTYPE "open_create_nameandtype"
+#define OPEN_CREATE_FIELDREF "open_create_fieldref"
+#define MATH_MAX_LONG_NAMEANDTYPE "math_max_long_nameandtype"
+#define MATH_MAX_LONG_METHODREF "math_max_long_methodref"
+#define BUFFER_POSITION_NAMEANDTYPE "buffer_position_nameandtype"
+#define BUFFER_POSITION_METHODREF "buffer_position_methodref"
+#define BUFFER_PUT_ARRAY_NAMEANDTYPE "buffer_put_array_nameandtype"
+#define BUFFER_PUT_ARRAY_METHODREF "buffer_put_array_methodref"
+
+/*
+ * Snapshots, which snap$ writes at every EBREAK and resume$ reads when main
+ * gets the path of one. As DataOutputStream values they are the magic, the
+ * number of blocks, the block to resume in, the guest pc, the number of
+ * registers and the registers. Then come the address, length and bytes of
+ * every page of memory that is not all zero, and -1. The number of blocks
+ * tells snapshots of other programs apart.
+ */
+#define SNAPSHOT_MAGIC 0x525653
+#define SNAPSHOT_PAGE_SIZE 4096
+#define SNAPSHOT_PATH "snapshot_path"
+#define SNAP_METHOD_NAME "snap$"
+#define SNAP_METHOD_DESCRIPTOR "([JII)V"
+#define SNAP_METHOD_NAMEANDTYPE "snap_nameandtype"
+#define SNAP_METHODREF "snap_methodref"
+#define RESUME_METHOD_NAME "resume$"
+#define RESUME_METHOD_DESCRIPTOR "(L" STRING_CLASS_NAME ";)V"
+#define RESUME_METHOD_NAMEANDTYPE "resume_nameandtype"
+#define RESUME_METHODREF "resume_methodref"
+#define RESUME_BLOCK_FIELD_NAME "resume$block"
+#define RESUME_BLOCK_NAMEANDTYPE "resume_block_nameandtype"
+#define RESUME_BLOCK_FIELDREF "resume_block_fieldref"
+#define RESUME_REGISTERS_FIELD_NAME "resume$registers"
+#define RESUME_REGISTERS_NAMEANDTYPE "resume_registers_nameandtype"
+#define RESUME_REGISTERS_FIELDREF "resume_registers_fieldref"
+#define BYTE_ARRAY_CLASS "byte_array_class"
+#define DATA_OUTPUT_STREAM "java/io/DataOutputStream"
+#define DATA_OUTPUT_STREAM_CLASS "data_output_stream_class"
+#define DATA_INPUT_STREAM "java/io/DataInputStream"
+#define DATA_INPUT_STREAM_CLASS "data_input_stream_class"
+#define BUFFERED_OUTPUT_STREAM "java/io/BufferedOutputStream"
+#define BUFFERED_OUTPUT_STREAM_CLASS "buffered_output_stream_class"
+#define BUFFERED_INPUT_STREAM "java/io/BufferedInputStream"
+#define BUFFERED_INPUT_STREAM_CLASS "buffered_input_stream_class"
+#define OUTPUT_STREAM_DESCRIPTOR "Ljava/io/OutputStream;"
+#define INPUT_STREAM_DESCRIPTOR "Ljava/io/InputStream;"
+#define DATA_OUTPUT_INIT_NAMEANDTYPE "data_output_init_nameandtype"
+#define DATA_OUTPUT_INIT_METHODREF "data_output_init_methodref"
+#define BUFFERED_OUTPUT_INIT_NAMEANDTYPE "buffered_output_init_nameandtype"
+#define BUFFERED_OUTPUT_INIT_METHODREF "buffered_output_init_methodref"
+#define DATA_INPUT_INIT_NAMEANDTYPE "data_input_init_nameandtype"
+#define DATA_INPUT_INIT_METHODREF "data_input_init_methodref"
+#define BUFFERED_INPUT_INIT_NAMEANDTYPE "buffered_input_init_nameandtype"
+#define BUFFERED_INPUT_INIT_METHODREF "buffered_input_init_methodref"
+#define WRITE_INT_NAMEANDTYPE "write_int_nameandtype"
+#define WRITE_INT_METHODREF "write_int_methodref"
+#define WRITE_LONG_NAMEANDTYPE "write_long_nameandtype"
+#define WRITE_LONG_METHODREF "write_long_methodref"
+#define WRITE_BYTES_NAMEANDTYPE "write_bytes_nameandtype"
+#define WRITE_BYTES_METHODREF "write_bytes_methodref"
+#define OUTPUT_CLOSE_NAMEANDTYPE "output_close_nameandtype"
+#define OUTPUT_CLOSE_METHODREF "output_close_methodref"
+#define READ_INT_NAMEANDTYPE "read_int_nameandtype"
+#define READ_INT_METHODREF "read_int_methodref"
+#define READ_LONG_NAMEANDTYPE "read_long_nameandtype"
+#define READ_LONG_METHODREF "read_long_methodref"
+#define READ_FULLY_NAMEANDTYPE "read_fully_nameandtype"
+#define READ_FULLY_METHODREF "read_fully_methodref"
+#define INPUT_CLOSE_NAMEANDTYPE "input_close_nameandtype"
+#define INPUT_CLOSE_METHODREF "input_close_methodref"
+#define FILES_NEW_OUTPUT_STREAM_NAMEANDTYPE "files_new_output_stream_nameandtype"
+#define FILES_NEW_OUTPUT_STREAM_METHODREF "files_new_output_stream_methodref"
+#define FILES_NEW_INPUT_STREAM_NAMEANDTYPE "files_new_input_stream_nameandtype"
+#define FILES_NEW_INPUT_STREAM_METHODREF "files_new_input_stream_methodref"
+#define ARRAYS "java/util/Arrays"
+#define ARRAYS_CLASS "arrays_class"
+#define ARRAYS_EQUALS_NAMEANDTYPE "arrays_equals_nameandtype"
+#define ARRAYS_EQUALS_METHODREF "arrays_equals_methodref"
+#define SYSTEM "java/lang/System"
+#define SYSTEM_CLASS "system_class"
+#define ARRAYCOPY_NAMEANDTYPE "arraycopy_nameandtype"
+#define ARRAYCOPY_METHODREF "arraycopy_methodref"
+#define ILLEGAL_ARGUMENT "java/lang/IllegalArgumentException"
+#define ILLEGAL_ARGUMENT_CLASS "illegal_argument_class"
+#define ILLEGAL_ARGUMENT_INIT_NAMEANDTYPE "illegal_argument_init_nameandtype"
+#define ILLEGAL_ARGUMENT_INIT_METHODREF "illegal_argument_init_methodref"
+
+#define VAR_HANDLE_METHOD(name) { name, name "_nameandtype", name "_methodref" }
+
 #define SIGNATURE "Signature"
 #define CODE "Code"
 #define STACK_MAP_TABLE "StackMapTable"
@@ -78,57 +389,268 @@ enum jvm_access_flag {
 };
 
 enum jvm_atype {
+	JVM_T_BYTE = 8,
 	JVM_T_LONG = 11,
 };
 
 enum jvm_item {
+	JVM_ITEM_INTEGER = 1,
 	JVM_ITEM_LONG = 4,
 	JVM_ITEM_OBJECT = 7,
 };
 
 enum jvm_frame_type {
-	JVM_SAME_FRAME_EXTENDED = 251
+	JVM_SAME_FRAME_EXTENDED = 251,
+	JVM_FULL_FRAME = 255
 };
 
+// locals an append_frame adds at most
+#define APPEND_FRAME_LOCALS_MAX 3
+
 enum jvm_opcode {
+	JVM_ICONST_M1 = 2,
+	JVM_ICONST_0 = 3,
+	JVM_ICONST_1 = 4,
+	JVM_LCONST_0 = 9,
+	JVM_LCONST_1 = 10,
 	JVM_BIPUSH = 16,
 	JVM_SIPUSH = 17,
 	JVM_LDC_W = 19,
+	JVM_ILOAD = 21,
+	JVM_ALOAD = 25,
+	JVM_ILOAD_0 = 26,
+	JVM_ILOAD_1 = 27,
+	JVM_ILOAD_2 = 28,
+	JVM_ILOAD_3 = 29,
 	JVM_LLOAD_2 = 32,
+	JVM_ALOAD_0 = 42,
 	JVM_ALOAD_1 = 43,
+	JVM_ALOAD_2 = 44,
+	JVM_ALOAD_3 = 45,
 	JVM_LALOAD = 47,
+	JVM_AALOAD = 50,
+	JVM_BALOAD = 51,
+	JVM_ISTORE = 54,
+	JVM_ASTORE = 58,
+	JVM_ISTORE_0 = 59,
+	JVM_ISTORE_1 = 60,
+	JVM_ISTORE_2 = 61,
+	JVM_ISTORE_3 = 62,
 	JVM_LSTORE_2 = 65,
+	JVM_ASTORE_0 = 75,
 	JVM_ASTORE_1 = 76,
+	JVM_ASTORE_2 = 77,
+	JVM_ASTORE_3 = 78,
 	JVM_LASTORE = 80,
+	JVM_AASTORE = 83,
+	JVM_BASTORE = 84,
+	JVM_POP = 87,
 	JVM_POP2 = 88,
 	JVM_DUP = 89,
+	JVM_DUP_X1 = 90,
+	JVM_DUP_X2 = 91,
+	JVM_DUP2 = 92,
+	JVM_SWAP = 95,
+	JVM_IADD = 96,
 	JVM_LADD = 97,
+	JVM_ISUB = 100,
+	JVM_IMUL = 104,
+	JVM_LMUL = 105,
+	JVM_IDIV = 108,
+	JVM_IREM = 112,
+	JVM_ISHL = 120,
+	JVM_LSHL = 121,
+	JVM_LSHR = 123,
+	JVM_LUSHR = 125,
+	JVM_IAND = 126,
+	JVM_IOR = 128,
+	JVM_LOR = 129,
+	JVM_IXOR = 130,
 	JVM_I2L = 133,
+	JVM_L2I = 136,
+	JVM_I2B = 145,
+	JVM_I2C = 146,
+	JVM_I2S = 147,
 	JVM_LCMP = 148,
 	JVM_IFEQ = 153,
+	JVM_IFNE = 154,
+	JVM_IFLT = 155,
 	JVM_IFGT = 157,
+	JVM_IFLE = 158,
+	JVM_IF_ICMPNE = 160,
+	JVM_IF_ICMPGE = 162,
+	JVM_GOTO = 167,
+	JVM_LOOKUPSWITCH = 171,
+	JVM_IRETURN = 172,
 	JVM_RETURN = 177,
 	JVM_GETSTATIC = 178,
 	JVM_PUTSTATIC = 179,
+	JVM_GETFIELD = 180,
+	JVM_PUTFIELD = 181,
 	JVM_INVOKEVIRTUAL = 182,
 	JVM_INVOKESPECIAL = 183,
+	JVM_INVOKESTATIC = 184,
 	JVM_NEW = 187,
 	JVM_NEWARRAY = 188,
+	JVM_ANEWARRAY = 189,
+	JVM_ARRAYLENGTH = 190,
+	JVM_ATHROW = 191,
 	JVM_CHECKCAST = 192,
+	JVM_IFNULL = 198,
 	JVM_GOTO_W = 200,
 };
 
+struct method_constant {
+	char *name;
+	char *nameandtype;
+	char *methodref;
+};
+
+enum fence_kind {
+	FENCE_FULL,
+	FENCE_ACQUIRE,
+	FENCE_RELEASE,
+	FENCE_LOAD_LOAD,
+	FENCE_STORE_STORE,
+	FENCE_KINDS
+};
+
+static struct method_constant fence_methods[FENCE_KINDS] = {
+	[FENCE_FULL] = VAR_HANDLE_METHOD("fullFence"),
+	[FENCE_ACQUIRE] = VAR_HANDLE_METHOD("acquireFence"),
+	[FENCE_RELEASE] = VAR_HANDLE_METHOD("releaseFence"),
+	[FENCE_LOAD_LOAD] = VAR_HANDLE_METHOD("loadLoadFence"),
+	[FENCE_STORE_STORE] = VAR_HANDLE_METHOD("storeStoreFence")
+};
+
+/*
+ * Atomic memory operations VarHandle has a method for, in the order of
+ * the mnemonics from AMOSWAP_W. An .aq or .rl suffix picks the acquire or
+ * release variant, none or both the volatile one.
+ */
+enum amo_mode {
+	AMO_VOLATILE,
+	AMO_ACQUIRE,
+	AMO_RELEASE,
+	AMO_MODES
+};
+
+#define AMO_METHODS(name) { \
+	[AMO_VOLATILE] = VAR_HANDLE_METHOD(name), \
+	[AMO_ACQUIRE] = VAR_HANDLE_METHOD(name "Acquire"), \
+	[AMO_RELEASE] = VAR_HANDLE_METHOD(name "Release") \
+}
+
+static struct method_constant amo_methods[][AMO_MODES] = {
+	AMO_METHODS("getAndSet"),
+	AMO_METHODS("getAndAdd"),
+	AMO_METHODS("getAndBitwiseAnd"),
+	AMO_METHODS("getAndBitwiseOr"),
+	AMO_METHODS("getAndBitwiseXor")
+};
+
+#define AMO_METHOD_COUNT (sizeof(amo_methods) / sizeof(amo_methods[0]))
+
+/*
+ * The rest are compare-and-set loops in helper methods of the class, in
+ * the order of the mnemonics from AMOMIN_W. Unsigned ones flip the sign
+ * bit around Math.min and Math.max.
+ */
+struct amo_loop {
+	struct method_constant method;
+	char *math_methodref;
+	bool is_unsigned;
+};
+
+static struct amo_loop amo_loops[] = {
+	{ { "amomin$w", "amomin_nameandtype", "amomin_methodref" },
+	  MATH_MIN_METHODREF, false },
+	{ { "amomax$w", "amomax_nameandtype", "amomax_methodref" },
+	  MATH_MAX_METHODREF, false },
+	{ { "amominu$w", "amominu_nameandtype", "amominu_methodref" },
+	  MATH_MIN_METHODREF, true },
+	{ { "amomaxu$w", "amomaxu_nameandtype", "amomaxu_methodref" },
+	  MATH_MAX_METHODREF, true }
+};
+
+#define AMO_LOOP_COUNT (sizeof(amo_loops) / sizeof(amo_loops[0]))
+
+/*
+ * Helpers of DIV, DIVU, REM and REMU, in that order. RISC-V division never
+ * traps: dividing by zero gives all ones and the remainder the dividend.
+ * The overflow of the most negative value divided by -1 gives itself and a
+ * remainder of 0 like idiv and irem do, so only zero needs a check.
+ */
+struct division {
+	struct method_constant method;
+	bool zero_gives_dividend;
+	// idiv or irem, or 0 to call methodref
+	uint8_t opcode;
+	char *methodref;
+};
+
+static struct division divisions[] = {
+	{ { "div$", "div_nameandtype", "div_methodref" },
+	  false, JVM_IDIV, NULL },
+	{ { "divu$", "divu_nameandtype", "divu_methodref" },
+	  false, 0, DIVIDE_UNSIGNED_METHODREF },
+	{ { "rem$", "rem_nameandtype", "rem_methodref" },
+	  true, JVM_IREM, NULL },
+	{ { "remu$", "remu_nameandtype", "remu_methodref" },
+	  true, 0, REMAINDER_UNSIGNED_METHODREF }
+};
+
+#define DIVISION_COUNT (sizeof(divisions) / sizeof(divisions[0]))
+
+/*
+ * Helpers of LW, LH, LHU, LB, LBU, SW, SH and SB, in that order, taking the
+ * address and for stores the value: lw$(int address) returns the word.
+ * Calling one takes an invokestatic at the site in place of the memory
+ * access, and a program calls the ones whose sites it saves more bytes at
+ * than the helper adds to the class. The JIT inlines them, the methods
+ * calling them stay small enough for it to compile.
+ */
+struct memory_helper {
+	struct method_constant method;
+	char *descriptor;
+	// bytes of the access at a site besides its address and value
+	uint8_t inline_size;
+	uint8_t mapped_inline_size;
+};
+
+static struct memory_helper memory_helpers[] = {
+	{ { "lw$", "lw_nameandtype", "lw_methodref" }, "(I)I", 9, 9 },
+	{ { "lh$", "lh_nameandtype", "lh_methodref" }, "(I)I", 9, 9 },
+	{ { "lhu$", "lhu_nameandtype", "lhu_methodref" }, "(I)I", 10, 10 },
+	{ { "lb$", "lb_nameandtype", "lb_methodref" }, "(I)I", 4, 6 },
+	{ { "lbu$", "lbu_nameandtype", "lbu_methodref" }, "(I)I", 8, 10 },
+	{ { "sw$", "sw_nameandtype", "sw_methodref" }, "(II)V", 9, 9 },
+	{ { "sh$", "sh_nameandtype", "sh_methodref" }, "(II)V", 10, 10 },
+	{ { "sb$", "sb_nameandtype", "sb_methodref" }, "(II)V", 4, 8 }
+};
+
+#define MEMORY_HELPER_COUNT (sizeof(memory_helpers) / sizeof(memory_helpers[0]))
+// invokestatic and its index
+#define HELPER_CALL_SIZE 3
+// about what a helper adds to the class with its method, code and constants
+#define HELPER_CLASS_SIZE 64
+
 struct constant_pool_index {
 	uint16_t index;
 };
 
+/*
+ * Offsets into the code of a method are kept in 32 bits, like the
+ * branches that are patched with them, so that they never wrap on the way
+ * to the class file.
+ */
 struct code_label_offset {
-	uint16_t offset;
+	uint32_t offset;
 };
 
 struct label_reference {
-	uint16_t opcode_offset;
-	uint16_t branch_offset;
+	uint32_t opcode_offset;
+	uint32_t branch_offset;
 };
 
 struct label_references {
@@ -144,8 +666,7 @@ struct local {
 
 struct stack_map_frame {
 	uint8_t frame_type;
-	uint16_t target_offset;
-	struct local locals[2];
+	uint32_t target_offset;
 };
 
 struct stack_map_frames {
@@ -161,14 +682,74 @@ struct code {
 	uint16_t exception_table_length;
 	uint16_t attributes_count;
 	struct stack_map_frames *stack_map_frames;
+	// locals past the parameters, declared by the first frame
+	struct local frame_locals[APPEND_FRAME_LOCALS_MAX + STACK_SLOTS_MAX];
+	uint8_t frame_locals_size;
+	// parameters, which a first frame declaring more than 3 locals lists
+	// as well
+	struct local frame_parameters[1];
+	uint8_t frame_parameters_size;
+};
+
+struct data_chunk {
+	uint32_t address;
+	uint32_t length;
+	// modified UTF-8 of the chars, which has no zero bytes
+	char *utf8;
+	char utf8_key[32];
+	char string_key[32];
+};
+
+struct data_chunks {
+	struct data_chunk *items;
+	size_t size;
+	size_t capacity;
+};
+
+// size of the numbered pool keys of units and entries, the longest prefix
+// "entry$nameandtype$" and the 20 digits of any size_t
+#define ENTRY_KEY_SIZE 40
+
+/*
+ * Constant pool keys of the entry points hart calls in a separately
+ * compiled program.
+ */
+struct entry_keys {
+	char nameandtype[ENTRY_KEY_SIZE];
+	char methodref[ENTRY_KEY_SIZE];
 };
 
 struct codegen {
 	struct ir_element *ir;
+	// guest address of the first instruction of ir
+	uint32_t base_address;
+	struct data *data;
+	struct data_chunks data_chunks;
+	struct compile_options *options;
+	struct compile_stats *stats;
 	struct bytecode *res;
 	struct table *constant_map;
 	struct table *code_label_offsets;
 	struct table *label_references;
+	struct blocks blocks;
+	// method being generated and the block of it being written
+	enum block_placement method;
+	size_t block;
+	// class of memory and the helpers, THIS_CLASS or RUNTIME_CLASS
+	char *runtime_class;
+	// separately compiled program, NULL for a single class
+	struct separate_program *program;
+	// file of the class being generated, the runtime class has none
+	size_t unit;
+	char (*unit_class_keys)[ENTRY_KEY_SIZE];
+	struct entry_keys *entry_keys;
+	// loads and stores that call their memory_helpers
+	bool outlined[MEMORY_HELPER_COUNT];
+	// words of the stack hart keeps in locals
+	struct stack_slots stack_slots;
+	struct access_runs access_runs;
+	// the class has the doublewords view, which access runs use
+	bool doublewords;
 };
 
 static struct code create_code()
@@ -193,48 +774,362 @@ static void free_code(struct code *c)
 	free(c->stack_map_frames);
 }
 
+// chars 1 to 127 take one byte in modified UTF-8, 0 and the rest two
+static size_t utf8_width(uint8_t byte)
+{
+	return byte == 0 || byte >= 0x80 ? 2 : 1;
+}
+
+/*
+ * Splits the data segment into runs that fit a CONSTANT_Utf8 and leaves
+ * out runs of at least gap zero bytes, memory starts out zero.
+ */
+static void split_data(struct data *data, size_t gap,
+		       struct data_chunks *chunks)
+{
+	size_t i = 0;
+	while (i < data->size) {
+		if (data->image[i] == 0) {
+			i++;
+			continue;
+		}
+		size_t end = i;
+		size_t encoded = 0;
+		size_t j = i;
+		while (j < data->size && j - end < gap &&
+		       encoded + utf8_width(data->image[j]) <= UTF8_LIMIT) {
+			encoded += utf8_width(data->image[j]);
+			j++;
+			if (data->image[j - 1] != 0) {
+				end = j;
+			}
+		}
+		struct data_chunk chunk = {
+			.address = i,
+			.length = end - i
+		};
+		darray_append((*chunks), chunk);
+		i = j;
+	}
+}
+
+/*
+ * clinit loads every chunk with String.getBytes(int, int, byte[], int),
+ * which copies the low byte of each char straight into memory, so the
+ * code it takes depends on the number of chunks and not on the size of
+ * the segment. Sparse segments are split with a larger gap until the
+ * chunks fit the method.
+ */
+static void find_data_chunks(struct data *data, struct data_chunks *chunks)
+{
+	size_t gap = MIN_DATA_GAP;
+	split_data(data, gap, chunks);
+	while (chunks->size > MAX_DATA_CHUNKS) {
+		chunks->size = 0;
+		gap *= 2;
+		split_data(data, gap, chunks);
+	}
+
+	for (size_t i = 0; i < chunks->size; i++) {
+		struct data_chunk *chunk = &chunks->items[i];
+		uint8_t *bytes = &data->image[chunk->address];
+		size_t encoded = 0;
+		for (size_t j = 0; j < chunk->length; j++) {
+			encoded += utf8_width(bytes[j]);
+		}
+		chunk->utf8 = malloc(encoded + 1);
+		if (chunk->utf8 == NULL) {
+			fail("Failed to allocate memory for data chunk.");
+		}
+		char *it = chunk->utf8;
+		for (size_t j = 0; j < chunk->length; j++) {
+			if (utf8_width(bytes[j]) == 1) {
+				*it++ = bytes[j];
+			} else {
+				*it++ = 0xc0 | bytes[j] >> 6;
+				*it++ = 0x80 | (bytes[j] & 0x3f);
+			}
+		}
+		*it = '\0';
+		// '$' keeps the keys apart from guest labels
+		snprintf(chunk->utf8_key, sizeof(chunk->utf8_key), "data$utf8$%zu",
+			 i);
+		snprintf(chunk->string_key, sizeof(chunk->string_key), "data$%zu",
+			 i);
+	}
+}
+
+/*
+ * The blocks of ir, with the ones of the entry points of unit in program,
+ * if there is one, entered from other files.
+ */
+static void find_code_blocks(struct codegen *c, struct ir_element *ir,
+			     struct separate_program *program, size_t unit)
+{
+	size_t entries_n = program != NULL ? program->entries_n : 0;
+	char **entry_labels = malloc(entries_n * sizeof(*entry_labels) + 1);
+	if (entry_labels == NULL) {
+		fail("Failed to allocate memory for entry points.");
+	}
+	size_t entry_labels_n = 0;
+	for (size_t i = 0; i < entries_n; i++) {
+		if (program->entries[i].unit == unit) {
+			entry_labels[entry_labels_n++] = program->entries[i].label;
+		}
+	}
+	find_blocks(ir, ENTRY_LABEL, c->options->snapshot != NULL, &c->blocks);
+	simplify_blocks(ir, entry_labels, entry_labels_n, &c->blocks);
+	free(entry_labels);
+}
+
 static void init_codegen(struct codegen *c, struct ir_element *ir,
+			 struct data *data, struct compile_options *options,
+			 struct separate_program *program, size_t unit,
 			 struct bytecode *res)
 {
 	c->res = res;
 	c->ir = ir;
+	c->base_address = 0;
+	c->data = data;
+	c->data_chunks = (struct data_chunks) { 0 };
+	c->options = options;
+	c->stats = options->stats;
 	c->constant_map = table_create();
 	c->code_label_offsets = table_create();
 	c->label_references = table_create();
+
+	find_code_blocks(c, ir, program, unit);
+	uint64_t *profile = NULL;
+	if (options->profile_use != NULL) {
+		profile = read_profile(options->profile_use, &c->blocks);
+	}
+	layout_blocks(&c->blocks, profile);
+	free(profile);
+	c->method = BLOCK_HOT;
+	c->runtime_class = program != NULL ? RUNTIME_CLASS : THIS_CLASS;
+	c->program = program;
+	c->unit = unit;
+	c->unit_class_keys = NULL;
+	c->entry_keys = NULL;
+	memset(c->outlined, 0, sizeof(c->outlined));
+	c->stack_slots = (struct stack_slots) { 0 };
+	c->access_runs = (struct access_runs) { 0 };
+	c->doublewords = false;
+}
+
+// the values are lists of references, whose items are freed with them
+static void free_label_references(struct table *label_references)
+{
+	for (size_t i = 0; i < label_references->capacity; i++) {
+		struct label_references *references =
+			label_references->values[i].value;
+		if (references != NULL) {
+			darray_free((*references));
+		}
+	}
+	table_free(label_references);
 }
 
 static void free_codegen(struct codegen *c)
 {
 	table_free(c->constant_map);
 	table_free(c->code_label_offsets);
-	table_free(c->label_references);
+	free_label_references(c->label_references);
+	free_blocks(&c->blocks);
+	for (size_t i = 0; i < c->data_chunks.size; i++) {
+		free(c->data_chunks.items[i].utf8);
+	}
+	darray_free(c->data_chunks);
+	free(c->unit_class_keys);
+	free(c->entry_keys);
+	free_stack_slots(&c->stack_slots);
+	free_access_runs(&c->access_runs);
+}
+
+static bool instrumented(struct codegen *c)
+{
+	return c->options->profile_generate != NULL;
+}
+
+static bool mapped(struct codegen *c)
+{
+	return c->options->memory_file != NULL;
+}
+
+static bool snapshots(struct codegen *c)
+{
+	return c->options->snapshot != NULL;
+}
+
+static char *memory_descriptor(struct codegen *c)
+{
+	return mapped(c) ? BYTE_BUFFER_DESCRIPTOR : BYTE_ARRAY_DESCRIPTOR;
+}
+
+static bool has_cold_blocks(struct codegen *c)
+{
+	return c->blocks.hot < c->blocks.size;
+}
+
+/*
+ * Locals belong to one method of one hart. The stack stays in memory when
+ * other methods run blocks of the program, when harts share memory and
+ * when snapshots or the memory file keep what memory holds.
+ */
+static void find_locals_for_stack(struct codegen *c)
+{
+	int harts = c->options->harts > 0 ? c->options->harts : 1;
+	if (c->program != NULL || has_cold_blocks(c) || harts > 1 ||
+	    snapshots(c) || mapped(c)) {
+		return;
+	}
+	find_stack_slots(c->ir, &c->blocks, c->data->size,
+			 memory_size(c->data), &c->stack_slots);
+	if (c->stats != NULL) {
+		c->stats->codegen.stack_slots += c->stack_slots.size;
+	}
+}
+
+static uint8_t stack_slot(struct codegen *c, size_t ir_idx)
+{
+	if (c->stack_slots.of_element == NULL) {
+		return NO_STACK_SLOT;
+	}
+	return c->stack_slots.of_element[ir_idx];
+}
+
+static void find_runs(struct codegen *c)
+{
+	find_access_runs(c->ir, c->stack_slots.of_element, &c->access_runs);
+	c->doublewords = c->access_runs.doublewords;
+}
+
+static uint8_t run_length(struct codegen *c, size_t ir_idx)
+{
+	if (c->access_runs.length == NULL) {
+		return 1;
+	}
+	return c->access_runs.length[ir_idx];
+}
+
+// the runtime class has the views of all files
+static bool program_has_doublewords(struct separate_program *program)
+{
+	bool doublewords = false;
+	for (size_t u = 0; u < program->units_n && !doublewords; u++) {
+		struct access_runs runs;
+		find_access_runs(program->units[u].ir, NULL, &runs);
+		doublewords = runs.doublewords;
+		free_access_runs(&runs);
+	}
+	return doublewords;
+}
+
+// whether the accesses of mnemonic call its helper
+static bool outlined(struct codegen *c, enum ir_instruction_mnemonic mnemonic)
+{
+	return c->outlined[mnemonic - LW];
+}
+
+/*
+ * Accesses to stack slots use locals and runs of accesses the views, so
+ * neither is counted.
+ */
+static void count_memory_accesses(struct ir_element *ir,
+				  uint8_t *stack_slots, uint8_t *run_lengths,
+				  size_t *uses)
+{
+	for (size_t i = 0; ir[i].type != IR_EOF; i++) {
+		if (ir[i].type == IR_INSTRUCTION &&
+		    ir[i].as.instruction.type == TYPE_MEM &&
+		    (stack_slots == NULL ||
+		     stack_slots[i] == NO_STACK_SLOT) &&
+		    (run_lengths == NULL || run_lengths[i] == 1)) {
+			uses[ir[i].as.instruction.mnemonic - LW]++;
+		}
+	}
+}
+
+/*
+ * Counts the accesses of the whole program, so that the runtime class of a
+ * separately compiled one has the helpers its files call.
+ */
+static void choose_memory_helpers(struct codegen *c)
+{
+	size_t uses[MEMORY_HELPER_COUNT] = { 0 };
+	if (c->program != NULL) {
+		for (size_t u = 0; u < c->program->units_n; u++) {
+			count_memory_accesses(c->program->units[u].ir, NULL,
+					      NULL, uses);
+		}
+	} else {
+		count_memory_accesses(c->ir, c->stack_slots.of_element,
+				      c->access_runs.length, uses);
+	}
+	for (size_t i = 0; i < MEMORY_HELPER_COUNT; i++) {
+		struct memory_helper *helper = &memory_helpers[i];
+		size_t size = mapped(c) ? helper->mapped_inline_size
+					: helper->inline_size;
+		c->outlined[i] = size > HELPER_CALL_SIZE &&
+				 (size - HELPER_CALL_SIZE) * uses[i] >
+				 HELPER_CLASS_SIZE;
+	}
+}
+
+static size_t outlined_count(struct codegen *c)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < MEMORY_HELPER_COUNT; i++) {
+		count += c->outlined[i];
+	}
+	return count;
+}
+
+/*
+ * The classes of a separately compiled program use the memory and the
+ * helpers of the runtime class.
+ */
+static uint16_t shared_access(struct codegen *c)
+{
+	return c->program != NULL ? JVM_ACC_PUBLIC : JVM_ACC_PRIVATE;
+}
+
+// ids of the entry points, one more when harts start at no label
+static size_t entry_ids(struct separate_program *program)
+{
+	return program->entries_n +
+	       (program->start == (int32_t)program->entries_n);
 }
 
 static bool add_constant(struct codegen *c, struct table_key key)
 {
+	if (table_get(c->constant_map, key) != NULL) {
+		return false;
+	}
+	if (c->constant_map->size + 2 > CONSTANT_POOL_LIMIT &&
+	    !c->options->ignore_class_limits) {
+		fail("The class needs more than the %d constants a class can "
+		     "hold.", CONSTANT_POOL_LIMIT - 1);
+	}
 	struct constant_pool_index *value = malloc(sizeof(*value));
 	if (value == NULL) {
-		fprintf(stderr, "Failed to allocate memory for constant_pool_index.\n");
-		exit(EXIT_FAILURE);
+		fail("Failed to allocate memory for constant_pool_index.");
 	}
 	value->index = c->constant_map->size + 1;
-	bool added = table_get(c->constant_map, key) == NULL;
-	if (added) {
-		table_set(c->constant_map, key, value);
-#ifdef DEBUG
-		printf("%d: ", value->index);
+	table_set(c->constant_map, key, value);
+	if (c->options->trace >= TRACE_CODEGEN) {
+		fprintf(stderr, "%d: ", value->index);
 		switch (key.type) {
 		case TABLE_KEY_STRING:
-			printf("'%s'", key.as.string);
+			fprintf(stderr, "'%s'", key.as.string);
 			break;
 		case TABLE_KEY_NUMBER:
-			printf("%d", key.as.number);
+			fprintf(stderr, "%d", key.as.number);
 			break;
 		}
-		printf("\n");
-#endif
+		fprintf(stderr, "\n");
 	}
-	return added;
+	return true;
 }
 
 static struct constant_pool_index *get_constant(struct codegen *c,
@@ -251,42 +1146,38 @@ static uint16_t get_constant_index(struct codegen *c, struct table_key key)
 {
 	struct constant_pool_index *index = get_constant(c, key);
 	if (index == NULL) {
-		fprintf(stderr, "Failed to retrieve constant index using key ");
-		switch (key.type) {
-		case TABLE_KEY_NUMBER:
-			fprintf(stderr, "%d", key.as.number);
-		case TABLE_KEY_STRING:
-			fprintf(stderr, "'%s'", key.as.string);
+		if (key.type == TABLE_KEY_NUMBER) {
+			fail("Failed to retrieve constant index using key %d.",
+			     key.as.number);
 		}
-		fprintf(stderr, ".\n");
-		exit(EXIT_FAILURE);
+		fail("Failed to retrieve constant index using key '%s'.",
+		     key.as.string);
 	}
 	return index->index;
 }
 
 static void set_code_label_offset(struct codegen *c, struct table_key key,
-				  uint16_t offset)
+				  uint32_t offset)
 {
 	struct code_label_offset *value = malloc(sizeof(*value));
 	if (value == NULL) {
-		fprintf(stderr, "Failed to allocate memory for code_label_offset.\n");
-		exit(EXIT_FAILURE);
+		fail("Failed to allocate memory for code_label_offset.");
+	}
+	if (c->options->trace >= TRACE_CODEGEN) {
+		fprintf(stderr, "set_code_label_offset: '%s' %u\n",
+			key.as.string, offset);
 	}
-#ifdef DEBUG
-	printf("set_code_label_offset: '%s' %d\n", key.as.string, offset);
-#endif
 	value->offset = offset;
 	table_set(c->code_label_offsets, key, value);
 }
 
-static uint16_t get_code_label_offset(struct codegen *c, char *label)
+static uint32_t get_code_label_offset(struct codegen *c, char *label)
 {
 	struct table_value *table_value = table_get(c->code_label_offsets,
 						    to_string_key(label));
 	if (table_value == NULL) {
-		fprintf(stderr, "Failed to retrieve code label offset for label '%s'.\n",
+		fail("Failed to retrieve code label offset for label '%s'.",
 			label);
-		exit(EXIT_FAILURE);
 	}
 	return ((struct code_label_offset*)table_value->value)->offset;
 }
@@ -303,15 +1194,17 @@ static struct label_references *get_label_references(struct codegen *c,
 }
 
 static void add_label_reference(struct codegen *c, char *label,
-				uint16_t opcode_offset, uint16_t branch_offset)
+				uint32_t opcode_offset, uint32_t branch_offset)
 {
 	struct label_references *label_references = get_label_references(c, label);
 	if (label_references == NULL) {
 		label_references = malloc(sizeof(*label_references));
 		if (label_references == NULL) {
-			fprintf(stderr, "Failed to allocate memory for label_reference.\n");
-			exit(EXIT_FAILURE);
+			fail("Failed to allocate memory for label_reference.");
 		}
+		label_references->items = NULL;
+		label_references->size = 0;
+		label_references->capacity = 0;
 		table_set(c->label_references, to_string_key(label),
 			  label_references);
 	}
@@ -319,117 +1212,90 @@ static void add_label_reference(struct codegen *c, char *label,
 		.opcode_offset = opcode_offset,
 		.branch_offset = branch_offset
 	};
-#ifdef DEBUG
-	printf("add_label_reference: '%s' %d %d\n", label, opcode_offset, branch_offset);
-#endif
+	if (c->options->trace >= TRACE_CODEGEN) {
+		fprintf(stderr, "add_label_reference: '%s' %u %u\n", label,
+			opcode_offset, branch_offset);
+	}
 	darray_append((*label_references), reference);
 }
 
 static void add_stack_frame(struct codegen *c, struct code *code,
-			    uint16_t target_offset)
+			    uint32_t target_offset)
 {
-#ifdef DEBUG
-	printf("add_stack_frame: target_offset %d\n", target_offset);
-#endif
+	if (c->options->trace >= TRACE_CODEGEN) {
+		fprintf(stderr, "add_stack_frame: target_offset %u\n",
+			target_offset);
+	}
 	struct stack_map_frame frame = {
 		.target_offset = target_offset,
 	};
 	darray_append((*code->stack_map_frames), frame);
 }
 
-static void write_byte(struct bytecode *bytecode, uint8_t byte)
-{
-	darray_append((*bytecode), byte);
-}
-
-static void write_bytes(struct bytecode *bytecode, int64_t bytes,
-			int8_t bytes_n)
-{
-	for (int8_t i = bytes_n - 1; i >= 0; i--) {
-		write_byte(bytecode, bytes >> (i * 8));
-	}
-}
-
-static void overwrite_bytes(struct bytecode *bytecode, size_t start,
-			    int64_t bytes, int8_t bytes_n)
-{
-	size_t bytecode_idx = start;
-	for (int8_t i = bytes_n - 1; i >= 0; i--) {
-		bytecode->items[bytecode_idx] = bytes >> (i * 8);
-		bytecode_idx++;
-	}
-}
-
-static void write(struct codegen *c, uint8_t byte)
-{
-	write_byte(c->res, byte);
-	//darray_append((*c->res), byte);
-}
-
-static void write_int(struct codegen *c, uint64_t bytes, size_t bytes_n)
-{
-	write_bytes(c->res, bytes, bytes_n);
-}
-
 static void magic(struct codegen *c)
 {
-	write_int(c, 0xCAFEBABE, 4);
+	emit_u32(c->res, 0xCAFEBABE);
 }
 
 static void minor_version(struct codegen *c)
 {
-	write_int(c, 0, 2);
+	emit_u16(c->res, 0);
 }
 
 static void major_version(struct codegen *c)
 {
-	write_int(c, 52, 2);
+	// 53 for the VarHandle calls
+	emit_u16(c->res, 53);
 }
 
 static void constant_integer_info(struct codegen *c, uint32_t value)
 {
-	write(c, JVM_CONSTANT_INTEGER);
-	write_int(c, value, 4);
+	emit_u8(c->res, JVM_CONSTANT_INTEGER);
+	emit_u32(c->res, value);
 }
 
 static void constant_utf8_info(struct codegen *c, uint16_t length, char *bytes)
 {
-	write(c, JVM_CONSTANT_UTF8);
-	write_int(c, length, 2);
+	emit_u8(c->res, JVM_CONSTANT_UTF8);
+	emit_u16(c->res, length);
 
-	for (uint16_t i = 0; i < length; i++) {
-		write(c, (uint8_t)bytes[i]);
-	}
+	emit_bytes(c->res, bytes, length);
+}
+
+static void constant_string_info(struct codegen *c, uint16_t string_index)
+{
+	emit_u8(c->res, JVM_CONSTANT_STRING);
+	emit_u16(c->res, string_index);
 }
 
 static void constant_class_info(struct codegen *c, uint16_t name_index)
 {
-	write(c, JVM_CONSTANT_CLASS);
-	write_int(c, name_index, 2);
+	emit_u8(c->res, JVM_CONSTANT_CLASS);
+	emit_u16(c->res, name_index);
 }
 
 static void constant_nameandtype_info(struct codegen *c, uint16_t name_idx,
 				      uint16_t descriptor_idx)
 {
-	write(c, JVM_CONSTANT_NAMEANDTYPE);
-	write_int(c, name_idx, 2);
-	write_int(c, descriptor_idx, 2);
+	emit_u8(c->res, JVM_CONSTANT_NAMEANDTYPE);
+	emit_u16(c->res, name_idx);
+	emit_u16(c->res, descriptor_idx);
 }
 
 static void constant_methodref_info(struct codegen *c, uint16_t class_idx,
 				    uint16_t nameandtype_idx)
 {
-	write(c, JVM_CONSTANT_METHODREF);
-	write_int(c, class_idx, 2);
-	write_int(c, nameandtype_idx, 2);
+	emit_u8(c->res, JVM_CONSTANT_METHODREF);
+	emit_u16(c->res, class_idx);
+	emit_u16(c->res, nameandtype_idx);
 }
 
 static void constant_fieldref_info(struct codegen *c, uint16_t class_idx,
 				   uint16_t nameandtype_idx)
 {
-	write(c, JVM_CONSTANT_FIELDREF);
-	write_int(c, class_idx, 2);
-	write_int(c, nameandtype_idx, 2);
+	emit_u8(c->res, JVM_CONSTANT_FIELDREF);
+	emit_u16(c->res, class_idx);
+	emit_u16(c->res, nameandtype_idx);
 }
 
 static uint16_t add_utf8_to_pool(struct codegen *c, char *string)
@@ -451,6 +1317,13 @@ static void add_class_to_pool(struct codegen *c, char *class_name, char *key)
 	add_constant(c, to_string_key(key));
 }
 
+static void add_string_to_pool(struct codegen *c, char *string, char *key)
+{
+	uint16_t idx = add_utf8_to_pool(c, string);
+	constant_string_info(c, idx);
+	add_constant(c, to_string_key(key));
+}
+
 static void add_nameandtype_to_pool(struct codegen *c, char *key,
 				    char *name, char *descriptor)
 {
@@ -482,20 +1355,35 @@ static void add_fieldref_to_pool(struct codegen *c, char *class_key,
 	add_constant(c, to_string_key(field_key));
 }
 
-static void load_constant_from_instruction_at(struct codegen *c, size_t idx)
+/*
+ * address is the guest address of the instruction, the return address of
+ * a jal is a constant too.
+ */
+static void load_constant_from_instruction_at(struct codegen *c, size_t idx,
+					      uint32_t address)
 {
 	struct ir_instruction instruction = c->ir[idx].as.instruction;
 	int32_t imm;
 	switch (instruction.type) {
 	case TYPE_R1_OP:
-		if (instruction.as.r1op.op_type == OPERAND_IMM) {
+		if (instruction.mnemonic == LI) {
+			imm = instruction.as.r1op.op.value;
+		} else if (instruction.mnemonic == JAL) {
+			if (instruction.as.r1op.rd == X0) {
+				return;
+			}
+			imm = address + INSTRUCTION_SIZE;
+		} else if (instruction.as.r1op.op_type == OPERAND_IMM) {
 			imm = instruction.as.r1op.op.imm;
+		} else {
+			return;
 		}
 		break;
 	case TYPE_R2_OP:
-		if (instruction.as.r2op.op_type == OPERAND_IMM) {
-			imm = instruction.as.r2op.op.imm;
+		if (instruction.as.r2op.op_type != OPERAND_IMM) {
+			return;
 		}
+		imm = instruction.as.r2op.op.imm;
 		break;
 	default:
 		return;
@@ -506,13 +1394,396 @@ static void load_constant_from_instruction_at(struct codegen *c, size_t idx)
 	}
 }
 
+/*
+ * Memory views, the VarHandle methods loads, stores and atomics call, the
+ * library methods of the M extension and the helpers of both.
+ */
+static void memory_constant_pool(struct codegen *c)
+{
+	choose_memory_helpers(c);
+	add_class_to_pool(c, "[I", INT_ARRAY_CLASS);
+	add_class_to_pool(c, "[S", SHORT_ARRAY_CLASS);
+	add_class_to_pool(c, BYTE_ORDER_CLASS_NAME, BYTE_ORDER_CLASS);
+	add_class_to_pool(c, METHOD_HANDLES, METHOD_HANDLES_CLASS);
+	add_class_to_pool(c, MATH, MATH_CLASS);
+	add_fieldref_to_pool(c, BYTE_ORDER_CLASS, LITTLE_ENDIAN_FIELDREF,
+			     LITTLE_ENDIAN_FIELD_NAMEANDTYPE, "LITTLE_ENDIAN",
+			     "L" BYTE_ORDER_CLASS_NAME ";");
+	add_methodref_to_pool(c, METHOD_HANDLES_CLASS, BYTE_ARRAY_VIEW_METHODREF,
+			      BYTE_ARRAY_VIEW_METHOD_NAMEANDTYPE,
+			      mapped(c) ? "byteBufferViewVarHandle"
+					: "byteArrayViewVarHandle",
+			      BYTE_ARRAY_VIEW_METHOD_DESCRIPTOR);
+	add_fieldref_to_pool(c, c->runtime_class, WORDS_FIELDREF,
+			     WORDS_FIELD_NAMEANDTYPE, WORDS_FIELD_NAME,
+			     VAR_HANDLE_DESCRIPTOR);
+	add_fieldref_to_pool(c, c->runtime_class, HALVES_FIELDREF,
+			     HALVES_FIELD_NAMEANDTYPE, HALVES_FIELD_NAME,
+			     VAR_HANDLE_DESCRIPTOR);
+
+	add_methodref_to_pool(c, VAR_HANDLE_CLASS, WORD_GET_METHODREF,
+			      WORD_GET_NAMEANDTYPE, "get",
+			      MEMORY_METHOD_DESCRIPTOR(c, "I)I"));
+	add_methodref_to_pool(c, VAR_HANDLE_CLASS, WORD_SET_METHODREF,
+			      WORD_SET_NAMEANDTYPE, "set",
+			      MEMORY_METHOD_DESCRIPTOR(c, "II)V"));
+	add_methodref_to_pool(c, VAR_HANDLE_CLASS, HALF_GET_METHODREF,
+			      HALF_GET_NAMEANDTYPE, "get",
+			      MEMORY_METHOD_DESCRIPTOR(c, "I)S"));
+	add_methodref_to_pool(c, VAR_HANDLE_CLASS, HALF_SET_METHODREF,
+			      HALF_SET_NAMEANDTYPE, "set",
+			      MEMORY_METHOD_DESCRIPTOR(c, "IS)V"));
+	if (c->doublewords) {
+		add_fieldref_to_pool(c, c->runtime_class, DOUBLEWORDS_FIELDREF,
+				     DOUBLEWORDS_FIELD_NAMEANDTYPE,
+				     DOUBLEWORDS_FIELD_NAME,
+				     VAR_HANDLE_DESCRIPTOR);
+		add_methodref_to_pool(c, VAR_HANDLE_CLASS,
+				      DOUBLEWORD_GET_METHODREF,
+				      DOUBLEWORD_GET_NAMEANDTYPE, "get",
+				      MEMORY_METHOD_DESCRIPTOR(c, "I)J"));
+		add_methodref_to_pool(c, VAR_HANDLE_CLASS,
+				      DOUBLEWORD_SET_METHODREF,
+				      DOUBLEWORD_SET_NAMEANDTYPE, "set",
+				      MEMORY_METHOD_DESCRIPTOR(c, "IJ)V"));
+	}
+	add_methodref_to_pool(c, VAR_HANDLE_CLASS, WORD_GET_VOLATILE_METHODREF,
+			      WORD_GET_VOLATILE_NAMEANDTYPE, "getVolatile",
+			      MEMORY_METHOD_DESCRIPTOR(c, "I)I"));
+	add_methodref_to_pool(c, VAR_HANDLE_CLASS, WORD_CAS_METHODREF,
+			      WORD_CAS_NAMEANDTYPE, "compareAndSet",
+			      MEMORY_METHOD_DESCRIPTOR(c, "III)Z"));
+	for (size_t i = 0; i < AMO_METHOD_COUNT; i++) {
+		for (size_t mode = 0; mode < AMO_MODES; mode++) {
+			struct method_constant *method = &amo_methods[i][mode];
+			add_methodref_to_pool(c, VAR_HANDLE_CLASS,
+					      method->methodref,
+					      method->nameandtype,
+					      method->name,
+					      MEMORY_METHOD_DESCRIPTOR(c,
+								       "II)I"));
+		}
+	}
+	if (mapped(c)) {
+		add_class_to_pool(c, BYTE_BUFFER, BYTE_BUFFER_CLASS);
+		add_methodref_to_pool(c, BYTE_BUFFER_CLASS, BUFFER_GET_METHODREF,
+				      BUFFER_GET_NAMEANDTYPE, "get", "(I)B");
+		add_methodref_to_pool(c, BYTE_BUFFER_CLASS, BUFFER_PUT_METHODREF,
+				      BUFFER_PUT_NAMEANDTYPE, "put",
+				      "(IB)" BYTE_BUFFER_DESCRIPTOR);
+	}
+
+	add_methodref_to_pool(c, MATH_CLASS, MATH_MIN_METHODREF,
+			      MATH_MIN_NAMEANDTYPE, "min",
+			      INT_INT_INT_DESCRIPTOR);
+	add_methodref_to_pool(c, MATH_CLASS, MATH_MAX_METHODREF,
+			      MATH_MAX_NAMEANDTYPE, "max",
+			      INT_INT_INT_DESCRIPTOR);
+	if (add_constant(c, to_number_key(INT32_MIN))) {
+		constant_integer_info(c, INT32_MIN);
+	}
+	for (size_t i = 0; i < AMO_LOOP_COUNT; i++) {
+		add_methodref_to_pool(c, c->runtime_class,
+				      amo_loops[i].method.methodref,
+				      amo_loops[i].method.nameandtype,
+				      amo_loops[i].method.name,
+				      INT_INT_INT_DESCRIPTOR);
+	}
+	add_methodref_to_pool(c, MATH_CLASS, MATH_MULTIPLY_FULL_METHODREF,
+			      MATH_MULTIPLY_FULL_NAMEANDTYPE, "multiplyFull",
+			      "(II)J");
+	add_class_to_pool(c, INTEGER, INTEGER_CLASS);
+	add_methodref_to_pool(c, INTEGER_CLASS, TO_UNSIGNED_LONG_METHODREF,
+			      TO_UNSIGNED_LONG_NAMEANDTYPE, "toUnsignedLong",
+			      "(I)J");
+	add_methodref_to_pool(c, INTEGER_CLASS, DIVIDE_UNSIGNED_METHODREF,
+			      DIVIDE_UNSIGNED_NAMEANDTYPE, "divideUnsigned",
+			      INT_INT_INT_DESCRIPTOR);
+	add_methodref_to_pool(c, INTEGER_CLASS, REMAINDER_UNSIGNED_METHODREF,
+			      REMAINDER_UNSIGNED_NAMEANDTYPE,
+			      "remainderUnsigned", INT_INT_INT_DESCRIPTOR);
+	for (size_t i = 0; i < DIVISION_COUNT; i++) {
+		add_methodref_to_pool(c, c->runtime_class,
+				      divisions[i].method.methodref,
+				      divisions[i].method.nameandtype,
+				      divisions[i].method.name,
+				      INT_INT_INT_DESCRIPTOR);
+	}
+	add_methodref_to_pool(c, c->runtime_class, LR_METHODREF,
+			      LR_METHOD_NAMEANDTYPE, LR_METHOD_NAME,
+			      LR_METHOD_DESCRIPTOR);
+	add_methodref_to_pool(c, c->runtime_class, SC_METHODREF,
+			      SC_METHOD_NAMEANDTYPE, SC_METHOD_NAME,
+			      SC_METHOD_DESCRIPTOR);
+	for (size_t i = 0; i < MEMORY_HELPER_COUNT; i++) {
+		if (c->outlined[i]) {
+			add_methodref_to_pool(c, c->runtime_class,
+					      memory_helpers[i].method.methodref,
+					      memory_helpers[i].method.nameandtype,
+					      memory_helpers[i].method.name,
+					      memory_helpers[i].descriptor);
+		}
+	}
+}
+
+/*
+ * The counters of an instrumented program and what main writes them to
+ * the profile file with.
+ */
+static void profile_constant_pool(struct codegen *c)
+{
+	add_fieldref_to_pool(c, THIS_CLASS, PROFILE_FIELDREF,
+			     PROFILE_FIELD_NAMEANDTYPE, PROFILE_FIELD_NAME,
+			     LONG_ARRAY_DESCRIPTOR);
+	add_string_to_pool(c, c->options->profile_generate, PROFILE_PATH);
+	if (!mapped(c)) {
+		// memory_constant_pool() added it for mapped memory
+		add_class_to_pool(c, BYTE_BUFFER, BYTE_BUFFER_CLASS);
+	}
+	add_class_to_pool(c, LONG_BUFFER, LONG_BUFFER_CLASS);
+	add_class_to_pool(c, PATHS, PATHS_CLASS);
+	add_class_to_pool(c, FILES, FILES_CLASS);
+	add_class_to_pool(c, OPEN_OPTION, OPEN_OPTION_CLASS);
+	add_methodref_to_pool(c, BYTE_BUFFER_CLASS, ALLOCATE_METHODREF,
+			      ALLOCATE_NAMEANDTYPE, "allocate",
+			      "(I)L" BYTE_BUFFER ";");
+	add_methodref_to_pool(c, BYTE_BUFFER_CLASS, AS_LONG_BUFFER_METHODREF,
+			      AS_LONG_BUFFER_NAMEANDTYPE, "asLongBuffer",
+			      "()L" LONG_BUFFER ";");
+	add_methodref_to_pool(c, BYTE_BUFFER_CLASS, ARRAY_METHODREF,
+			      ARRAY_NAMEANDTYPE, "array", "()[B");
+	add_methodref_to_pool(c, LONG_BUFFER_CLASS, PUT_METHODREF,
+			      PUT_NAMEANDTYPE, "put", "([J)L" LONG_BUFFER ";");
+	add_methodref_to_pool(c, PATHS_CLASS, PATHS_GET_METHODREF,
+			      PATHS_GET_NAMEANDTYPE, "get",
+			      "(L" STRING_CLASS_NAME ";[L" STRING_CLASS_NAME
+			      ";)Ljava/nio/file/Path;");
+	add_methodref_to_pool(c, FILES_CLASS, FILES_WRITE_METHODREF,
+			      FILES_WRITE_NAMEANDTYPE, "write",
+			      "(Ljava/nio/file/Path;[B[L" OPEN_OPTION
+			      ";)Ljava/nio/file/Path;");
+}
+
+/*
+ * What clinit opens and maps the memory file with and, for the data, what
+ * copies a chunk into the buffer. Paths.get and OpenOption are shared with
+ * profile_constant_pool().
+ */
+static void mapped_memory_constant_pool(struct codegen *c)
+{
+	add_string_to_pool(c, c->options->memory_file, MEMORY_PATH);
+	if (!instrumented(c)) {
+		add_class_to_pool(c, PATHS, PATHS_CLASS);
+		add_class_to_pool(c, OPEN_OPTION, OPEN_OPTION_CLASS);
+		add_methodref_to_pool(c, PATHS_CLASS, PATHS_GET_METHODREF,
+				      PATHS_GET_NAMEANDTYPE, "get",
+				      "(L" STRING_CLASS_NAME ";[L"
+				      STRING_CLASS_NAME ";)Ljava/nio/file/Path;");
+	}
+	add_class_to_pool(c, FILE_CHANNEL, FILE_CHANNEL_CLASS);
+	add_class_to_pool(c, MAP_MODE, MAP_MODE_CLASS);
+	add_class_to_pool(c, STANDARD_OPEN_OPTION, STANDARD_OPEN_OPTION_CLASS);
+	add_fieldref_to_pool(c, STANDARD_OPEN_OPTION_CLASS, OPEN_READ_FIELDREF,
+			     OPEN_READ_NAMEANDTYPE, "READ",
+			     STANDARD_OPEN_OPTION_DESCRIPTOR);
+	add_fieldref_to_pool(c, STANDARD_OPEN_OPTION_CLASS, OPEN_WRITE_FIELDREF,
+			     OPEN_WRITE_NAMEANDTYPE, "WRITE",
+			     STANDARD_OPEN_OPTION_DESCRIPTOR);
+	add_fieldref_to_pool(c, STANDARD_OPEN_OPTION_CLASS, OPEN_CREATE_FIELDREF,
+			     OPEN_CREATE_NAMEANDTYPE, "CREATE",
+			     STANDARD_OPEN_OPTION_DESCRIPTOR);
+	add_fieldref_to_pool(c, MAP_MODE_CLASS, MAP_MODE_FIELDREF,
+			     MAP_MODE_NAMEANDTYPE,
+			     c->options->share_memory_file ? "READ_WRITE"
+							   : "PRIVATE",
+			     "L" MAP_MODE ";");
+	add_methodref_to_pool(c, FILE_CHANNEL_CLASS, FILE_CHANNEL_OPEN_METHODREF,
+			      FILE_CHANNEL_OPEN_NAMEANDTYPE, "open",
+			      "(Ljava/nio/file/Path;[L" OPEN_OPTION ";)L"
+			      FILE_CHANNEL ";");
+	add_methodref_to_pool(c, FILE_CHANNEL_CLASS, FILE_CHANNEL_SIZE_METHODREF,
+			      FILE_CHANNEL_SIZE_NAMEANDTYPE, "size", "()J");
+	add_methodref_to_pool(c, FILE_CHANNEL_CLASS, FILE_CHANNEL_MAP_METHODREF,
+			      FILE_CHANNEL_MAP_NAMEANDTYPE, "map",
+			      "(L" MAP_MODE ";JJ)Ljava/nio/MappedByteBuffer;");
+	add_methodref_to_pool(c, FILE_CHANNEL_CLASS, FILE_CHANNEL_CLOSE_METHODREF,
+			      FILE_CHANNEL_CLOSE_NAMEANDTYPE, "close",
+			      NO_ARGS_VOID_DESCRIPTOR);
+	add_methodref_to_pool(c, MATH_CLASS, MATH_MAX_LONG_METHODREF,
+			      MATH_MAX_LONG_NAMEANDTYPE, "max", "(JJ)J");
+	add_methodref_to_pool(c, BYTE_BUFFER_CLASS, BUFFER_POSITION_METHODREF,
+			      BUFFER_POSITION_NAMEANDTYPE, "position",
+			      "(I)" BYTE_BUFFER_DESCRIPTOR);
+	add_methodref_to_pool(c, BYTE_BUFFER_CLASS, BUFFER_PUT_ARRAY_METHODREF,
+			      BUFFER_PUT_ARRAY_NAMEANDTYPE, "put",
+			      "([B)" BYTE_BUFFER_DESCRIPTOR);
+}
+
+/*
+ * What snap$ writes a snapshot with and resume$ reads it back with, and
+ * where resume$ leaves it for hart. Paths.get, Files and OpenOption are
+ * shared with profile_constant_pool().
+ */
+static void snapshot_constant_pool(struct codegen *c)
+{
+	add_string_to_pool(c, c->options->snapshot, SNAPSHOT_PATH);
+	add_methodref_to_pool(c, THIS_CLASS, SNAP_METHODREF,
+			      SNAP_METHOD_NAMEANDTYPE, SNAP_METHOD_NAME,
+			      SNAP_METHOD_DESCRIPTOR);
+	add_methodref_to_pool(c, THIS_CLASS, RESUME_METHODREF,
+			      RESUME_METHOD_NAMEANDTYPE, RESUME_METHOD_NAME,
+			      RESUME_METHOD_DESCRIPTOR);
+	add_fieldref_to_pool(c, THIS_CLASS, RESUME_BLOCK_FIELDREF,
+			     RESUME_BLOCK_NAMEANDTYPE, RESUME_BLOCK_FIELD_NAME,
+			     "I");
+	add_fieldref_to_pool(c, THIS_CLASS, RESUME_REGISTERS_FIELDREF,
+			     RESUME_REGISTERS_NAMEANDTYPE,
+			     RESUME_REGISTERS_FIELD_NAME, LONG_ARRAY_DESCRIPTOR);
+	if (!instrumented(c)) {
+		add_class_to_pool(c, PATHS, PATHS_CLASS);
+		add_class_to_pool(c, FILES, FILES_CLASS);
+		add_class_to_pool(c, OPEN_OPTION, OPEN_OPTION_CLASS);
+		add_methodref_to_pool(c, PATHS_CLASS, PATHS_GET_METHODREF,
+				      PATHS_GET_NAMEANDTYPE, "get",
+				      "(L" STRING_CLASS_NAME ";[L"
+				      STRING_CLASS_NAME ";)Ljava/nio/file/Path;");
+	}
+	add_class_to_pool(c, BYTE_ARRAY_DESCRIPTOR, BYTE_ARRAY_CLASS);
+	add_class_to_pool(c, DATA_OUTPUT_STREAM, DATA_OUTPUT_STREAM_CLASS);
+	add_class_to_pool(c, DATA_INPUT_STREAM, DATA_INPUT_STREAM_CLASS);
+	add_class_to_pool(c, BUFFERED_OUTPUT_STREAM,
+			  BUFFERED_OUTPUT_STREAM_CLASS);
+	add_class_to_pool(c, BUFFERED_INPUT_STREAM, BUFFERED_INPUT_STREAM_CLASS);
+	add_class_to_pool(c, ARRAYS, ARRAYS_CLASS);
+	add_class_to_pool(c, SYSTEM, SYSTEM_CLASS);
+	add_class_to_pool(c, ILLEGAL_ARGUMENT, ILLEGAL_ARGUMENT_CLASS);
+	add_methodref_to_pool(c, FILES_CLASS, FILES_NEW_OUTPUT_STREAM_METHODREF,
+			      FILES_NEW_OUTPUT_STREAM_NAMEANDTYPE,
+			      "newOutputStream",
+			      "(Ljava/nio/file/Path;[L" OPEN_OPTION ";)"
+			      OUTPUT_STREAM_DESCRIPTOR);
+	add_methodref_to_pool(c, FILES_CLASS, FILES_NEW_INPUT_STREAM_METHODREF,
+			      FILES_NEW_INPUT_STREAM_NAMEANDTYPE,
+			      "newInputStream",
+			      "(Ljava/nio/file/Path;[L" OPEN_OPTION ";)"
+			      INPUT_STREAM_DESCRIPTOR);
+	add_methodref_to_pool(c, DATA_OUTPUT_STREAM_CLASS,
+			      DATA_OUTPUT_INIT_METHODREF,
+			      DATA_OUTPUT_INIT_NAMEANDTYPE, INIT_METHOD_NAME,
+			      "(" OUTPUT_STREAM_DESCRIPTOR ")V");
+	add_methodref_to_pool(c, BUFFERED_OUTPUT_STREAM_CLASS,
+			      BUFFERED_OUTPUT_INIT_METHODREF,
+			      BUFFERED_OUTPUT_INIT_NAMEANDTYPE, INIT_METHOD_NAME,
+			      "(" OUTPUT_STREAM_DESCRIPTOR ")V");
+	add_methodref_to_pool(c, DATA_INPUT_STREAM_CLASS,
+			      DATA_INPUT_INIT_METHODREF,
+			      DATA_INPUT_INIT_NAMEANDTYPE, INIT_METHOD_NAME,
+			      "(" INPUT_STREAM_DESCRIPTOR ")V");
+	add_methodref_to_pool(c, BUFFERED_INPUT_STREAM_CLASS,
+			      BUFFERED_INPUT_INIT_METHODREF,
+			      BUFFERED_INPUT_INIT_NAMEANDTYPE, INIT_METHOD_NAME,
+			      "(" INPUT_STREAM_DESCRIPTOR ")V");
+	add_methodref_to_pool(c, DATA_OUTPUT_STREAM_CLASS, WRITE_INT_METHODREF,
+			      WRITE_INT_NAMEANDTYPE, "writeInt", "(I)V");
+	add_methodref_to_pool(c, DATA_OUTPUT_STREAM_CLASS, WRITE_LONG_METHODREF,
+			      WRITE_LONG_NAMEANDTYPE, "writeLong", "(J)V");
+	add_methodref_to_pool(c, DATA_OUTPUT_STREAM_CLASS, WRITE_BYTES_METHODREF,
+			      WRITE_BYTES_NAMEANDTYPE, "write", "([BII)V");
+	add_methodref_to_pool(c, DATA_OUTPUT_STREAM_CLASS, OUTPUT_CLOSE_METHODREF,
+			      OUTPUT_CLOSE_NAMEANDTYPE, "close",
+			      NO_ARGS_VOID_DESCRIPTOR);
+	add_methodref_to_pool(c, DATA_INPUT_STREAM_CLASS, READ_INT_METHODREF,
+			      READ_INT_NAMEANDTYPE, "readInt", "()I");
+	add_methodref_to_pool(c, DATA_INPUT_STREAM_CLASS, READ_LONG_METHODREF,
+			      READ_LONG_NAMEANDTYPE, "readLong", "()J");
+	add_methodref_to_pool(c, DATA_INPUT_STREAM_CLASS, READ_FULLY_METHODREF,
+			      READ_FULLY_NAMEANDTYPE, "readFully", "([BII)V");
+	add_methodref_to_pool(c, DATA_INPUT_STREAM_CLASS, INPUT_CLOSE_METHODREF,
+			      INPUT_CLOSE_NAMEANDTYPE, "close",
+			      NO_ARGS_VOID_DESCRIPTOR);
+	add_methodref_to_pool(c, ARRAYS_CLASS, ARRAYS_EQUALS_METHODREF,
+			      ARRAYS_EQUALS_NAMEANDTYPE, "equals",
+			      "([BII[BII)Z");
+	add_methodref_to_pool(c, SYSTEM_CLASS, ARRAYCOPY_METHODREF,
+			      ARRAYCOPY_NAMEANDTYPE, "arraycopy",
+			      "(Ljava/lang/Object;ILjava/lang/Object;II)V");
+	add_methodref_to_pool(c, ILLEGAL_ARGUMENT_CLASS,
+			      ILLEGAL_ARGUMENT_INIT_METHODREF,
+			      ILLEGAL_ARGUMENT_INIT_NAMEANDTYPE, INIT_METHOD_NAME,
+			      "(L" STRING_CLASS_NAME ";)V");
+}
+
+static void data_constant_pool(struct codegen *c)
+{
+	add_methodref_to_pool(c, STRING_CLASS, GET_BYTES_METHODREF,
+			      GET_BYTES_NAMEANDTYPE, "getBytes", "(II[BI)V");
+	for (size_t i = 0; i < c->data_chunks.size; i++) {
+		struct data_chunk *chunk = &c->data_chunks.items[i];
+		add_constant(c, to_string_key(chunk->utf8_key));
+		constant_utf8_info(c, strlen(chunk->utf8), chunk->utf8);
+		constant_string_info(c, c->constant_map->size);
+		add_constant(c, to_string_key(chunk->string_key));
+	}
+}
+
+static void guest_constant_pool(struct codegen *c)
+{
+	uint32_t address = c->base_address;
+	for (size_t i = 0; c->ir[i].type != IR_EOF; i++) {
+		switch (c->ir[i].type) {
+		case IR_INSTRUCTION:
+			load_constant_from_instruction_at(c, i, address);
+			address += INSTRUCTION_SIZE;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/*
+ * The classes of the files and the entry points hart calls in them, the
+ * run$ of the first file with code when harts start at no label.
+ */
+static void units_constant_pool(struct codegen *c)
+{
+	struct separate_program *program = c->program;
+	for (size_t u = 0; u < program->units_n; u++) {
+		snprintf(c->unit_class_keys[u], sizeof(c->unit_class_keys[u]),
+			 "unit$class$%zu", u);
+		add_class_to_pool(c, program->units[u].class_name,
+				  c->unit_class_keys[u]);
+	}
+	for (size_t id = 0; id < entry_ids(program); id++) {
+		struct entry_keys *keys = &c->entry_keys[id];
+		snprintf(keys->nameandtype, sizeof(keys->nameandtype),
+			 "entry$nameandtype$%zu", id);
+		snprintf(keys->methodref, sizeof(keys->methodref), "entry$%zu",
+			 id);
+		if (id < program->entries_n) {
+			struct entry_point *entry = &program->entries[id];
+			add_methodref_to_pool(c, c->unit_class_keys[entry->unit],
+					      keys->methodref, keys->nameandtype,
+					      entry->label,
+					      ENTRY_METHOD_DESCRIPTOR);
+		} else {
+			add_methodref_to_pool(c,
+					      c->unit_class_keys[program->start_unit],
+					      keys->methodref, keys->nameandtype,
+					      UNIT_METHOD_NAME,
+					      COLD_METHOD_DESCRIPTOR);
+		}
+	}
+}
+
 static void constant_pool(struct codegen *c)
 {
-	size_t pool_size_idx = c->res->size;
-	write_int(c, 0, 2);
+	size_t pool_size_idx = emit_placeholder_u16(c->res);
 
 	add_class_to_pool(c, SUPER_CLASS_NAME, SUPER_CLASS);
-	add_class_to_pool(c, THIS_CLASS_NAME, THIS_CLASS);
+	add_class_to_pool(c, c->options->class_name != NULL
+			     ? c->options->class_name : DEFAULT_CLASS_NAME,
+			     THIS_CLASS);
 	add_class_to_pool(c, THREAD_LOCAL, THREAD_LOCAL_CLASS);
 	add_class_to_pool(c, LONG_ARRAY_DESCRIPTOR, LONG_ARRAY_CLASS);
 	add_class_to_pool(c, STRING_ARRAY_DESCRIPTOR, STRING_ARRAY_CLASS);
@@ -544,43 +1815,142 @@ static void constant_pool(struct codegen *c)
 	add_fieldref_to_pool(c, THIS_CLASS, REGISTERS_FIELDREF,
 			     REGISTERS_FIELD_NAMEANDTYPE, REGISTERS_FIELD_NAME,
 			     REGISTERS_FIELD_DESCRIPTOR);
-	add_fieldref_to_pool(c, THIS_CLASS, MEMORY_FIELDREF, 
+	add_fieldref_to_pool(c, THIS_CLASS, MEMORY_FIELDREF,
 			     MEMORY_FIELD_NAMEANDTYPE, MEMORY_FIELD_NAME,
-		     	     LONG_ARRAY_DESCRIPTOR);
+			     memory_descriptor(c));
 
-	for (size_t i = 0; c->ir[i].type != IR_EOF; i++) {
-		switch (c->ir[i].type) {
-		case IR_INSTRUCTION:
-			load_constant_from_instruction_at(c, i);
-			break;
-		default:
-			break;
-		}
+	add_class_to_pool(c, RUNNABLE_CLASS_NAME, RUNNABLE_CLASS);
+	add_class_to_pool(c, THREAD_CLASS_NAME, THREAD_CLASS);
+	add_class_to_pool(c, VAR_HANDLE_CLASS_NAME, VAR_HANDLE_CLASS);
+	add_utf8_to_pool(c, RUN_METHOD_NAME);
+	add_fieldref_to_pool(c, THIS_CLASS, HARTID_FIELDREF,
+			     HARTID_FIELD_NAMEANDTYPE, HARTID_FIELD_NAME,
+			     HARTID_FIELD_DESCRIPTOR);
+	add_methodref_to_pool(c, THIS_CLASS, HART_METHODREF,
+			      HART_METHOD_NAMEANDTYPE, HART_METHOD_NAME,
+			      INT_ARG_VOID_DESCRIPTOR);
+	add_methodref_to_pool(c, THIS_CLASS, THIS_INIT_METHODREF,
+			      THIS_INIT_METHOD_NAMEANDTYPE, INIT_METHOD_NAME,
+			      INT_ARG_VOID_DESCRIPTOR);
+	add_methodref_to_pool(c, SUPER_CLASS, OBJECT_INIT_METHODREF,
+			      OBJECT_INIT_METHOD_NAMEANDTYPE, INIT_METHOD_NAME,
+			      NO_ARGS_VOID_DESCRIPTOR);
+	add_methodref_to_pool(c, THREAD_CLASS, THREAD_INIT_METHODREF,
+			      THREAD_INIT_METHOD_NAMEANDTYPE, INIT_METHOD_NAME,
+			      THREAD_INIT_METHOD_DESCRIPTOR);
+	add_methodref_to_pool(c, THREAD_CLASS, THREAD_START_METHODREF,
+			      THREAD_START_METHOD_NAMEANDTYPE,
+			      THREAD_START_METHOD_NAME, NO_ARGS_VOID_DESCRIPTOR);
+	add_methodref_to_pool(c, THREAD_CLASS, THREAD_JOIN_METHODREF,
+			      THREAD_JOIN_METHOD_NAMEANDTYPE,
+			      THREAD_JOIN_METHOD_NAME, NO_ARGS_VOID_DESCRIPTOR);
+	for (size_t i = 0; i < FENCE_KINDS; i++) {
+		add_methodref_to_pool(c, VAR_HANDLE_CLASS,
+				      fence_methods[i].methodref,
+				      fence_methods[i].nameandtype,
+				      fence_methods[i].name,
+				      NO_ARGS_VOID_DESCRIPTOR);
 	}
+	memory_constant_pool(c);
+	if (instrumented(c) || mapped(c) || snapshots(c) ||
+	    c->data_chunks.size > 0) {
+		add_class_to_pool(c, STRING_CLASS_NAME, STRING_CLASS);
+	}
+	if (instrumented(c)) {
+		profile_constant_pool(c);
+	}
+	if (mapped(c)) {
+		mapped_memory_constant_pool(c);
+	}
+	if (snapshots(c)) {
+		snapshot_constant_pool(c);
+	}
+	if (c->data_chunks.size > 0) {
+		data_constant_pool(c);
+	}
+	if (has_cold_blocks(c)) {
+		add_methodref_to_pool(c, THIS_CLASS, COLD_METHODREF,
+				      COLD_METHOD_NAMEANDTYPE,
+				      COLD_METHOD_NAME, COLD_METHOD_DESCRIPTOR);
+	}
+	if (c->program != NULL) {
+		units_constant_pool(c);
+	}
+	guest_constant_pool(c);
 
-	overwrite_bytes(c->res, pool_size_idx, c->constant_map->size + 1, 2);
+	patch_u16(c->res, pool_size_idx, c->constant_map->size + 1);
+	if (c->stats != NULL) {
+		c->stats->codegen.constant_pool_entries = c->constant_map->size;
+	}
+}
+
+/*
+ * A file of a separately compiled program refers to memory and the helpers
+ * in the runtime class and to its own run$ from the stubs.
+ */
+static void unit_constant_pool(struct codegen *c)
+{
+	size_t pool_size_idx = emit_placeholder_u16(c->res);
+	struct separate_program *program = c->program;
+
+	add_class_to_pool(c, SUPER_CLASS_NAME, SUPER_CLASS);
+	add_class_to_pool(c, program->units[c->unit].class_name, THIS_CLASS);
+	add_class_to_pool(c, program->runtime_class, RUNTIME_CLASS);
+	add_utf8_to_pool(c, CODE);
+	add_utf8_to_pool(c, STACK_MAP_TABLE);
+	add_fieldref_to_pool(c, RUNTIME_CLASS, MEMORY_FIELDREF,
+			     MEMORY_FIELD_NAMEANDTYPE, MEMORY_FIELD_NAME,
+			     memory_descriptor(c));
+	add_class_to_pool(c, VAR_HANDLE_CLASS_NAME, VAR_HANDLE_CLASS);
+	for (size_t i = 0; i < FENCE_KINDS; i++) {
+		add_methodref_to_pool(c, VAR_HANDLE_CLASS,
+				      fence_methods[i].methodref,
+				      fence_methods[i].nameandtype,
+				      fence_methods[i].name,
+				      NO_ARGS_VOID_DESCRIPTOR);
+	}
+	memory_constant_pool(c);
+	add_methodref_to_pool(c, THIS_CLASS, UNIT_METHODREF,
+			      UNIT_METHOD_NAMEANDTYPE, UNIT_METHOD_NAME,
+			      COLD_METHOD_DESCRIPTOR);
+	add_utf8_to_pool(c, ENTRY_METHOD_DESCRIPTOR);
+	for (size_t i = 0; i < program->entries_n; i++) {
+		if (program->entries[i].unit == c->unit) {
+			add_utf8_to_pool(c, program->entries[i].label);
+		}
+	}
+	guest_constant_pool(c);
+
+	patch_u16(c->res, pool_size_idx, c->constant_map->size + 1);
+	if (c->stats != NULL) {
+		c->stats->codegen.constant_pool_entries += c->constant_map->size;
+	}
 }
 
 static void access_flags(struct codegen *c)
 {
-	write_int(c, JVM_ACC_PUBLIC | JVM_ACC_SYNTHETIC, 2);
+	emit_u16(c->res, JVM_ACC_PUBLIC | JVM_ACC_SYNTHETIC);
 }
 
 static void this_class(struct codegen *c)
 {
 	uint16_t idx = get_constant_index(c, to_string_key(THIS_CLASS));
-	write_int(c, idx, 2);
+	emit_u16(c->res, idx);
 }
 
 static void super_class(struct codegen *c)
 {
 	uint16_t idx = get_constant_index(c, to_string_key(SUPER_CLASS));
-	write_int(c, idx, 2);
+	emit_u16(c->res, idx);
 }
 
+/*
+ * The class is the Runnable of the threads main starts for the harts.
+ */
 static void interfaces(struct codegen *c)
 {
-	write_int(c, 0, 2);
+	emit_u16(c->res, 1);
+	emit_u16(c->res, get_constant_index(c, to_string_key(RUNNABLE_CLASS)));
 }
 
 static void add_field(struct codegen *c, uint16_t access_mask, char *name,
@@ -589,80 +1959,155 @@ static void add_field(struct codegen *c, uint16_t access_mask, char *name,
 
 	uint16_t name_idx = get_constant_index(c, to_string_key(name));
 	uint16_t descriptor_idx = get_constant_index(c, to_string_key(descriptor));
-	write_int(c, access_mask, 2);
-	write_int(c, name_idx, 2);
-	write_int(c, descriptor_idx, 2);
+	emit_u16(c->res, access_mask);
+	emit_u16(c->res, name_idx);
+	emit_u16(c->res, descriptor_idx);
 
 	if (signature != NULL) {
-		write_int(c, 1, 2);
+		emit_u16(c->res, 1);
 		uint16_t idx = get_constant_index(c, to_string_key(SIGNATURE));
-		write_int(c, idx, 2);
-		write_int(c, 2, 4);
+		emit_u16(c->res, idx);
+		emit_u32(c->res, 2);
 		idx = get_constant_index(c, to_string_key(REGISTERS_FIELD_SIGNATURE));
-		write_int(c, idx, 2);
+		emit_u16(c->res, idx);
 	} else {
-		write_int(c, 0, 2);
+		emit_u16(c->res, 0);
 	}
 }
 
 static void fields(struct codegen *c)
 {
-	write_int(c, 2, 2);
+	emit_u16(c->res, 5 + c->doublewords + instrumented(c) +
+			 2 * snapshots(c));
 
-	uint16_t mask = JVM_ACC_PRIVATE | JVM_ACC_FINAL | JVM_ACC_STATIC
+	uint16_t mask = shared_access(c) | JVM_ACC_FINAL | JVM_ACC_STATIC
 			| JVM_ACC_SYNTHETIC;
 	add_field(c, mask, REGISTERS_FIELD_NAME, REGISTERS_FIELD_DESCRIPTOR,
 		  REGISTERS_FIELD_SIGNATURE);
-	add_field(c, mask, MEMORY_FIELD_NAME, LONG_ARRAY_DESCRIPTOR, NULL);
+	add_field(c, mask, MEMORY_FIELD_NAME, memory_descriptor(c), NULL);
+	add_field(c, mask, WORDS_FIELD_NAME, VAR_HANDLE_DESCRIPTOR, NULL);
+	add_field(c, mask, HALVES_FIELD_NAME, VAR_HANDLE_DESCRIPTOR, NULL);
+	if (c->doublewords) {
+		add_field(c, mask, DOUBLEWORDS_FIELD_NAME,
+			  VAR_HANDLE_DESCRIPTOR, NULL);
+	}
+	add_field(c, JVM_ACC_PRIVATE | JVM_ACC_FINAL | JVM_ACC_SYNTHETIC,
+		  HARTID_FIELD_NAME, HARTID_FIELD_DESCRIPTOR, NULL);
+	if (instrumented(c)) {
+		add_field(c, mask, PROFILE_FIELD_NAME, LONG_ARRAY_DESCRIPTOR,
+			  NULL);
+	}
+	if (snapshots(c)) {
+		// set by resume$ before hart runs
+		uint16_t resume_mask = JVM_ACC_PRIVATE | JVM_ACC_STATIC |
+				       JVM_ACC_SYNTHETIC;
+		add_field(c, resume_mask, RESUME_BLOCK_FIELD_NAME, "I", NULL);
+		add_field(c, resume_mask, RESUME_REGISTERS_FIELD_NAME,
+			  LONG_ARRAY_DESCRIPTOR, NULL);
+	}
 }
 
+static int compare_stack_map_frames(const void *a, const void *b)
+{
+	uint32_t left = ((const struct stack_map_frame*)a)->target_offset;
+	uint32_t right = ((const struct stack_map_frame*)b)->target_offset;
+	return (left > right) - (left < right);
+}
+
+/*
+ * Frames are added in code order except for the ones of labels, which come
+ * when the jumps to them are patched, so the list is mostly sorted.
+ */
 static void sort_stack_map_frames(struct stack_map_frames *stack_map_frames)
 {
-	bool swapped;
 	struct stack_map_frame *frames = stack_map_frames->items;
-	do {
-		swapped = false;
-		for (size_t i = 1; i < stack_map_frames->size; i++) {
-			if (frames[i - 1].target_offset > frames[i].target_offset) {
-				struct stack_map_frame tmp = frames[i - 1];
-				frames[i - 1] = frames[i];
-				frames[i] = tmp;
-				swapped = true;
-			}
+	for (size_t i = 1; i < stack_map_frames->size; i++) {
+		if (frames[i - 1].target_offset > frames[i].target_offset) {
+			qsort(frames, stack_map_frames->size, sizeof(*frames),
+			      compare_stack_map_frames);
+			return;
 		}
-	} while (swapped);
+	}
 }
 
+/*
+ * Labels and the code after jumps can ask for a frame at the same offset,
+ * keep one.
+ */
+static void remove_duplicate_frames(struct stack_map_frames *stack_map_frames)
+{
+	size_t size = 0;
+	for (size_t i = 0; i < stack_map_frames->size; i++) {
+		if (size > 0 && stack_map_frames->items[size - 1].target_offset ==
+				stack_map_frames->items[i].target_offset) {
+			continue;
+		}
+		stack_map_frames->items[size++] = stack_map_frames->items[i];
+	}
+	stack_map_frames->size = size;
+}
+
+static uint32_t add_frame_locals(struct codegen *c, struct local *locals,
+				 size_t size)
+{
+	uint32_t length = 0;
+	for (size_t i = 0; i < size; i++) {
+		emit_u8(c->res, locals[i].tag);
+		length += 1;
+		if (locals[i].tag == JVM_ITEM_OBJECT) {
+			emit_u16(c->res, locals[i].constant_pool_index);
+			length += 2;
+		}
+	}
+	return length;
+}
+
+/*
+ * The first frame appends the locals of the method body to its parameters,
+ * or lists them all in a full frame when there are too many to append. The
+ * ones after it have the same locals and an empty stack.
+ */
 static uint32_t add_stack_table_attribute_entries(struct codegen *c,
-						  struct stack_map_frames *stack_map_frames)
+						  struct code *code)
 {
+	struct stack_map_frames *stack_map_frames = code->stack_map_frames;
 	uint32_t attribute_length = 2;
-	sort_stack_map_frames(stack_map_frames);
-	uint16_t previous_offset_deltas = 0;
+	uint32_t previous_offset_deltas = 0;
 	for (size_t i = 0; i < stack_map_frames->size; i++) {
 		struct stack_map_frame frame = stack_map_frames->items[i];
 		attribute_length += 1;
-		uint16_t offset_delta;
+		uint32_t offset_delta;
 		uint8_t frame_type;
-		if (i != 0) {
+		if (i != 0 || code->frame_locals_size == 0) {
 			offset_delta = frame.target_offset - previous_offset_deltas - i;
 			frame_type = JVM_SAME_FRAME_EXTENDED;
-			write(c, frame_type);
-			write_int(c, offset_delta, 2);
+			emit_u8(c->res, frame_type);
+			emit_u16(c->res, offset_delta);
+			attribute_length += 2;
+		} else if (code->frame_locals_size <= APPEND_FRAME_LOCALS_MAX) {
+			offset_delta = frame.target_offset;
+			frame_type = JVM_SAME_FRAME_EXTENDED +
+				     code->frame_locals_size;
+			emit_u8(c->res, frame_type);
+			emit_u16(c->res, offset_delta);
 			attribute_length += 2;
+			attribute_length += add_frame_locals(c,
+				code->frame_locals, code->frame_locals_size);
 		} else {
 			offset_delta = frame.target_offset;
-			frame_type = 251 + 2;
-			frame.locals[0].tag = JVM_ITEM_OBJECT;
-			frame.locals[0].constant_pool_index =
-				get_constant_index(c, to_string_key(LONG_ARRAY_CLASS));
-			frame.locals[1].tag = JVM_ITEM_LONG;
-			write(c, frame_type);
-			write_int(c, offset_delta, 2);
-			write(c, frame.locals[0].tag);
-			write_int(c, frame.locals[0].constant_pool_index, 2);
-			write(c, frame.locals[1].tag);
-			attribute_length += 2 + 1 + 2 + 1;
+			emit_u8(c->res, JVM_FULL_FRAME);
+			emit_u16(c->res, offset_delta);
+			emit_u16(c->res, code->frame_parameters_size +
+					 code->frame_locals_size);
+			attribute_length += 4;
+			attribute_length += add_frame_locals(c,
+				code->frame_parameters,
+				code->frame_parameters_size);
+			attribute_length += add_frame_locals(c,
+				code->frame_locals, code->frame_locals_size);
+			// no stack items
+			emit_u16(c->res, 0);
+			attribute_length += 2;
 		}
 
 		previous_offset_deltas += offset_delta;
@@ -671,115 +2116,323 @@ static uint32_t add_stack_table_attribute_entries(struct codegen *c,
 }
 
 static uint32_t add_stack_table_attribute(struct codegen *c,
-					  struct stack_map_frames *stack_map_frames)
+					  struct code *code)
 {
 	uint16_t idx = get_constant_index(c, to_string_key(STACK_MAP_TABLE));
-	write_int(c, idx, 2);
-	uint16_t attribute_length_idx = c->res->size;
-	write_int(c, 0, 4);
-	write_int(c, stack_map_frames->size, 2);
+	emit_u16(c->res, idx);
+	size_t attribute_length_idx = emit_placeholder_u32(c->res);
+	emit_u16(c->res, code->stack_map_frames->size);
 	uint32_t attribute_length =
-		add_stack_table_attribute_entries(c, stack_map_frames);
-	overwrite_bytes(c->res, attribute_length_idx, attribute_length, 4);
+		add_stack_table_attribute_entries(c, code);
+	patch_u32(c->res, attribute_length_idx, attribute_length);
 	return attribute_length + 6;
 }
 
 static void add_code_attribute(struct codegen *c, struct code *code)
 {
+	sort_stack_map_frames(code->stack_map_frames);
+	remove_duplicate_frames(code->stack_map_frames);
+
+	// name, length, limits, code, exception table and attribute count
+	size_t size = 2 + 4 + 2 + 2 + 4 + code->code->size + 2 + 2;
+	if (code->stack_map_frames->size > 0) {
+		size += STACK_MAP_TABLE_HEADER_SIZE +
+			code->stack_map_frames->size * STACK_MAP_FRAME_MAX_SIZE;
+	}
+	emit_reserve(c->res, size);
+
 	uint16_t idx = get_constant_index(c, to_string_key(CODE));
-	write_int(c, idx, 2);
-	uint16_t attribute_length_idx = c->res->size;
-	write_int(c, 0, 4);
-	write_int(c, code->max_stack, 2);
-	write_int(c, code->max_locals, 2);
-	write_int(c, code->code->size, 4);
-	for (size_t i = 0; i < code->code->size; i++) {
-		write(c, code->code->items[i]);
-	}
-	write_int(c, code->exception_table_length, 2);
+	emit_u16(c->res, idx);
+	size_t attribute_length_idx = emit_placeholder_u32(c->res);
+	emit_u16(c->res, code->max_stack);
+	emit_u16(c->res, code->max_locals);
+	emit_u32(c->res, code->code->size);
+	emit_bytes(c->res, code->code->items, code->code->size);
+	emit_u16(c->res, code->exception_table_length);
 	if (code->stack_map_frames->size > 0) {
 		code->attributes_count += 1;
 	}
-	write_int(c, code->attributes_count, 2);
+	emit_u16(c->res, code->attributes_count);
 	uint32_t attribute_length = code->code->size + 12;
 	if (code->stack_map_frames->size > 0) {
 		attribute_length +=
-			add_stack_table_attribute(c, code->stack_map_frames);
+			add_stack_table_attribute(c, code);
 	}
-	overwrite_bytes(c->res, attribute_length_idx, attribute_length, 4);
+	patch_u32(c->res, attribute_length_idx, attribute_length);
 }
 
 static void add_method(struct codegen *c, uint16_t mask, char *name,
 		       char *descriptor, struct code *code)
 {
-	write_int(c, mask, 2);
+	emit_u16(c->res, mask);
 	uint16_t name_index = get_constant_index(c, to_string_key(name));
-	write_int(c, name_index, 2);
+	emit_u16(c->res, name_index);
 	uint16_t descriptor_index = get_constant_index(c, to_string_key(descriptor));
-	write_int(c, descriptor_index, 2);
-	write_int(c, 1, 2);
+	emit_u16(c->res, descriptor_index);
+	emit_u16(c->res, 1);
+	if (code->code->size > CODE_LENGTH_LIMIT &&
+	    !c->options->ignore_class_limits) {
+		fail("Method %s has %zu bytes of code, more than the %d the "
+		     "JVM loads.", name, code->code->size, CODE_LENGTH_LIMIT);
+	}
 	add_code_attribute(c, code);
+
+	struct method_stats method = {
+		.name = name,
+		.code_length = code->code->size,
+		.max_stack = code->max_stack,
+		.max_locals = code->max_locals,
+		.stack_map_frames = code->stack_map_frames->size
+	};
+	stats_add_method(c->stats, method);
+}
+
+static void invoke(struct codegen *c, struct code *code, uint8_t opcode,
+		   char *methodref)
+{
+	emit_u8(code->code, opcode);
+	emit_u16(code->code, get_constant_index(c, to_string_key(methodref)));
+}
+
+static void get_static(struct codegen *c, struct code *code, char *fieldref)
+{
+	emit_u8(code->code, JVM_GETSTATIC);
+	emit_u16(code->code, get_constant_index(c, to_string_key(fieldref)));
+}
+
+static void byte_array_view(struct codegen *c, struct code *code,
+			    char *array_class, char *fieldref)
+{
+	emit_u8(code->code, JVM_LDC_W);
+	emit_u16(code->code, get_constant_index(c, to_string_key(array_class)));
+	emit_u8(code->code, JVM_GETSTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(LITTLE_ENDIAN_FIELDREF)));
+	emit_u8(code->code, JVM_INVOKESTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(BYTE_ARRAY_VIEW_METHODREF)));
+	emit_u8(code->code, JVM_PUTSTATIC);
+	emit_u16(code->code, get_constant_index(c, to_string_key(fieldref)));
+}
+
+/*
+ * Pushes an int without a constant pool entry, block and counter indices
+ * would fill the pool.
+ */
+static void push_int(struct code *code, uint32_t value)
+{
+	emit_u8(code->code, JVM_SIPUSH);
+	if (value <= INT16_MAX) {
+		emit_u16(code->code, value);
+		return;
+	}
+	emit_u16(code->code, value >> 15);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, 15);
+	emit_u8(code->code, JVM_ISHL);
+	emit_u8(code->code, JVM_SIPUSH);
+	emit_u16(code->code, value & INT16_MAX);
+	emit_u8(code->code, JVM_IOR);
+}
+
+/*
+ * Mapped memory is no array getBytes can copy into, the chunk goes through
+ * a new one in local 0.
+ */
+static void load_data_chunk_mapped(struct codegen *c, struct code *code,
+				   struct data_chunk *chunk)
+{
+	push_int(code, chunk->length);
+	emit_u8(code->code, JVM_NEWARRAY);
+	emit_u8(code->code, JVM_T_BYTE);
+	emit_u8(code->code, JVM_ASTORE_0);
+	emit_u8(code->code, JVM_LDC_W);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(chunk->string_key)));
+	emit_u8(code->code, JVM_ICONST_0);
+	push_int(code, chunk->length);
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_INVOKEVIRTUAL);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(GET_BYTES_METHODREF)));
+
+	emit_u8(code->code, JVM_GETSTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(MEMORY_FIELDREF)));
+	push_int(code, chunk->address);
+	emit_u8(code->code, JVM_INVOKEVIRTUAL);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(BUFFER_POSITION_METHODREF)));
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_INVOKEVIRTUAL);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(BUFFER_PUT_ARRAY_METHODREF)));
+	emit_u8(code->code, JVM_POP);
+}
+
+static void load_data_chunk(struct codegen *c, struct code *code,
+			    struct data_chunk *chunk)
+{
+	if (mapped(c)) {
+		load_data_chunk_mapped(c, code, chunk);
+		return;
+	}
+	emit_u8(code->code, JVM_LDC_W);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(chunk->string_key)));
+	emit_u8(code->code, JVM_ICONST_0);
+	push_int(code, chunk->length);
+	emit_u8(code->code, JVM_GETSTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(MEMORY_FIELDREF)));
+	push_int(code, chunk->address);
+	emit_u8(code->code, JVM_INVOKEVIRTUAL);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(GET_BYTES_METHODREF)));
+}
+
+/*
+ * Maps the memory file, at least memory_size() bytes of it. The file grows
+ * to that size when it is smaller, the mapping outlives the channel.
+ */
+static void map_memory(struct codegen *c, struct code *code)
+{
+	code->max_stack = code->max_stack > 8 ? code->max_stack : 8;
+	code->max_locals = 1;
+	emit_u8(code->code, JVM_LDC_W);
+	emit_u16(code->code, get_constant_index(c, to_string_key(MEMORY_PATH)));
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_ANEWARRAY);
+	emit_u16(code->code, get_constant_index(c, to_string_key(STRING_CLASS)));
+	invoke(c, code, JVM_INVOKESTATIC, PATHS_GET_METHODREF);
+	char *options[] = {
+		OPEN_READ_FIELDREF, OPEN_WRITE_FIELDREF, OPEN_CREATE_FIELDREF
+	};
+	push_int(code, sizeof(options) / sizeof(*options));
+	emit_u8(code->code, JVM_ANEWARRAY);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(OPEN_OPTION_CLASS)));
+	for (size_t i = 0; i < sizeof(options) / sizeof(*options); i++) {
+		emit_u8(code->code, JVM_DUP);
+		push_int(code, i);
+		get_static(c, code, options[i]);
+		emit_u8(code->code, JVM_AASTORE);
+	}
+	invoke(c, code, JVM_INVOKESTATIC, FILE_CHANNEL_OPEN_METHODREF);
+	emit_u8(code->code, JVM_ASTORE_0);
+
+	emit_u8(code->code, JVM_ALOAD_0);
+	get_static(c, code, MAP_MODE_FIELDREF);
+	emit_u8(code->code, JVM_LCONST_0);
+	emit_u8(code->code, JVM_ALOAD_0);
+	invoke(c, code, JVM_INVOKEVIRTUAL, FILE_CHANNEL_SIZE_METHODREF);
+	push_int(code, memory_size(c->data));
+	emit_u8(code->code, JVM_I2L);
+	invoke(c, code, JVM_INVOKESTATIC, MATH_MAX_LONG_METHODREF);
+	invoke(c, code, JVM_INVOKEVIRTUAL, FILE_CHANNEL_MAP_METHODREF);
+	emit_u8(code->code, JVM_PUTSTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(MEMORY_FIELDREF)));
+	emit_u8(code->code, JVM_ALOAD_0);
+	invoke(c, code, JVM_INVOKEVIRTUAL, FILE_CHANNEL_CLOSE_METHODREF);
 }
 
 static void clinit_method_code(struct codegen *c, struct code *code)
 {
-	code->max_stack = 3;
+	// getBytes takes five arguments, push_int needs one more slot
+	code->max_stack = c->data_chunks.size > 0 ? 6 : 2;
 	uint16_t idx;
 
 	// Initialize registers
-	write_byte(code->code, JVM_NEW);
+	emit_u8(code->code, JVM_NEW);
 	idx = get_constant_index(c, to_string_key(THREAD_LOCAL_CLASS));
-	write_bytes(code->code, idx, 2);
-	write_byte(code->code, JVM_DUP);
-	write_byte(code->code, JVM_INVOKESPECIAL);
+	emit_u16(code->code, idx);
+	emit_u8(code->code, JVM_DUP);
+	emit_u8(code->code, JVM_INVOKESPECIAL);
 	idx = get_constant_index(c, to_string_key(THREAD_LOCAL_INIT_METHODREF));
-	write_bytes(code->code, idx, 2);
-	write_byte(code->code, JVM_PUTSTATIC);
-	idx = get_constant_index(c, to_string_key(REGISTERS_FIELDREF));
-	write_bytes(code->code, idx, 2);
-	write_byte(code->code, JVM_GETSTATIC);
+	emit_u16(code->code, idx);
+	emit_u8(code->code, JVM_PUTSTATIC);
 	idx = get_constant_index(c, to_string_key(REGISTERS_FIELDREF));
-	write_bytes(code->code, idx, 2);
-	write_byte(code->code, JVM_BIPUSH);
-	write_byte(code->code, 32);
-	write_byte(code->code, JVM_NEWARRAY);
-	write_byte(code->code, JVM_T_LONG);
-	write_byte(code->code, JVM_INVOKEVIRTUAL);
-	idx = get_constant_index(c, to_string_key(THREAD_LOCAL_SET_METHODREF));
-	write_bytes(code->code, idx, 2);
+	emit_u16(code->code, idx);
+
+	// Initialize memory, its contents and its views
+	if (mapped(c)) {
+		map_memory(c, code);
+	} else {
+		push_int(code, memory_size(c->data));
+		emit_u8(code->code, JVM_NEWARRAY);
+		emit_u8(code->code, JVM_T_BYTE);
+		emit_u8(code->code, JVM_PUTSTATIC);
+		idx = get_constant_index(c, to_string_key(MEMORY_FIELDREF));
+		emit_u16(code->code, idx);
+	}
+	for (size_t i = 0; i < c->data_chunks.size; i++) {
+		load_data_chunk(c, code, &c->data_chunks.items[i]);
+	}
+	byte_array_view(c, code, INT_ARRAY_CLASS, WORDS_FIELDREF);
+	byte_array_view(c, code, SHORT_ARRAY_CLASS, HALVES_FIELDREF);
+	if (c->doublewords) {
+		byte_array_view(c, code, LONG_ARRAY_CLASS,
+				DOUBLEWORDS_FIELDREF);
+	}
 
-	// Initialize memory
-	write_byte(code->code, JVM_SIPUSH);
-	write_bytes(code->code, MEMORY_SIZE / 8, 2); // divide by 8 to get the number of longs
-	write_byte(code->code, JVM_NEWARRAY);
-	write_byte(code->code, JVM_T_LONG);
-	write_byte(code->code, JVM_PUTSTATIC);
-	idx = get_constant_index(c, to_string_key(MEMORY_FIELDREF));
-	write_bytes(code->code, idx, 2);
+	if (instrumented(c)) {
+		push_int(code, c->blocks.size * PROFILE_COUNTERS_PER_BLOCK);
+		emit_u8(code->code, JVM_NEWARRAY);
+		emit_u8(code->code, JVM_T_LONG);
+		emit_u8(code->code, JVM_PUTSTATIC);
+		emit_u16(code->code, get_constant_index(c,
+				to_string_key(PROFILE_FIELDREF)));
+	}
 
-	write_byte(code->code, JVM_RETURN);
+	emit_u8(code->code, JVM_RETURN);
 }
 
-static void load_registers_into_local(struct codegen *c, struct code *code)
+/*
+ * Every hart gets a register file of its own, published in the registers
+ * thread local of the thread that runs it.
+ */
+static void create_registers_in_local(struct codegen *c, struct code *code)
 {
-	write_byte(code->code, JVM_GETSTATIC);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, REGISTER_FILE_SIZE);
+	emit_u8(code->code, JVM_NEWARRAY);
+	emit_u8(code->code, JVM_T_LONG);
+	emit_u8(code->code, JVM_DUP);
+	emit_u8(code->code, JVM_ASTORE_1);
+	emit_u8(code->code, JVM_GETSTATIC);
 	uint16_t idx = get_constant_index(c, to_string_key(REGISTERS_FIELDREF));
-	write_bytes(code->code, idx, 2);
-	write_byte(code->code, JVM_INVOKEVIRTUAL);
-	idx = get_constant_index(c, to_string_key(THREAD_LOCAL_GET_METHODREF));
-	write_bytes(code->code, idx, 2);
-	write_byte(code->code, JVM_CHECKCAST);
-	idx = get_constant_index(c, to_string_key(LONG_ARRAY_CLASS));
-	write_bytes(code->code, idx, 2);
-	write_byte(code->code, JVM_ASTORE_1);
+	emit_u16(code->code, idx);
+	emit_u8(code->code, JVM_SWAP);
+	emit_u8(code->code, JVM_INVOKEVIRTUAL);
+	idx = get_constant_index(c, to_string_key(THREAD_LOCAL_SET_METHODREF));
+	emit_u16(code->code, idx);
+
+	emit_u8(code->code, JVM_ALOAD_1);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, HARTID_REGISTER);
+	emit_u8(code->code, JVM_ILOAD_0);
+	emit_u8(code->code, JVM_I2L);
+	emit_u8(code->code, JVM_LASTORE);
+
+	// -1 for no reservation, it is not the address of a word
+	emit_u8(code->code, JVM_ALOAD_1);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, RESERVATION_ADDRESS);
+	emit_u8(code->code, JVM_ICONST_M1);
+	emit_u8(code->code, JVM_I2L);
+	emit_u8(code->code, JVM_LASTORE);
 }
 
+// Labels followed by another label are aliases of the same instruction.
 static void write_label(struct codegen *c, size_t ir_idx, struct code *code)
 {
 	struct ir_label label = c->ir[ir_idx].as.label;
 	switch (c->ir[ir_idx + 1].type) {
 	case IR_EOF:
 	case IR_INSTRUCTION:
+	case IR_LABEL:
 		set_code_label_offset(c, to_string_key(label.name),
 				      code->code->size);
 		break;
@@ -790,53 +2443,618 @@ static void write_label(struct codegen *c, size_t ir_idx, struct code *code)
 
 static void load_register(struct code *code, enum ir_instruction_register r)
 {
-	write_byte(code->code, JVM_ALOAD_1);
-	write_byte(code->code, JVM_BIPUSH);
-	write_byte(code->code, r);
-	write_byte(code->code, JVM_LALOAD);
+	emit_u8(code->code, JVM_ALOAD_1);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, r);
+	emit_u8(code->code, JVM_LALOAD);
 }
 
 static void store_register(struct code *code, enum ir_instruction_register r)
 {
 	if (r == X0) {
-		write_byte(code->code, JVM_POP2);
+		emit_u8(code->code, JVM_POP2);
 		return;
 	}
-	write_byte(code->code, JVM_LSTORE_2);
-	write_byte(code->code, JVM_ALOAD_1);
-	write_byte(code->code, JVM_BIPUSH);
-	write_byte(code->code, r);
-	write_byte(code->code, JVM_LLOAD_2);
-	write_byte(code->code, JVM_LASTORE);
+	emit_u8(code->code, JVM_LSTORE_2);
+	emit_u8(code->code, JVM_ALOAD_1);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, r);
+	emit_u8(code->code, JVM_LLOAD_2);
+	emit_u8(code->code, JVM_LASTORE);
 }
 
 static void load_constant(struct codegen *c, struct code *code,
 			  uint32_t constant)
 {
-	write_byte(code->code, JVM_LDC_W);
-	write_bytes(code->code, get_constant_index(c,
-						   to_number_key(constant)), 2);
-	write_byte(code->code, JVM_I2L);
+	emit_u8(code->code, JVM_LDC_W);
+	emit_u16(code->code, get_constant_index(c, to_number_key(constant)));
+	emit_u8(code->code, JVM_I2L);
+}
+
+/*
+ * profile[counter]++ in instrumented programs. Harts do not synchronize
+ * on the counters, which may lose some of their counts.
+ */
+static void count(struct codegen *c, struct code *code, size_t counter)
+{
+	if (!instrumented(c)) {
+		return;
+	}
+	emit_u8(code->code, JVM_GETSTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(PROFILE_FIELDREF)));
+	push_int(code, counter);
+	emit_u8(code->code, JVM_DUP2);
+	emit_u8(code->code, JVM_LALOAD);
+	emit_u8(code->code, JVM_LCONST_1);
+	emit_u8(code->code, JVM_LADD);
+	emit_u8(code->code, JVM_LASTORE);
+}
+
+/*
+ * Control leaves the hot method for the cold one through the dispatch
+ * after its code, with the block to run in local 0, and leaves the cold
+ * one by returning the block to continue in.
+ */
+static void leave_method(struct codegen *c, struct code *code, size_t block)
+{
+	push_int(code, block);
+	if (c->method == BLOCK_COLD) {
+		emit_u8(code->code, JVM_IRETURN);
+		return;
+	}
+	emit_u8(code->code, JVM_ISTORE_0);
+	size_t opcode_offset = code->code->size;
+	emit_u8(code->code, JVM_GOTO_W);
+	size_t branch_offset = emit_placeholder_u32(code->code);
+	add_label_reference(c, COLD_DISPATCH_LABEL, opcode_offset,
+			    branch_offset);
+}
+
+/*
+ * Falling off the end of the program returns from hart, the cold method
+ * returns -1 for it.
+ */
+static void exit_program(struct codegen *c, struct code *code)
+{
+	if (c->method == BLOCK_COLD) {
+		emit_u8(code->code, JVM_ICONST_M1);
+		emit_u8(code->code, JVM_IRETURN);
+	} else {
+		emit_u8(code->code, JVM_RETURN);
+	}
 }
 
 static void jump(struct codegen *c, struct code *code, char *label)
 {
-	add_label_reference(c, label, code->code->size, code->code->size + 1);
-	write_byte(code->code, JVM_GOTO_W);
-	write_bytes(code->code, 0, 4);
+	if (c->stats != NULL) {
+		c->stats->codegen.branches++;
+	}
+	size_t block = block_of_label(&c->blocks, label);
+	if (block != NO_BLOCK && c->blocks.items[block].placement != c->method) {
+		leave_method(c, code, block);
+		return;
+	}
+	if (block == NO_BLOCK && c->program != NULL) {
+		// in another file, hart goes on at its entry point
+		leave_method(c, code, entry_id(c->program, label));
+		return;
+	}
+	size_t opcode_offset = code->code->size;
+	emit_u8(code->code, JVM_GOTO_W);
+	size_t branch_offset = emit_placeholder_u32(code->code);
+	add_label_reference(c, label, opcode_offset, branch_offset);
+}
+
+/*
+ * Device input orders like a load and device output like a store. An
+ * empty set orders nothing, FENCE_KINDS is returned for it.
+ */
+static enum fence_kind fence_kind(int32_t ordering)
+{
+	uint32_t pred = ordering >> 4 & 0xf;
+	uint32_t succ = ordering & 0xf;
+	bool pred_loads = pred & (FENCE_I | FENCE_R);
+	bool pred_stores = pred & (FENCE_O | FENCE_W);
+	bool succ_loads = succ & (FENCE_I | FENCE_R);
+	bool succ_stores = succ & (FENCE_O | FENCE_W);
+	if (pred == 0 || succ == 0) {
+		return FENCE_KINDS;
+	}
+	if (!pred_stores && !succ_stores) {
+		return FENCE_LOAD_LOAD;
+	}
+	if (!pred_loads && !succ_loads) {
+		return FENCE_STORE_STORE;
+	}
+	if (!pred_stores) {
+		return FENCE_ACQUIRE;
+	}
+	if (!succ_loads) {
+		return FENCE_RELEASE;
+	}
+	return FENCE_FULL;
+}
+
+static void fence(struct codegen *c, struct code *code, int32_t ordering)
+{
+	enum fence_kind kind = fence_kind(ordering);
+	if (kind == FENCE_KINDS) {
+		return;
+	}
+	emit_u8(code->code, JVM_INVOKESTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(fence_methods[kind].methodref)));
+}
+
+/*
+ * snap$(registers, block, pc) at an EBREAK, which resumes in the block
+ * after it.
+ */
+static void snapshot(struct codegen *c, struct code *code, uint32_t address)
+{
+	emit_u8(code->code, JVM_ALOAD_1);
+	push_int(code, c->block + 1);
+	push_int(code, address + INSTRUCTION_SIZE);
+	invoke(c, code, JVM_INVOKESTATIC, SNAP_METHODREF);
+}
+
+/*
+ * Pushes rs1 + offset as an int, the index into memory.
+ */
+static void load_address(struct code *code, enum ir_instruction_register rs1,
+			 int16_t offset)
+{
+	load_register(code, rs1);
+	emit_u8(code->code, JVM_L2I);
+	if (offset != 0) {
+		emit_u8(code->code, JVM_SIPUSH);
+		emit_u16(code->code, offset);
+		emit_u8(code->code, JVM_IADD);
+	}
+}
+
+static void load_int_register(struct code *code,
+			      enum ir_instruction_register r)
+{
+	load_register(code, r);
+	emit_u8(code->code, JVM_L2I);
+}
+
+// what a load or store pushes before its address
+static void begin_access(struct codegen *c, struct code *code,
+			 enum ir_instruction_mnemonic mnemonic)
+{
+	switch (mnemonic) {
+	case LW:
+	case SW:
+		get_static(c, code, WORDS_FIELDREF);
+		break;
+	case LH:
+	case LHU:
+	case SH:
+		get_static(c, code, HALVES_FIELDREF);
+		break;
+	default:
+		break;
+	}
+	get_static(c, code, MEMORY_FIELDREF);
+}
+
+// leaves the int that was loaded from the address on the stack
+static void finish_load(struct codegen *c, struct code *code,
+			enum ir_instruction_mnemonic mnemonic)
+{
+	switch (mnemonic) {
+	case LW:
+		invoke(c, code, JVM_INVOKEVIRTUAL, WORD_GET_METHODREF);
+		break;
+	case LH:
+	case LHU:
+		invoke(c, code, JVM_INVOKEVIRTUAL, HALF_GET_METHODREF);
+		if (mnemonic == LHU) {
+			emit_u8(code->code, JVM_I2C);
+		}
+		break;
+	default:
+		if (mapped(c)) {
+			invoke(c, code, JVM_INVOKEVIRTUAL, BUFFER_GET_METHODREF);
+		} else {
+			emit_u8(code->code, JVM_BALOAD);
+		}
+		if (mnemonic == LBU) {
+			emit_u8(code->code, JVM_SIPUSH);
+			emit_u16(code->code, 0xff);
+			emit_u8(code->code, JVM_IAND);
+		}
+		break;
+	}
+}
+
+// stores the int on the stack at the address below it
+static void finish_store(struct codegen *c, struct code *code,
+			 enum ir_instruction_mnemonic mnemonic)
+{
+	switch (mnemonic) {
+	case SW:
+		invoke(c, code, JVM_INVOKEVIRTUAL, WORD_SET_METHODREF);
+		break;
+	case SH:
+		emit_u8(code->code, JVM_I2S);
+		invoke(c, code, JVM_INVOKEVIRTUAL, HALF_SET_METHODREF);
+		break;
+	default:
+		if (mapped(c)) {
+			emit_u8(code->code, JVM_I2B);
+			invoke(c, code, JVM_INVOKEVIRTUAL, BUFFER_PUT_METHODREF);
+			emit_u8(code->code, JVM_POP);
+		} else {
+			emit_u8(code->code, JVM_BASTORE);
+		}
+		break;
+	}
+}
+
+static void write_load(struct codegen *c, struct code *code,
+		       struct ir_instruction instr)
+{
+	struct ir_instruction_mem mem = instr.as.mem;
+	if (outlined(c, instr.mnemonic)) {
+		load_address(code, mem.rs1, mem.offset);
+		invoke(c, code, JVM_INVOKESTATIC,
+		       memory_helpers[instr.mnemonic - LW].method.methodref);
+	} else {
+		begin_access(c, code, instr.mnemonic);
+		load_address(code, mem.rs1, mem.offset);
+		finish_load(c, code, instr.mnemonic);
+	}
+	emit_u8(code->code, JVM_I2L);
+	store_register(code, mem.rd);
+}
+
+/*
+ * rd of a store is the source register rs2.
+ */
+static void write_store(struct codegen *c, struct code *code,
+			struct ir_instruction instr)
+{
+	struct ir_instruction_mem mem = instr.as.mem;
+	if (outlined(c, instr.mnemonic)) {
+		load_address(code, mem.rs1, mem.offset);
+		load_int_register(code, mem.rd);
+		invoke(c, code, JVM_INVOKESTATIC,
+		       memory_helpers[instr.mnemonic - LW].method.methodref);
+		return;
+	}
+	begin_access(c, code, instr.mnemonic);
+	load_address(code, mem.rs1, mem.offset);
+	load_int_register(code, mem.rd);
+	finish_store(c, code, instr.mnemonic);
+}
+
+/*
+ * lw or sw of a stack slot, whose word is in a local of hart.
+ */
+static void write_stack_slot_access(struct code *code,
+				    struct ir_instruction instr, uint8_t slot)
+{
+	struct ir_instruction_mem mem = instr.as.mem;
+	if (instr.mnemonic == SW) {
+		load_int_register(code, mem.rd);
+		emit_u8(code->code, JVM_ISTORE);
+		emit_u8(code->code, FIRST_STACK_SLOT_LOCAL + slot);
+		return;
+	}
+	emit_u8(code->code, JVM_ILOAD);
+	emit_u8(code->code, FIRST_STACK_SLOT_LOCAL + slot);
+	emit_u8(code->code, JVM_I2L);
+	store_register(code, mem.rd);
+}
+
+// like the memory past the data segment, and before any frame declares them
+static void clear_stack_slots(struct codegen *c, struct code *code)
+{
+	for (size_t i = 0; i < c->stack_slots.size; i++) {
+		emit_u8(code->code, JVM_ICONST_0);
+		emit_u8(code->code, JVM_ISTORE);
+		emit_u8(code->code, FIRST_STACK_SLOT_LOCAL + i);
+	}
+}
+
+static void shift_long(struct code *code, uint8_t opcode, uint8_t bits)
+{
+	if (bits == 0) {
+		return;
+	}
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, bits);
+	emit_u8(code->code, opcode);
+}
+
+// what the access of a run of size bytes pushes before its address
+static void begin_run_access(struct codegen *c, struct code *code,
+			     uint8_t size)
+{
+	if (size == 8) {
+		get_static(c, code, DOUBLEWORDS_FIELDREF);
+		get_static(c, code, MEMORY_FIELDREF);
+	} else {
+		begin_access(c, code, size == 4 ? LW : LH);
+	}
+}
+
+/*
+ * The bytes of a run of stores go to the temporary as a long, the first
+ * store's in the lowest bits, and then to memory in one access.
+ */
+static void write_store_run(struct codegen *c, struct code *code,
+			    size_t ir_idx, uint8_t length, uint8_t bits)
+{
+	struct ir_instruction_mem first = c->ir[ir_idx].as.instruction.as.mem;
+	uint8_t size = length * bits / 8;
+	for (uint8_t j = 0; j < length; j++) {
+		load_register(code, c->ir[ir_idx + j].as.instruction.as.mem.rd);
+		shift_long(code, JVM_LSHL, 64 - bits);
+		shift_long(code, JVM_LUSHR, 64 - bits * (j + 1));
+		if (j > 0) {
+			emit_u8(code->code, JVM_LOR);
+		}
+	}
+	emit_u8(code->code, JVM_LSTORE_2);
+	begin_run_access(c, code, size);
+	load_address(code, first.rs1, first.offset);
+	emit_u8(code->code, JVM_LLOAD_2);
+	if (size == 8) {
+		invoke(c, code, JVM_INVOKEVIRTUAL, DOUBLEWORD_SET_METHODREF);
+	} else {
+		emit_u8(code->code, JVM_L2I);
+		finish_store(c, code, size == 4 ? SW : SH);
+	}
+}
+
+/*
+ * A run of loads reads its bytes in one access to the temporary, which
+ * stays there while the registers get their part. So it stores to the
+ * register array itself rather than calling store_register().
+ */
+static void write_load_run(struct codegen *c, struct code *code,
+			   size_t ir_idx, uint8_t length, uint8_t bits)
+{
+	struct ir_instruction first = c->ir[ir_idx].as.instruction;
+	uint8_t size = length * bits / 8;
+	begin_run_access(c, code, size);
+	load_address(code, first.as.mem.rs1, first.as.mem.offset);
+	if (size == 8) {
+		invoke(c, code, JVM_INVOKEVIRTUAL, DOUBLEWORD_GET_METHODREF);
+	} else {
+		finish_load(c, code, size == 4 ? LW : LH);
+		emit_u8(code->code, JVM_I2L);
+	}
+	emit_u8(code->code, JVM_LSTORE_2);
+
+	bool zero_extends = first.mnemonic == LHU || first.mnemonic == LBU;
+	for (uint8_t j = 0; j < length; j++) {
+		enum ir_instruction_register rd =
+			c->ir[ir_idx + j].as.instruction.as.mem.rd;
+		if (rd == X0) {
+			continue;
+		}
+		emit_u8(code->code, JVM_ALOAD_1);
+		emit_u8(code->code, JVM_BIPUSH);
+		emit_u8(code->code, rd);
+		emit_u8(code->code, JVM_LLOAD_2);
+		shift_long(code, JVM_LSHL, 64 - bits * (j + 1));
+		shift_long(code, zero_extends ? JVM_LUSHR : JVM_LSHR,
+			   64 - bits);
+		emit_u8(code->code, JVM_LASTORE);
+	}
+}
+
+// a run of loads or stores as one access of all its bytes, see coalesce.h
+static void write_access_run(struct codegen *c, struct code *code,
+			     size_t ir_idx)
+{
+	enum ir_instruction_mnemonic mnemonic =
+		c->ir[ir_idx].as.instruction.mnemonic;
+	uint8_t length = run_length(c, ir_idx);
+	uint8_t bits = access_size(mnemonic) * 8;
+	if (mnemonic == SW || mnemonic == SH || mnemonic == SB) {
+		write_store_run(c, code, ir_idx, length, bits);
+	} else {
+		write_load_run(c, code, ir_idx, length, bits);
+	}
+	if (c->stats != NULL) {
+		c->stats->codegen.access_runs++;
+	}
+}
+
+static bool is_mul_div(enum ir_instruction_mnemonic mnemonic)
+{
+	return mnemonic >= MUL && mnemonic <= REMU;
+}
+
+static void load_unsigned_register(struct codegen *c, struct code *code,
+				   enum ir_instruction_register r)
+{
+	load_int_register(code, r);
+	invoke(c, code, JVM_INVOKESTATIC, TO_UNSIGNED_LONG_METHODREF);
+}
+
+/*
+ * Computes in 32 bits and sign extends the result into rd. The high halves
+ * of products come from the full 64 bit product of the operands, extended
+ * the way the instruction treats them.
+ */
+static void write_mul_div(struct codegen *c, struct code *code,
+			  struct ir_instruction instr)
+{
+	struct ir_instruction_r3 r3 = instr.as.r3;
+	switch (instr.mnemonic) {
+	case MUL:
+		load_int_register(code, r3.rs1);
+		load_int_register(code, r3.rs2);
+		emit_u8(code->code, JVM_IMUL);
+		break;
+	case MULH:
+		load_int_register(code, r3.rs1);
+		load_int_register(code, r3.rs2);
+		invoke(c, code, JVM_INVOKESTATIC, MATH_MULTIPLY_FULL_METHODREF);
+		emit_u8(code->code, JVM_BIPUSH);
+		emit_u8(code->code, 32);
+		emit_u8(code->code, JVM_LSHR);
+		emit_u8(code->code, JVM_L2I);
+		break;
+	case MULHSU:
+		load_int_register(code, r3.rs1);
+		emit_u8(code->code, JVM_I2L);
+		load_unsigned_register(c, code, r3.rs2);
+		emit_u8(code->code, JVM_LMUL);
+		emit_u8(code->code, JVM_BIPUSH);
+		emit_u8(code->code, 32);
+		emit_u8(code->code, JVM_LSHR);
+		emit_u8(code->code, JVM_L2I);
+		break;
+	case MULHU:
+		load_unsigned_register(c, code, r3.rs1);
+		load_unsigned_register(c, code, r3.rs2);
+		emit_u8(code->code, JVM_LMUL);
+		emit_u8(code->code, JVM_BIPUSH);
+		emit_u8(code->code, 32);
+		emit_u8(code->code, JVM_LUSHR);
+		emit_u8(code->code, JVM_L2I);
+		break;
+	default:
+		load_int_register(code, r3.rs1);
+		load_int_register(code, r3.rs2);
+		invoke(c, code, JVM_INVOKESTATIC,
+		       divisions[instr.mnemonic - DIV].method.methodref);
+		break;
+	}
+	emit_u8(code->code, JVM_I2L);
+	store_register(code, r3.rd);
+}
+
+static enum amo_mode amo_mode(uint8_t ordering)
+{
+	switch (ordering) {
+	case AMO_AQ:
+		return AMO_ACQUIRE;
+	case AMO_RL:
+		return AMO_RELEASE;
+	default:
+		return AMO_VOLATILE;
+	}
+}
+
+/*
+ * Atomics go to VarHandle methods and helpers, neither takes a lock.
+ */
+static void write_amo(struct codegen *c, struct code *code,
+		      struct ir_instruction instr)
+{
+	struct ir_instruction_amo amo = instr.as.amo;
+	switch (instr.mnemonic) {
+	case LR_W:
+		emit_u8(code->code, JVM_ALOAD_1);
+		load_address(code, amo.rs1, 0);
+		invoke(c, code, JVM_INVOKESTATIC, LR_METHODREF);
+		break;
+	case SC_W:
+		emit_u8(code->code, JVM_ALOAD_1);
+		load_address(code, amo.rs1, 0);
+		load_int_register(code, amo.rs2);
+		invoke(c, code, JVM_INVOKESTATIC, SC_METHODREF);
+		break;
+	case AMOMIN_W:
+	case AMOMAX_W:
+	case AMOMINU_W:
+	case AMOMAXU_W:
+		load_address(code, amo.rs1, 0);
+		load_int_register(code, amo.rs2);
+		invoke(c, code, JVM_INVOKESTATIC,
+		       amo_loops[instr.mnemonic - AMOMIN_W].method.methodref);
+		break;
+	default:
+		get_static(c, code, WORDS_FIELDREF);
+		get_static(c, code, MEMORY_FIELDREF);
+		load_address(code, amo.rs1, 0);
+		load_int_register(code, amo.rs2);
+		invoke(c, code, JVM_INVOKEVIRTUAL,
+		       amo_methods[instr.mnemonic - AMOSWAP_W]
+				  [amo_mode(amo.ordering)].methodref);
+		break;
+	}
+	emit_u8(code->code, JVM_I2L);
+	store_register(code, amo.rd);
+}
+
+/*
+ * The if<cond> opcodes come in pairs of opposite conditions, ifeq and ifne
+ * first.
+ */
+static uint8_t opposite_condition(uint8_t opcode)
+{
+	return JVM_IFEQ + ((opcode - JVM_IFEQ) ^ 1);
+}
+
+/*
+ * Where the branch or jump to label of IR element ir_idx goes. Only the
+ * last instruction of a block branches, to the block simplify_blocks()
+ * threaded it to. Labels of other files stay as they are.
+ */
+static char *block_target(struct codegen *c, size_t ir_idx, char *label)
+{
+	struct block *block = &c->blocks.items[c->block];
+	if (ir_idx + 1 != block->end || block->target == NO_BLOCK) {
+		return label;
+	}
+	return block_name(&c->blocks, block->target);
+}
+
+/*
+ * A conditional branch skips the jump to label when skip_opcode is true of
+ * the result of lcmp. When the layout puts the target right after the
+ * block, the condition flips and the jump goes to the next block in source
+ * order instead.
+ */
+static void branch(struct codegen *c, struct code *code, size_t ir_idx,
+		   uint8_t skip_opcode, char *label)
+{
+	struct block *block = &c->blocks.items[c->block];
+	size_t skip = code->code->size;
+	if (block->inverted) {
+		emit_u8(code->code, opposite_condition(skip_opcode));
+		emit_placeholder_u16(code->code);
+		if (c->block + 1 < c->blocks.size) {
+			jump(c, code, block_name(&c->blocks, c->block + 1));
+		} else {
+			exit_program(c, code);
+		}
+	} else {
+		emit_u8(code->code, skip_opcode);
+		emit_placeholder_u16(code->code);
+		count(c, code, c->block * PROFILE_COUNTERS_PER_BLOCK + 1);
+		jump(c, code, block_target(c, ir_idx, label));
+	}
+	patch_u16(code->code, skip + 1, code->code->size - skip);
+	add_stack_frame(c, code, code->code->size);
 }
 
 static void write_instruction(struct codegen *c, size_t ir_idx,
-			      struct code *code)
+			      uint32_t address, struct code *code)
 {
 	struct ir_instruction instr = c->ir[ir_idx].as.instruction;
 	switch (instr.type) {
 	case TYPE_R3:
+		if (is_mul_div(instr.mnemonic)) {
+			write_mul_div(c, code, instr);
+			break;
+		}
 		load_register(code, instr.as.r3.rs1);
 		load_register(code, instr.as.r3.rs2);
 		switch (instr.mnemonic) {
 		case ADD:
-			write_byte(code->code, JVM_LADD);
+			emit_u8(code->code, JVM_LADD);
 			break;
 		default:
 			break;
@@ -849,35 +3067,89 @@ static void write_instruction(struct codegen *c, size_t ir_idx,
 		case ADDI:
 			load_register(code, instr.as.r2op.rs1);
 			load_constant(c, code, instr.as.r2op.op.imm);
-			write_byte(code->code, JVM_LADD);
+			emit_u8(code->code, JVM_LADD);
 			store_register(code, instr.as.r2op.rd);
 			break;
 		case BNE:
 			load_register(code, instr.as.r2op.rd);
 			load_register(code, instr.as.r2op.rs1);
-			write_byte(code->code, JVM_LCMP);
-			add_stack_frame(c, code, code->code->size + 8);
-			write_byte(code->code, JVM_IFEQ);
-			write_bytes(code->code, 8, 2);
-			jump(c, code, instr.as.r2op.op.label);
+			emit_u8(code->code, JVM_LCMP);
+			branch(c, code, ir_idx, JVM_IFEQ,
+			       instr.as.r2op.op.label);
 			break;
 		case BLT:
 			load_register(code, instr.as.r2op.rd);
 			load_register(code, instr.as.r2op.rs1);
-			write_byte(code->code, JVM_LCMP);
-			add_stack_frame(c, code, code->code->size + 8);
-			write_byte(code->code, JVM_IFGT);
-			write_bytes(code->code, 8, 2);
-			jump(c, code, instr.as.r2op.op.label);
+			emit_u8(code->code, JVM_LCMP);
+			branch(c, code, ir_idx, JVM_IFGT,
+			       instr.as.r2op.op.label);
+			break;
+		case FENCE:
+			fence(c, code, instr.as.r2op.op.imm);
+			break;
+		case EBREAK:
+			if (snapshots(c)) {
+				snapshot(c, code, address);
+			}
+			break;
 		default:
 			break;
 		}
 		break;
 
+	case TYPE_MEM:
+		if (stack_slot(c, ir_idx) != NO_STACK_SLOT) {
+			write_stack_slot_access(code, instr,
+						stack_slot(c, ir_idx));
+			break;
+		}
+		if (run_length(c, ir_idx) != 1) {
+			// the ones after the first are part of its access
+			if (run_length(c, ir_idx) > 1) {
+				write_access_run(c, code, ir_idx);
+			}
+			break;
+		}
+		switch (instr.mnemonic) {
+		case SW:
+		case SH:
+		case SB:
+			write_store(c, code, instr);
+			break;
+		default:
+			write_load(c, code, instr);
+			break;
+		}
+		break;
+
+	case TYPE_AMO:
+		write_amo(c, code, instr);
+		break;
+
 	case TYPE_R1_OP:
 		switch (instr.mnemonic) {
+		case LI:
+			load_constant(c, code, instr.as.r1op.op.value);
+			store_register(code, instr.as.r1op.rd);
+			break;
 		case J:
-			jump(c, code, instr.as.r1op.op.label);
+		case JAL:
+			if (instr.as.r1op.op_type != OPERAND_LABEL) {
+				break;
+			}
+			if (instr.as.r1op.rd != X0) {
+				load_constant(c, code, address + INSTRUCTION_SIZE);
+				store_register(code, instr.as.r1op.rd);
+			}
+			struct block *block = &c->blocks.items[c->block];
+			if (block->target == block->next) {
+				// the block laid out next is where it goes
+				break;
+			}
+			jump(c, code, block_target(c, ir_idx,
+						 instr.as.r1op.op.label));
+			// code after an unconditional jump needs a frame
+			add_stack_frame(c, code, code->code->size);
 			break;
 		default:
 			break;
@@ -896,84 +3168,1152 @@ static void update_label_reference(struct codegen *c, struct code *code,
 	if (references == NULL) {
 		return;
 	}
+	uint32_t label_offset = get_code_label_offset(c, label);
 	for (size_t i = 0; i < references->size; i++) {
 		struct label_reference reference = references->items[i];
-		uint16_t label_offset = get_code_label_offset(c, label);
-		int32_t offset = (int32_t)label_offset - reference.opcode_offset;
-		overwrite_bytes(code->code, reference.branch_offset, offset, 4);
-		add_stack_frame(c, code, label_offset);
+		int32_t offset = (int32_t)(label_offset - reference.opcode_offset);
+		patch_u32(code->code, reference.branch_offset, offset);
 	}
+	// one frame for the label, however many jumps go to it
+	add_stack_frame(c, code, label_offset);
 }
 
-static void main_method_code(struct codegen *c, struct code *code)
+/*
+ * Labels first, then the counter of the block in instrumented programs,
+ * the instructions and a jump to the next block in source order when the
+ * layout put another one after it.
+ */
+static void write_block(struct codegen *c, struct code *code, size_t b)
 {
-	code->max_stack = 5;
-	code->max_locals = 2 + 2;
-	load_registers_into_local(c, code);
+	struct block *block = &c->blocks.items[b];
+	c->block = b;
+	if (block->name_allocated) {
+		set_code_label_offset(c, to_string_key(block->name),
+				      code->code->size);
+	}
+	size_t i = block->first;
+	for (; i < block->end && c->ir[i].type == IR_LABEL; i++) {
+		write_label(c, i, code);
+	}
+	count(c, code, b * PROFILE_COUNTERS_PER_BLOCK);
 
-	// 1st pass: build bytecode with offset placeholders and a symbol map
-	for (size_t i = 0; c->ir[i].type != IR_EOF; i++) {
+	uint32_t address = c->base_address + block->address;
+	for (; i < block->end; i++) {
 		switch (c->ir[i].type) {
-		case IR_DIRECTIVE:
-			break;
 		case IR_LABEL:
 			write_label(c, i, code);
 			break;
 		case IR_INSTRUCTION:
-			write_instruction(c, i, code);
+			write_instruction(c, i, address, code);
+			address += INSTRUCTION_SIZE;
+			if (c->stats != NULL) {
+				c->stats->codegen.guest_instructions++;
+			}
 			break;
 		default:
 			break;
 		}
 	}
 
+	if (!block->falls_through || block->inverted || block->next == b + 1) {
+		return;
+	}
+	if (b + 1 < c->blocks.size) {
+		jump(c, code, block_name(&c->blocks, b + 1));
+	} else {
+		exit_program(c, code);
+	}
+	add_stack_frame(c, code, code->code->size);
+}
+
+/*
+ * Writes the blocks from order[from] to order[to] and then patches the
+ * jumps to their labels.
+ */
+static void write_blocks(struct codegen *c, struct code *code, size_t from,
+			 size_t to)
+{
+	// 1st pass: build bytecode with offset placeholders and a symbol map
+	for (size_t i = from; i < to; i++) {
+		write_block(c, code, c->blocks.order[i]);
+	}
+
 	// 2nd pass: calculate actual offsets and replace placeholder values
-	for (size_t i = 0; c->ir[i].type != IR_EOF; i++) {
-		if (c->ir[i].type != IR_LABEL) {
+	for (size_t i = from; i < to; i++) {
+		struct block *block = &c->blocks.items[c->blocks.order[i]];
+		for (size_t j = block->first; j < block->end; j++) {
+			if (c->ir[j].type == IR_LABEL) {
+				update_label_reference(c, code,
+						       c->ir[j].as.label.name);
+			}
+		}
+		if (block->name_allocated) {
+			update_label_reference(c, code, block->name);
+		}
+	}
+}
+
+/*
+ * lookupswitch on the int on the stack to the blocks of the method that
+ * the other method transfers control to. Returns the offset of the
+ * opcode, patch_switch_default() sets where other values go.
+ */
+static size_t switch_to_blocks(struct codegen *c, struct code *code)
+{
+	size_t opcode_offset = code->code->size;
+	emit_u8(code->code, JVM_LOOKUPSWITCH);
+	while (code->code->size % 4 != 0) {
+		emit_u8(code->code, 0);
+	}
+	emit_placeholder_u32(code->code);
+	size_t pairs_offset = emit_placeholder_u32(code->code);
+	uint32_t pairs = 0;
+	for (size_t i = 0; i < c->blocks.size; i++) {
+		struct block *block = &c->blocks.items[i];
+		if (block->placement != c->method ||
+		    !block->entered_from_other_method) {
+			continue;
+		}
+		emit_u32(code->code, i);
+		size_t branch_offset = emit_placeholder_u32(code->code);
+		add_label_reference(c, block->name, opcode_offset,
+				    branch_offset);
+		pairs++;
+	}
+	patch_u32(code->code, pairs_offset, pairs);
+	return opcode_offset;
+}
+
+static void patch_switch_default(struct codegen *c, struct code *code,
+				 size_t opcode_offset, size_t target_offset)
+{
+	size_t default_offset = (opcode_offset + 4) & ~(size_t)3;
+	patch_u32(code->code, default_offset, target_offset - opcode_offset);
+	add_stack_frame(c, code, target_offset);
+}
+
+/*
+ * hart of a separately compiled program calls the entry point with the id
+ * in local 0 until one returns -1 at the end of the program.
+ */
+static void dispatch_to_units(struct codegen *c, struct code *code)
+{
+	struct separate_program *program = c->program;
+	if (program->start < 0) {
+		return;
+	}
+	if (code->max_stack < 2) {
+		code->max_stack = 2;
+	}
+	push_int(code, program->start);
+	emit_u8(code->code, JVM_ISTORE_0);
+
+	size_t loop_offset = code->code->size;
+	add_stack_frame(c, code, loop_offset);
+	emit_u8(code->code, JVM_ILOAD_0);
+	size_t opcode_offset = code->code->size;
+	emit_u8(code->code, JVM_LOOKUPSWITCH);
+	while (code->code->size % 4 != 0) {
+		emit_u8(code->code, 0);
+	}
+	size_t default_offset = emit_placeholder_u32(code->code);
+	size_t ids = entry_ids(program);
+	emit_u32(code->code, ids);
+	size_t cases_offset = code->code->size;
+	for (size_t id = 0; id < ids; id++) {
+		emit_u32(code->code, id);
+		emit_placeholder_u32(code->code);
+	}
+
+	for (size_t id = 0; id < ids; id++) {
+		size_t case_offset = code->code->size;
+		patch_u32(code->code, cases_offset + id * 8 + 4,
+			  case_offset - opcode_offset);
+		add_stack_frame(c, code, case_offset);
+		if (id == program->entries_n) {
+			// run$ of the file hart starts in, at its first block
+			emit_u8(code->code, JVM_ICONST_0);
+		}
+		emit_u8(code->code, JVM_ALOAD_1);
+		invoke(c, code, JVM_INVOKESTATIC, c->entry_keys[id].methodref);
+		emit_u8(code->code, JVM_ISTORE_0);
+		size_t goto_offset = code->code->size;
+		emit_u8(code->code, JVM_GOTO_W);
+		emit_u32(code->code, (uint32_t)(loop_offset - goto_offset));
+	}
+	patch_u32(code->code, default_offset,
+		  code->code->size - opcode_offset);
+	add_stack_frame(c, code, code->code->size);
+}
+
+// the block after an EBREAK, where a snapshot taken there resumes
+static bool resumes_in(struct codegen *c, size_t b)
+{
+	if (b == 0) {
+		return false;
+	}
+	struct ir_element *last = &c->ir[c->blocks.items[b - 1].end - 1];
+	return last->type == IR_INSTRUCTION &&
+	       last->as.instruction.mnemonic == EBREAK;
+}
+
+/*
+ * After resume$ read a snapshot, hart takes its registers over and goes on
+ * in the block it was taken for. Returns the offset of the lookupswitch,
+ * whose default is the end of the program.
+ */
+static size_t resume_snapshot(struct codegen *c, struct code *code)
+{
+	get_static(c, code, RESUME_REGISTERS_FIELDREF);
+	size_t ifnull_offset = code->code->size;
+	emit_u8(code->code, JVM_IFNULL);
+	emit_placeholder_u16(code->code);
+	get_static(c, code, RESUME_REGISTERS_FIELDREF);
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_ALOAD_1);
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, REGISTER_FILE_SIZE);
+	invoke(c, code, JVM_INVOKESTATIC, ARRAYCOPY_METHODREF);
+
+	get_static(c, code, RESUME_BLOCK_FIELDREF);
+	size_t opcode_offset = code->code->size;
+	emit_u8(code->code, JVM_LOOKUPSWITCH);
+	while (code->code->size % 4 != 0) {
+		emit_u8(code->code, 0);
+	}
+	emit_placeholder_u32(code->code);
+	size_t pairs_offset = emit_placeholder_u32(code->code);
+	uint32_t pairs = 0;
+	for (size_t i = 0; i < c->blocks.size; i++) {
+		if (!resumes_in(c, i)) {
 			continue;
 		}
-		update_label_reference(c, code, c->ir[i].as.label.name);
+		emit_u32(code->code, i);
+		size_t branch_offset = emit_placeholder_u32(code->code);
+		add_label_reference(c, block_name(&c->blocks, i), opcode_offset,
+				    branch_offset);
+		pairs++;
+	}
+	patch_u32(code->code, pairs_offset, pairs);
+
+	patch_u16(code->code, ifnull_offset + 1,
+		  code->code->size - ifnull_offset);
+	add_stack_frame(c, code, code->code->size);
+	return opcode_offset;
+}
+
+/*
+ * static void hart(int hartid) runs the program on the calling thread. It
+ * starts at _start when there is one and at the first instruction if not.
+ * With a profile, blocks that never ran are in the cold method, called
+ * from the dispatch after the code until it returns to a hot block.
+ */
+static void hart_method_code(struct codegen *c, struct code *code)
+{
+	code->max_stack = instrumented(c) ? 6 : 5;
+	code->max_locals = FIRST_STACK_SLOT_LOCAL + c->stack_slots.size;
+	code->frame_locals[0].tag = JVM_ITEM_OBJECT;
+	code->frame_locals[0].constant_pool_index =
+		get_constant_index(c, to_string_key(LONG_ARRAY_CLASS));
+	code->frame_locals[1].tag = JVM_ITEM_LONG;
+	code->frame_locals_size = 2;
+	for (size_t i = 0; i < c->stack_slots.size; i++) {
+		code->frame_locals[code->frame_locals_size++].tag =
+			JVM_ITEM_INTEGER;
+	}
+	code->frame_parameters[0].tag = JVM_ITEM_INTEGER;
+	code->frame_parameters_size = 1;
+
+	size_t instructions = 0;
+	for (size_t i = 0; c->ir[i].type != IR_EOF; i++) {
+		instructions += c->ir[i].type == IR_INSTRUCTION;
+	}
+	emit_reserve(code->code, 32 + instructions * GUEST_INSTRUCTION_SIZE);
+	create_registers_in_local(c, code);
+	// every frame declares the temporary, so it must be set from the start
+	emit_u8(code->code, JVM_LCONST_0);
+	emit_u8(code->code, JVM_LSTORE_2);
+	clear_stack_slots(c, code);
+	if (c->program != NULL) {
+		dispatch_to_units(c, code);
+	}
+	size_t resume_offset = 0;
+	if (snapshots(c)) {
+		resume_offset = resume_snapshot(c, code);
+	}
+	if (block_of_label(&c->blocks, ENTRY_LABEL) != NO_BLOCK) {
+		jump(c, code, ENTRY_LABEL);
+		add_stack_frame(c, code, code->code->size);
+	}
+
+	c->method = BLOCK_HOT;
+	write_blocks(c, code, 0, c->blocks.hot);
+	size_t exit_offset = code->code->size;
+	emit_u8(code->code, JVM_RETURN);
+	if (snapshots(c)) {
+		patch_switch_default(c, code, resume_offset, exit_offset);
+	}
+	if (!has_cold_blocks(c)) {
+		return;
+	}
+
+	size_t dispatch_offset = code->code->size;
+	set_code_label_offset(c, to_string_key(COLD_DISPATCH_LABEL),
+			      dispatch_offset);
+	emit_u8(code->code, JVM_ILOAD_0);
+	emit_u8(code->code, JVM_ALOAD_1);
+	invoke(c, code, JVM_INVOKESTATIC, COLD_METHODREF);
+	size_t opcode_offset = switch_to_blocks(c, code);
+	patch_switch_default(c, code, opcode_offset, exit_offset);
+	for (size_t i = 0; i < c->blocks.size; i++) {
+		struct block *block = &c->blocks.items[i];
+		if (block->placement == BLOCK_HOT &&
+		    block->entered_from_other_method) {
+			update_label_reference(c, code, block->name);
+		}
+	}
+	update_label_reference(c, code, COLD_DISPATCH_LABEL);
+}
+
+/*
+ * static int cold$(int block, long[] registers) runs the blocks that never
+ * ran while profiling, starting at block, and returns the hot block to
+ * continue in or -1 at the end of the program. Its locals are laid out like
+ * the ones of hart.
+ */
+static void cold_method_code(struct codegen *c, struct code *code)
+{
+	code->max_stack = 5;
+	code->max_locals = 2 + 2;
+	code->frame_locals[0].tag = JVM_ITEM_LONG;
+	code->frame_locals_size = 1;
+
+	// labels are per method
+	table_free(c->code_label_offsets);
+	free_label_references(c->label_references);
+	c->code_label_offsets = table_create();
+	c->label_references = table_create();
+
+	c->method = BLOCK_COLD;
+	emit_u8(code->code, JVM_LCONST_0);
+	emit_u8(code->code, JVM_LSTORE_2);
+	emit_u8(code->code, JVM_ILOAD_0);
+	size_t opcode_offset = switch_to_blocks(c, code);
+	add_stack_frame(c, code, code->code->size);
+	write_blocks(c, code, c->blocks.hot, c->blocks.size);
+	size_t exit_offset = code->code->size;
+	exit_program(c, code);
+	patch_switch_default(c, code, opcode_offset, exit_offset);
+}
+
+/*
+ * public static int label(long[] registers) of an entry point runs the
+ * file from its block.
+ */
+static void entry_method_code(struct codegen *c, struct code *code,
+			      size_t block)
+{
+	code->max_stack = 2;
+	code->max_locals = 1;
+	push_int(code, block);
+	emit_u8(code->code, JVM_ALOAD_0);
+	invoke(c, code, JVM_INVOKESTATIC, UNIT_METHODREF);
+	emit_u8(code->code, JVM_IRETURN);
+}
+
+/*
+ * static int lr$w(long[] registers, int address) loads the word and
+ * reserves it, remembering the value it had.
+ */
+static void lr_method_code(struct codegen *c, struct code *code)
+{
+	code->max_stack = 4;
+	code->max_locals = 3;
+	get_static(c, code, WORDS_FIELDREF);
+	get_static(c, code, MEMORY_FIELDREF);
+	emit_u8(code->code, JVM_ILOAD_1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WORD_GET_VOLATILE_METHODREF);
+	emit_u8(code->code, JVM_ISTORE_2);
+
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, RESERVATION_ADDRESS);
+	emit_u8(code->code, JVM_ILOAD_1);
+	emit_u8(code->code, JVM_I2L);
+	emit_u8(code->code, JVM_LASTORE);
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, RESERVATION_VALUE);
+	emit_u8(code->code, JVM_ILOAD_2);
+	emit_u8(code->code, JVM_I2L);
+	emit_u8(code->code, JVM_LASTORE);
+
+	emit_u8(code->code, JVM_ILOAD_2);
+	emit_u8(code->code, JVM_IRETURN);
+}
+
+/*
+ * static int sc$w(long[] registers, int address, int value) stores value
+ * if the hart holds a reservation of address and the word still has the
+ * value lr$w saw, with a single compare-and-set. Returns 0 when it stored
+ * and 1 when not, the reservation is gone either way. Like every
+ * compare-and-set emulation it cannot tell whether the word changed and
+ * changed back in between, which guest locks do not depend on.
+ */
+static void sc_method_code(struct codegen *c, struct code *code)
+{
+	code->max_stack = 6;
+	code->max_locals = 3;
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, RESERVATION_ADDRESS);
+	emit_u8(code->code, JVM_LALOAD);
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, RESERVATION_ADDRESS);
+	emit_u8(code->code, JVM_ICONST_M1);
+	emit_u8(code->code, JVM_I2L);
+	emit_u8(code->code, JVM_LASTORE);
+	emit_u8(code->code, JVM_ILOAD_1);
+	emit_u8(code->code, JVM_I2L);
+	emit_u8(code->code, JVM_LCMP);
+	size_t not_reserved = code->code->size;
+	emit_u8(code->code, JVM_IFNE);
+	emit_placeholder_u16(code->code);
+
+	get_static(c, code, WORDS_FIELDREF);
+	get_static(c, code, MEMORY_FIELDREF);
+	emit_u8(code->code, JVM_ILOAD_1);
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, RESERVATION_VALUE);
+	emit_u8(code->code, JVM_LALOAD);
+	emit_u8(code->code, JVM_L2I);
+	emit_u8(code->code, JVM_ILOAD_2);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WORD_CAS_METHODREF);
+	size_t changed = code->code->size;
+	emit_u8(code->code, JVM_IFEQ);
+	emit_placeholder_u16(code->code);
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_IRETURN);
+
+	uint32_t failed = code->code->size;
+	patch_u16(code->code, not_reserved + 1, failed - not_reserved);
+	patch_u16(code->code, changed + 1, failed - changed);
+	add_stack_frame(c, code, failed);
+	emit_u8(code->code, JVM_ICONST_1);
+	emit_u8(code->code, JVM_IRETURN);
+}
+
+/*
+ * static int amo<op>$w(int address, int value) retries a compare-and-set
+ * of the word until no other hart changed it in between and returns the
+ * old value.
+ */
+static void amo_loop_method_code(struct codegen *c, struct code *code,
+				 struct amo_loop *loop)
+{
+	code->max_stack = 7;
+	code->max_locals = 3;
+	uint16_t sign_bit = get_constant_index(c, to_number_key(INT32_MIN));
+	add_stack_frame(c, code, 0);
+	get_static(c, code, WORDS_FIELDREF);
+	get_static(c, code, MEMORY_FIELDREF);
+	emit_u8(code->code, JVM_ILOAD_0);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WORD_GET_VOLATILE_METHODREF);
+	emit_u8(code->code, JVM_ISTORE_2);
+
+	get_static(c, code, WORDS_FIELDREF);
+	get_static(c, code, MEMORY_FIELDREF);
+	emit_u8(code->code, JVM_ILOAD_0);
+	emit_u8(code->code, JVM_ILOAD_2);
+	emit_u8(code->code, JVM_ILOAD_2);
+	if (loop->is_unsigned) {
+		emit_u8(code->code, JVM_LDC_W);
+		emit_u16(code->code, sign_bit);
+		emit_u8(code->code, JVM_IXOR);
+	}
+	emit_u8(code->code, JVM_ILOAD_1);
+	if (loop->is_unsigned) {
+		emit_u8(code->code, JVM_LDC_W);
+		emit_u16(code->code, sign_bit);
+		emit_u8(code->code, JVM_IXOR);
+	}
+	invoke(c, code, JVM_INVOKESTATIC, loop->math_methodref);
+	if (loop->is_unsigned) {
+		emit_u8(code->code, JVM_LDC_W);
+		emit_u16(code->code, sign_bit);
+		emit_u8(code->code, JVM_IXOR);
+	}
+	invoke(c, code, JVM_INVOKEVIRTUAL, WORD_CAS_METHODREF);
+	emit_u8(code->code, JVM_IFEQ);
+	emit_u16(code->code, -(int16_t)(code->code->size - 1));
+	emit_u8(code->code, JVM_ILOAD_2);
+	emit_u8(code->code, JVM_IRETURN);
+}
+
+/*
+ * static int div$(int dividend, int divisor) and the like.
+ */
+static void division_method_code(struct codegen *c, struct code *code,
+				 struct division *division)
+{
+	code->max_stack = 2;
+	code->max_locals = 2;
+	emit_u8(code->code, JVM_ILOAD_1);
+	size_t nonzero = code->code->size;
+	emit_u8(code->code, JVM_IFNE);
+	emit_placeholder_u16(code->code);
+	emit_u8(code->code, division->zero_gives_dividend ? JVM_ILOAD_0
+							  : JVM_ICONST_M1);
+	emit_u8(code->code, JVM_IRETURN);
+
+	patch_u16(code->code, nonzero + 1, code->code->size - nonzero);
+	add_stack_frame(c, code, code->code->size);
+	emit_u8(code->code, JVM_ILOAD_0);
+	emit_u8(code->code, JVM_ILOAD_1);
+	if (division->opcode != 0) {
+		emit_u8(code->code, division->opcode);
+	} else {
+		invoke(c, code, JVM_INVOKESTATIC, division->methodref);
+	}
+	emit_u8(code->code, JVM_IRETURN);
+}
+
+/*
+ * Pushes new Data<kind>Stream(new Buffered<kind>Stream(
+ * Files.new<kind>Stream(Paths.get(path)))) for the path on the stack.
+ */
+static void open_snapshot(struct codegen *c, struct code *code,
+			  char *data_class, char *data_init,
+			  char *buffered_class, char *buffered_init,
+			  char *files_new)
+{
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_ANEWARRAY);
+	emit_u16(code->code, get_constant_index(c, to_string_key(STRING_CLASS)));
+	invoke(c, code, JVM_INVOKESTATIC, PATHS_GET_METHODREF);
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_ANEWARRAY);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(OPEN_OPTION_CLASS)));
+	invoke(c, code, JVM_INVOKESTATIC, files_new);
+	// new objects go below their argument
+	emit_u8(code->code, JVM_NEW);
+	emit_u16(code->code, get_constant_index(c, to_string_key(buffered_class)));
+	emit_u8(code->code, JVM_DUP_X1);
+	emit_u8(code->code, JVM_SWAP);
+	invoke(c, code, JVM_INVOKESPECIAL, buffered_init);
+	emit_u8(code->code, JVM_NEW);
+	emit_u16(code->code, get_constant_index(c, to_string_key(data_class)));
+	emit_u8(code->code, JVM_DUP_X1);
+	emit_u8(code->code, JVM_SWAP);
+	invoke(c, code, JVM_INVOKESPECIAL, data_init);
+}
+
+static void branch_forward(struct code *code, uint8_t opcode,
+			   size_t *offset)
+{
+	*offset = code->code->size;
+	emit_u8(code->code, opcode);
+	emit_placeholder_u16(code->code);
+}
+
+// points the branch at offset to here, which gets a frame
+static void land_branch(struct codegen *c, struct code *code, size_t offset)
+{
+	patch_u16(code->code, offset + 1, code->code->size - offset);
+	add_stack_frame(c, code, code->code->size);
+}
+
+static void go_back(struct code *code, size_t target)
+{
+	size_t offset = code->code->size;
+	emit_u8(code->code, JVM_GOTO);
+	emit_u16(code->code, (uint16_t)(target - offset));
+}
+
+/*
+ * static void snap$(long[] registers, int block, int pc) writes the
+ * snapshot, comparing memory to the zero page in local 4 page by page.
+ * Locals 1 and 2 hold the start and end of the page once block and pc are
+ * written, local 3 the stream.
+ */
+static void snap_method_code(struct codegen *c, struct code *code)
+{
+	code->max_stack = 7;
+	code->max_locals = 5;
+	code->frame_locals[0].tag = JVM_ITEM_OBJECT;
+	code->frame_locals[0].constant_pool_index = get_constant_index(c,
+			to_string_key(DATA_OUTPUT_STREAM_CLASS));
+	code->frame_locals[1].tag = JVM_ITEM_OBJECT;
+	code->frame_locals[1].constant_pool_index = get_constant_index(c,
+			to_string_key(BYTE_ARRAY_CLASS));
+	code->frame_locals_size = 2;
+
+	emit_u8(code->code, JVM_LDC_W);
+	emit_u16(code->code, get_constant_index(c, to_string_key(SNAPSHOT_PATH)));
+	open_snapshot(c, code, DATA_OUTPUT_STREAM_CLASS,
+		      DATA_OUTPUT_INIT_METHODREF, BUFFERED_OUTPUT_STREAM_CLASS,
+		      BUFFERED_OUTPUT_INIT_METHODREF,
+		      FILES_NEW_OUTPUT_STREAM_METHODREF);
+	emit_u8(code->code, JVM_ASTORE_3);
+	push_int(code, SNAPSHOT_PAGE_SIZE);
+	emit_u8(code->code, JVM_NEWARRAY);
+	emit_u8(code->code, JVM_T_BYTE);
+	emit_u8(code->code, JVM_ASTORE);
+	emit_u8(code->code, 4);
+
+	uint32_t header[] = { SNAPSHOT_MAGIC, c->blocks.size };
+	for (size_t i = 0; i < sizeof(header) / sizeof(*header); i++) {
+		emit_u8(code->code, JVM_ALOAD_3);
+		push_int(code, header[i]);
+		invoke(c, code, JVM_INVOKEVIRTUAL, WRITE_INT_METHODREF);
+	}
+	emit_u8(code->code, JVM_ALOAD_3);
+	emit_u8(code->code, JVM_ILOAD_1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WRITE_INT_METHODREF);
+	emit_u8(code->code, JVM_ALOAD_3);
+	emit_u8(code->code, JVM_ILOAD_2);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WRITE_INT_METHODREF);
+	emit_u8(code->code, JVM_ALOAD_3);
+	push_int(code, REGISTER_FILE_SIZE);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WRITE_INT_METHODREF);
+	for (int r = 0; r < REGISTER_FILE_SIZE; r++) {
+		emit_u8(code->code, JVM_ALOAD_3);
+		emit_u8(code->code, JVM_ALOAD_0);
+		emit_u8(code->code, JVM_BIPUSH);
+		emit_u8(code->code, r);
+		emit_u8(code->code, JVM_LALOAD);
+		invoke(c, code, JVM_INVOKEVIRTUAL, WRITE_LONG_METHODREF);
+	}
+
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_ISTORE_1);
+	size_t loop_offset = code->code->size;
+	add_stack_frame(c, code, loop_offset);
+	size_t end_branch;
+	emit_u8(code->code, JVM_ILOAD_1);
+	get_static(c, code, MEMORY_FIELDREF);
+	emit_u8(code->code, JVM_ARRAYLENGTH);
+	branch_forward(code, JVM_IF_ICMPGE, &end_branch);
+	emit_u8(code->code, JVM_ILOAD_1);
+	push_int(code, SNAPSHOT_PAGE_SIZE);
+	emit_u8(code->code, JVM_IADD);
+	get_static(c, code, MEMORY_FIELDREF);
+	emit_u8(code->code, JVM_ARRAYLENGTH);
+	invoke(c, code, JVM_INVOKESTATIC, MATH_MIN_METHODREF);
+	emit_u8(code->code, JVM_ISTORE_2);
+
+	// Arrays.equals(memory, from, to, zeros, 0, to - from)
+	size_t zero_branch;
+	get_static(c, code, MEMORY_FIELDREF);
+	emit_u8(code->code, JVM_ILOAD_1);
+	emit_u8(code->code, JVM_ILOAD_2);
+	emit_u8(code->code, JVM_ALOAD);
+	emit_u8(code->code, 4);
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_ILOAD_2);
+	emit_u8(code->code, JVM_ILOAD_1);
+	emit_u8(code->code, JVM_ISUB);
+	invoke(c, code, JVM_INVOKESTATIC, ARRAYS_EQUALS_METHODREF);
+	branch_forward(code, JVM_IFNE, &zero_branch);
+	emit_u8(code->code, JVM_ALOAD_3);
+	emit_u8(code->code, JVM_ILOAD_1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WRITE_INT_METHODREF);
+	emit_u8(code->code, JVM_ALOAD_3);
+	emit_u8(code->code, JVM_ILOAD_2);
+	emit_u8(code->code, JVM_ILOAD_1);
+	emit_u8(code->code, JVM_ISUB);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WRITE_INT_METHODREF);
+	emit_u8(code->code, JVM_ALOAD_3);
+	get_static(c, code, MEMORY_FIELDREF);
+	emit_u8(code->code, JVM_ILOAD_1);
+	emit_u8(code->code, JVM_ILOAD_2);
+	emit_u8(code->code, JVM_ILOAD_1);
+	emit_u8(code->code, JVM_ISUB);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WRITE_BYTES_METHODREF);
+	land_branch(c, code, zero_branch);
+	emit_u8(code->code, JVM_ILOAD_2);
+	emit_u8(code->code, JVM_ISTORE_1);
+	go_back(code, loop_offset);
+
+	land_branch(c, code, end_branch);
+	emit_u8(code->code, JVM_ALOAD_3);
+	emit_u8(code->code, JVM_ICONST_M1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, WRITE_INT_METHODREF);
+	emit_u8(code->code, JVM_ALOAD_3);
+	invoke(c, code, JVM_INVOKEVIRTUAL, OUTPUT_CLOSE_METHODREF);
+	emit_u8(code->code, JVM_RETURN);
+}
+
+/*
+ * static void resume$(String path) reads the snapshot into memory and
+ * leaves its block and registers for hart. Snapshots of other programs
+ * throw IllegalArgumentException. Local 1 holds the stream, local 2 the
+ * registers and local 3 the address of the page being read.
+ */
+static void resume_method_code(struct codegen *c, struct code *code)
+{
+	code->max_stack = 6;
+	code->max_locals = 4;
+	code->frame_locals[0].tag = JVM_ITEM_OBJECT;
+	code->frame_locals[0].constant_pool_index = get_constant_index(c,
+			to_string_key(DATA_INPUT_STREAM_CLASS));
+	code->frame_locals[1].tag = JVM_ITEM_OBJECT;
+	code->frame_locals[1].constant_pool_index = get_constant_index(c,
+			to_string_key(LONG_ARRAY_CLASS));
+	code->frame_locals[2].tag = JVM_ITEM_INTEGER;
+	code->frame_locals_size = 3;
+
+	emit_u8(code->code, JVM_ALOAD_0);
+	open_snapshot(c, code, DATA_INPUT_STREAM_CLASS,
+		      DATA_INPUT_INIT_METHODREF, BUFFERED_INPUT_STREAM_CLASS,
+		      BUFFERED_INPUT_INIT_METHODREF,
+		      FILES_NEW_INPUT_STREAM_METHODREF);
+	emit_u8(code->code, JVM_ASTORE_1);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, REGISTER_FILE_SIZE);
+	emit_u8(code->code, JVM_NEWARRAY);
+	emit_u8(code->code, JVM_T_LONG);
+	emit_u8(code->code, JVM_ASTORE_2);
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_ISTORE_3);
+
+	size_t mismatches[3];
+	uint32_t header[] = { SNAPSHOT_MAGIC, c->blocks.size };
+	for (size_t i = 0; i < sizeof(header) / sizeof(*header); i++) {
+		emit_u8(code->code, JVM_ALOAD_1);
+		invoke(c, code, JVM_INVOKEVIRTUAL, READ_INT_METHODREF);
+		push_int(code, header[i]);
+		branch_forward(code, JVM_IF_ICMPNE, &mismatches[i]);
+	}
+	emit_u8(code->code, JVM_ALOAD_1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, READ_INT_METHODREF);
+	emit_u8(code->code, JVM_PUTSTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(RESUME_BLOCK_FIELDREF)));
+	// the pc is for people reading the snapshot
+	emit_u8(code->code, JVM_ALOAD_1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, READ_INT_METHODREF);
+	emit_u8(code->code, JVM_POP);
+	emit_u8(code->code, JVM_ALOAD_1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, READ_INT_METHODREF);
+	push_int(code, REGISTER_FILE_SIZE);
+	branch_forward(code, JVM_IF_ICMPNE, &mismatches[2]);
+	for (int r = 0; r < REGISTER_FILE_SIZE; r++) {
+		emit_u8(code->code, JVM_ALOAD_2);
+		emit_u8(code->code, JVM_BIPUSH);
+		emit_u8(code->code, r);
+		emit_u8(code->code, JVM_ALOAD_1);
+		invoke(c, code, JVM_INVOKEVIRTUAL, READ_LONG_METHODREF);
+		emit_u8(code->code, JVM_LASTORE);
+	}
+
+	size_t loop_offset = code->code->size;
+	add_stack_frame(c, code, loop_offset);
+	size_t end_branch;
+	emit_u8(code->code, JVM_ALOAD_1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, READ_INT_METHODREF);
+	emit_u8(code->code, JVM_DUP);
+	emit_u8(code->code, JVM_ISTORE_3);
+	branch_forward(code, JVM_IFLT, &end_branch);
+	emit_u8(code->code, JVM_ALOAD_1);
+	get_static(c, code, MEMORY_FIELDREF);
+	emit_u8(code->code, JVM_ILOAD_3);
+	emit_u8(code->code, JVM_ALOAD_1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, READ_INT_METHODREF);
+	invoke(c, code, JVM_INVOKEVIRTUAL, READ_FULLY_METHODREF);
+	go_back(code, loop_offset);
+
+	land_branch(c, code, end_branch);
+	emit_u8(code->code, JVM_ALOAD_1);
+	invoke(c, code, JVM_INVOKEVIRTUAL, INPUT_CLOSE_METHODREF);
+	emit_u8(code->code, JVM_ALOAD_2);
+	emit_u8(code->code, JVM_PUTSTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(RESUME_REGISTERS_FIELDREF)));
+	emit_u8(code->code, JVM_RETURN);
+
+	for (size_t i = 0; i < sizeof(mismatches) / sizeof(*mismatches); i++) {
+		patch_u16(code->code, mismatches[i] + 1,
+			  code->code->size - mismatches[i]);
+	}
+	add_stack_frame(c, code, code->code->size);
+	emit_u8(code->code, JVM_NEW);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(ILLEGAL_ARGUMENT_CLASS)));
+	emit_u8(code->code, JVM_DUP);
+	emit_u8(code->code, JVM_ALOAD_0);
+	invoke(c, code, JVM_INVOKESPECIAL, ILLEGAL_ARGUMENT_INIT_METHODREF);
+	emit_u8(code->code, JVM_ATHROW);
+}
+
+static void init_method_code(struct codegen *c, struct code *code)
+{
+	code->max_stack = 2;
+	code->max_locals = 2;
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_INVOKESPECIAL);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(OBJECT_INIT_METHODREF)));
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_ILOAD_1);
+	emit_u8(code->code, JVM_PUTFIELD);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(HARTID_FIELDREF)));
+	emit_u8(code->code, JVM_RETURN);
+}
+
+static void run_method_code(struct codegen *c, struct code *code)
+{
+	code->max_stack = 1;
+	code->max_locals = 1;
+	emit_u8(code->code, JVM_ALOAD_0);
+	emit_u8(code->code, JVM_GETFIELD);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(HARTID_FIELDREF)));
+	emit_u8(code->code, JVM_INVOKESTATIC);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(HART_METHODREF)));
+	emit_u8(code->code, JVM_RETURN);
+}
+
+/*
+ * static int lw$(int address) and the other loads, static void
+ * sw$(int address, int value) and the other stores.
+ */
+static void memory_helper_method_code(struct codegen *c, struct code *code,
+				      enum ir_instruction_mnemonic mnemonic)
+{
+	bool store = mnemonic >= SW;
+	code->max_stack = store ? 4 : 3;
+	code->max_locals = store ? 2 : 1;
+	begin_access(c, code, mnemonic);
+	emit_u8(code->code, JVM_ILOAD_0);
+	if (store) {
+		emit_u8(code->code, JVM_ILOAD_1);
+		finish_store(c, code, mnemonic);
+		emit_u8(code->code, JVM_RETURN);
+	} else {
+		finish_load(c, code, mnemonic);
+		emit_u8(code->code, JVM_IRETURN);
+	}
+}
+
+/*
+ * Files.write(Paths.get(path), buffer.array()) with the counters put into
+ * buffer as big endian longs.
+ */
+static void write_profile(struct codegen *c, struct code *code)
+{
+	if (code->max_stack < 4) {
+		code->max_stack = 4;
+	}
+	emit_u8(code->code, JVM_LDC_W);
+	emit_u16(code->code, get_constant_index(c, to_string_key(PROFILE_PATH)));
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_ANEWARRAY);
+	emit_u16(code->code, get_constant_index(c, to_string_key(STRING_CLASS)));
+	invoke(c, code, JVM_INVOKESTATIC, PATHS_GET_METHODREF);
+
+	get_static(c, code, PROFILE_FIELDREF);
+	emit_u8(code->code, JVM_ARRAYLENGTH);
+	emit_u8(code->code, JVM_BIPUSH);
+	emit_u8(code->code, 8);
+	emit_u8(code->code, JVM_IMUL);
+	invoke(c, code, JVM_INVOKESTATIC, ALLOCATE_METHODREF);
+	emit_u8(code->code, JVM_DUP);
+	invoke(c, code, JVM_INVOKEVIRTUAL, AS_LONG_BUFFER_METHODREF);
+	get_static(c, code, PROFILE_FIELDREF);
+	invoke(c, code, JVM_INVOKEVIRTUAL, PUT_METHODREF);
+	emit_u8(code->code, JVM_POP);
+	invoke(c, code, JVM_INVOKEVIRTUAL, ARRAY_METHODREF);
+
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_ANEWARRAY);
+	emit_u16(code->code, get_constant_index(c,
+			to_string_key(OPEN_OPTION_CLASS)));
+	invoke(c, code, JVM_INVOKESTATIC, FILES_WRITE_METHODREF);
+	emit_u8(code->code, JVM_POP);
+}
+
+/*
+ * Starts harts 1 to n - 1 on threads of their own, runs hart 0 on the main
+ * thread and joins the others. The harts share memory, registers are per
+ * thread.
+ */
+static void main_method_code(struct codegen *c, struct code *code)
+{
+	int harts = c->options->harts > 0 ? c->options->harts : 1;
+	code->max_stack = harts > 1 ? 7 : 1;
+	code->max_locals = 2;
+	emit_reserve(code->code, 16 + harts * 34);
+
+	uint16_t thread_idx = get_constant_index(c, to_string_key(THREAD_CLASS));
+	uint16_t this_idx = get_constant_index(c, to_string_key(THIS_CLASS));
+	if (snapshots(c)) {
+		// java RvRuntime snapshot resumes from it
+		if (code->max_stack < 2) {
+			code->max_stack = 2;
+		}
+		size_t no_args;
+		emit_u8(code->code, JVM_ALOAD_0);
+		emit_u8(code->code, JVM_ARRAYLENGTH);
+		branch_forward(code, JVM_IFEQ, &no_args);
+		emit_u8(code->code, JVM_ALOAD_0);
+		emit_u8(code->code, JVM_ICONST_0);
+		emit_u8(code->code, JVM_AALOAD);
+		invoke(c, code, JVM_INVOKESTATIC, RESUME_METHODREF);
+		land_branch(c, code, no_args);
+	}
+	if (harts > 1) {
+		emit_u8(code->code, JVM_SIPUSH);
+		emit_u16(code->code, harts - 1);
+		emit_u8(code->code, JVM_ANEWARRAY);
+		emit_u16(code->code, thread_idx);
+		emit_u8(code->code, JVM_ASTORE_1);
 	}
+	for (int i = 1; i < harts; i++) {
+		// threads[i - 1] = new Thread(new RvRuntime(i)), then start it
+		emit_u8(code->code, JVM_ALOAD_1);
+		emit_u8(code->code, JVM_SIPUSH);
+		emit_u16(code->code, i - 1);
+		emit_u8(code->code, JVM_NEW);
+		emit_u16(code->code, thread_idx);
+		emit_u8(code->code, JVM_DUP);
+		emit_u8(code->code, JVM_NEW);
+		emit_u16(code->code, this_idx);
+		emit_u8(code->code, JVM_DUP);
+		emit_u8(code->code, JVM_SIPUSH);
+		emit_u16(code->code, i);
+		emit_u8(code->code, JVM_INVOKESPECIAL);
+		emit_u16(code->code, get_constant_index(c,
+				to_string_key(THIS_INIT_METHODREF)));
+		emit_u8(code->code, JVM_INVOKESPECIAL);
+		emit_u16(code->code, get_constant_index(c,
+				to_string_key(THREAD_INIT_METHODREF)));
+		emit_u8(code->code, JVM_DUP_X2);
+		emit_u8(code->code, JVM_AASTORE);
+		emit_u8(code->code, JVM_INVOKEVIRTUAL);
+		emit_u16(code->code, get_constant_index(c,
+				to_string_key(THREAD_START_METHODREF)));
+	}
+
+	emit_u8(code->code, JVM_ICONST_0);
+	emit_u8(code->code, JVM_INVOKESTATIC);
+	emit_u16(code->code, get_constant_index(c, to_string_key(HART_METHODREF)));
 
-	write_byte(code->code, JVM_RETURN);
+	for (int i = 1; i < harts; i++) {
+		emit_u8(code->code, JVM_ALOAD_1);
+		emit_u8(code->code, JVM_SIPUSH);
+		emit_u16(code->code, i - 1);
+		emit_u8(code->code, JVM_AALOAD);
+		emit_u8(code->code, JVM_INVOKEVIRTUAL);
+		emit_u16(code->code, get_constant_index(c,
+				to_string_key(THREAD_JOIN_METHODREF)));
+	}
+	if (instrumented(c)) {
+		write_profile(c, code);
+	}
+	emit_u8(code->code, JVM_RETURN);
+}
+
+static void method(struct codegen *c, uint16_t mask, char *name,
+		   char *descriptor,
+		   void (*method_code)(struct codegen*, struct code*))
+{
+	struct code code = create_code();
+	method_code(c, &code);
+	add_method(c, mask, name, descriptor, &code);
+	free_code(&code);
 }
 
 static void methods(struct codegen *c)
 {
-	write_int(c, 2, 2);
+	emit_u16(c->res, 7 + AMO_LOOP_COUNT + DIVISION_COUNT +
+			 outlined_count(c) + has_cold_blocks(c) +
+			 2 * snapshots(c));
 
 	uint16_t mask = JVM_ACC_PUBLIC | JVM_ACC_STATIC | JVM_ACC_SYNTHETIC;
-	struct code clinit_code = create_code();
-	clinit_method_code(c, &clinit_code);
-	add_method(c, mask, CLINIT_METHOD_NAME, NO_ARGS_VOID_DESCRIPTOR,
-		   &clinit_code);
-	free_code(&clinit_code);
-	struct code main_code = create_code();
-	main_method_code(c, &main_code);
-	add_method(c, mask, MAIN_METHOD_NAME, MAIN_METHOD_DESCRIPTOR,
-		   &main_code);
-	free_code(&main_code);
+	method(c, mask, CLINIT_METHOD_NAME, NO_ARGS_VOID_DESCRIPTOR,
+	       clinit_method_code);
+	method(c, JVM_ACC_PUBLIC | JVM_ACC_SYNTHETIC, INIT_METHOD_NAME,
+	       INT_ARG_VOID_DESCRIPTOR, init_method_code);
+	method(c, JVM_ACC_PUBLIC | JVM_ACC_SYNTHETIC, RUN_METHOD_NAME,
+	       NO_ARGS_VOID_DESCRIPTOR, run_method_code);
+	method(c, mask, HART_METHOD_NAME, INT_ARG_VOID_DESCRIPTOR,
+	       hart_method_code);
+	method(c, mask, MAIN_METHOD_NAME, MAIN_METHOD_DESCRIPTOR,
+	       main_method_code);
+
+	uint16_t helper_mask = shared_access(c) | JVM_ACC_STATIC |
+			       JVM_ACC_SYNTHETIC;
+	method(c, helper_mask, LR_METHOD_NAME, LR_METHOD_DESCRIPTOR,
+	       lr_method_code);
+	method(c, helper_mask, SC_METHOD_NAME, SC_METHOD_DESCRIPTOR,
+	       sc_method_code);
+	for (size_t i = 0; i < AMO_LOOP_COUNT; i++) {
+		struct code code = create_code();
+		amo_loop_method_code(c, &code, &amo_loops[i]);
+		add_method(c, helper_mask, amo_loops[i].method.name,
+			   INT_INT_INT_DESCRIPTOR, &code);
+		free_code(&code);
+	}
+	for (size_t i = 0; i < DIVISION_COUNT; i++) {
+		struct code code = create_code();
+		division_method_code(c, &code, &divisions[i]);
+		add_method(c, helper_mask, divisions[i].method.name,
+			   INT_INT_INT_DESCRIPTOR, &code);
+		free_code(&code);
+	}
+	for (size_t i = 0; i < MEMORY_HELPER_COUNT; i++) {
+		if (!c->outlined[i]) {
+			continue;
+		}
+		struct code code = create_code();
+		memory_helper_method_code(c, &code, LW + i);
+		add_method(c, helper_mask, memory_helpers[i].method.name,
+			   memory_helpers[i].descriptor, &code);
+		free_code(&code);
+	}
+	if (has_cold_blocks(c)) {
+		method(c, helper_mask, COLD_METHOD_NAME, COLD_METHOD_DESCRIPTOR,
+		       cold_method_code);
+	}
+	if (snapshots(c)) {
+		method(c, helper_mask, SNAP_METHOD_NAME, SNAP_METHOD_DESCRIPTOR,
+		       snap_method_code);
+		method(c, helper_mask, RESUME_METHOD_NAME,
+		       RESUME_METHOD_DESCRIPTOR, resume_method_code);
+	}
+}
+
+/*
+ * run$ runs the code of the file like cold$ does, called by the stubs of
+ * its entry points.
+ */
+static void unit_methods(struct codegen *c)
+{
+	struct separate_program *program = c->program;
+	size_t stubs = 0;
+	for (size_t i = 0; i < program->entries_n; i++) {
+		stubs += program->entries[i].unit == c->unit;
+	}
+	emit_u16(c->res, 1 + stubs);
+
+	method(c, JVM_ACC_PUBLIC | JVM_ACC_STATIC | JVM_ACC_SYNTHETIC,
+	       UNIT_METHOD_NAME, COLD_METHOD_DESCRIPTOR, cold_method_code);
+	for (size_t i = 0; i < program->entries_n; i++) {
+		struct entry_point *entry = &program->entries[i];
+		if (entry->unit != c->unit) {
+			continue;
+		}
+		struct code code = create_code();
+		entry_method_code(c, &code,
+				  block_of_label(&c->blocks, entry->label));
+		add_method(c, JVM_ACC_PUBLIC | JVM_ACC_STATIC, entry->label,
+			   ENTRY_METHOD_DESCRIPTOR, &code);
+		free_code(&code);
+	}
 }
 
 static void attributes(struct codegen *c)
 {
-	write_int(c, 0, 2);
+	emit_u16(c->res, 0);
+}
+
+static void write_class(struct codegen *c)
+{
+	magic(c);
+	minor_version(c);
+	major_version(c);
+	constant_pool(c);
+	access_flags(c);
+	this_class(c);
+	super_class(c);
+	interfaces(c);
+	fields(c);
+	methods(c);
+	attributes(c);
 }
 
-void generate_bytecode(struct ir_element *ir, struct bytecode *res)
+void generate_bytecode(struct ir_element *ir, struct data *data,
+		       struct compile_options *options, struct bytecode *res)
 {
 	struct codegen codegen;
-	init_codegen(&codegen, ir, res);
-	magic(&codegen);
-	minor_version(&codegen);
-	major_version(&codegen);
-	constant_pool(&codegen);
-	access_flags(&codegen);
-	this_class(&codegen);
-	super_class(&codegen);
-	interfaces(&codegen);
-	fields(&codegen);
-	methods(&codegen);
-	attributes(&codegen);
+	init_codegen(&codegen, ir, data, options, NULL, 0, res);
+	find_locals_for_stack(&codegen);
+	find_runs(&codegen);
+	find_data_chunks(data, &codegen.data_chunks);
+	write_class(&codegen);
 	free_codegen(&codegen);
 }
+
+void generate_runtime(struct separate_program *program, struct data *data,
+		      struct compile_options *options, struct bytecode *res)
+{
+	static struct ir_element no_code[] = { { .type = IR_EOF } };
+	struct codegen codegen;
+	init_codegen(&codegen, no_code, data, options, NULL, 0, res);
+	find_data_chunks(data, &codegen.data_chunks);
+	codegen.program = program;
+	codegen.doublewords = program_has_doublewords(program);
+	codegen.unit_class_keys = malloc(program->units_n *
+					 sizeof(*codegen.unit_class_keys));
+	codegen.entry_keys = malloc(entry_ids(program) *
+				    sizeof(*codegen.entry_keys));
+	if ((codegen.unit_class_keys == NULL && program->units_n > 0) ||
+	    (codegen.entry_keys == NULL && entry_ids(program) > 0)) {
+		fail("Failed to allocate memory for entry points.");
+	}
+	write_class(&codegen);
+	free_codegen(&codegen);
+}
+
+/*
+ * Every block of the file is in run$, the ones of its entry points and
+ * the first one of the file harts start in are entered from hart.
+ */
+void generate_unit(struct separate_program *program, size_t unit,
+		   struct data *data, struct compile_options *options,
+		   struct bytecode *res)
+{
+	struct codegen codegen;
+	struct codegen *c = &codegen;
+	init_codegen(c, program->units[unit].ir, data, options, program, unit,
+		     res);
+	c->base_address = program->units[unit].address;
+	find_runs(c);
+	for (size_t i = 0; i < c->blocks.size; i++) {
+		c->blocks.items[i].placement = BLOCK_COLD;
+	}
+	c->blocks.hot = 0;
+	for (size_t i = 0; i < program->entries_n; i++) {
+		if (program->entries[i].unit == unit) {
+			size_t block = block_of_label(&c->blocks,
+						      program->entries[i].label);
+			c->blocks.items[block].entered_from_other_method = true;
+			block_name(&c->blocks, block);
+		}
+	}
+	if (program->start == (int32_t)program->entries_n &&
+	    program->start_unit == unit) {
+		c->blocks.items[0].entered_from_other_method = true;
+		block_name(&c->blocks, 0);
+	}
+
+	magic(c);
+	minor_version(c);
+	major_version(c);
+	unit_constant_pool(c);
+	emit_u16(c->res, JVM_ACC_PUBLIC | JVM_ACC_SYNTHETIC);
+	this_class(c);
+	super_class(c);
+	emit_u16(c->res, 0);
+	emit_u16(c->res, 0);
+	unit_methods(c);
+	attributes(c);
+	free_codegen(c);
+}
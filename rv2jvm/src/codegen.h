@@ -4,14 +4,19 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "data.h"
+#include "emit.h"
 #include "ir.h"
+#include "options.h"
+#include "separate.h"
 
-struct bytecode {
-	uint8_t *items;
-	size_t size;
-	size_t capacity;
-};
-
-void generate_bytecode(struct ir_element *ir, struct bytecode *res);
+void generate_bytecode(struct ir_element *ir, struct data *data,
+		       struct compile_options *options, struct bytecode *res);
+// runtime class of a separately compiled program and the class of a file
+void generate_runtime(struct separate_program *program, struct data *data,
+		      struct compile_options *options, struct bytecode *res);
+void generate_unit(struct separate_program *program, size_t unit,
+		   struct data *data, struct compile_options *options,
+		   struct bytecode *res);
 
 #endif
@@ -1,18 +1,330 @@
 #include "compiler.h"
 
+#include "cache.h"
 #include "codegen.h"
+#include "darray.h"
+#include "data.h"
+#include "error.h"
+#include "file.h"
+#include "idiom.h"
+#include "interpreter.h"
 #include "parser.h"
 #include "lexer.h"
 #include "seman.h"
+#include "separate.h"
+#include "stats.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-void compile(int filepaths_n, char **filepaths, struct bytecode *res)
-{
-	struct tokens tokens = { 0 };
-	lex(filepaths_n, filepaths, &tokens);
+/*
+ * Parsed form of one input file. Label names in ir point either into the
+ * lexemes of tokens or, when the file was loaded from the cache, into the
+ * strings of the cache fragment.
+ */
+struct unit {
+	struct tokens tokens;
+	struct cache_fragment cached;
 	struct ir_element *ir;
-	parse(tokens, &ir);
+};
+
+static size_t ir_length(struct ir_element *ir)
+{
+	size_t length = 0;
+	while (ir[length].type != IR_EOF) {
+		length++;
+	}
+	return length;
+}
+
+static void parse_unit(struct source *source, struct compile_options *options,
+		       struct unit *unit)
+{
+	struct compile_stats *stats = options->stats;
+	struct stats_timer timer;
+
+	size_t length = source->length;
+	uint64_t key = 0;
+
+	if (options->cache_dir != NULL) {
+		key = cache_key(source->text, length, options);
+		if (cache_load(options->cache_dir, key, source->text, length,
+			       &unit->cached)) {
+			unit->ir = unit->cached.ir;
+			if (stats != NULL) {
+				stats->cache_hits++;
+			}
+			return;
+		}
+		if (stats != NULL) {
+			stats->cache_misses++;
+		}
+	}
+
+	struct phase_stats lex_before = { 0 };
+	struct phase_stats parse_before = { 0 };
+	if (stats != NULL) {
+		lex_before = stats->phases[STATS_LEX];
+		parse_before = stats->phases[STATS_PARSE];
+	}
+
+	stats_begin(stats, &timer);
+	lex(source->text, source->name, &unit->tokens);
+	stats_end(stats, STATS_LEX, &timer,
+		  unit->tokens.size * sizeof(*unit->tokens.items));
+
+	stats_begin(stats, &timer);
+	parse(unit->tokens, &unit->ir);
+	stats_end(stats, STATS_PARSE, &timer,
+		  ir_length(unit->ir) * sizeof(*unit->ir));
+
+	// lex and parse run once per file, report the sum over all files
+	if (stats != NULL) {
+		stats_accumulate(&stats->phases[STATS_LEX], &lex_before);
+		stats_accumulate(&stats->phases[STATS_PARSE], &parse_before);
+		stats->tokens += unit->tokens.size;
+	}
+
+	if (options->cache_dir != NULL) {
+		cache_store(options->cache_dir, key, source->text, length,
+			    unit->ir);
+	}
+}
+
+static void free_unit(struct unit *unit)
+{
+	if (unit->cached.ir != NULL) {
+		free_cache_fragment(&unit->cached);
+	} else {
+		free_ir(unit->ir);
+	}
+	free_tokens(&unit->tokens);
+}
+
+/*
+ * Concatenates the IR of all units into one program terminated by IR_EOF.
+ */
+static struct ir_element *link_units(int units_n, struct unit *units)
+{
+	size_t length = 0;
+	for (int i = 0; i < units_n; i++) {
+		length += ir_length(units[i].ir);
+	}
+	struct ir_element *ir = malloc((length + 1) * sizeof(*ir));
+	if (ir == NULL) {
+		fail("Failed to allocate memory for IR.");
+	}
+	size_t position = 0;
+	for (int i = 0; i < units_n; i++) {
+		size_t unit_length = ir_length(units[i].ir);
+		memcpy(&ir[position], units[i].ir, unit_length * sizeof(*ir));
+		position += unit_length;
+	}
+	ir[position].type = IR_EOF;
+	return ir;
+}
+
+/*
+ * Parses, links and checks the sources into one program of IR, which the
+ * units it was made of still own the strings of, and moves its data
+ * segment into data.
+ */
+static struct ir_element *front_end(int sources_n, struct source *sources,
+				    struct compile_options *options,
+				    struct unit **units_res, struct data *data)
+{
+	struct compile_stats *stats = options->stats;
+	struct stats_timer timer;
+
+	struct unit *units = calloc(sources_n, sizeof(*units));
+	if (units == NULL) {
+		fail("Failed to allocate memory for units.");
+	}
+	for (int i = 0; i < sources_n; i++) {
+		if (stats != NULL) {
+			stats->input_bytes += sources[i].length;
+		}
+		parse_unit(&sources[i], options, &units[i]);
+	}
+	struct ir_element *ir = link_units(sources_n, units);
+	if (stats != NULL) {
+		stats->ir_elements = ir_length(ir);
+	}
+
+	stats_begin(stats, &timer);
 	seman(ir);
-	generate_bytecode(ir, res);
+	extract_data(ir, data);
+	fuse_idioms(ir, data, stats);
+	stats_end(stats, STATS_SEMAN, &timer, 0);
+
+	*units_res = units;
+	return ir;
+}
+
+static void free_front_end(int sources_n, struct unit *units,
+			   struct ir_element *ir, struct data *data)
+{
+	free_data(data);
+	free(ir);
+	for (int i = 0; i < sources_n; i++) {
+		free_unit(&units[i]);
+	}
+	free(units);
+}
+
+void compile_sources(int sources_n, struct source *sources,
+		     struct compile_options *options, struct bytecode *res)
+{
+	struct compile_stats *stats = options->stats;
+	struct stats_timer timer;
+
+	struct unit *units;
+	struct data data;
+	struct ir_element *ir = front_end(sources_n, sources, options, &units,
+					  &data);
+
+	stats_begin(stats, &timer);
+	generate_bytecode(ir, &data, options, res);
+	stats_end(stats, STATS_CODEGEN, &timer, res->size);
+
+	if (stats != NULL) {
+		stats->class_bytes = res->size;
+	}
+
+	free_front_end(sources_n, units, ir, &data);
+}
+
+// malloc, not strdup, so that a recovery frees the copy on an error
+static char *copy_string(char *string)
+{
+	size_t length = strlen(string) + 1;
+	char *copy = malloc(length);
+	if (copy == NULL) {
+		fail("Failed to allocate memory for class name.");
+	}
+	memcpy(copy, string, length);
+	return copy;
+}
+
+static void separate_sources(int sources_n, struct source *sources,
+			     struct compile_options *options,
+			     struct class_files *res)
+{
+	struct compile_stats *stats = options->stats;
+	struct stats_timer timer;
+
+	struct unit *units;
+	struct data data;
+	struct ir_element *ir = front_end(sources_n, sources, options, &units,
+					  &data);
+
+	struct ir_element **unit_irs = malloc(sources_n * sizeof(*unit_irs));
+	char **paths = malloc(sources_n * sizeof(*paths));
+	if (unit_irs == NULL || paths == NULL) {
+		fail("Failed to allocate memory for units.");
+	}
+	for (int i = 0; i < sources_n; i++) {
+		unit_irs[i] = units[i].ir;
+		paths[i] = sources[i].name;
+	}
+	struct separate_program program;
+	char *runtime_class = options->class_name != NULL
+			      ? options->class_name : DEFAULT_CLASS_NAME;
+	separate_units(ir, sources_n, unit_irs, paths, runtime_class,
+		       &program);
+
+	stats_begin(stats, &timer);
+	size_t class_bytes = 0;
+	for (size_t i = 0; i <= program.units_n; i++) {
+		struct class_file file = { 0 };
+		if (i == 0) {
+			file.name = copy_string(runtime_class);
+			generate_runtime(&program, &data, options,
+					 &file.bytecode);
+		} else {
+			file.name = copy_string(program.units[i - 1].class_name);
+			generate_unit(&program, i - 1, &data, options,
+				      &file.bytecode);
+		}
+		class_bytes += file.bytecode.size;
+		darray_append((*res), file);
+	}
+	stats_end(stats, STATS_CODEGEN, &timer, class_bytes);
+
+	if (stats != NULL) {
+		stats->class_bytes = class_bytes;
+	}
+
+	free_separate_program(&program);
+	free(paths);
+	free(unit_irs);
+	free_front_end(sources_n, units, ir, &data);
+}
+
+void run_sources(int sources_n, struct source *sources,
+		 struct compile_options *options, FILE *out)
+{
+	struct unit *units;
+	struct data data;
+	struct ir_element *ir = front_end(sources_n, sources, options, &units,
+					  &data);
+	interpret(ir, &data, options, out);
+	free_front_end(sources_n, units, ir, &data);
+}
+
+static struct source *read_sources(int filepaths_n, char **filepaths)
+{
+	struct source *sources = malloc(filepaths_n * sizeof(*sources));
+	if (sources == NULL) {
+		fail("Failed to allocate memory for sources.");
+	}
+	for (int i = 0; i < filepaths_n; i++) {
+		sources[i].name = filepaths[i];
+		sources[i].text = read_file(filepaths[i]);
+		sources[i].length = strlen(sources[i].text);
+	}
+	return sources;
+}
+
+static void free_sources(int sources_n, struct source *sources)
+{
+	for (int i = 0; i < sources_n; i++) {
+		free(sources[i].text);
+	}
+	free(sources);
+}
+
+void compile(int filepaths_n, char **filepaths,
+	     struct compile_options *options, struct bytecode *res)
+{
+	struct source *sources = read_sources(filepaths_n, filepaths);
+	compile_sources(filepaths_n, sources, options, res);
+	free_sources(filepaths_n, sources);
+}
+
+void run(int filepaths_n, char **filepaths, struct compile_options *options,
+	 FILE *out)
+{
+	struct source *sources = read_sources(filepaths_n, filepaths);
+	run_sources(filepaths_n, sources, options, out);
+	free_sources(filepaths_n, sources);
+}
+
+void compile_separately(int filepaths_n, char **filepaths,
+			struct compile_options *options,
+			struct class_files *res)
+{
+	struct source *sources = read_sources(filepaths_n, filepaths);
+	separate_sources(filepaths_n, sources, options, res);
+	free_sources(filepaths_n, sources);
+}
+
+void free_class_files(struct class_files *files)
+{
+	for (size_t i = 0; i < files->size; i++) {
+		free(files->items[i].name);
+		darray_free(files->items[i].bytecode);
+	}
+	darray_free((*files));
 }
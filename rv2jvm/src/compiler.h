@@ -1,8 +1,54 @@
 #ifndef RV2JVM_COMPILER_H
 #define RV2JVM_COMPILER_H
 
+#include <stddef.h>
+#include <stdio.h>
+
 #include "codegen.h"
+#include "options.h"
+
+/*
+ * One input file. text is NUL terminated and length excludes the NUL.
+ */
+struct source {
+	char *name;
+	char *text;
+	size_t length;
+};
+
+/*
+ * A class of a separately compiled program, name is its binary name.
+ */
+struct class_file {
+	char *name;
+	struct bytecode bytecode;
+};
+
+struct class_files {
+	struct class_file *items;
+	size_t size;
+	size_t capacity;
+};
 
-void compile(int filepaths_n, char **filepaths, struct bytecode *res);
+void compile_sources(int sources_n, struct source *sources,
+		     struct compile_options *options, struct bytecode *res);
+void compile(int filepaths_n, char **filepaths,
+	     struct compile_options *options, struct bytecode *res);
+/*
+ * Compile every source into a class of its own and the runtime class, which
+ * comes first in res, see separate.h.
+ */
+void compile_separately(int filepaths_n, char **filepaths,
+			struct compile_options *options,
+			struct class_files *res);
+void free_class_files(struct class_files *files);
+/*
+ * Interpret the program instead of compiling it and print the registers the
+ * harts end with to out.
+ */
+void run_sources(int sources_n, struct source *sources,
+		 struct compile_options *options, FILE *out);
+void run(int filepaths_n, char **filepaths, struct compile_options *options,
+	 FILE *out);
 
 #endif
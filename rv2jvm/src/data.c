@@ -0,0 +1,326 @@
+#include "data.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "ir.h"
+#include "table.h"
+
+/*
+ * Files start in .text, .data switches to the data segment and .text back.
+ * Labels in .data have the address of the data that follows them, labels
+ * in .text the guest code address of the next instruction, see idiom.c.
+ * Once laid out, the directives and data labels are removed from the IR
+ * and the rest of the compiler only sees code.
+ */
+#define INSTRUCTION_SIZE 4
+// .align takes a power of two up to a page
+#define MAX_ALIGN 12
+
+struct label_address {
+	uint32_t address;
+	bool data;
+};
+
+static bool is_directive(struct ir_element *it, char *name)
+{
+	return it->type == IR_DIRECTIVE &&
+	       strcmp(it->as.directive.name, name) == 0;
+}
+
+bool is_global_directive(struct ir_element *it)
+{
+	return is_directive(it, ".globl") || is_directive(it, ".global");
+}
+
+static bool is_label_operand(char *operand)
+{
+	return operand[0] != '-' && (operand[0] < '0' || operand[0] > '9');
+}
+
+static int64_t number(struct ir_directive *directive, char *operand,
+		      int64_t min, int64_t max)
+{
+	char *endptr;
+	long long value = strtoll(operand, &endptr, 10);
+	if (*endptr != '\0' || value < min || value > max) {
+		fail("Error: Operand %s of %s out of range.",
+			operand, directive->name);
+	}
+	return value;
+}
+
+/*
+ * Decodes a string literal into out, followed by a NUL, unless out is
+ * NULL. Returns the number of bytes with the NUL. The lexer checked the
+ * escapes.
+ */
+static size_t string_bytes(char *literal, uint8_t *out)
+{
+	size_t length = 0;
+	for (char *it = literal + 1; *it != '"'; it++) {
+		char c = *it;
+		if (c == '\\') {
+			it++;
+			switch (*it) {
+			case 'n': c = '\n'; break;
+			case 't': c = '\t'; break;
+			case 'r': c = '\r'; break;
+			case '0': c = '\0'; break;
+			default: c = *it; break;
+			}
+		}
+		if (out != NULL) {
+			out[length] = c;
+		}
+		length++;
+	}
+	if (out != NULL) {
+		out[length] = '\0';
+	}
+	return length + 1;
+}
+
+// size of the elements of .word, .half and .byte, 0 for other directives
+static size_t element_size(char *name)
+{
+	if (strcmp(name, ".word") == 0) {
+		return 4;
+	}
+	if (strcmp(name, ".half") == 0) {
+		return 2;
+	}
+	return strcmp(name, ".byte") == 0 ? 1 : 0;
+}
+
+/*
+ * Bytes a directive at offset takes, the padding in the case of .align.
+ */
+static uint64_t directive_size(struct ir_directive *directive, uint64_t offset)
+{
+	char **operands = directive->operands.items;
+	if (strcmp(directive->name, ".zero") == 0) {
+		return number(directive, operands[0], 0, DATA_LIMIT);
+	}
+	if (strcmp(directive->name, ".align") == 0) {
+		uint64_t align = 1 << number(directive, operands[0], 0,
+					     MAX_ALIGN);
+		return (align - offset % align) % align;
+	}
+	if (strcmp(directive->name, ".string") == 0 ||
+	    strcmp(directive->name, ".asciz") == 0) {
+		uint64_t size = 0;
+		for (size_t i = 0; i < directive->operands.size; i++) {
+			size += string_bytes(operands[i], NULL);
+		}
+		return size;
+	}
+	return directive->operands.size * element_size(directive->name);
+}
+
+static void add_label(struct table *labels, char *name, uint32_t address,
+		      bool data)
+{
+	struct label_address *value = malloc(sizeof(*value));
+	if (value == NULL) {
+		fail("Failed to allocate memory for label_address.");
+	}
+	value->address = address;
+	value->data = data;
+	table_set(labels, to_string_key(name), value);
+}
+
+static struct label_address *find_label(struct table *labels, char *name)
+{
+	struct table_value *value = table_get(labels, to_string_key(name));
+	if (value == NULL) {
+		fail("Error: Referenced label '%s' not found.",
+			name);
+	}
+	return value->value;
+}
+
+/*
+ * Assigns addresses to all labels and returns the size of the data
+ * segment.
+ */
+static size_t layout(struct ir_element *ir, struct table *labels)
+{
+	bool in_data = false;
+	uint64_t offset = 0;
+	uint32_t address = 0;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		switch (it->type) {
+		case IR_INSTRUCTION:
+			if (in_data) {
+				fail("Error: Instruction in .data.");
+			}
+			address += INSTRUCTION_SIZE;
+			break;
+		case IR_LABEL:
+			add_label(labels, it->as.label.name,
+				  in_data ? offset : address, in_data);
+			break;
+		case IR_DIRECTIVE:
+			if (is_directive(it, ".data") || is_directive(it, ".text")) {
+				in_data = is_directive(it, ".data");
+				break;
+			}
+			if (is_global_directive(it)) {
+				break;
+			}
+			if (!in_data) {
+				fail("Error: %s outside of .data.",
+					it->as.directive.name);
+			}
+			offset += directive_size(&it->as.directive, offset);
+			if (offset > DATA_LIMIT) {
+				fail("Error: Data segment larger than %d bytes.",
+					DATA_LIMIT);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return offset;
+}
+
+static void write_directive(struct data *data, struct ir_directive *directive,
+			    size_t *offset)
+{
+	char **operands = directive->operands.items;
+	size_t size = element_size(directive->name);
+	if (size == 0) {
+		if (strcmp(directive->name, ".string") == 0 ||
+		    strcmp(directive->name, ".asciz") == 0) {
+			for (size_t i = 0; i < directive->operands.size; i++) {
+				*offset += string_bytes(operands[i],
+							&data->image[*offset]);
+			}
+		} else {
+			// .zero and .align, memory starts out zero
+			*offset += directive_size(directive, *offset);
+		}
+		return;
+	}
+	// signed or unsigned, as long as it fits
+	int64_t min = -((int64_t)1 << (size * 8 - 1));
+	int64_t max = ((int64_t)1 << (size * 8)) - 1;
+	for (size_t i = 0; i < directive->operands.size; i++) {
+		uint32_t value;
+		if (is_label_operand(operands[i])) {
+			value = find_label(data->labels, operands[i])->address;
+		} else {
+			value = number(directive, operands[i], min, max);
+		}
+		for (size_t byte = 0; byte < size; byte++) {
+			data->image[*offset + byte] = value >> (byte * 8);
+		}
+		*offset += size;
+	}
+}
+
+// label control goes to, call and jalr with %pcrel_lo included
+static char *jump_target(struct ir_instruction *instruction)
+{
+	switch (instruction->type) {
+	case TYPE_R1_OP:
+		return instruction->as.r1op.op_type == OPERAND_LABEL
+		       ? instruction->as.r1op.op.label : NULL;
+	case TYPE_R2_OP:
+		if (instruction->as.r2op.op_type == OPERAND_IMM) {
+			return NULL;
+		}
+		return instruction->as.r2op.op_type == OPERAND_LABEL ||
+		       instruction->mnemonic == JALR
+		       ? instruction->as.r2op.op.label : NULL;
+	default:
+		return NULL;
+	}
+}
+
+void extract_data(struct ir_element *ir, struct data *res)
+{
+	res->labels = table_create();
+	res->size = layout(ir, res->labels);
+	res->image = calloc(res->size > 0 ? res->size : 1, 1);
+	if (res->image == NULL) {
+		fail("Failed to allocate memory for the data segment.");
+	}
+
+	size_t offset = 0;
+	struct ir_element *code = ir;
+	bool in_data = false;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		switch (it->type) {
+		case IR_DIRECTIVE:
+			if (is_directive(it, ".data") || is_directive(it, ".text")) {
+				in_data = is_directive(it, ".data");
+			} else if (!is_global_directive(it)) {
+				write_directive(res, &it->as.directive, &offset);
+			}
+			continue;
+		case IR_LABEL:
+			if (in_data) {
+				continue;
+			}
+			break;
+		case IR_INSTRUCTION: {
+			char *target = jump_target(&it->as.instruction);
+			if (target != NULL && find_label(res->labels, target)->data) {
+				fail("Error: Jump to data label '%s'.",
+					target);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		*code++ = *it;
+	}
+	code->type = IR_EOF;
+}
+
+size_t code_elements(struct ir_element *ir)
+{
+	size_t elements = 0;
+	bool in_data = false;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		if (is_directive(it, ".data") || is_directive(it, ".text")) {
+			in_data = is_directive(it, ".data");
+		}
+		elements += it->type == IR_INSTRUCTION ||
+			    (it->type == IR_LABEL && !in_data);
+	}
+	return elements;
+}
+
+bool data_label_address(struct data *data, char *label, uint32_t *address)
+{
+	struct table_value *value = table_get(data->labels,
+					      to_string_key(label));
+	if (value == NULL || !((struct label_address*)value->value)->data) {
+		return false;
+	}
+	*address = ((struct label_address*)value->value)->address;
+	return true;
+}
+
+uint32_t memory_size(struct data *data)
+{
+	// whole words, the word view does not reach into a partial one
+	uint32_t size = (data->size + 7) & ~(uint32_t)7;
+	return size > MEMORY_SIZE ? size : MEMORY_SIZE;
+}
+
+void free_data(struct data *data)
+{
+	free(data->image);
+	table_free(data->labels);
+}
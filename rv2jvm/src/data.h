@@ -0,0 +1,39 @@
+#ifndef RV2JVM_DATA_H
+#define RV2JVM_DATA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ir.h"
+#include "table.h"
+
+/*
+ * Guest memory starts with the data segment, the contents of the .data
+ * sections of all files in order, and is zero after it. It holds at least
+ * MEMORY_SIZE bytes and grows with the data segment up to DATA_LIMIT.
+ */
+#define MEMORY_SIZE 8192
+#define DATA_LIMIT (16 * 1024 * 1024)
+
+struct data {
+	// initial contents of memory from address 0
+	uint8_t *image;
+	size_t size;
+	// addresses of the labels in .data sections
+	struct table *labels;
+};
+
+void extract_data(struct ir_element *ir, struct data *res);
+/*
+ * Number of elements of the IR of one file that extract_data() keeps, its
+ * instructions and the labels in .text.
+ */
+size_t code_elements(struct ir_element *ir);
+// .globl and .global, which mark labels other files can jump to
+bool is_global_directive(struct ir_element *it);
+bool data_label_address(struct data *data, char *label, uint32_t *address);
+uint32_t memory_size(struct data *data);
+void free_data(struct data *data);
+
+#endif
@@ -0,0 +1,27 @@
+#include "emit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+
+#define EMIT_MIN_CAPACITY 64
+
+void emit_reserve(struct bytecode *out, size_t length)
+{
+	size_t needed = out->size + length;
+	if (needed <= out->capacity) {
+		return;
+	}
+	size_t capacity = out->capacity == 0 ? EMIT_MIN_CAPACITY
+					     : out->capacity * 2;
+	while (capacity < needed) {
+		capacity *= 2;
+	}
+	uint8_t *items = realloc(out->items, capacity);
+	if (items == NULL) {
+		fail("Failed to allocate memory for bytecode.");
+	}
+	out->items = items;
+	out->capacity = capacity;
+}
@@ -0,0 +1,129 @@
+#ifndef RV2JVM_EMIT_H
+#define RV2JVM_EMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Growable byte buffer, used as the sink for class files and everything
+ * else rv2jvm writes.
+ */
+struct bytecode {
+	uint8_t *items;
+	size_t size;
+	size_t capacity;
+};
+
+/*
+ * Makes room for at least length more bytes. Callers that know the size
+ * of what they are about to append reserve it up front so the put helpers
+ * below never reallocate.
+ */
+void emit_reserve(struct bytecode *out, size_t length);
+
+/*
+ * Append helpers. Integers are written big endian as in class files.
+ */
+static inline void emit_u8(struct bytecode *out, uint8_t value)
+{
+	if (out->size == out->capacity) {
+		emit_reserve(out, 1);
+	}
+	out->items[out->size++] = value;
+}
+
+static inline void emit_u16(struct bytecode *out, uint16_t value)
+{
+	if (out->capacity - out->size < 2) {
+		emit_reserve(out, 2);
+	}
+	out->items[out->size] = value >> 8;
+	out->items[out->size + 1] = value;
+	out->size += 2;
+}
+
+static inline void emit_u32(struct bytecode *out, uint32_t value)
+{
+	if (out->capacity - out->size < 4) {
+		emit_reserve(out, 4);
+	}
+	out->items[out->size] = value >> 24;
+	out->items[out->size + 1] = value >> 16;
+	out->items[out->size + 2] = value >> 8;
+	out->items[out->size + 3] = value;
+	out->size += 4;
+}
+
+/*
+ * Little endian variants, for the ZIP structures of JAR files.
+ */
+static inline void emit_u16_le(struct bytecode *out, uint16_t value)
+{
+	if (out->capacity - out->size < 2) {
+		emit_reserve(out, 2);
+	}
+	out->items[out->size] = value;
+	out->items[out->size + 1] = value >> 8;
+	out->size += 2;
+}
+
+static inline void emit_u32_le(struct bytecode *out, uint32_t value)
+{
+	if (out->capacity - out->size < 4) {
+		emit_reserve(out, 4);
+	}
+	out->items[out->size] = value;
+	out->items[out->size + 1] = value >> 8;
+	out->items[out->size + 2] = value >> 16;
+	out->items[out->size + 3] = value >> 24;
+	out->size += 4;
+}
+
+static inline void emit_bytes(struct bytecode *out, const void *bytes,
+			      size_t length)
+{
+	if (out->capacity - out->size < length) {
+		emit_reserve(out, length);
+	}
+	if (length > 0) {
+		memcpy(&out->items[out->size], bytes, length);
+	}
+	out->size += length;
+}
+
+/*
+ * Placeholders for lengths and offsets that are only known later. They
+ * return the position to hand to the matching patch function.
+ */
+static inline size_t emit_placeholder_u16(struct bytecode *out)
+{
+	size_t position = out->size;
+	emit_u16(out, 0);
+	return position;
+}
+
+static inline size_t emit_placeholder_u32(struct bytecode *out)
+{
+	size_t position = out->size;
+	emit_u32(out, 0);
+	return position;
+}
+
+static inline void patch_u16(struct bytecode *out, size_t position,
+			     uint16_t value)
+{
+	out->items[position] = value >> 8;
+	out->items[position + 1] = value;
+}
+
+static inline void patch_u32(struct bytecode *out, size_t position,
+			     uint32_t value)
+{
+	out->items[position] = value >> 24;
+	out->items[position + 1] = value >> 16;
+	out->items[position + 2] = value >> 8;
+	out->items[position + 3] = value;
+}
+
+#endif
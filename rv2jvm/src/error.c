@@ -0,0 +1,246 @@
+#include "error.h"
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "darray.h"
+
+#define ALLOCATIONS_MIN_CAPACITY 64
+
+static _Thread_local struct recovery *current;
+// marks a freed slot, so that probing goes on past it
+static char tombstone;
+
+static size_t allocation_slot(struct allocations *allocations, void *pointer)
+{
+	uint64_t hash = ((uintptr_t)pointer >> 4) * 0x9e3779b97f4a7c15u;
+	return (hash ^ hash >> 32) & (allocations->capacity - 1);
+}
+
+static void insert_allocation(struct allocations *allocations, void *pointer)
+{
+	size_t i = allocation_slot(allocations, pointer);
+	while (allocations->items[i] != NULL &&
+	       allocations->items[i] != &tombstone) {
+		i = (i + 1) & (allocations->capacity - 1);
+	}
+	allocations->used += allocations->items[i] == NULL;
+	allocations->items[i] = pointer;
+	allocations->size++;
+}
+
+/*
+ * Rehashes into a table twice as large as the live pointers need, which
+ * also drops the tombstones.
+ */
+static bool grow_allocations(struct allocations *allocations)
+{
+	struct allocations old = *allocations;
+	size_t capacity = ALLOCATIONS_MIN_CAPACITY;
+	while (capacity < (old.size + 1) * 4) {
+		capacity *= 2;
+	}
+	allocations->items = calloc(capacity, sizeof(*allocations->items));
+	if (allocations->items == NULL) {
+		*allocations = old;
+		return false;
+	}
+	allocations->capacity = capacity;
+	allocations->size = 0;
+	allocations->used = 0;
+	for (size_t i = 0; i < old.capacity; i++) {
+		if (old.items[i] != NULL && old.items[i] != &tombstone) {
+			insert_allocation(allocations, old.items[i]);
+		}
+	}
+	free(old.items);
+	return true;
+}
+
+/*
+ * The set itself is not tracked, current is cleared while it changes.
+ * When the set cannot grow, pointer is freed and the compilation fails
+ * back to the recovery, which still frees everything else.
+ */
+void track_allocation(void *pointer)
+{
+	struct recovery *recovery = current;
+	if (recovery == NULL || pointer == NULL) {
+		return;
+	}
+	current = NULL;
+	struct allocations *allocations = &recovery->allocations;
+	if ((allocations->used + 1) * 2 > allocations->capacity &&
+	    !grow_allocations(allocations)) {
+		free(pointer);
+		current = recovery;
+		fail("Failed to allocate memory for allocations.");
+	}
+	insert_allocation(allocations, pointer);
+	current = recovery;
+}
+
+void untrack_allocation(void *pointer)
+{
+	struct recovery *recovery = current;
+	if (recovery == NULL || pointer == NULL ||
+	    recovery->allocations.capacity == 0) {
+		return;
+	}
+	struct allocations *allocations = &recovery->allocations;
+	size_t i = allocation_slot(allocations, pointer);
+	while (allocations->items[i] != NULL) {
+		if (allocations->items[i] == pointer) {
+			allocations->items[i] = &tombstone;
+			allocations->size--;
+			return;
+		}
+		i = (i + 1) & (allocations->capacity - 1);
+	}
+}
+
+static void free_allocations(struct allocations *allocations)
+{
+	for (size_t i = 0; i < allocations->capacity; i++) {
+		if (allocations->items[i] != NULL &&
+		    allocations->items[i] != &tombstone) {
+			free(allocations->items[i]);
+		}
+	}
+	free(allocations->items);
+	*allocations = (struct allocations) { 0 };
+}
+
+/*
+ * Diagnostics outlive the compilation, so they are allocated untracked.
+ */
+static void record(struct recovery *recovery, enum severity severity,
+		   char *file, size_t line, const char *format, va_list args)
+{
+	current = NULL;
+	va_list copy;
+	va_copy(copy, args);
+	int length = vsnprintf(NULL, 0, format, copy);
+	va_end(copy);
+	struct diagnostic diagnostic = {
+		.severity = severity,
+		.file = file != NULL ? strdup(file) : NULL,
+		.line = line,
+		.message = malloc(length > 0 ? length + 1 : 1)
+	};
+	if (diagnostic.message != NULL) {
+		vsnprintf(diagnostic.message, length > 0 ? length + 1 : 1,
+			  format, args);
+		darray_append(recovery->diagnostics, diagnostic);
+	}
+	current = recovery;
+}
+
+static void report(enum severity severity, char *file, size_t line,
+		   const char *format, va_list args)
+{
+	if (current != NULL) {
+		record(current, severity, file, line, format, args);
+		return;
+	}
+	vfprintf(stderr, format, args);
+	if (file != NULL) {
+		fprintf(stderr, " at %s line %zu", file, line);
+	}
+	fputc('\n', stderr);
+}
+
+__attribute__((noreturn))
+static void stop(int status)
+{
+	struct recovery *recovery = current;
+	if (recovery == NULL) {
+		exit(status);
+	}
+	recovery->status = status;
+	current = NULL;
+	free_allocations(&recovery->allocations);
+	current = recovery;
+	longjmp(recovery->env, 1);
+}
+
+void fail(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	report(SEVERITY_ERROR, NULL, 0, format, args);
+	va_end(args);
+	stop(EXIT_FAILURE);
+}
+
+void fail_with(int status, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	report(SEVERITY_ERROR, NULL, 0, format, args);
+	va_end(args);
+	stop(status);
+}
+
+void fail_at(char *file, size_t line, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	report(SEVERITY_ERROR, file, line, format, args);
+	va_end(args);
+	stop(EXIT_FAILURE);
+}
+
+void warn(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	report(SEVERITY_WARNING, NULL, 0, format, args);
+	va_end(args);
+}
+
+void begin_recovery(struct recovery *recovery)
+{
+	recovery->status = 0;
+	recovery->diagnostics = (struct diagnostics) { 0 };
+	recovery->allocations = (struct allocations) { 0 };
+	current = recovery;
+}
+
+void end_recovery(struct recovery *recovery)
+{
+	current = NULL;
+	free(recovery->allocations.items);
+	recovery->allocations = (struct allocations) { 0 };
+}
+
+void free_diagnostics(struct diagnostics *diagnostics)
+{
+	for (size_t i = 0; i < diagnostics->size; i++) {
+		free(diagnostics->items[i].file);
+		free(diagnostics->items[i].message);
+	}
+	darray_free((*diagnostics));
+}
+
+void print_diagnostics(FILE *stream, const char *prefix,
+		       struct diagnostics *diagnostics)
+{
+	for (size_t i = 0; i < diagnostics->size; i++) {
+		struct diagnostic *diagnostic = &diagnostics->items[i];
+		if (prefix != NULL) {
+			fprintf(stream, "%s: ", prefix);
+		}
+		fputs(diagnostic->message, stream);
+		if (diagnostic->file != NULL) {
+			fprintf(stream, " at %s line %zu", diagnostic->file,
+				diagnostic->line);
+		}
+		fputc('\n', stream);
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef RV2JVM_ERROR_H
+#define RV2JVM_ERROR_H
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Errors end the compilation. The command line tool prints them to stderr
+ * and exits, a compilation run under a recovery (see librv2jvm.c) records
+ * them, frees everything it allocated and returns to where it started.
+ */
+enum severity {
+	SEVERITY_WARNING,
+	SEVERITY_ERROR
+};
+
+struct diagnostic {
+	enum severity severity;
+	// source and line the message is about, NULL and 0 if none
+	char *file;
+	size_t line;
+	char *message;
+};
+
+struct diagnostics {
+	struct diagnostic *items;
+	size_t size;
+	size_t capacity;
+};
+
+// pointers allocated during a recovery, an open addressing hash set
+struct allocations {
+	void **items;
+	size_t size;
+	size_t used;
+	size_t capacity;
+};
+
+struct recovery {
+	jmp_buf env;
+	// exit status of the error, 0 until there is one
+	int status;
+	struct diagnostics diagnostics;
+	struct allocations allocations;
+};
+
+__attribute__((noreturn, format(printf, 1, 2)))
+void fail(const char *format, ...);
+__attribute__((noreturn, format(printf, 2, 3)))
+void fail_with(int status, const char *format, ...);
+// appends " at file line n" to the message
+__attribute__((noreturn, format(printf, 3, 4)))
+void fail_at(char *file, size_t line, const char *format, ...);
+__attribute__((format(printf, 1, 2)))
+void warn(const char *format, ...);
+
+/*
+ * Errors on this thread go back to setjmp(recovery->env) until
+ * end_recovery(), which the caller has to call after setjmp() returned
+ * nonzero as well. Allocations in between are freed on an error and
+ * left alone otherwise.
+ */
+void begin_recovery(struct recovery *recovery);
+void end_recovery(struct recovery *recovery);
+void free_diagnostics(struct diagnostics *diagnostics);
+// writes the diagnostics to stream the way errors are printed without a
+// recovery, every line starting with prefix unless it is NULL
+void print_diagnostics(FILE *stream, const char *prefix,
+		       struct diagnostics *diagnostics);
+
+// called by the allocator wrappers in alloc.c
+void track_allocation(void *pointer);
+void untrack_allocation(void *pointer);
+
+#endif
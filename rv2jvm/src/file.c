@@ -1,18 +1,22 @@
 #include "file.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sysexits.h>
+#include <unistd.h>
+
+#include "error.h"
 
 char *read_file(const char *path)
 {
 	FILE *file = fopen(path, "rb");
 	if (file == NULL) {
-		fprintf(stderr, "Could not open file \"%s\" for reading.\n",
+		fail_with(EX_IOERR, "Could not open file \"%s\" for reading.",
 				path);
-		exit(EX_IOERR);
 	}
 
 	fseek(file, 0L, SEEK_END);
@@ -21,14 +25,14 @@ char *read_file(const char *path)
 
 	char *buffer = (char*)malloc(size + 1);
 	if (buffer == NULL) {
-		fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-		exit(EXIT_FAILURE);
+		fclose(file);
+		fail("Not enough memory to read \"%s\".", path);
 	}
 
 	size_t read = fread(buffer, sizeof(char), size, file);
 	if (read < size) {
-		fprintf(stderr, "Could not read file \"%s\".\n", path);
-		exit(EX_IOERR);
+		fclose(file);
+		fail_with(EX_IOERR, "Could not read file \"%s\".", path);
 	}
 	buffer[read] = '\0';
 
@@ -36,20 +40,32 @@ char *read_file(const char *path)
 	return buffer;
 }
 
+/*
+ * The whole buffer goes to the kernel in one write() call; the loop only
+ * runs again for a short write.
+ */
 void write_file(char *path, uint8_t *contents, size_t length)
 {
-	FILE *file = fopen(path, "wb");
-	if (file == NULL) {
-		fprintf(stderr, "Could not open file \"%s\" for writing.\n",
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fail_with(EX_IOERR, "Could not open file \"%s\" for writing.",
 				path);
-		exit(EX_IOERR);
 	}
 
-	size_t written = fwrite(contents, 1, length, file);
-	if (written < length) {
-		fprintf(stderr, "Could not write to file \"%s\".\n", path);
-		exit(EX_IOERR);
+	while (length > 0) {
+		ssize_t written = write(fd, contents, length);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			close(fd);
+			fail_with(EX_IOERR, "Could not write to file \"%s\".", path);
+		}
+		contents += written;
+		length -= written;
 	}
 
-	fclose(file);
+	if (close(fd) != 0) {
+		fail_with(EX_IOERR, "Could not write to file \"%s\".", path);
+	}
 }
@@ -0,0 +1,452 @@
+#include "idiom.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "data.h"
+#include "error.h"
+#include "ir.h"
+#include "table.h"
+
+/*
+ * Toolchains build 32 bit constants and addresses with an upper immediate
+ * instruction followed by an addi (li, la, lui+addi with %hi/%lo), and far
+ * calls with auipc followed by jalr. Translated one by one, both halves
+ * store to the register array. This pass resolves the relocation operands
+ * to immediates and rewrites
+ *
+ *   lui/auipc rd, hi; addi rd2, rd, lo   into   li rd2, value
+ *   lui/auipc rd, hi; jalr rd2, rd, lo   into   jal rd2, label
+ *
+ * The first instruction becomes a nop when rd is dead afterwards and a
+ * constant load of its own when it is not. Remaining lui and auipc
+ * instructions are constants too and become li.
+ *
+ * Guest code addresses are four times the index of an instruction, a label
+ * has the address of the instruction that follows it. Labels of the data
+ * segment have its addresses, see data.c.
+ */
+#define INSTRUCTION_SIZE 4
+
+struct label_address {
+	uint32_t address;
+	// named by an operand, so it is declared wherever code goes to it
+	bool referenced;
+};
+
+struct layout {
+	struct table *labels;
+	struct data *data;
+	// label at every instruction index, one past the last included
+	char **label_at;
+	size_t instructions;
+};
+
+static char *operand_label(struct ir_instruction *instruction)
+{
+	switch (instruction->type) {
+	case TYPE_R1_OP:
+		return instruction->as.r1op.op_type != OPERAND_IMM
+		       ? instruction->as.r1op.op.label : NULL;
+	case TYPE_R2_OP:
+		return instruction->as.r2op.op_type != OPERAND_IMM
+		       ? instruction->as.r2op.op.label : NULL;
+	default:
+		return NULL;
+	}
+}
+
+static struct label_address *find_label(struct layout *layout, char *label)
+{
+	struct table_value *value = table_get(layout->labels,
+					      to_string_key(label));
+	return value != NULL ? value->value : NULL;
+}
+
+/*
+ * Of the labels at an index the first one some operand names is taken, an
+ * alias nothing jumps to may be local to a file the jump is not in.
+ */
+static void find_labels_at(struct layout *layout, struct ir_element *ir)
+{
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		char *label = it->type == IR_INSTRUCTION
+			      ? operand_label(&it->as.instruction) : NULL;
+		struct label_address *value = label != NULL
+					      ? find_label(layout, label) : NULL;
+		if (value != NULL) {
+			value->referenced = true;
+		}
+	}
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		if (it->type != IR_LABEL) {
+			continue;
+		}
+		struct label_address *value = find_label(layout,
+							 it->as.label.name);
+		char **at = &layout->label_at[value->address /
+					      INSTRUCTION_SIZE];
+		if (*at == NULL || (value->referenced &&
+				    !find_label(layout, *at)->referenced)) {
+			*at = it->as.label.name;
+		}
+	}
+}
+
+static void init_layout(struct layout *layout, struct ir_element *ir,
+			struct data *data)
+{
+	layout->data = data;
+	layout->instructions = 0;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		layout->instructions += it->type == IR_INSTRUCTION;
+	}
+	layout->labels = table_create();
+	layout->label_at = calloc(layout->instructions + 1,
+				  sizeof(*layout->label_at));
+	if (layout->label_at == NULL) {
+		fail("Failed to allocate memory for label_at.");
+	}
+
+	size_t index = 0;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		if (it->type == IR_INSTRUCTION) {
+			index++;
+			continue;
+		}
+		if (it->type != IR_LABEL) {
+			continue;
+		}
+		struct label_address *value = malloc(sizeof(*value));
+		if (value == NULL) {
+			fail("Failed to allocate memory for label_address.");
+		}
+		value->address = index * INSTRUCTION_SIZE;
+		value->referenced = false;
+		table_set(layout->labels, to_string_key(it->as.label.name),
+			  value);
+	}
+	find_labels_at(layout, ir);
+}
+
+static void free_layout(struct layout *layout)
+{
+	table_free(layout->labels);
+	free(layout->label_at);
+}
+
+static uint32_t label_address(struct layout *layout, char *label)
+{
+	struct label_address *value = find_label(layout, label);
+	uint32_t address;
+	if (value == NULL && data_label_address(layout->data, label, &address)) {
+		return address;
+	}
+	return value->address;
+}
+
+static char *label_at(struct layout *layout, uint32_t address)
+{
+	if (address % INSTRUCTION_SIZE != 0 ||
+	    address / INSTRUCTION_SIZE > layout->instructions) {
+		return NULL;
+	}
+	return layout->label_at[address / INSTRUCTION_SIZE];
+}
+
+static int32_t hi20(uint32_t value)
+{
+	return (value + 0x800) >> 12;
+}
+
+static int32_t lo12(uint32_t value)
+{
+	return (int32_t)(value << 20) >> 20;
+}
+
+/*
+ * %pcrel_lo names the label like %pcrel_hi does and is relative to the
+ * auipc right before it, which is how la and call are expanded.
+ */
+static int32_t relocate(struct layout *layout, enum ir_operand_type type,
+			char *label, uint32_t pc)
+{
+	uint32_t address = label_address(layout, label);
+	switch (type) {
+	case OPERAND_HI:
+		return hi20(address);
+	case OPERAND_LO:
+		return lo12(address);
+	case OPERAND_PCREL_HI:
+		return hi20(address - pc);
+	case OPERAND_PCREL_LO:
+		return lo12(address - (pc - INSTRUCTION_SIZE));
+	default:
+		return 0;
+	}
+}
+
+static void resolve_relocations(struct layout *layout, struct ir_element *ir)
+{
+	uint32_t pc = 0;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		if (it->type != IR_INSTRUCTION) {
+			continue;
+		}
+		struct ir_instruction *instruction = &it->as.instruction;
+		if (instruction->type == TYPE_R1_OP &&
+		    instruction->as.r1op.op_type >= OPERAND_HI) {
+			struct ir_instruction_r1op *op = &instruction->as.r1op;
+			op->op.imm = relocate(layout, op->op_type, op->op.label,
+					      pc);
+			op->op_type = OPERAND_IMM;
+		} else if (instruction->type == TYPE_R2_OP &&
+			   instruction->as.r2op.op_type >= OPERAND_HI) {
+			struct ir_instruction_r2op *op = &instruction->as.r2op;
+			op->op.imm = relocate(layout, op->op_type, op->op.label,
+					      pc);
+			op->op_type = OPERAND_IMM;
+		}
+		pc += INSTRUCTION_SIZE;
+	}
+}
+
+static bool is_branch(enum ir_instruction_mnemonic mnemonic)
+{
+	switch (mnemonic) {
+	case BEQ:
+	case BNE:
+	case BLT:
+	case BLTU:
+	case BGE:
+	case BGEU:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool reads_register(struct ir_instruction *instruction,
+		    enum ir_instruction_register r)
+{
+	switch (instruction->type) {
+	case TYPE_R3:
+		return instruction->as.r3.rs1 == r || instruction->as.r3.rs2 == r;
+	case TYPE_R2_OP:
+		switch (instruction->mnemonic) {
+		case ECALL:
+		case EBREAK:
+			// the environment reads the argument registers
+			return true;
+		case FENCE:
+		case NOP:
+			return false;
+		default:
+			break;
+		}
+		if (is_branch(instruction->mnemonic)) {
+			return instruction->as.r2op.rd == r ||
+			       instruction->as.r2op.rs1 == r;
+		}
+		return instruction->as.r2op.rs1 == r;
+	case TYPE_MEM:
+		switch (instruction->mnemonic) {
+		case SW:
+		case SH:
+		case SB:
+			return instruction->as.mem.rd == r ||
+			       instruction->as.mem.rs1 == r;
+		default:
+			return instruction->as.mem.rs1 == r;
+		}
+	case TYPE_AMO:
+		return instruction->as.amo.rs1 == r || instruction->as.amo.rs2 == r;
+	default:
+		return false;
+	}
+}
+
+bool writes_register(struct ir_instruction *instruction,
+		     enum ir_instruction_register r)
+{
+	switch (instruction->type) {
+	case TYPE_R3:
+		return instruction->as.r3.rd == r;
+	case TYPE_R2_OP:
+		return !is_branch(instruction->mnemonic) &&
+		       instruction->as.r2op.rd == r;
+	case TYPE_R1_OP:
+		return instruction->as.r1op.rd == r;
+	case TYPE_MEM:
+		switch (instruction->mnemonic) {
+		case SW:
+		case SH:
+		case SB:
+			return false;
+		default:
+			return instruction->as.mem.rd == r;
+		}
+	case TYPE_AMO:
+		return instruction->as.amo.rd == r;
+	default:
+		return false;
+	}
+}
+
+static bool transfers_control(struct ir_instruction *instruction)
+{
+	switch (instruction->mnemonic) {
+	case JAL:
+	case J:
+	case JALR:
+		return true;
+	default:
+		return is_branch(instruction->mnemonic);
+	}
+}
+
+/*
+ * Whether r may be read before it is written again, looking no further
+ * than the end of the straight-line code starting at it.
+ */
+static bool live(struct ir_element *it, enum ir_instruction_register r)
+{
+	for (; it->type != IR_EOF; it++) {
+		if (it->type == IR_LABEL) {
+			return true;
+		}
+		if (it->type != IR_INSTRUCTION) {
+			continue;
+		}
+		struct ir_instruction *instruction = &it->as.instruction;
+		if (reads_register(instruction, r) || transfers_control(instruction)) {
+			return true;
+		}
+		if (writes_register(instruction, r)) {
+			return false;
+		}
+	}
+	return false;
+}
+
+static struct ir_instruction create_li(enum ir_instruction_register rd,
+				       uint32_t value)
+{
+	struct ir_instruction instruction = {
+		.type = TYPE_R1_OP,
+		.mnemonic = LI,
+		.as.r1op = {
+			.rd = rd,
+			.op_type = OPERAND_IMM,
+			.op.value = value
+		}
+	};
+	return instruction;
+}
+
+static struct ir_instruction create_nop(void)
+{
+	struct ir_instruction instruction = {
+		.type = TYPE_R2_OP,
+		.mnemonic = NOP,
+		.as.r2op = {
+			.rd = X0,
+			.rs1 = X0,
+			.op_type = OPERAND_IMM,
+			.op.imm = 0
+		}
+	};
+	return instruction;
+}
+
+/*
+ * Rewrites the instruction after an upper immediate instruction that put
+ * value into rd. Returns whether it did.
+ */
+static bool fuse_second(struct layout *layout, struct ir_element *next,
+			enum ir_instruction_register rd, uint32_t value)
+{
+	if (next->type != IR_INSTRUCTION) {
+		return false;
+	}
+	struct ir_instruction *second = &next->as.instruction;
+	if (second->type != TYPE_R2_OP || second->as.r2op.rs1 != rd ||
+	    second->as.r2op.op_type != OPERAND_IMM) {
+		return false;
+	}
+	enum ir_instruction_register rd2 = second->as.r2op.rd;
+	uint32_t target = value + (uint32_t)(int32_t)second->as.r2op.op.imm;
+	switch (second->mnemonic) {
+	case ADDI:
+		*second = create_li(rd2, target);
+		return true;
+	case JALR: {
+		char *label = label_at(layout, target & ~1u);
+		if (label == NULL) {
+			return false;
+		}
+		second->type = TYPE_R1_OP;
+		second->mnemonic = JAL;
+		second->as.r1op.rd = rd2;
+		second->as.r1op.op_type = OPERAND_LABEL;
+		second->as.r1op.op.label = label;
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+void fuse_idioms(struct ir_element *ir, struct data *data,
+		 struct compile_stats *stats)
+{
+	struct layout layout;
+	init_layout(&layout, ir, data);
+	resolve_relocations(&layout, ir);
+
+	uint32_t pc = 0;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		if (it->type != IR_INSTRUCTION) {
+			continue;
+		}
+		struct ir_instruction *first = &it->as.instruction;
+		uint32_t address = pc;
+		pc += INSTRUCTION_SIZE;
+		if ((first->mnemonic != LUI && first->mnemonic != AUIPC) ||
+		    first->as.r1op.op_type != OPERAND_IMM) {
+			continue;
+		}
+
+		enum ir_instruction_register rd = first->as.r1op.rd;
+		uint32_t value = (uint32_t)first->as.r1op.op.imm << 12;
+		if (first->mnemonic == AUIPC) {
+			value += address;
+		}
+		if (rd == X0) {
+			*first = create_nop();
+			continue;
+		}
+
+		struct ir_element *next = it + 1;
+		if (!fuse_second(&layout, next, rd, value)) {
+			*first = create_li(rd, value);
+			continue;
+		}
+		if (stats != NULL) {
+			stats->fused_idioms++;
+		}
+		// the second instruction overwrote rd or it is not read again
+		struct ir_instruction *second = &next->as.instruction;
+		bool overwritten = second->as.r1op.rd == rd;
+		if (overwritten || (second->mnemonic == LI && !live(next + 1, rd))) {
+			*first = create_nop();
+		} else {
+			*first = create_li(rd, value);
+		}
+	}
+
+	free_layout(&layout);
+}
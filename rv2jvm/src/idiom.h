@@ -0,0 +1,18 @@
+#ifndef RV2JVM_IDIOM_H
+#define RV2JVM_IDIOM_H
+
+#include <stdbool.h>
+
+#include "data.h"
+#include "ir.h"
+#include "stats.h"
+
+void fuse_idioms(struct ir_element *ir, struct data *data,
+		 struct compile_stats *stats);
+// whether the instruction may read or write r, ECALL reads all of them
+bool reads_register(struct ir_instruction *instruction,
+		    enum ir_instruction_register r);
+bool writes_register(struct ir_instruction *instruction,
+		     enum ir_instruction_register r);
+
+#endif
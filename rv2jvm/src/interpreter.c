@@ -0,0 +1,724 @@
+#include "interpreter.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data.h"
+#include "error.h"
+#include "ir.h"
+#include "options.h"
+#include "table.h"
+
+/*
+ * Instructions are predecoded into an array of ops, one per IR instruction
+ * so op i has the guest address 4 * i like in the generated class, followed
+ * by an op that ends the hart. Every op holds the address of the code that
+ * executes it and jumps straight to the next one with computed gotos.
+ *
+ * Memory, harts and environment calls follow the generated class: all
+ * harts share little endian memory that starts out with the data segment,
+ * each one starts at
+ * _start or the first instruction with its hart id in x10 and stops when
+ * control falls off the end, and ECALL and EBREAK do nothing.
+ */
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "guest memory is accessed in host byte order"
+#endif
+
+#define INSTRUCTION_SIZE 4
+#define HARTID_REGISTER X10
+#define ENTRY_LABEL "_start"
+// x0 is written here and never read
+#define SINK_REGISTER 32
+#define REGISTERS 33
+
+enum op_kind {
+	OP_ADDI,
+	OP_SLTI,
+	OP_SLTIU,
+	OP_ANDI,
+	OP_ORI,
+	OP_XORI,
+	OP_SLLI,
+	OP_SRLI,
+	OP_SRAI,
+	OP_LI,
+	OP_ADD,
+	OP_SUB,
+	OP_SLT,
+	OP_SLTU,
+	OP_AND,
+	OP_OR,
+	OP_XOR,
+	OP_SLL,
+	OP_SRL,
+	OP_SRA,
+	OP_MUL,
+	OP_MULH,
+	OP_MULHSU,
+	OP_MULHU,
+	OP_DIV,
+	OP_DIVU,
+	OP_REM,
+	OP_REMU,
+	OP_JAL,
+	OP_JALR,
+	OP_BEQ,
+	OP_BNE,
+	OP_BLT,
+	OP_BLTU,
+	OP_BGE,
+	OP_BGEU,
+	OP_LW,
+	OP_LH,
+	OP_LHU,
+	OP_LB,
+	OP_LBU,
+	OP_SW,
+	OP_SH,
+	OP_SB,
+	OP_FENCE,
+	OP_NOP,
+	OP_LR,
+	OP_SC,
+	OP_AMOSWAP,
+	OP_AMOADD,
+	OP_AMOAND,
+	OP_AMOOR,
+	OP_AMOXOR,
+	OP_AMOMIN,
+	OP_AMOMAX,
+	OP_AMOMINU,
+	OP_AMOMAXU,
+	OP_EXIT,
+	OP_KINDS
+};
+
+struct op {
+	void *handler;
+	uint8_t kind;
+	uint8_t rd;
+	uint8_t rs1;
+	uint8_t rs2;
+	int32_t imm;
+	// index of the op a branch or jal goes to
+	uint32_t target;
+};
+
+struct machine {
+	struct op *ops;
+	// ops without the one at the end
+	size_t size;
+	size_t entry;
+	uint8_t *memory;
+	uint32_t memory_size;
+};
+
+struct hart {
+	struct machine *machine;
+	pthread_t thread;
+	int id;
+	uint32_t x[REGISTERS];
+	// address and value of lr.w, no reservation when reserved is false
+	bool reserved;
+	uint32_t reservation_address;
+	uint32_t reservation_value;
+};
+
+struct label_index {
+	size_t index;
+};
+
+static uint8_t destination(enum ir_instruction_register rd)
+{
+	return rd == X0 ? SINK_REGISTER : rd;
+}
+
+static enum op_kind r3_kind(enum ir_instruction_mnemonic mnemonic)
+{
+	switch (mnemonic) {
+	case ADD: return OP_ADD;
+	case SUB: return OP_SUB;
+	case SLT: return OP_SLT;
+	case SLTU: return OP_SLTU;
+	case AND: return OP_AND;
+	case OR: return OP_OR;
+	case XOR: return OP_XOR;
+	case SLL: return OP_SLL;
+	case SRL: return OP_SRL;
+	case SRA: return OP_SRA;
+	case MUL: return OP_MUL;
+	case MULH: return OP_MULH;
+	case MULHSU: return OP_MULHSU;
+	case MULHU: return OP_MULHU;
+	case DIV: return OP_DIV;
+	case DIVU: return OP_DIVU;
+	case REM: return OP_REM;
+	default: return OP_REMU;
+	}
+}
+
+static enum op_kind r2op_kind(enum ir_instruction_mnemonic mnemonic)
+{
+	switch (mnemonic) {
+	case ADDI: return OP_ADDI;
+	case SLTI: return OP_SLTI;
+	case SLTIU: return OP_SLTIU;
+	case ANDI: return OP_ANDI;
+	case ORI: return OP_ORI;
+	case XORI: return OP_XORI;
+	case SLLI: return OP_SLLI;
+	case SRLI: return OP_SRLI;
+	case SRAI: return OP_SRAI;
+	case JALR: return OP_JALR;
+	case BEQ: return OP_BEQ;
+	case BNE: return OP_BNE;
+	case BLT: return OP_BLT;
+	case BLTU: return OP_BLTU;
+	case BGE: return OP_BGE;
+	case BGEU: return OP_BGEU;
+	case FENCE: return OP_FENCE;
+	default: return OP_NOP;
+	}
+}
+
+static enum op_kind mem_kind(enum ir_instruction_mnemonic mnemonic)
+{
+	switch (mnemonic) {
+	case LW: return OP_LW;
+	case LH: return OP_LH;
+	case LHU: return OP_LHU;
+	case LB: return OP_LB;
+	case LBU: return OP_LBU;
+	case SW: return OP_SW;
+	case SH: return OP_SH;
+	default: return OP_SB;
+	}
+}
+
+static enum op_kind amo_kind(enum ir_instruction_mnemonic mnemonic)
+{
+	switch (mnemonic) {
+	case LR_W: return OP_LR;
+	case SC_W: return OP_SC;
+	case AMOSWAP_W: return OP_AMOSWAP;
+	case AMOADD_W: return OP_AMOADD;
+	case AMOAND_W: return OP_AMOAND;
+	case AMOOR_W: return OP_AMOOR;
+	case AMOXOR_W: return OP_AMOXOR;
+	case AMOMIN_W: return OP_AMOMIN;
+	case AMOMAX_W: return OP_AMOMAX;
+	case AMOMINU_W: return OP_AMOMINU;
+	default: return OP_AMOMAXU;
+	}
+}
+
+static size_t label_index(struct table *labels, char *label)
+{
+	struct table_value *value = table_get(labels, to_string_key(label));
+	if (value == NULL) {
+		fail("Undefined label '%s'.", label);
+	}
+	return ((struct label_index*)value->value)->index;
+}
+
+/*
+ * Branch targets are labels or byte offsets from the branch.
+ */
+static uint32_t branch_target(struct table *labels, struct ir_instruction *instr,
+			      size_t index)
+{
+	if (instr->as.r2op.op_type == OPERAND_LABEL) {
+		return label_index(labels, instr->as.r2op.op.label);
+	}
+	return index + instr->as.r2op.op.imm / INSTRUCTION_SIZE;
+}
+
+static struct op decode(struct table *labels, struct ir_instruction *instr,
+			size_t index)
+{
+	struct op op = { 0 };
+	switch (instr->type) {
+	case TYPE_R3:
+		op.kind = r3_kind(instr->mnemonic);
+		op.rd = destination(instr->as.r3.rd);
+		op.rs1 = instr->as.r3.rs1;
+		op.rs2 = instr->as.r3.rs2;
+		break;
+	case TYPE_R2_OP:
+		op.kind = r2op_kind(instr->mnemonic);
+		op.rd = destination(instr->as.r2op.rd);
+		op.rs1 = instr->as.r2op.rs1;
+		op.imm = instr->as.r2op.op.imm;
+		switch (instr->mnemonic) {
+		case BEQ:
+		case BNE:
+		case BLT:
+		case BLTU:
+		case BGE:
+		case BGEU:
+			// rd is the first register compared
+			op.rd = instr->as.r2op.rd;
+			op.target = branch_target(labels, instr, index);
+			break;
+		default:
+			break;
+		}
+		break;
+	case TYPE_R1_OP:
+		op.rd = destination(instr->as.r1op.rd);
+		switch (instr->mnemonic) {
+		case LI:
+			op.kind = OP_LI;
+			op.imm = instr->as.r1op.op.value;
+			break;
+		case LUI:
+			op.kind = OP_LI;
+			op.imm = (uint32_t)instr->as.r1op.op.imm << 12;
+			break;
+		case AUIPC:
+			op.kind = OP_LI;
+			op.imm = ((uint32_t)instr->as.r1op.op.imm << 12) +
+				 index * INSTRUCTION_SIZE;
+			break;
+		default:
+			op.kind = OP_JAL;
+			if (instr->as.r1op.op_type == OPERAND_LABEL) {
+				op.target = label_index(labels,
+							instr->as.r1op.op.label);
+			} else {
+				op.target = index + instr->as.r1op.op.imm /
+						    INSTRUCTION_SIZE;
+			}
+			break;
+		}
+		break;
+	case TYPE_MEM:
+		op.kind = mem_kind(instr->mnemonic);
+		// stores read rd, loads write it
+		op.rd = op.kind >= OP_SW ? instr->as.mem.rd
+					 : destination(instr->as.mem.rd);
+		op.rs1 = instr->as.mem.rs1;
+		op.imm = instr->as.mem.offset;
+		break;
+	case TYPE_AMO:
+		op.kind = amo_kind(instr->mnemonic);
+		op.rd = destination(instr->as.amo.rd);
+		op.rs1 = instr->as.amo.rs1;
+		op.rs2 = instr->as.amo.rs2;
+		break;
+	}
+	return op;
+}
+
+static void init_machine(struct machine *machine, struct ir_element *ir,
+			 struct data *data)
+{
+	struct table *labels = table_create();
+	size_t size = 0;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		if (it->type == IR_INSTRUCTION) {
+			size++;
+			continue;
+		}
+		if (it->type != IR_LABEL) {
+			continue;
+		}
+		struct label_index *value = malloc(sizeof(*value));
+		if (value == NULL) {
+			fail("Failed to allocate memory for label_index.");
+		}
+		value->index = size;
+		table_set(labels, to_string_key(it->as.label.name), value);
+	}
+
+	machine->size = size;
+	machine->ops = calloc(size + 1, sizeof(*machine->ops));
+	machine->memory_size = memory_size(data);
+	machine->memory = calloc(machine->memory_size, 1);
+	if (machine->ops == NULL || machine->memory == NULL) {
+		fail("Failed to allocate memory for the machine.");
+	}
+	memcpy(machine->memory, data->image, data->size);
+	size_t index = 0;
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		if (it->type == IR_INSTRUCTION) {
+			machine->ops[index] = decode(labels, &it->as.instruction,
+						     index);
+			index++;
+		}
+	}
+	machine->ops[size].kind = OP_EXIT;
+
+	struct table_value *entry = table_get(labels,
+					      to_string_key(ENTRY_LABEL));
+	machine->entry = entry != NULL
+			 ? ((struct label_index*)entry->value)->index : 0;
+	table_free(labels);
+}
+
+static void free_machine(struct machine *machine)
+{
+	free(machine->ops);
+	free(machine->memory);
+}
+
+__attribute__((noreturn))
+static void fault(struct hart *hart, struct op *op, char *reason,
+		  uint32_t address)
+{
+	fail("Hart %d: %s 0x%08x at pc 0x%08x.", hart->id, reason, address,
+	     (uint32_t)(op - hart->machine->ops) * INSTRUCTION_SIZE);
+}
+
+static inline uint8_t *memory_at(struct hart *hart, struct op *op,
+				 uint32_t address, uint32_t size)
+{
+	if (address > hart->machine->memory_size - size) {
+		fault(hart, op, "memory access out of bounds at", address);
+	}
+	return &hart->machine->memory[address];
+}
+
+// atomics need naturally aligned words like the VarHandle views do
+static inline uint32_t *word_at(struct hart *hart, struct op *op,
+				uint32_t address)
+{
+	if (address % 4 != 0) {
+		fault(hart, op, "misaligned atomic access at", address);
+	}
+	return (uint32_t*)memory_at(hart, op, address, 4);
+}
+
+static uint32_t amo_min_max(uint32_t *word, uint32_t value, enum op_kind kind)
+{
+	uint32_t old = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+	for (;;) {
+		uint32_t result;
+		switch (kind) {
+		case OP_AMOMIN:
+			result = (int32_t)old < (int32_t)value ? old : value;
+			break;
+		case OP_AMOMAX:
+			result = (int32_t)old > (int32_t)value ? old : value;
+			break;
+		case OP_AMOMINU:
+			result = old < value ? old : value;
+			break;
+		default:
+			result = old > value ? old : value;
+			break;
+		}
+		if (__atomic_compare_exchange_n(word, &old, result, false,
+						__ATOMIC_SEQ_CST,
+						__ATOMIC_SEQ_CST)) {
+			return old;
+		}
+	}
+}
+
+/*
+ * Threads the ops when hart is NULL, which must happen once before any hart
+ * runs, and runs hart otherwise.
+ */
+static void execute(struct machine *machine, struct hart *hart)
+{
+	static void *handlers[OP_KINDS] = {
+		[OP_ADDI] = &&op_addi,
+		[OP_SLTI] = &&op_slti,
+		[OP_SLTIU] = &&op_sltiu,
+		[OP_ANDI] = &&op_andi,
+		[OP_ORI] = &&op_ori,
+		[OP_XORI] = &&op_xori,
+		[OP_SLLI] = &&op_slli,
+		[OP_SRLI] = &&op_srli,
+		[OP_SRAI] = &&op_srai,
+		[OP_LI] = &&op_li,
+		[OP_ADD] = &&op_add,
+		[OP_SUB] = &&op_sub,
+		[OP_SLT] = &&op_slt,
+		[OP_SLTU] = &&op_sltu,
+		[OP_AND] = &&op_and,
+		[OP_OR] = &&op_or,
+		[OP_XOR] = &&op_xor,
+		[OP_SLL] = &&op_sll,
+		[OP_SRL] = &&op_srl,
+		[OP_SRA] = &&op_sra,
+		[OP_MUL] = &&op_mul,
+		[OP_MULH] = &&op_mulh,
+		[OP_MULHSU] = &&op_mulhsu,
+		[OP_MULHU] = &&op_mulhu,
+		[OP_DIV] = &&op_div,
+		[OP_DIVU] = &&op_divu,
+		[OP_REM] = &&op_rem,
+		[OP_REMU] = &&op_remu,
+		[OP_JAL] = &&op_jal,
+		[OP_JALR] = &&op_jalr,
+		[OP_BEQ] = &&op_beq,
+		[OP_BNE] = &&op_bne,
+		[OP_BLT] = &&op_blt,
+		[OP_BLTU] = &&op_bltu,
+		[OP_BGE] = &&op_bge,
+		[OP_BGEU] = &&op_bgeu,
+		[OP_LW] = &&op_lw,
+		[OP_LH] = &&op_lh,
+		[OP_LHU] = &&op_lhu,
+		[OP_LB] = &&op_lb,
+		[OP_LBU] = &&op_lbu,
+		[OP_SW] = &&op_sw,
+		[OP_SH] = &&op_sh,
+		[OP_SB] = &&op_sb,
+		[OP_FENCE] = &&op_fence,
+		[OP_NOP] = &&op_nop,
+		[OP_LR] = &&op_lr,
+		[OP_SC] = &&op_sc,
+		[OP_AMOSWAP] = &&op_amoswap,
+		[OP_AMOADD] = &&op_amoadd,
+		[OP_AMOAND] = &&op_amoand,
+		[OP_AMOOR] = &&op_amoor,
+		[OP_AMOXOR] = &&op_amoxor,
+		[OP_AMOMIN] = &&op_amo_min_max,
+		[OP_AMOMAX] = &&op_amo_min_max,
+		[OP_AMOMINU] = &&op_amo_min_max,
+		[OP_AMOMAXU] = &&op_amo_min_max,
+		[OP_EXIT] = &&op_exit
+	};
+	struct op *ops = machine->ops;
+	if (hart == NULL) {
+		for (size_t i = 0; i <= machine->size; i++) {
+			ops[i].handler = handlers[ops[i].kind];
+		}
+		return;
+	}
+
+	uint32_t *x = hart->x;
+	struct op *op = &ops[machine->entry];
+	uint32_t address;
+	uint32_t value;
+	uint16_t half;
+
+#define NEXT() do { op++; goto *op->handler; } while (0)
+#define JUMP(index) do { op = &ops[index]; goto *op->handler; } while (0)
+#define PC() ((uint32_t)(op - ops) * INSTRUCTION_SIZE)
+#define ADDRESS() (x[op->rs1] + (uint32_t)op->imm)
+
+	goto *op->handler;
+
+op_addi: x[op->rd] = x[op->rs1] + (uint32_t)op->imm; NEXT();
+op_slti: x[op->rd] = (int32_t)x[op->rs1] < op->imm; NEXT();
+op_sltiu: x[op->rd] = x[op->rs1] < (uint32_t)op->imm; NEXT();
+op_andi: x[op->rd] = x[op->rs1] & (uint32_t)op->imm; NEXT();
+op_ori: x[op->rd] = x[op->rs1] | (uint32_t)op->imm; NEXT();
+op_xori: x[op->rd] = x[op->rs1] ^ (uint32_t)op->imm; NEXT();
+op_slli: x[op->rd] = x[op->rs1] << (op->imm & 31); NEXT();
+op_srli: x[op->rd] = x[op->rs1] >> (op->imm & 31); NEXT();
+op_srai: x[op->rd] = (int32_t)x[op->rs1] >> (op->imm & 31); NEXT();
+op_li: x[op->rd] = op->imm; NEXT();
+
+op_add: x[op->rd] = x[op->rs1] + x[op->rs2]; NEXT();
+op_sub: x[op->rd] = x[op->rs1] - x[op->rs2]; NEXT();
+op_slt: x[op->rd] = (int32_t)x[op->rs1] < (int32_t)x[op->rs2]; NEXT();
+op_sltu: x[op->rd] = x[op->rs1] < x[op->rs2]; NEXT();
+op_and: x[op->rd] = x[op->rs1] & x[op->rs2]; NEXT();
+op_or: x[op->rd] = x[op->rs1] | x[op->rs2]; NEXT();
+op_xor: x[op->rd] = x[op->rs1] ^ x[op->rs2]; NEXT();
+op_sll: x[op->rd] = x[op->rs1] << (x[op->rs2] & 31); NEXT();
+op_srl: x[op->rd] = x[op->rs1] >> (x[op->rs2] & 31); NEXT();
+op_sra: x[op->rd] = (int32_t)x[op->rs1] >> (x[op->rs2] & 31); NEXT();
+
+op_mul: x[op->rd] = x[op->rs1] * x[op->rs2]; NEXT();
+op_mulh:
+	x[op->rd] = (uint64_t)((int64_t)(int32_t)x[op->rs1] *
+			       (int32_t)x[op->rs2]) >> 32;
+	NEXT();
+op_mulhsu:
+	x[op->rd] = (uint64_t)((int64_t)(int32_t)x[op->rs1] *
+			       (int64_t)x[op->rs2]) >> 32;
+	NEXT();
+op_mulhu:
+	x[op->rd] = ((uint64_t)x[op->rs1] * x[op->rs2]) >> 32;
+	NEXT();
+op_div:
+	if (x[op->rs2] == 0) {
+		x[op->rd] = UINT32_MAX;
+	} else if (x[op->rs1] == (uint32_t)INT32_MIN && x[op->rs2] == UINT32_MAX) {
+		x[op->rd] = x[op->rs1];
+	} else {
+		x[op->rd] = (int32_t)x[op->rs1] / (int32_t)x[op->rs2];
+	}
+	NEXT();
+op_divu:
+	x[op->rd] = x[op->rs2] == 0 ? UINT32_MAX : x[op->rs1] / x[op->rs2];
+	NEXT();
+op_rem:
+	if (x[op->rs2] == 0) {
+		x[op->rd] = x[op->rs1];
+	} else if (x[op->rs1] == (uint32_t)INT32_MIN && x[op->rs2] == UINT32_MAX) {
+		x[op->rd] = 0;
+	} else {
+		x[op->rd] = (int32_t)x[op->rs1] % (int32_t)x[op->rs2];
+	}
+	NEXT();
+op_remu:
+	x[op->rd] = x[op->rs2] == 0 ? x[op->rs1] : x[op->rs1] % x[op->rs2];
+	NEXT();
+
+op_jal:
+	x[op->rd] = PC() + INSTRUCTION_SIZE;
+	JUMP(op->target);
+op_jalr:
+	address = (x[op->rs1] + (uint32_t)op->imm) & ~1u;
+	x[op->rd] = PC() + INSTRUCTION_SIZE;
+	if (address % INSTRUCTION_SIZE != 0 ||
+	    address / INSTRUCTION_SIZE > machine->size) {
+		fault(hart, op, "jump to invalid address", address);
+	}
+	JUMP(address / INSTRUCTION_SIZE);
+op_beq: if (x[op->rd] == x[op->rs1]) JUMP(op->target); NEXT();
+op_bne: if (x[op->rd] != x[op->rs1]) JUMP(op->target); NEXT();
+op_blt:
+	if ((int32_t)x[op->rd] < (int32_t)x[op->rs1]) JUMP(op->target);
+	NEXT();
+op_bltu: if (x[op->rd] < x[op->rs1]) JUMP(op->target); NEXT();
+op_bge:
+	if ((int32_t)x[op->rd] >= (int32_t)x[op->rs1]) JUMP(op->target);
+	NEXT();
+op_bgeu: if (x[op->rd] >= x[op->rs1]) JUMP(op->target); NEXT();
+
+op_lw:
+	memcpy(&value, memory_at(hart, op, ADDRESS(), 4), 4);
+	x[op->rd] = value;
+	NEXT();
+op_lh:
+	memcpy(&half, memory_at(hart, op, ADDRESS(), 2), 2);
+	x[op->rd] = (int16_t)half;
+	NEXT();
+op_lhu:
+	memcpy(&half, memory_at(hart, op, ADDRESS(), 2), 2);
+	x[op->rd] = half;
+	NEXT();
+op_lb: x[op->rd] = (int8_t)*memory_at(hart, op, ADDRESS(), 1); NEXT();
+op_lbu: x[op->rd] = *memory_at(hart, op, ADDRESS(), 1); NEXT();
+op_sw:
+	value = x[op->rd];
+	memcpy(memory_at(hart, op, ADDRESS(), 4), &value, 4);
+	NEXT();
+op_sh:
+	half = x[op->rd];
+	memcpy(memory_at(hart, op, ADDRESS(), 2), &half, 2);
+	NEXT();
+op_sb: *memory_at(hart, op, ADDRESS(), 1) = x[op->rd]; NEXT();
+
+op_fence:
+	// an empty predecessor or successor set orders nothing
+	if ((op->imm >> 4 & 0xf) != 0 && (op->imm & 0xf) != 0) {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+	NEXT();
+op_nop: NEXT();
+
+	// atomics are sequentially consistent whatever their .aq and .rl bits
+op_lr:
+	hart->reservation_address = x[op->rs1];
+	hart->reservation_value = __atomic_load_n(
+		word_at(hart, op, x[op->rs1]), __ATOMIC_SEQ_CST);
+	hart->reserved = true;
+	x[op->rd] = hart->reservation_value;
+	NEXT();
+op_sc:
+	address = x[op->rs1];
+	value = hart->reservation_value;
+	x[op->rd] = !(hart->reserved && hart->reservation_address == address &&
+		      __atomic_compare_exchange_n(word_at(hart, op, address),
+						  &value, x[op->rs2], false,
+						  __ATOMIC_SEQ_CST,
+						  __ATOMIC_SEQ_CST));
+	hart->reserved = false;
+	NEXT();
+op_amoswap:
+	x[op->rd] = __atomic_exchange_n(word_at(hart, op, x[op->rs1]),
+					x[op->rs2], __ATOMIC_SEQ_CST);
+	NEXT();
+op_amoadd:
+	x[op->rd] = __atomic_fetch_add(word_at(hart, op, x[op->rs1]),
+				       x[op->rs2], __ATOMIC_SEQ_CST);
+	NEXT();
+op_amoand:
+	x[op->rd] = __atomic_fetch_and(word_at(hart, op, x[op->rs1]),
+				       x[op->rs2], __ATOMIC_SEQ_CST);
+	NEXT();
+op_amoor:
+	x[op->rd] = __atomic_fetch_or(word_at(hart, op, x[op->rs1]),
+				      x[op->rs2], __ATOMIC_SEQ_CST);
+	NEXT();
+op_amoxor:
+	x[op->rd] = __atomic_fetch_xor(word_at(hart, op, x[op->rs1]),
+				       x[op->rs2], __ATOMIC_SEQ_CST);
+	NEXT();
+op_amo_min_max:
+	x[op->rd] = amo_min_max(word_at(hart, op, x[op->rs1]), x[op->rs2],
+				op->kind);
+	NEXT();
+
+op_exit:
+	return;
+
+#undef NEXT
+#undef JUMP
+#undef PC
+#undef ADDRESS
+}
+
+static void *run_hart(void *arg)
+{
+	struct hart *hart = arg;
+	execute(hart->machine, hart);
+	return NULL;
+}
+
+void interpret(struct ir_element *ir, struct data *data,
+	       struct compile_options *options, FILE *out)
+{
+	struct machine machine;
+	init_machine(&machine, ir, data);
+	execute(&machine, NULL);
+
+	int harts_n = options->harts > 0 ? options->harts : 1;
+	struct hart *harts = calloc(harts_n, sizeof(*harts));
+	if (harts == NULL) {
+		fail("Failed to allocate memory for harts.");
+	}
+	for (int i = 0; i < harts_n; i++) {
+		harts[i].machine = &machine;
+		harts[i].id = i;
+		harts[i].x[HARTID_REGISTER] = i;
+	}
+	// hart 0 runs on this thread like it runs on the main thread of the
+	// class
+	for (int i = 1; i < harts_n; i++) {
+		if (pthread_create(&harts[i].thread, NULL, run_hart,
+				   &harts[i]) != 0) {
+			fail("Failed to start hart %d.", i);
+		}
+	}
+	run_hart(&harts[0]);
+	for (int i = 1; i < harts_n; i++) {
+		pthread_join(harts[i].thread, NULL);
+	}
+
+	for (int i = 0; i < harts_n; i++) {
+		for (int r = 1; r < 32; r++) {
+			if (harts[i].x[r] != 0) {
+				fprintf(out, "%d x%d 0x%08x\n", i, r,
+					harts[i].x[r]);
+			}
+		}
+	}
+	free(harts);
+	free_machine(&machine);
+}
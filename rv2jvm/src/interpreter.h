@@ -0,0 +1,18 @@
+#ifndef RV2JVM_INTERPRETER_H
+#define RV2JVM_INTERPRETER_H
+
+#include <stdio.h>
+
+#include "data.h"
+#include "ir.h"
+#include "options.h"
+
+/*
+ * Runs the program in this process instead of compiling it, with the
+ * memory and harts of the generated class, and prints the registers the
+ * harts end with to out.
+ */
+void interpret(struct ir_element *ir, struct data *data,
+	       struct compile_options *options, FILE *out);
+
+#endif
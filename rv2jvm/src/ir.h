@@ -13,14 +13,20 @@ enum ir_element_type {
 
 enum ir_operand_type {
 	OPERAND_IMM,
-	OPERAND_LABEL
+	OPERAND_LABEL,
+	// relocations of a label, resolved to immediates by fuse_idioms()
+	OPERAND_HI,
+	OPERAND_LO,
+	OPERAND_PCREL_HI,
+	OPERAND_PCREL_LO
 };
 
 enum ir_instruction_type {
 	TYPE_R3,
 	TYPE_R2_OP,
 	TYPE_R1_OP,
-	TYPE_MEM
+	TYPE_MEM,
+	TYPE_AMO
 };
 
 enum ir_instruction_register {
@@ -123,9 +129,52 @@ enum ir_instruction_mnemonic {
 
 	// chapter 2.8
 	ECALL,
-	EBREAK
+	EBREAK,
+
+	// M extension
+	MUL,
+	MULH,
+	MULHSU,
+	MULHU,
+	DIV,
+	DIVU,
+	REM,
+	REMU,
+
+	// A extension, load-reserved/store-conditional
+	LR_W,
+	SC_W,
+
+	// A extension, atomic memory operations
+	AMOSWAP_W,
+	AMOADD_W,
+	AMOAND_W,
+	AMOOR_W,
+	AMOXOR_W,
+	AMOMIN_W,
+	AMOMAX_W,
+	AMOMINU_W,
+	AMOMAXU_W,
+
+	// pseudoinstructions expanded by the parser
+	LI,
+	LA,
+	CALL
 };
 
+/*
+ * Ordering sets of a FENCE. Its immediate holds pred << 4 | succ as in the
+ * instruction encoding, a bare fence orders everything.
+ */
+enum ir_fence_set {
+	FENCE_W = 1,
+	FENCE_R = 2,
+	FENCE_O = 4,
+	FENCE_I = 8
+};
+
+#define FENCE_ALL 0xff
+
 struct ir_instruction_r3 {
 	enum ir_instruction_register rd;
 	enum ir_instruction_register rs1;
@@ -148,6 +197,9 @@ struct ir_instruction_r1op {
 	union {
 		int32_t imm : 20;
 		char *label;
+		// full 32 bit constant of the LI instructions made by
+		// fuse_idioms()
+		int32_t value;
 	} op;
 };
 
@@ -157,6 +209,26 @@ struct ir_instruction_mem {
 	int16_t offset : 12;
 };
 
+/*
+ * Ordering bits of an atomic instruction, .aq and .rl suffixes of the
+ * mnemonic.
+ */
+enum ir_amo_ordering {
+	AMO_RL = 1,
+	AMO_AQ = 2
+};
+
+/*
+ * lr.w rd, (rs1), sc.w rd, rs2, (rs1) and amo<op>.w rd, rs2, (rs1). rs2 of
+ * lr.w is X0.
+ */
+struct ir_instruction_amo {
+	enum ir_instruction_register rd;
+	enum ir_instruction_register rs1;
+	enum ir_instruction_register rs2;
+	uint8_t ordering;
+};
+
 struct ir_instruction {
 	enum ir_instruction_type type;
 	enum ir_instruction_mnemonic mnemonic;
@@ -165,6 +237,7 @@ struct ir_instruction {
 		struct ir_instruction_r2op r2op;
 		struct ir_instruction_r1op r1op;
 		struct ir_instruction_mem mem;
+		struct ir_instruction_amo amo;
 	} as;
 };
 
@@ -172,6 +245,11 @@ struct ir_label {
 	char *name;
 };
 
+/*
+ * An assembler directive like .word 1, -2, label. Operands are kept as
+ * written: decimal numbers with their sign, labels, and string literals
+ * with their quotes and escapes.
+ */
 struct ir_directive {
 	char *name;
 	struct {
@@ -0,0 +1,285 @@
+#include "jar.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "codegen.h"
+#include "darray.h"
+#include "emit.h"
+#include "error.h"
+
+/*
+ * JAR files are ZIP archives whose first entry is META-INF/MANIFEST.MF.
+ * Every entry is written as soon as it is added: a local file header,
+ * followed by the data, deflated when that makes it smaller and stored
+ * otherwise. The central directory is written on close. All integers are
+ * little endian.
+ *
+ * Entries carry a fixed timestamp so that the archive does not depend on
+ * when it was built.
+ */
+#define ZIP_LOCAL_HEADER 0x04034b50
+#define ZIP_CENTRAL_HEADER 0x02014b50
+#define ZIP_END_OF_CENTRAL_DIRECTORY 0x06054b50
+#define ZIP_VERSION 20
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+#define ZIP_DOS_DATE ((0 << 9) | (1 << 5) | 1) // 1980-01-01
+#define ZIP_DOS_TIME 0
+#define ZIP_MAX_ENTRIES 65535
+// offsets are 32 bits, so nothing may start or end past this
+#define ZIP_MAX_SIZE UINT32_MAX
+#define ZIP_LOCAL_HEADER_SIZE 30
+
+#define JAR_OUTPUT_BUFFER (1 << 20)
+#define MANIFEST_NAME "META-INF/MANIFEST.MF"
+
+struct jar_entry {
+	char *name;
+	uint16_t method;
+	uint32_t crc;
+	uint32_t compressed_size;
+	uint32_t size;
+	uint32_t offset;
+};
+
+struct jar_entries {
+	struct jar_entry *items;
+	size_t size;
+	size_t capacity;
+};
+
+struct jar {
+	char *path;
+	FILE *file;
+	uint64_t offset;
+	struct jar_entries entries;
+	pthread_mutex_t lock;
+};
+
+// returns whether all of bytes were written
+static bool jar_write(struct jar *jar, const void *bytes, size_t length)
+{
+	if (fwrite(bytes, 1, length, jar->file) < length) {
+		return false;
+	}
+	jar->offset += length;
+	return true;
+}
+
+/*
+ * Returns the raw deflate stream of contents in *res, or NULL when it is
+ * not smaller than contents.
+ */
+static uint8_t *deflate_entry(uint8_t *contents, size_t length, size_t *res)
+{
+	z_stream stream = { 0 };
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+			 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		fail("Failed to initialize deflate.");
+	}
+	size_t bound = deflateBound(&stream, length);
+	uint8_t *out = malloc(bound);
+	if (out == NULL) {
+		deflateEnd(&stream);
+		fail("Failed to allocate memory for JAR entry.");
+	}
+	stream.next_in = contents;
+	stream.avail_in = length;
+	stream.next_out = out;
+	stream.avail_out = bound;
+	int status = deflate(&stream, Z_FINISH);
+	*res = stream.total_out;
+	deflateEnd(&stream);
+	if (status != Z_STREAM_END || *res >= length) {
+		free(out);
+		return NULL;
+	}
+	return out;
+}
+
+static void local_header(struct bytecode *out, struct jar_entry *entry)
+{
+	emit_u32_le(out, ZIP_LOCAL_HEADER);
+	emit_u16_le(out, ZIP_VERSION);
+	emit_u16_le(out, 0);
+	emit_u16_le(out, entry->method);
+	emit_u16_le(out, ZIP_DOS_TIME);
+	emit_u16_le(out, ZIP_DOS_DATE);
+	emit_u32_le(out, entry->crc);
+	emit_u32_le(out, entry->compressed_size);
+	emit_u32_le(out, entry->size);
+	emit_u16_le(out, strlen(entry->name));
+	emit_u16_le(out, 0);
+	emit_bytes(out, entry->name, strlen(entry->name));
+}
+
+static void central_header(struct bytecode *out, struct jar_entry *entry)
+{
+	emit_u32_le(out, ZIP_CENTRAL_HEADER);
+	emit_u16_le(out, ZIP_VERSION);
+	emit_u16_le(out, ZIP_VERSION);
+	emit_u16_le(out, 0);
+	emit_u16_le(out, entry->method);
+	emit_u16_le(out, ZIP_DOS_TIME);
+	emit_u16_le(out, ZIP_DOS_DATE);
+	emit_u32_le(out, entry->crc);
+	emit_u32_le(out, entry->compressed_size);
+	emit_u32_le(out, entry->size);
+	emit_u16_le(out, strlen(entry->name));
+	emit_u16_le(out, 0);
+	emit_u16_le(out, 0);
+	emit_u16_le(out, 0);
+	emit_u16_le(out, 0);
+	emit_u32_le(out, 0);
+	emit_u32_le(out, entry->offset);
+	emit_bytes(out, entry->name, strlen(entry->name));
+}
+
+void jar_add(struct jar *jar, char *name, uint8_t *contents, size_t length)
+{
+	if (length > ZIP_MAX_SIZE) {
+		fail("Entry \"%s\" is too large for a JAR.", name);
+	}
+	// malloc, not strdup, so that a recovery frees it on an error
+	size_t name_length = strlen(name) + 1;
+	struct jar_entry entry = {
+		.name = malloc(name_length),
+		.crc = crc32(0, contents, length),
+		.size = length
+	};
+	if (entry.name == NULL) {
+		fail("Failed to allocate memory for JAR entry.");
+	}
+	memcpy(entry.name, name, name_length);
+
+	// compress before taking the lock so that threads deflate in parallel
+	size_t compressed_size;
+	uint8_t *compressed = deflate_entry(contents, length, &compressed_size);
+	uint8_t *data = contents;
+	entry.method = ZIP_STORED;
+	entry.compressed_size = length;
+	if (compressed != NULL) {
+		data = compressed;
+		entry.method = ZIP_DEFLATED;
+		entry.compressed_size = compressed_size;
+	}
+
+	struct bytecode header = { 0 };
+	pthread_mutex_lock(&jar->lock);
+	if (jar->entries.size >= ZIP_MAX_ENTRIES) {
+		pthread_mutex_unlock(&jar->lock);
+		fail("Too many entries for JAR \"%s\".", jar->path);
+	}
+	if (jar->offset + ZIP_LOCAL_HEADER_SIZE + strlen(name) +
+	    entry.compressed_size > ZIP_MAX_SIZE) {
+		pthread_mutex_unlock(&jar->lock);
+		fail("JAR \"%s\" would be larger than a ZIP archive can be.",
+		     jar->path);
+	}
+	entry.offset = jar->offset;
+	local_header(&header, &entry);
+	// errors fail without the lock, other threads go on adding entries
+	if (!jar_write(jar, header.items, header.size) ||
+	    !jar_write(jar, data, entry.compressed_size)) {
+		pthread_mutex_unlock(&jar->lock);
+		fail_with(EX_IOERR, "Could not write to file \"%s\".",
+			  jar->path);
+	}
+	darray_append(jar->entries, entry);
+	pthread_mutex_unlock(&jar->lock);
+
+	darray_free(header);
+	free(compressed);
+}
+
+void jar_add_class(struct jar *jar, char *class_name, uint8_t *contents,
+		   size_t length)
+{
+	size_t name_length = strlen(class_name);
+	char *name = malloc(name_length + sizeof(".class"));
+	if (name == NULL) {
+		fail("Failed to allocate memory for JAR entry.");
+	}
+	memcpy(name, class_name, name_length);
+	memcpy(name + name_length, ".class", sizeof(".class"));
+	jar_add(jar, name, contents, length);
+	free(name);
+}
+
+struct jar *jar_open(char *path, char *main_class)
+{
+	struct jar *jar = calloc(1, sizeof(*jar));
+	if (jar == NULL) {
+		fail("Failed to allocate memory for JAR.");
+	}
+	jar->path = path;
+	jar->file = fopen(path, "wb");
+	if (jar->file == NULL) {
+		fail_with(EX_IOERR, "Could not open file \"%s\" for writing.",
+			  path);
+	}
+	setvbuf(jar->file, NULL, _IOFBF, JAR_OUTPUT_BUFFER);
+	pthread_mutex_init(&jar->lock, NULL);
+
+	struct bytecode manifest = { 0 };
+	const char *version = "Manifest-Version: 1.0\r\n"
+			      "Created-By: rv2jvm\r\n";
+	emit_bytes(&manifest, version, strlen(version));
+	if (main_class != NULL) {
+		const char *key = "Main-Class: ";
+		emit_bytes(&manifest, key, strlen(key));
+		// the manifest separates packages with dots, not slashes
+		for (char *c = main_class; *c != '\0'; c++) {
+			emit_u8(&manifest, *c == '/' ? '.' : *c);
+		}
+		emit_bytes(&manifest, "\r\n", 2);
+	}
+	emit_bytes(&manifest, "\r\n", 2);
+	jar_add(jar, MANIFEST_NAME, manifest.items, manifest.size);
+	darray_free(manifest);
+	return jar;
+}
+
+void jar_close(struct jar *jar)
+{
+	struct bytecode directory = { 0 };
+	for (size_t i = 0; i < jar->entries.size; i++) {
+		central_header(&directory, &jar->entries.items[i]);
+	}
+	if (jar->offset + directory.size > ZIP_MAX_SIZE) {
+		fail("JAR \"%s\" would be larger than a ZIP archive can be.",
+		     jar->path);
+	}
+	uint32_t directory_offset = jar->offset;
+	uint32_t directory_size = directory.size;
+	emit_u32_le(&directory, ZIP_END_OF_CENTRAL_DIRECTORY);
+	emit_u16_le(&directory, 0);
+	emit_u16_le(&directory, 0);
+	emit_u16_le(&directory, jar->entries.size);
+	emit_u16_le(&directory, jar->entries.size);
+	emit_u32_le(&directory, directory_size);
+	emit_u32_le(&directory, directory_offset);
+	emit_u16_le(&directory, 0);
+	if (!jar_write(jar, directory.items, directory.size) ||
+	    fflush(jar->file) != 0 || fsync(fileno(jar->file)) != 0 ||
+	    fclose(jar->file) != 0) {
+		fail_with(EX_IOERR, "Could not write to file \"%s\".",
+			  jar->path);
+	}
+
+	for (size_t i = 0; i < jar->entries.size; i++) {
+		free(jar->entries.items[i].name);
+	}
+	darray_free(jar->entries);
+	darray_free(directory);
+	pthread_mutex_destroy(&jar->lock);
+	free(jar);
+}
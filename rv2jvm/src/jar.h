@@ -0,0 +1,25 @@
+#ifndef RV2JVM_JAR_H
+#define RV2JVM_JAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct jar;
+
+/*
+ * Creates the archive at path and writes its manifest. main_class may be
+ * NULL for archives without an entry point.
+ */
+struct jar *jar_open(char *path, char *main_class);
+/*
+ * Appends one entry. Safe to call from several threads at once.
+ */
+void jar_add(struct jar *jar, char *name, uint8_t *contents, size_t length);
+void jar_add_class(struct jar *jar, char *class_name, uint8_t *contents,
+		   size_t length);
+/*
+ * Writes the central directory, syncs the file to disk and frees jar.
+ */
+void jar_close(struct jar *jar);
+
+#endif
@@ -7,7 +7,7 @@
 #include <sysexits.h>
 
 #include "darray.h"
-#include "file.h"
+#include "error.h"
 #include "tokens.h"
 
 struct lexer {
@@ -17,10 +17,11 @@ struct lexer {
 	size_t line;
 };
 
-static void init_lexer(struct lexer *lexer, char *source)
+static void init_lexer(struct lexer *lexer, char *source, char *file)
 {
 	lexer->start = source;
 	lexer->current = source;
+	lexer->file = file;
 	lexer->line = 1;
 }
 
@@ -102,12 +103,46 @@ static void skip_whitespace(struct lexer *lexer)
 
 static struct token identifier(struct lexer *lexer)
 {
-	while (is_alpha(peek(lexer)) || is_digit(peek(lexer))) {
+	// dots separate mnemonic suffixes like the .w and .aq of amoadd.w.aq
+	while (is_alpha(peek(lexer)) || is_digit(peek(lexer)) ||
+	       peek(lexer) == '.') {
 		advance(lexer);
 	}
 	return create_token(lexer, TOKEN_IDENTIFIER);
 }
 
+/*
+ * Strings may hold the escapes \\, \", \n, \t, \r and \0, which the data
+ * layout decodes.
+ */
+static struct token string(struct lexer *lexer)
+{
+	while (peek(lexer) != '"') {
+		if (is_at_end(lexer) || peek(lexer) == '\n') {
+			fail_at(lexer->file, lexer->line,
+				"Unterminated string");
+		}
+		if (advance(lexer) != '\\') {
+			continue;
+		}
+		switch (peek(lexer)) {
+		case '\\':
+		case '"':
+		case 'n':
+		case 't':
+		case 'r':
+		case '0':
+			advance(lexer);
+			break;
+		default:
+			fail_at(lexer->file, lexer->line,
+				"Unknown escape '\\%c'", peek(lexer));
+		}
+	}
+	advance(lexer);
+	return create_token(lexer, TOKEN_STRING);
+}
+
 static struct token number(struct lexer *lexer)
 {
 	while (is_digit(peek(lexer))) {
@@ -132,10 +167,18 @@ static struct token scan_token(struct lexer *lexer)
 	if (is_digit(c)) {
 		return number(lexer);
 	}
+	// directives like .word and local labels like .L1
+	if (c == '.' && is_alpha(peek(lexer))) {
+		return identifier(lexer);
+	}
+	if (c == '"') {
+		return string(lexer);
+	}
 
 	switch (c) {
 		case ',': return create_token(lexer, TOKEN_COMMA);
 		case '-': return create_token(lexer, TOKEN_MINUS);
+		case '%': return create_token(lexer, TOKEN_PERCENT);
 		case ':': return create_token(lexer, TOKEN_COLON);
 		case '(': return create_token(lexer, TOKEN_LPAREN);
 		case ')': return create_token(lexer, TOKEN_RPAREN);
@@ -144,26 +187,19 @@ static struct token scan_token(struct lexer *lexer)
 			  return create_token(lexer, TOKEN_NEWLINE);
 	}
 
-	fprintf(stderr, "Unexpected character '%c' %s line %lu\n", c, lexer->file,
-			lexer->line);
-	exit(EXIT_FAILURE);
+	fail_at(lexer->file, lexer->line, "Unexpected character '%c'", c);
 }
 
-void lex(int filepaths_n, char **filepaths, struct tokens *res)
+/*
+ * Appends the tokens of one source file to res, followed by TOKEN_EOF.
+ */
+void lex(char *source, char *file, struct tokens *res)
 {
 	struct lexer lexer;
 	struct token token;
-	for (int i = 0; i < filepaths_n; i++) {
-		char *source = read_file(filepaths[i]);
-		init_lexer(&lexer, source);
-		while (true) {
-			token = scan_token(&lexer);
-			if (token.type == TOKEN_EOF) {
-				break;
-			}
-			darray_append((*res), token);
-		}
-		free(source);
-	}
-	darray_append((*res), token); // token should contain token of type TOKEN_EOF
+	init_lexer(&lexer, source, file);
+	do {
+		token = scan_token(&lexer);
+		darray_append((*res), token);
+	} while (token.type != TOKEN_EOF);
 }
@@ -3,6 +3,6 @@
 
 #include "tokens.h"
 
-void lex(int filepaths_n, char **filepaths, struct tokens *res);
+void lex(char *source, char *file, struct tokens *res);
 
 #endif
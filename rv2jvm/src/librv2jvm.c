@@ -0,0 +1,120 @@
+#include "rv2jvm.h"
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "darray.h"
+#include "emit.h"
+#include "error.h"
+#include "options.h"
+
+/*
+ * Copies the sources with the NUL the lexer stops at. The copies are
+ * allocated under the recovery like the rest of the compilation.
+ */
+static struct source *copy_sources(const struct rv2jvm_source *sources,
+				   size_t sources_n)
+{
+	struct source *copies = malloc(sources_n * sizeof(*copies));
+	if (copies == NULL) {
+		fail("Failed to allocate memory for sources.");
+	}
+	for (size_t i = 0; i < sources_n; i++) {
+		copies[i].name = (char*)sources[i].name;
+		copies[i].length = sources[i].length;
+		copies[i].text = malloc(sources[i].length + 1);
+		if (copies[i].text == NULL) {
+			fail("Not enough memory to read \"%s\".", sources[i].name);
+		}
+		memcpy(copies[i].text, sources[i].text, sources[i].length);
+		copies[i].text[sources[i].length] = '\0';
+	}
+	return copies;
+}
+
+static void compile_copies(const struct rv2jvm_source *sources,
+			   size_t sources_n, struct compile_options *options,
+			   struct bytecode *res)
+{
+	if (sources_n == 0 || sources_n > INT32_MAX) {
+		fail("Expected between 1 and %d sources.", INT32_MAX);
+	}
+	if (options->harts < 0 || options->harts > MAX_HARTS) {
+		fail("Expected between 1 and %d harts.", MAX_HARTS);
+	}
+	struct source *copies = copy_sources(sources, sources_n);
+	compile_sources(sources_n, copies, options, res);
+	for (size_t i = 0; i < sources_n; i++) {
+		free(copies[i].text);
+	}
+	free(copies);
+}
+
+static void move_diagnostics(struct diagnostics *diagnostics,
+			     struct rv2jvm_result *result)
+{
+	if (diagnostics->size == 0) {
+		return;
+	}
+	result->diagnostics = malloc(diagnostics->size *
+				     sizeof(*result->diagnostics));
+	if (result->diagnostics == NULL) {
+		free_diagnostics(diagnostics);
+		return;
+	}
+	for (size_t i = 0; i < diagnostics->size; i++) {
+		struct diagnostic *diagnostic = &diagnostics->items[i];
+		result->diagnostics[i] = (struct rv2jvm_diagnostic) {
+			.severity = diagnostic->severity == SEVERITY_ERROR
+				    ? RV2JVM_ERROR : RV2JVM_WARNING,
+			.file = diagnostic->file,
+			.line = diagnostic->line,
+			.message = diagnostic->message
+		};
+	}
+	result->diagnostics_n = diagnostics->size;
+	// the strings now belong to the result
+	darray_free((*diagnostics));
+}
+
+int rv2jvm_compile(const struct rv2jvm_source *sources, size_t sources_n,
+		   const struct rv2jvm_options *options,
+		   struct rv2jvm_result *result)
+{
+	struct compile_options compile_options = { 0 };
+	if (options != NULL) {
+		compile_options.class_name = (char*)options->class_name;
+		compile_options.harts = options->harts;
+	}
+	*result = (struct rv2jvm_result) { 0 };
+
+	// allocations of a failed compilation are freed by the recovery
+	struct bytecode bytecode = { 0 };
+	struct recovery recovery;
+	begin_recovery(&recovery);
+	if (setjmp(recovery.env) == 0) {
+		compile_copies(sources, sources_n, &compile_options, &bytecode);
+	}
+	end_recovery(&recovery);
+
+	result->status = recovery.status;
+	if (recovery.status == 0) {
+		result->class_bytes = bytecode.items;
+		result->class_length = bytecode.size;
+	}
+	move_diagnostics(&recovery.diagnostics, result);
+	return result->status;
+}
+
+void rv2jvm_free_result(struct rv2jvm_result *result)
+{
+	free(result->class_bytes);
+	for (size_t i = 0; i < result->diagnostics_n; i++) {
+		free((char*)result->diagnostics[i].file);
+		free((char*)result->diagnostics[i].message);
+	}
+	free(result->diagnostics);
+	*result = (struct rv2jvm_result) { 0 };
+}
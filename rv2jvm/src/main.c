@@ -1,31 +1,456 @@
+#include <getopt.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
 
+#include "batch.h"
 #include "codegen.h"
 #include "compiler.h"
 #include "darray.h"
 #include "file.h"
+#include "jar.h"
+#include "options.h"
+#include "server.h"
+#include "stats.h"
 
-static void compile_files(int filepaths_n, char **filepaths)
+enum option_id {
+	OPTION_STATS = 256,
+	OPTION_TRACE,
+	OPTION_CACHE_DIR,
+	OPTION_OUTPUT,
+	OPTION_SERVER,
+	OPTION_CLIENT,
+	OPTION_WORKERS,
+	OPTION_BATCH,
+	OPTION_JOBS,
+	OPTION_JAR,
+	OPTION_HARTS,
+	OPTION_PROFILE_GENERATE,
+	OPTION_PROFILE_USE,
+	OPTION_RUN,
+	OPTION_SEPARATE,
+	OPTION_RUNNER,
+	OPTION_MEMORY_FILE,
+	OPTION_SHARE_MEMORY_FILE,
+	OPTION_SNAPSHOT
+};
+
+static struct option long_options[] = {
+	{ "stats", optional_argument, NULL, OPTION_STATS },
+	{ "trace", optional_argument, NULL, OPTION_TRACE },
+	{ "cache-dir", required_argument, NULL, OPTION_CACHE_DIR },
+	{ "output", required_argument, NULL, OPTION_OUTPUT },
+	{ "server", required_argument, NULL, OPTION_SERVER },
+	{ "client", required_argument, NULL, OPTION_CLIENT },
+	{ "workers", required_argument, NULL, OPTION_WORKERS },
+	{ "batch", required_argument, NULL, OPTION_BATCH },
+	{ "jobs", required_argument, NULL, OPTION_JOBS },
+	{ "jar", required_argument, NULL, OPTION_JAR },
+	{ "harts", required_argument, NULL, OPTION_HARTS },
+	{ "profile-generate", required_argument, NULL, OPTION_PROFILE_GENERATE },
+	{ "profile-use", required_argument, NULL, OPTION_PROFILE_USE },
+	{ "run", no_argument, NULL, OPTION_RUN },
+	{ "separate", no_argument, NULL, OPTION_SEPARATE },
+	{ "runner", required_argument, NULL, OPTION_RUNNER },
+	{ "memory-file", required_argument, NULL, OPTION_MEMORY_FILE },
+	{ "share-memory-file", no_argument, NULL, OPTION_SHARE_MEMORY_FILE },
+	{ "snapshot", required_argument, NULL, OPTION_SNAPSHOT },
+	{ NULL, 0, NULL, 0 }
+};
+
+struct main_options {
+	struct compile_options compile;
+	bool stats;
+	enum stats_format stats_format;
+	char *output;
+	char *server;
+	char *client;
+	int workers;
+	char *batch;
+	int jobs;
+	char *jar;
+	bool run;
+	bool separate;
+	char *runner;
+};
+
+static void usage(char *program)
+{
+	fprintf(stderr,
+		"Usage: %s [options] file...\n"
+		"       %s --server=socket [--workers=n] [options]\n"
+		"       %s --batch=manifest [--jobs=n] [options]\n"
+		"       %s --run [--harts=n] file...\n"
+		"       %s --separate [options] file...\n"
+		"       %s --runner=socket [--separate] [options] file...\n"
+		"  --stats[=text|json]  print per-phase timing, memory and codegen "
+		"statistics\n"
+		"  --trace[=level]      trace compilation to stderr "
+		"(1: codegen constants, labels and frames)\n"
+		"  --cache-dir=dir      reuse the parsed IR of unchanged files "
+		"from dir\n"
+		"  --output=file        write the class to file instead of "
+		"RvRuntime.class\n"
+		"  --jar=file           write the classes into a JAR archive, "
+		"runnable with java -jar\n"
+		"                       when it holds one program\n"
+		"  --server=socket      stay resident and compile requests sent "
+		"to socket\n"
+		"  --workers=n          number of server worker processes "
+		"(default: one per CPU)\n"
+		"  --client=socket      send the files to a server instead of "
+		"compiling them,\n"
+		"                       which compiles with its own options\n"
+		"  --batch=manifest     compile the programs listed in manifest, "
+		"one per line:\n"
+		"                       class_name output_path source...\n"
+		"  --jobs=n             number of batch threads "
+		"(default: one per CPU)\n"
+		"  --harts=n            start n harts sharing memory from main "
+		"(default: 1, at most %d)\n"
+		"  --profile-generate=file  count block executions and taken "
+		"branches, the\n"
+		"                       program writes them to file on exit\n"
+		"  --profile-use=file   lay out hot blocks by the counts in file "
+		"and move the\n"
+		"                       ones that never ran out of the hot "
+		"method\n"
+		"  --run                interpret the program instead of "
+		"compiling it and print\n"
+		"                       the nonzero registers of every hart "
+		"as hart register value\n"
+		"  --separate           compile every file into a class of its "
+		"own next to the\n"
+		"                       output, calling the .globl labels of "
+		"the others\n"
+		"  --runner=socket      run the program in the resident runner "
+		"listening on\n"
+		"                       socket (runner/RvRunner.java) instead "
+		"of writing it\n"
+		"  --memory-file=file   map guest memory from file, created when "
+		"missing, instead\n"
+		"                       of allocating it, writes stay private\n"
+		"  --share-memory-file  write guest memory through to the memory "
+		"file\n"
+		"  --snapshot=file      save registers and memory to file at "
+		"every EBREAK, the\n"
+		"                       class resumes from the file given as "
+		"its argument\n",
+		program, program, program, program, program, program, MAX_HARTS);
+	exit(EX_USAGE);
+}
+
+static void parse_options(int argc, char *argv[], struct main_options *options)
 {
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case OPTION_STATS:
+			options->stats = true;
+			if (optarg == NULL || strcmp(optarg, "text") == 0) {
+				options->stats_format = STATS_TEXT;
+			} else if (strcmp(optarg, "json") == 0) {
+				options->stats_format = STATS_JSON;
+			} else {
+				usage(argv[0]);
+			}
+			break;
+		case OPTION_TRACE:
+			options->compile.trace = optarg == NULL ? TRACE_CODEGEN
+								: atoi(optarg);
+			break;
+		case OPTION_CACHE_DIR:
+			options->compile.cache_dir = optarg;
+			break;
+		case OPTION_OUTPUT:
+			options->output = optarg;
+			break;
+		case OPTION_SERVER:
+			options->server = optarg;
+			break;
+		case OPTION_CLIENT:
+			options->client = optarg;
+			break;
+		case OPTION_WORKERS:
+			options->workers = atoi(optarg);
+			if (options->workers <= 0) {
+				usage(argv[0]);
+			}
+			break;
+		case OPTION_BATCH:
+			options->batch = optarg;
+			break;
+		case OPTION_JAR:
+			options->jar = optarg;
+			break;
+		case OPTION_JOBS:
+			options->jobs = atoi(optarg);
+			if (options->jobs <= 0) {
+				usage(argv[0]);
+			}
+			break;
+		case OPTION_HARTS:
+			options->compile.harts = atoi(optarg);
+			if (options->compile.harts <= 0 ||
+			    options->compile.harts > MAX_HARTS) {
+				usage(argv[0]);
+			}
+			break;
+		case OPTION_PROFILE_GENERATE:
+			options->compile.profile_generate = optarg;
+			break;
+		case OPTION_PROFILE_USE:
+			options->compile.profile_use = optarg;
+			break;
+		case OPTION_RUN:
+			options->run = true;
+			break;
+		case OPTION_SEPARATE:
+			options->separate = true;
+			break;
+		case OPTION_RUNNER:
+			options->runner = optarg;
+			break;
+		case OPTION_MEMORY_FILE:
+			options->compile.memory_file = optarg;
+			break;
+		case OPTION_SHARE_MEMORY_FILE:
+			options->compile.share_memory_file = true;
+			break;
+		case OPTION_SNAPSHOT:
+			options->compile.snapshot = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	// a profile belongs to one program compiled here
+	bool profile = options->compile.profile_generate != NULL ||
+		       options->compile.profile_use != NULL;
+	if ((options->compile.profile_generate != NULL &&
+	     options->compile.profile_use != NULL) ||
+	    (profile && (options->server != NULL || options->batch != NULL ||
+			 options->client != NULL))) {
+		usage(argv[0]);
+	}
+	if (options->compile.share_memory_file &&
+	    options->compile.memory_file == NULL) {
+		usage(argv[0]);
+	}
+	// a snapshot is of the one hart of a program compiled here, whose
+	// memory is an array and whose blocks are all in hart
+	if (options->compile.snapshot != NULL &&
+	    (options->compile.harts > 1 || options->compile.profile_use != NULL ||
+	     options->compile.memory_file != NULL || options->separate ||
+	     options->server != NULL || options->batch != NULL ||
+	     options->client != NULL)) {
+		usage(argv[0]);
+	}
+	// nothing is compiled, only the harts carry over to the interpreter
+	if (options->run &&
+	    (profile || options->compile.memory_file != NULL ||
+	     options->compile.snapshot != NULL ||
+	     options->server != NULL || options->batch != NULL ||
+	     options->client != NULL || options->jar != NULL ||
+	     strcmp(options->output, "RvRuntime.class") != 0)) {
+		usage(argv[0]);
+	}
+	// profiles and the other modes are of one class per program
+	if (options->separate &&
+	    (profile || options->run || options->server != NULL ||
+	     options->batch != NULL || options->client != NULL)) {
+		usage(argv[0]);
+	}
+	// the classes go to the runner, not to a file
+	if (options->runner != NULL &&
+	    (options->run || options->server != NULL || options->batch != NULL ||
+	     options->client != NULL || options->jar != NULL ||
+	     strcmp(options->output, "RvRuntime.class") != 0)) {
+		usage(argv[0]);
+	}
+	// the server compiles with the options it was started with
+	if (options->client != NULL &&
+	    (options->compile.harts != 0 || options->compile.memory_file != NULL ||
+	     options->compile.cache_dir != NULL ||
+	     options->compile.trace != TRACE_NONE || options->stats)) {
+		usage(argv[0]);
+	}
+	if (options->server != NULL || options->batch != NULL) {
+		// servers and batches read their files from requests, manifests
+		if (optind < argc || options->client != NULL || options->stats ||
+		    (options->server != NULL && options->batch != NULL) ||
+		    (options->server != NULL && options->jar != NULL)) {
+			usage(argv[0]);
+		}
+		return;
+	}
+	if (optind >= argc || (options->client != NULL && options->jar != NULL)) {
+		usage(argv[0]);
+	}
+}
+
+static void compile_files(int filepaths_n, char **filepaths,
+			  struct main_options *options)
+{
+	struct compile_stats stats = { 0 };
+	if (options->stats) {
+		options->compile.stats = &stats;
+	}
+
 	struct bytecode bytecode = { 0 };
-	compile(filepaths_n, filepaths, &bytecode);
-	char *compiled_filename = "RvRuntime.class";
-	write_file(compiled_filename, bytecode.items, bytecode.size);
+	compile(filepaths_n, filepaths, &options->compile, &bytecode);
+	if (options->jar != NULL) {
+		char *class_name = "RvRuntime";
+		struct jar *jar = jar_open(options->jar, class_name);
+		jar_add_class(jar, class_name, bytecode.items, bytecode.size);
+		jar_close(jar);
+	} else {
+		write_file(options->output, bytecode.items, bytecode.size);
+	}
 
+	if (options->stats) {
+		print_stats(stdout, &stats, options->stats_format);
+		free_stats(&stats);
+	}
 	darray_free(bytecode);
 }
 
-int main(int argc, char *argv[])
+/*
+ * The classes of the files go to the directory of the runtime class, or
+ * all into the JAR.
+ */
+static void write_separately(struct class_files *files,
+			     struct main_options *options)
+{
+	if (options->jar != NULL) {
+		struct jar *jar = jar_open(options->jar, files->items[0].name);
+		for (size_t i = 0; i < files->size; i++) {
+			jar_add_class(jar, files->items[i].name,
+				      files->items[i].bytecode.items,
+				      files->items[i].bytecode.size);
+		}
+		jar_close(jar);
+		return;
+	}
+	write_file(options->output, files->items[0].bytecode.items,
+		   files->items[0].bytecode.size);
+	char *slash = strrchr(options->output, '/');
+	int directory = slash != NULL ? slash - options->output + 1 : 0;
+	for (size_t i = 1; i < files->size; i++) {
+		struct class_file *file = &files->items[i];
+		size_t length = directory + strlen(file->name) +
+				sizeof(".class");
+		char *path = malloc(length);
+		if (path == NULL) {
+			fprintf(stderr, "Failed to allocate memory for path.\n");
+			exit(EXIT_FAILURE);
+		}
+		snprintf(path, length, "%.*s%s.class", directory,
+			 options->output, file->name);
+		write_file(path, file->bytecode.items, file->bytecode.size);
+		free(path);
+	}
+}
+
+static void compile_files_separately(int filepaths_n, char **filepaths,
+				     struct main_options *options)
+{
+	struct compile_stats stats = { 0 };
+	if (options->stats) {
+		options->compile.stats = &stats;
+	}
+
+	struct class_files files = { 0 };
+	compile_separately(filepaths_n, filepaths, &options->compile, &files);
+	write_separately(&files, options);
+
+	if (options->stats) {
+		print_stats(stdout, &stats, options->stats_format);
+		free_stats(&stats);
+	}
+	free_class_files(&files);
+}
+
+static int run_files_on_runner(int filepaths_n, char **filepaths,
+			       struct main_options *options)
 {
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s file...\n", argv[0]);
-		exit(EX_USAGE);
+	struct compile_stats stats = { 0 };
+	if (options->stats) {
+		options->compile.stats = &stats;
+	}
+
+	struct class_files files = { 0 };
+	if (options->separate) {
+		compile_separately(filepaths_n, filepaths, &options->compile,
+				   &files);
 	} else {
-		compile_files(argc - 1, &argv[1]);
+		struct class_file file = { .name = strdup(DEFAULT_CLASS_NAME) };
+		if (file.name == NULL) {
+			fprintf(stderr, "Failed to allocate memory for class name.\n");
+			exit(EXIT_FAILURE);
+		}
+		compile(filepaths_n, filepaths, &options->compile,
+			&file.bytecode);
+		darray_append(files, file);
+	}
+	int status = run_on_runner(options->runner, &files);
+
+	if (options->stats) {
+		print_stats(stdout, &stats, options->stats_format);
+		free_stats(&stats);
+	}
+	free_class_files(&files);
+	return status;
+}
+
+static void run_files(int filepaths_n, char **filepaths,
+		      struct main_options *options)
+{
+	struct compile_stats stats = { 0 };
+	if (options->stats) {
+		options->compile.stats = &stats;
+	}
+
+	run(filepaths_n, filepaths, &options->compile, stdout);
+
+	if (options->stats) {
+		print_stats(stdout, &stats, options->stats_format);
+		free_stats(&stats);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct main_options options = { .output = "RvRuntime.class" };
+	parse_options(argc, argv, &options);
+	if (options.server != NULL) {
+		return run_server(options.server, options.workers,
+				  &options.compile);
+	}
+	if (options.batch != NULL) {
+		return run_batch(options.batch, options.jobs, &options.compile,
+				 options.jar);
+	}
+	if (options.client != NULL) {
+		return run_client(options.client, argc - optind, &argv[optind],
+				  options.output);
+	}
+	if (options.runner != NULL) {
+		return run_files_on_runner(argc - optind, &argv[optind],
+					   &options);
+	}
+	if (options.run) {
+		run_files(argc - optind, &argv[optind], &options);
+		return 0;
+	}
+	if (options.separate) {
+		compile_files_separately(argc - optind, &argv[optind],
+					 &options);
+		return 0;
 	}
+	compile_files(argc - optind, &argv[optind], &options);
 	return 0;
 }
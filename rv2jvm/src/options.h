@@ -0,0 +1,40 @@
+#ifndef RV2JVM_OPTIONS_H
+#define RV2JVM_OPTIONS_H
+
+#include <stdbool.h>
+
+#include "stats.h"
+
+// main starts the harts one by one, this keeps its code within 64 KiB
+#define MAX_HARTS 1024
+#define DEFAULT_CLASS_NAME "RvRuntime"
+
+enum trace_level {
+	TRACE_NONE,
+	TRACE_CODEGEN
+};
+
+struct compile_options {
+	enum trace_level trace;
+	struct compile_stats *stats;
+	char *cache_dir;
+	// name of the generated class, DEFAULT_CLASS_NAME when NULL
+	char *class_name;
+	// number of harts main starts, one when 0
+	int harts;
+	// profile file an instrumented program writes on exit
+	char *profile_generate;
+	// profile file to lay out the blocks by
+	char *profile_use;
+	// file guest memory is mapped from instead of allocated on the heap
+	char *memory_file;
+	// writes to memory go to the file, not to private copies of its pages
+	bool share_memory_file;
+	// file the program saves its state to at every EBREAK
+	char *snapshot;
+	// write classes past the limits of the JVM instead of failing, for
+	// benchmarks that time the compiler on programs no class holds
+	bool ignore_class_limits;
+};
+
+#endif
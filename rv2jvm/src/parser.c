@@ -8,6 +8,7 @@
 #include <sysexits.h>
 
 #include "darray.h"
+#include "error.h"
 #include "ir.h"
 #include "tokens.h"
 
@@ -19,6 +20,33 @@ struct parser {
 	} ir;
 	struct tokens *tokens;
 	struct token *current;
+	// a .data directive came after the last .text
+	bool in_data;
+};
+
+/*
+ * Directives, the kind of token their operands are and how many they
+ * take, any number when max_operands is 0.
+ */
+static const struct directive_syntax {
+	char *name;
+	enum token_type operand;
+	// labels may stand for numbers
+	bool labels;
+	size_t min_operands;
+	size_t max_operands;
+} directives[] = {
+	{ ".text", TOKEN_EOF, false, 0, 0 },
+	{ ".data", TOKEN_EOF, false, 0, 0 },
+	{ ".word", TOKEN_DECIMAL, true, 1, 0 },
+	{ ".half", TOKEN_DECIMAL, false, 1, 0 },
+	{ ".byte", TOKEN_DECIMAL, false, 1, 0 },
+	{ ".zero", TOKEN_DECIMAL, false, 1, 1 },
+	{ ".align", TOKEN_DECIMAL, false, 1, 1 },
+	{ ".string", TOKEN_STRING, false, 1, 0 },
+	{ ".asciz", TOKEN_STRING, false, 1, 0 },
+	{ ".globl", TOKEN_IDENTIFIER, false, 1, 0 },
+	{ ".global", TOKEN_IDENTIFIER, false, 1, 0 }
 };
 
 static void advance(struct parser *parser)
@@ -34,8 +62,7 @@ static void consume(struct parser *parser, enum token_type type,
 		return;
 	}
 
-	fprintf(stderr, "%s\n", message);
-	exit(EXIT_FAILURE);
+	fail_at(parser->current->file, parser->current->line, "%s", message);
 }
 
 static bool check(struct parser *parser, enum token_type type)
@@ -89,10 +116,59 @@ static enum ir_instruction_mnemonic check_mnemonic(char *lexeme, size_t start,
 	return UNKNOWN_MNEMONIC;
 }
 
+static enum ir_instruction_mnemonic amo_trie(char *lexeme, size_t length)
+{
+	enum ir_instruction_mnemonic mnemonic;
+	switch (lexeme[3]) {
+	case 'a':
+		mnemonic = check_mnemonic(lexeme, 4, 4, "dd.w", length, AMOADD_W);
+		if (mnemonic == UNKNOWN_MNEMONIC) {
+			return check_mnemonic(lexeme, 4, 4, "nd.w", length,
+					      AMOAND_W);
+		}
+		return mnemonic;
+	case 'm':
+		if (length < 6) {
+			break;
+		}
+		switch (lexeme[4]) {
+		case 'a':
+			mnemonic = check_mnemonic(lexeme, 5, 3, "x.w", length,
+						  AMOMAX_W);
+			if (mnemonic == UNKNOWN_MNEMONIC) {
+				return check_mnemonic(lexeme, 5, 4, "xu.w",
+						      length, AMOMAXU_W);
+			}
+			return mnemonic;
+		case 'i':
+			mnemonic = check_mnemonic(lexeme, 5, 3, "n.w", length,
+						  AMOMIN_W);
+			if (mnemonic == UNKNOWN_MNEMONIC) {
+				return check_mnemonic(lexeme, 5, 4, "nu.w",
+						      length, AMOMINU_W);
+			}
+			return mnemonic;
+		}
+		break;
+	case 'o':
+		return check_mnemonic(lexeme, 4, 3, "r.w", length, AMOOR_W);
+	case 's':
+		return check_mnemonic(lexeme, 4, 5, "wap.w", length, AMOSWAP_W);
+	case 'x':
+		return check_mnemonic(lexeme, 4, 4, "or.w", length, AMOXOR_W);
+	}
+	return UNKNOWN_MNEMONIC;
+}
+
 static enum ir_instruction_mnemonic a_trie(char *lexeme, size_t length)
 {
 	enum ir_instruction_mnemonic mnemonic;
 	switch (lexeme[1]) {
+	case 'm':
+		if (length < 4 || lexeme[2] != 'o') {
+			break;
+		}
+		return amo_trie(lexeme, length);
 	case 'd':
 		mnemonic = check_mnemonic(lexeme, 2, 2, "di", length, ADDI);
 		if (mnemonic == UNKNOWN_MNEMONIC) {
@@ -155,6 +231,11 @@ static enum ir_instruction_mnemonic l_trie(char *lexeme, size_t length)
 {
 	enum ir_instruction_mnemonic mnemonic;
 	switch (lexeme[1]) {
+	case 'a':
+		if (length == 2) {
+			return LA;
+		}
+		break;
 	case 'b':
 		if (length == 2) {
 			return check_mnemonic(lexeme, 2, 0, "", length, LB);
@@ -165,6 +246,13 @@ static enum ir_instruction_mnemonic l_trie(char *lexeme, size_t length)
 			return check_mnemonic(lexeme, 2, 0, "", length, LH);
 		}
 		return check_mnemonic(lexeme, 2, 1, "u", length, LHU);
+	case 'i':
+		if (length == 2) {
+			return LI;
+		}
+		break;
+	case 'r':
+		return check_mnemonic(lexeme, 2, 2, ".w", length, LR_W);
 	case 'u':
 		return check_mnemonic(lexeme, 2, 1, "i", length, LUI);
 	case 'w':
@@ -176,6 +264,31 @@ static enum ir_instruction_mnemonic l_trie(char *lexeme, size_t length)
 	return UNKNOWN_MNEMONIC;
 }
 
+static enum ir_instruction_mnemonic m_trie(char *lexeme, size_t length)
+{
+	switch (lexeme[1]) {
+	case 'u':
+		if (length < 3 || lexeme[2] != 'l') {
+			break;
+		}
+		switch (length) {
+		case 3:
+			return MUL;
+		case 4:
+			return check_mnemonic(lexeme, 3, 1, "h", length, MULH);
+		case 5:
+			return check_mnemonic(lexeme, 3, 2, "hu", length, MULHU);
+		case 6:
+			return check_mnemonic(lexeme, 3, 3, "hsu", length,
+					      MULHSU);
+		}
+		break;
+	case 'v':
+		return check_mnemonic(lexeme, 2, 0, "", length, MV);
+	}
+	return UNKNOWN_MNEMONIC;
+}
+
 static enum ir_instruction_mnemonic s_trie(char *lexeme, size_t length)
 {
 	enum ir_instruction_mnemonic mnemonic;
@@ -185,6 +298,8 @@ static enum ir_instruction_mnemonic s_trie(char *lexeme, size_t length)
 			return SB;
 		}
 		break;
+	case 'c':
+		return check_mnemonic(lexeme, 2, 2, ".w", length, SC_W);
 	case 'e':
 		return check_mnemonic(lexeme, 2, 2, "qz", length, SEQZ);
 	case 'h':
@@ -254,10 +369,50 @@ static enum ir_instruction_mnemonic s_trie(char *lexeme, size_t length)
 	return UNKNOWN_MNEMONIC;
 }
 
-static enum ir_instruction_mnemonic get_mnemonic(struct token token)
+/*
+ * Strips the .aq, .rl or .aqrl suffix of an atomic instruction from the
+ * length of lexeme and returns its ordering bits.
+ */
+static uint8_t amo_ordering(char *lexeme, size_t *length)
+{
+	static const struct {
+		char *suffix;
+		uint8_t ordering;
+	} suffixes[] = {
+		{ ".aqrl", AMO_AQ | AMO_RL },
+		{ ".aq", AMO_AQ },
+		{ ".rl", AMO_RL }
+	};
+	for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+		size_t suffix_length = strlen(suffixes[i].suffix);
+		if (*length > suffix_length &&
+		    memcmp(lexeme + *length - suffix_length, suffixes[i].suffix,
+			   suffix_length) == 0) {
+			*length -= suffix_length;
+			return suffixes[i].ordering;
+		}
+	}
+	return 0;
+}
+
+static bool is_atomic(enum ir_instruction_mnemonic mnemonic)
+{
+	return mnemonic >= LR_W && mnemonic <= AMOMAXU_W;
+}
+
+static enum ir_instruction_mnemonic get_mnemonic(struct token token,
+						 uint8_t *ordering)
 {
 	size_t length = token.length;
 	char *lexeme = lower_str(token.lexeme, length);
+	*ordering = amo_ordering(lexeme, &length);
+	if (*ordering != 0) {
+		struct token base = token;
+		base.length = length;
+		uint8_t none;
+		enum ir_instruction_mnemonic mnemonic = get_mnemonic(base, &none);
+		return is_atomic(mnemonic) ? mnemonic : UNKNOWN_MNEMONIC;
+	}
 	enum ir_instruction_mnemonic mnemonic;
 	switch (lexeme[0]) {
 	case 'a':
@@ -270,6 +425,14 @@ static enum ir_instruction_mnemonic get_mnemonic(struct token token)
 			break;
 		}
 		return b_trie(lexeme, length);
+	case 'c':
+		return check_mnemonic(lexeme, 1, 3, "all", length, CALL);
+	case 'd':
+		mnemonic = check_mnemonic(lexeme, 1, 3, "ivu", length, DIVU);
+		if (mnemonic == UNKNOWN_MNEMONIC) {
+			return check_mnemonic(lexeme, 1, 2, "iv", length, DIV);
+		}
+		return mnemonic;
 	case 'e':
 		if (length < 2) {
 			break;
@@ -296,7 +459,10 @@ static enum ir_instruction_mnemonic get_mnemonic(struct token token)
 		}
 		return l_trie(lexeme, length);
 	case 'm':
-		return check_mnemonic(lexeme, 1, 1, "v", length, MV);
+		if (length < 2) {
+			break;
+		}
+		return m_trie(lexeme, length);
 	case 'n':
 		mnemonic = check_mnemonic(lexeme, 1, 2, "op", length, NOP);
 		if (mnemonic == UNKNOWN_MNEMONIC) {
@@ -310,7 +476,15 @@ static enum ir_instruction_mnemonic get_mnemonic(struct token token)
 		}
 		return mnemonic;
 	case 'r':
-		return check_mnemonic(lexeme, 1, 2, "et", length, RET);
+		mnemonic = check_mnemonic(lexeme, 1, 2, "et", length, RET);
+		if (mnemonic != UNKNOWN_MNEMONIC) {
+			return mnemonic;
+		}
+		mnemonic = check_mnemonic(lexeme, 1, 3, "emu", length, REMU);
+		if (mnemonic == UNKNOWN_MNEMONIC) {
+			return check_mnemonic(lexeme, 1, 2, "em", length, REM);
+		}
+		return mnemonic;
 	case 's':
 		if (length < 2) {
 			break;
@@ -352,9 +526,8 @@ static int32_t number(struct parser *parser)
 	long value = strtol(decimal, &endptr, 10);
 	
 	if (*endptr != '\0') {
-		fprintf(stderr, "Invalid decimal number: %s at %s line %lu\n",
-			decimal, parser->current->file, parser->current->line);
-		exit(EXIT_FAILURE);
+		fail_at(parser->current->file, parser->current->line,
+			"Invalid decimal number: %s", decimal);
 	}
 	
 	if (negative) {
@@ -370,10 +543,8 @@ static enum ir_instruction_register reg(struct parser *parser)
 	enum ir_instruction_register r = parse_register(register_str);
 	
 	if (r == (enum ir_instruction_register)-1) {
-		fprintf(stderr, "Invalid register: %s at %s line %lu\n",
-			register_str, parser->current->file,
-			parser->current->line);
-		exit(EXIT_FAILURE);
+		fail_at(parser->current->file, parser->current->line,
+			"Invalid register: %s", register_str);
 	}
 	
 	consume(parser, TOKEN_IDENTIFIER, "identifier expected");
@@ -387,7 +558,57 @@ static char *identifier(struct parser *parser)
 	return identifier;
 }
 
-static void memory_operand(struct parser *parser, int16_t *offset, 
+/*
+ * Parses %hi(label), %lo(label), %pcrel_hi(label) or %pcrel_lo(label).
+ */
+static char *relocation(struct parser *parser, enum ir_operand_type *type)
+{
+	consume(parser, TOKEN_PERCENT, "'%' expected");
+	char *function = parser->current->lexeme;
+	consume(parser, TOKEN_IDENTIFIER, "relocation function expected");
+	if (strcmp(function, "hi") == 0) {
+		*type = OPERAND_HI;
+	} else if (strcmp(function, "lo") == 0) {
+		*type = OPERAND_LO;
+	} else if (strcmp(function, "pcrel_hi") == 0) {
+		*type = OPERAND_PCREL_HI;
+	} else if (strcmp(function, "pcrel_lo") == 0) {
+		*type = OPERAND_PCREL_LO;
+	} else {
+		fail_at(parser->current->file, parser->current->line,
+			"Unknown relocation function: %%%s", function);
+	}
+	consume(parser, TOKEN_LPAREN, "Expected '(' after relocation function");
+	char *label = identifier(parser);
+	consume(parser, TOKEN_RPAREN, "Expected ')' after relocation label");
+	return label;
+}
+
+/*
+ * Parses a FENCE ordering set, some of i, o, r and w in that order.
+ */
+static uint32_t fence_set(struct parser *parser)
+{
+	char *set = parser->current->lexeme;
+	uint32_t bits = 0;
+	char *it = set;
+	char *letters = "iorw";
+	uint32_t flags[] = { FENCE_I, FENCE_O, FENCE_R, FENCE_W };
+	for (size_t i = 0; i < 4 && *it != '\0'; i++) {
+		if (tolower(*it) == letters[i]) {
+			bits |= flags[i];
+			it++;
+		}
+	}
+	if (*it != '\0' || bits == 0) {
+		fail_at(parser->current->file, parser->current->line,
+			"Invalid fence ordering set: %s", set);
+	}
+	consume(parser, TOKEN_IDENTIFIER, "fence ordering set expected");
+	return bits;
+}
+
+static void memory_operand(struct parser *parser, int16_t *offset,
 			   enum ir_instruction_register *rs1)
 {
 	if (check(parser, TOKEN_DECIMAL) || check(parser, TOKEN_MINUS)) {
@@ -498,6 +719,14 @@ static enum ir_instruction_type get_instruction_type(enum ir_instruction_mnemoni
 	case SLL:
 	case SRL:
 	case SRA:
+	case MUL:
+	case MULH:
+	case MULHSU:
+	case MULHU:
+	case DIV:
+	case DIVU:
+	case REM:
+	case REMU:
 		return TYPE_R3;
 	
 	case ADDI:
@@ -532,12 +761,35 @@ static enum ir_instruction_type get_instruction_type(enum ir_instruction_mnemoni
 	case AUIPC:
 	case JAL:
 		return TYPE_R1_OP;
+
+	case LR_W:
+	case SC_W:
+	case AMOSWAP_W:
+	case AMOADD_W:
+	case AMOAND_W:
+	case AMOOR_W:
+	case AMOXOR_W:
+	case AMOMIN_W:
+	case AMOMAX_W:
+	case AMOMINU_W:
+	case AMOMAXU_W:
+		return TYPE_AMO;
 	
 	default:
 		return -1; // pseudoinstruction
 	}
 }
 
+static void append_instruction(struct parser *parser,
+			       struct ir_instruction inst)
+{
+	struct ir_element element = {
+		.type = IR_INSTRUCTION,
+		.as.instruction = inst
+	};
+	darray_append((parser->ir), element);
+}
+
 static void parse_r3_instruction(struct parser *parser,
 				 enum ir_instruction_mnemonic mnemonic)
 {
@@ -577,6 +829,38 @@ static void parse_mem_instruction(struct parser *parser,
 	darray_append((parser->ir), element);
 }
 
+/*
+ * The address of an atomic instruction is (rs1), an offset other than 0 is
+ * an error.
+ */
+static void parse_amo_instruction(struct parser *parser,
+				  enum ir_instruction_mnemonic mnemonic,
+				  uint8_t ordering)
+{
+	struct ir_instruction inst = {
+		.type = TYPE_AMO,
+		.mnemonic = mnemonic,
+		.as.amo = {
+			.rs2 = X0,
+			.ordering = ordering
+		}
+	};
+
+	inst.as.amo.rd = reg(parser);
+	consume(parser, TOKEN_COMMA, "Expected ',' after rd");
+	if (mnemonic != LR_W) {
+		inst.as.amo.rs2 = reg(parser);
+		consume(parser, TOKEN_COMMA, "Expected ',' after rs2");
+	}
+	int16_t offset;
+	memory_operand(parser, &offset, &inst.as.amo.rs1);
+	if (offset != 0) {
+		fail_at(parser->current->file, parser->current->line,
+			"Atomic instructions take no address offset");
+	}
+	append_instruction(parser, inst);
+}
+
 static void parse_r2op_instruction(struct parser *parser,
 				   enum ir_instruction_mnemonic mnemonic)
 {
@@ -595,10 +879,14 @@ static void parse_r2op_instruction(struct parser *parser,
 	} else if (check(parser, TOKEN_IDENTIFIER)) {
 		char *label = identifier(parser);
 		inst = create_r2op_label_instruction(mnemonic, rd, rs1, label);
+	} else if (check(parser, TOKEN_PERCENT)) {
+		enum ir_operand_type type;
+		char *label = relocation(parser, &type);
+		inst = create_r2op_label_instruction(mnemonic, rd, rs1, label);
+		inst.as.r2op.op_type = type;
 	} else {
-		fprintf(stderr, "Expected immediate or label at %s line %lu\n",
-			parser->current->file, parser->current->line);
-		exit(EXIT_FAILURE);
+		fail_at(parser->current->file, parser->current->line,
+			"Expected immediate or label");
 	}
 	
 	struct ir_element element = {
@@ -624,10 +912,14 @@ static void parse_r1op_instruction(struct parser *parser,
 	} else if (check(parser, TOKEN_IDENTIFIER)) {
 		char *label = identifier(parser);
 		inst = create_r1op_label_instruction(mnemonic, rd, label);
+	} else if (check(parser, TOKEN_PERCENT)) {
+		enum ir_operand_type type;
+		char *label = relocation(parser, &type);
+		inst = create_r1op_label_instruction(mnemonic, rd, label);
+		inst.as.r1op.op_type = type;
 	} else {
-		fprintf(stderr, "Expected immediate or label at %s line %lu\n",
-			parser->current->file, parser->current->line);
-		exit(EXIT_FAILURE);
+		fail_at(parser->current->file, parser->current->line,
+			"Expected immediate or label");
 	}
 	
 	struct ir_element element = {
@@ -679,6 +971,48 @@ static void parse_special_instruction(struct parser *parser,
 		break;
 	}
 	
+	case LI: {
+		// lui with the rounded upper 20 bits, then addi the rest
+		enum ir_instruction_register rd = reg(parser);
+		consume(parser, TOKEN_COMMA, "Expected ',' after rd");
+		int32_t value = number(parser);
+		if (value >= -2048 && value < 2048) {
+			inst = create_r2op_imm_instruction(ADDI, rd, X0, value);
+			break;
+		}
+		uint32_t hi = ((uint32_t)value + 0x800) >> 12;
+		int32_t lo = (int32_t)((uint32_t)value - (hi << 12));
+		inst = create_r1op_imm_instruction(LUI, rd, hi);
+		if (lo == 0) {
+			break;
+		}
+		append_instruction(parser, inst);
+		inst = create_r2op_imm_instruction(ADDI, rd, rd, lo);
+		break;
+	}
+
+	case LA: {
+		enum ir_instruction_register rd = reg(parser);
+		consume(parser, TOKEN_COMMA, "Expected ',' after rd");
+		char *label = identifier(parser);
+		inst = create_r1op_label_instruction(AUIPC, rd, label);
+		inst.as.r1op.op_type = OPERAND_PCREL_HI;
+		append_instruction(parser, inst);
+		inst = create_r2op_label_instruction(ADDI, rd, rd, label);
+		inst.as.r2op.op_type = OPERAND_PCREL_LO;
+		break;
+	}
+
+	case CALL: {
+		char *label = identifier(parser);
+		inst = create_r1op_label_instruction(AUIPC, X1, label);
+		inst.as.r1op.op_type = OPERAND_PCREL_HI;
+		append_instruction(parser, inst);
+		inst = create_r2op_label_instruction(JALR, X1, X1, label);
+		inst.as.r2op.op_type = OPERAND_PCREL_LO;
+		break;
+	}
+
 	case J: {
 		char *label = identifier(parser);
 		inst = create_r1op_label_instruction(JAL, X0, label);
@@ -703,7 +1037,14 @@ static void parse_special_instruction(struct parser *parser,
 	}
 	
 	case FENCE: {
-		inst = create_r2op_imm_instruction(FENCE, X0, X0, 0);
+		int32_t ordering = FENCE_ALL;
+		if (check(parser, TOKEN_IDENTIFIER)) {
+			uint32_t pred = fence_set(parser);
+			consume(parser, TOKEN_COMMA, "Expected ',' after predecessor set");
+			uint32_t succ = fence_set(parser);
+			ordering = pred << 4 | succ;
+		}
+		inst = create_r2op_imm_instruction(FENCE, X0, X0, ordering);
 		break;
 	}
 	
@@ -718,8 +1059,7 @@ static void parse_special_instruction(struct parser *parser,
 	}
 	
 	default:
-		fprintf(stderr, "Unhandled pseudoinstruction mnemonic: %d\n", mnemonic);
-		exit(EXIT_FAILURE);
+		fail("Unhandled pseudoinstruction mnemonic: %d", mnemonic);
 	}
 	
 	struct ir_element element = {
@@ -731,13 +1071,14 @@ static void parse_special_instruction(struct parser *parser,
 
 static void instruction(struct parser *parser)
 {
-	enum ir_instruction_mnemonic mnemonic = get_mnemonic(*parser->current);
+	uint8_t ordering;
+	enum ir_instruction_mnemonic mnemonic = get_mnemonic(*parser->current,
+							     &ordering);
 	
 	if (mnemonic == UNKNOWN_MNEMONIC) {
-		fprintf(stderr, "Unknown instruction mnemonic: %s at %s line %lu\n",
-			parser->current->lexeme, parser->current->file,
-			parser->current->line);
-		exit(EXIT_FAILURE);
+		fail_at(parser->current->file, parser->current->line,
+			"Unknown instruction mnemonic: %s",
+			parser->current->lexeme);
 	}
 	
 	advance(parser);
@@ -757,6 +1098,9 @@ static void instruction(struct parser *parser)
 	case TYPE_MEM:
 		parse_mem_instruction(parser, mnemonic);
 		break;
+	case TYPE_AMO:
+		parse_amo_instruction(parser, mnemonic, ordering);
+		break;
 	default:
 		// pseudoinstructions
 		parse_special_instruction(parser, mnemonic);
@@ -766,6 +1110,77 @@ static void instruction(struct parser *parser)
 	consume(parser, TOKEN_NEWLINE, "NEWLINE expected after instruction");
 }
 
+static const struct directive_syntax *directive_syntax(struct token *token)
+{
+	char *name = lower_str(token->lexeme, token->length);
+	for (size_t i = 0; i < sizeof(directives) / sizeof(directives[0]); i++) {
+		if (strcmp(name, directives[i].name) == 0) {
+			return &directives[i];
+		}
+	}
+	fail_at(token->file, token->line, "Unknown directive: %s", name);
+}
+
+/*
+ * Copies an operand out of the tokens, which negative numbers are two of.
+ */
+static char *directive_operand(struct parser *parser,
+			       const struct directive_syntax *syntax)
+{
+	bool negative = match(parser, TOKEN_MINUS);
+	struct token *token = parser->current;
+	bool valid = token->type == syntax->operand ||
+		     (!negative && syntax->labels &&
+		      token->type == TOKEN_IDENTIFIER);
+	if (!valid) {
+		fail_at(token->file, token->line, "Invalid operand of %s: %s",
+			syntax->name, token->lexeme);
+	}
+	advance(parser);
+
+	char *operand = malloc(token->length + negative + 1);
+	if (operand == NULL) {
+		fail("Failed to allocate memory for operand.");
+	}
+	operand[0] = '-';
+	memcpy(operand + negative, token->lexeme, token->length + 1);
+	return operand;
+}
+
+static void directive(struct parser *parser)
+{
+	struct token *token = parser->current;
+	const struct directive_syntax *syntax = directive_syntax(token);
+	advance(parser);
+
+	struct ir_directive directive = { .name = syntax->name };
+	if (!check(parser, TOKEN_NEWLINE)) {
+		do {
+			char *operand = directive_operand(parser, syntax);
+			darray_append(directive.operands, operand);
+		} while (match(parser, TOKEN_COMMA));
+	}
+	size_t operands = directive.operands.size;
+	if (operands < syntax->min_operands ||
+	    (syntax->max_operands != 0 && operands > syntax->max_operands) ||
+	    (syntax->operand == TOKEN_EOF && operands != 0)) {
+		fail_at(token->file, token->line,
+			"Wrong number of operands of %s", syntax->name);
+	}
+	if (strcmp(syntax->name, ".data") == 0) {
+		parser->in_data = true;
+	} else if (strcmp(syntax->name, ".text") == 0) {
+		parser->in_data = false;
+	}
+
+	struct ir_element element = {
+		.type = IR_DIRECTIVE,
+		.as.directive = directive
+	};
+	darray_append((parser->ir), element);
+	consume(parser, TOKEN_NEWLINE, "NEWLINE expected after directive");
+}
+
 void parse(struct tokens tokens, struct ir_element **res)
 {
 	struct parser parser = { 0 };
@@ -778,12 +1193,41 @@ void parse(struct tokens tokens, struct ir_element **res)
 		}
 		if (check_next(&parser, TOKEN_COLON)) {
 			label(&parser);
+		} else if (check(&parser, TOKEN_IDENTIFIER) &&
+			   parser.current->lexeme[0] == '.') {
+			directive(&parser);
 		} else {
 			instruction(&parser);
 		}
 	}
 
+	// the next file starts in .text again
+	if (parser.in_data) {
+		struct ir_element text = {
+			.type = IR_DIRECTIVE,
+			.as.directive.name = directives[0].name
+		};
+		darray_append((parser.ir), text);
+	}
+
 	struct ir_element eof = { .type = IR_EOF };
 	darray_append((parser.ir), eof);
 	*res = parser.ir.items;
 }
+
+/*
+ * Frees IR made by parse(), the operands of directives belong to it.
+ */
+void free_ir(struct ir_element *ir)
+{
+	for (struct ir_element *it = ir; it->type != IR_EOF; it++) {
+		if (it->type != IR_DIRECTIVE) {
+			continue;
+		}
+		for (size_t i = 0; i < it->as.directive.operands.size; i++) {
+			free(it->as.directive.operands.items[i]);
+		}
+		darray_free(it->as.directive.operands);
+	}
+	free(ir);
+}
@@ -5,5 +5,6 @@
 #include "tokens.h"
 
 void parse(struct tokens tokens, struct ir_element **res);
+void free_ir(struct ir_element *ir);
 
 #endif
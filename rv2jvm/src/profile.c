@@ -0,0 +1,612 @@
+#include "profile.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include "darray.h"
+#include "error.h"
+#include "ir.h"
+#include "table.h"
+
+#define INSTRUCTION_SIZE 4
+
+struct label_block {
+	size_t block;
+};
+
+static bool ends_block(struct ir_instruction *instruction)
+{
+	switch (instruction->mnemonic) {
+	case BEQ:
+	case BNE:
+	case BLT:
+	case BLTU:
+	case BGE:
+	case BGEU:
+		return instruction->as.r2op.op_type == OPERAND_LABEL;
+	case J:
+	case JAL:
+		return instruction->as.r1op.op_type == OPERAND_LABEL;
+	default:
+		return false;
+	}
+}
+
+static void add_block(struct ir_element *ir, struct blocks *blocks,
+		      size_t first, size_t end, uint32_t address)
+{
+	struct block block = {
+		.first = first,
+		.end = end,
+		.address = address,
+		.target = NO_BLOCK,
+		.falls_through = true,
+		.placement = BLOCK_HOT
+	};
+	if (ir[first].type == IR_LABEL) {
+		block.name = ir[first].as.label.name;
+	}
+	for (size_t i = first; i < end && ir[i].type == IR_LABEL; i++) {
+		struct label_block *value = malloc(sizeof(*value));
+		if (value == NULL) {
+			fail("Failed to allocate memory for label_block.");
+		}
+		value->block = blocks->size;
+		table_set(blocks->by_label, to_string_key(ir[i].as.label.name),
+			  value);
+	}
+	darray_append((*blocks), block);
+}
+
+size_t block_of_label(struct blocks *blocks, char *label)
+{
+	struct table_value *value = table_get(blocks->by_label,
+					      to_string_key(label));
+	if (value == NULL) {
+		return NO_BLOCK;
+	}
+	return ((struct label_block*)value->value)->block;
+}
+
+static void find_targets(struct ir_element *ir, struct blocks *blocks)
+{
+	for (size_t i = 0; i < blocks->size; i++) {
+		struct block *block = &blocks->items[i];
+		struct ir_element *last = &ir[block->end - 1];
+		if (last->type != IR_INSTRUCTION ||
+		    !ends_block(&last->as.instruction)) {
+			continue;
+		}
+		struct ir_instruction *instruction = &last->as.instruction;
+		if (instruction->type == TYPE_R1_OP) {
+			block->target = block_of_label(blocks,
+						       instruction->as.r1op.op.label);
+			block->falls_through = false;
+		} else {
+			block->target = block_of_label(blocks,
+						       instruction->as.r2op.op.label);
+			block->conditional = true;
+		}
+	}
+}
+
+void find_blocks(struct ir_element *ir, char *entry_label,
+		 bool ebreak_ends_block, struct blocks *blocks)
+{
+	blocks->items = NULL;
+	blocks->size = 0;
+	blocks->capacity = 0;
+	blocks->by_label = table_create();
+	blocks->order = NULL;
+	blocks->hot = 0;
+
+	size_t first = 0;
+	uint32_t first_address = 0;
+	uint32_t address = 0;
+	bool has_instructions = false;
+	size_t i = 0;
+	for (; ir[i].type != IR_EOF; i++) {
+		if (ir[i].type == IR_LABEL && has_instructions) {
+			add_block(ir, blocks, first, i, first_address);
+			first = i;
+			first_address = address;
+			has_instructions = false;
+		}
+		if (ir[i].type != IR_INSTRUCTION) {
+			continue;
+		}
+		has_instructions = true;
+		address += INSTRUCTION_SIZE;
+		if (ends_block(&ir[i].as.instruction) ||
+		    (ebreak_ends_block &&
+		     ir[i].as.instruction.mnemonic == EBREAK)) {
+			add_block(ir, blocks, first, i + 1, first_address);
+			first = i + 1;
+			first_address = address;
+			has_instructions = false;
+		}
+	}
+	if (first < i) {
+		add_block(ir, blocks, first, i, first_address);
+	}
+	find_targets(ir, blocks);
+
+	size_t entry = block_of_label(blocks, entry_label);
+	blocks->entry = entry != NO_BLOCK ? entry : 0;
+}
+
+// nothing but labels and a jump to a block of the file, which keeps ra
+static bool is_trampoline(struct ir_element *ir, struct block *block)
+{
+	if (block->target == NO_BLOCK || block->conditional) {
+		return false;
+	}
+	struct ir_instruction *jump = &ir[block->end - 1].as.instruction;
+	if (jump->as.r1op.rd != X0) {
+		return false;
+	}
+	for (size_t i = block->first; i < block->end - 1; i++) {
+		if (ir[i].type == IR_INSTRUCTION) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// the first block past the trampolines starting at block
+static size_t thread_target(struct ir_element *ir, struct blocks *blocks,
+			    size_t block)
+{
+	// a cycle of trampolines never gets anywhere, it is left as it is
+	for (size_t hops = 0; hops < blocks->size; hops++) {
+		struct block *b = &blocks->items[block];
+		if (!is_trampoline(ir, b) || b->target == block) {
+			return block;
+		}
+		block = b->target;
+	}
+	return block;
+}
+
+/*
+ * Blocks code outside the pass can enter by name: the entry, the first
+ * block, where harts of a separately compiled program start, and the ones
+ * of the entry labels other files call.
+ */
+static void mark_named_entries(struct blocks *blocks, char **entry_labels,
+			       size_t entry_labels_n, bool *entered)
+{
+	if (blocks->size == 0) {
+		return;
+	}
+	entered[blocks->entry] = true;
+	entered[0] = true;
+	for (size_t i = 0; i < entry_labels_n; i++) {
+		size_t block = block_of_label(blocks, entry_labels[i]);
+		if (block != NO_BLOCK) {
+			entered[block] = true;
+		}
+	}
+}
+
+/*
+ * Trampolines are kept when control can get to them other than by a
+ * threaded jump: by name, by falling through or from another trampoline
+ * that stays. Everything else is kept as it is.
+ */
+static void find_kept_blocks(struct ir_element *ir, struct blocks *blocks,
+			     bool *entered, bool *kept)
+{
+	size_t *work = malloc(blocks->size * sizeof(*work) + 1);
+	if (work == NULL) {
+		fail("Failed to allocate memory for block worklist.");
+	}
+	size_t work_size = 0;
+	for (size_t i = 0; i < blocks->size; i++) {
+		if (entered[i] || !is_trampoline(ir, &blocks->items[i])) {
+			kept[i] = true;
+			work[work_size++] = i;
+		}
+	}
+	while (work_size > 0) {
+		size_t b = work[--work_size];
+		struct block *block = &blocks->items[b];
+		size_t successors[] = {
+			block->falls_through ? b + 1 : NO_BLOCK,
+			block->target
+		};
+		for (size_t j = 0; j < 2; j++) {
+			size_t successor = successors[j];
+			if (successor < blocks->size && !kept[successor]) {
+				kept[successor] = true;
+				work[work_size++] = successor;
+			}
+		}
+	}
+	free(work);
+}
+
+/*
+ * A block that only the one before it falls into joins it, unless that
+ * one ends at a branch or jump, which may go to another file, or at an
+ * EBREAK, where a snapshot resumes in the next block.
+ */
+static bool joins_previous(struct ir_element *ir, struct blocks *blocks,
+			   size_t previous, size_t block, bool *entered,
+			   bool *targeted)
+{
+	struct block *p = &blocks->items[previous];
+	struct ir_element *last = &ir[p->end - 1];
+	return p->end == blocks->items[block].first && p->falls_through &&
+	       !entered[block] && !targeted[block] &&
+	       !(last->type == IR_INSTRUCTION &&
+		 (ends_block(&last->as.instruction) ||
+		  last->as.instruction.mnemonic == EBREAK));
+}
+
+/*
+ * Drops the blocks that are not kept and renumbers the others, with their
+ * labels, which may now be in the middle of a block.
+ */
+static void compact_blocks(struct ir_element *ir, struct blocks *blocks,
+			   bool *kept)
+{
+	size_t *renumbered = malloc(blocks->size * sizeof(*renumbered) + 1);
+	if (renumbered == NULL) {
+		fail("Failed to allocate memory for block numbers.");
+	}
+	size_t size = 0;
+	for (size_t i = 0; i < blocks->size; i++) {
+		renumbered[i] = kept[i] ? size++ : NO_BLOCK;
+		if (kept[i]) {
+			blocks->items[renumbered[i]] = blocks->items[i];
+		}
+	}
+	blocks->size = size;
+	blocks->entry = renumbered[blocks->entry];
+
+	table_free(blocks->by_label);
+	blocks->by_label = table_create();
+	for (size_t b = 0; b < blocks->size; b++) {
+		struct block *block = &blocks->items[b];
+		if (block->target != NO_BLOCK) {
+			block->target = renumbered[block->target];
+		}
+		for (size_t i = block->first; i < block->end; i++) {
+			if (ir[i].type != IR_LABEL) {
+				continue;
+			}
+			struct label_block *value = malloc(sizeof(*value));
+			if (value == NULL) {
+				fail("Failed to allocate memory for label_block.");
+			}
+			value->block = b;
+			table_set(blocks->by_label,
+				  to_string_key(ir[i].as.label.name), value);
+		}
+	}
+	free(renumbered);
+}
+
+/*
+ * Jumps and branches go past trampolines to where they lead, and the
+ * trampolines nothing gets to any more are dropped. Then blocks join the
+ * one before them where only falling through gets to them. Codegen leaves
+ * out a jump to the block laid out next.
+ */
+void simplify_blocks(struct ir_element *ir, char **entry_labels,
+		     size_t entry_labels_n, struct blocks *blocks)
+{
+	if (blocks->size == 0) {
+		return;
+	}
+	bool *entered = calloc(blocks->size, sizeof(*entered));
+	bool *kept = calloc(blocks->size, sizeof(*kept));
+	bool *targeted = calloc(blocks->size, sizeof(*targeted));
+	if (entered == NULL || kept == NULL || targeted == NULL) {
+		fail("Failed to allocate memory for block simplification.");
+	}
+	for (size_t i = 0; i < blocks->size; i++) {
+		struct block *block = &blocks->items[i];
+		if (block->target != NO_BLOCK) {
+			block->target = thread_target(ir, blocks, block->target);
+		}
+	}
+	mark_named_entries(blocks, entry_labels, entry_labels_n, entered);
+	find_kept_blocks(ir, blocks, entered, kept);
+
+	for (size_t i = 0; i < blocks->size; i++) {
+		struct block *block = &blocks->items[i];
+		if (kept[i] && block->target != NO_BLOCK) {
+			targeted[block->target] = true;
+		}
+	}
+	size_t previous = NO_BLOCK;
+	for (size_t i = 0; i < blocks->size; i++) {
+		if (!kept[i]) {
+			continue;
+		}
+		if (previous != NO_BLOCK &&
+		    joins_previous(ir, blocks, previous, i, entered, targeted)) {
+			struct block *p = &blocks->items[previous];
+			struct block *block = &blocks->items[i];
+			p->end = block->end;
+			p->target = block->target;
+			p->conditional = block->conditional;
+			p->falls_through = block->falls_through;
+			kept[i] = false;
+			// further blocks join at the end of this one
+			continue;
+		}
+		previous = i;
+	}
+	compact_blocks(ir, blocks, kept);
+	free(entered);
+	free(kept);
+	free(targeted);
+}
+
+char *block_name(struct blocks *blocks, size_t block)
+{
+	struct block *b = &blocks->items[block];
+	if (b->name != NULL) {
+		return b->name;
+	}
+	// labels do not start with '$', made up names cannot clash with them
+	int length = snprintf(NULL, 0, "$%zu", block);
+	b->name = malloc(length + 1);
+	if (b->name == NULL) {
+		fail("Failed to allocate memory for block name.");
+	}
+	snprintf(b->name, length + 1, "$%zu", block);
+	b->name_allocated = true;
+	struct label_block *value = malloc(sizeof(*value));
+	if (value == NULL) {
+		fail("Failed to allocate memory for label_block.");
+	}
+	value->block = block;
+	table_set(blocks->by_label, to_string_key(b->name), value);
+	return b->name;
+}
+
+uint64_t *read_profile(char *path, struct blocks *blocks)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fail_with(EX_IOERR, "Could not open profile \"%s\" for reading.",
+			path);
+	}
+	long end = fseek(file, 0L, SEEK_END) == 0 ? ftell(file) : -1;
+	if (end < 0 || fseek(file, 0L, SEEK_SET) != 0) {
+		fclose(file);
+		fail_with(EX_IOERR, "Could not read profile \"%s\".", path);
+	}
+	size_t size = end;
+
+	size_t counters = blocks->size * PROFILE_COUNTERS_PER_BLOCK;
+	if (size != counters * 8) {
+		fclose(file);
+		fail("Profile \"%s\" was not recorded for this program.",
+			path);
+	}
+	uint8_t *bytes = malloc(size);
+	uint64_t *profile = malloc(counters * sizeof(*profile) + 1);
+	if (bytes == NULL || profile == NULL) {
+		fclose(file);
+		fail("Not enough memory to read \"%s\".", path);
+	}
+	if (fread(bytes, 1, size, file) < size) {
+		fclose(file);
+		fail_with(EX_IOERR, "Could not read profile \"%s\".", path);
+	}
+	fclose(file);
+
+	for (size_t i = 0; i < counters; i++) {
+		uint64_t counter = 0;
+		for (size_t j = 0; j < 8; j++) {
+			counter = counter << 8 | bytes[i * 8 + j];
+		}
+		profile[i] = counter;
+	}
+	free(bytes);
+	return profile;
+}
+
+struct block_count {
+	uint64_t count;
+	size_t block;
+};
+
+static int compare_block_counts(const void *a, const void *b)
+{
+	const struct block_count *x = a;
+	const struct block_count *y = b;
+	if (x->count != y->count) {
+		return x->count < y->count ? 1 : -1;
+	}
+	return x->block < y->block ? -1 : x->block > y->block;
+}
+
+static uint64_t executions(uint64_t *profile, size_t block)
+{
+	return profile[block * PROFILE_COUNTERS_PER_BLOCK];
+}
+
+static uint64_t taken(uint64_t *profile, size_t block)
+{
+	return profile[block * PROFILE_COUNTERS_PER_BLOCK + 1];
+}
+
+/*
+ * The unplaced hot successor control goes to most often, NO_BLOCK if there
+ * is none. Ties go to the next block, which keeps source order.
+ */
+static size_t hottest_successor(struct blocks *blocks, uint64_t *profile,
+				bool *placed, size_t block)
+{
+	struct block *b = &blocks->items[block];
+	size_t best = NO_BLOCK;
+	uint64_t best_count = 0;
+	uint64_t count = executions(profile, block);
+	if (b->falls_through && block + 1 < blocks->size &&
+	    !placed[block + 1] &&
+	    blocks->items[block + 1].placement == BLOCK_HOT) {
+		best = block + 1;
+		best_count = count;
+		// harts count without synchronization, taken may exceed count
+		if (b->conditional) {
+			uint64_t taken_count = taken(profile, block);
+			best_count = count > taken_count ? count - taken_count : 0;
+		}
+	}
+	if (b->target != NO_BLOCK && !placed[b->target] &&
+	    blocks->items[b->target].placement == BLOCK_HOT) {
+		uint64_t target_count = b->conditional ? taken(profile, block)
+						       : count;
+		if (best == NO_BLOCK || target_count > best_count) {
+			best = b->target;
+		}
+	}
+	return best;
+}
+
+static void order_hot_blocks(struct blocks *blocks, uint64_t *profile,
+			     bool *placed)
+{
+	struct block_count *seeds = malloc(blocks->size * sizeof(*seeds) + 1);
+	if (seeds == NULL) {
+		fail("Failed to allocate memory for block counts.");
+	}
+	size_t seeds_size = 0;
+	for (size_t i = 0; i < blocks->size; i++) {
+		if (blocks->items[i].placement == BLOCK_HOT) {
+			seeds[seeds_size].count = executions(profile, i);
+			seeds[seeds_size].block = i;
+			seeds_size++;
+		}
+	}
+	qsort(seeds, seeds_size, sizeof(*seeds), compare_block_counts);
+
+	// chains follow the hottest successor, each starting at the hottest
+	// block left, the first one at the entry
+	size_t next_seed = 0;
+	size_t block = blocks->entry;
+	while (block != NO_BLOCK) {
+		placed[block] = true;
+		blocks->order[blocks->hot++] = block;
+		block = hottest_successor(blocks, profile, placed, block);
+		while (block == NO_BLOCK && next_seed < seeds_size) {
+			if (!placed[seeds[next_seed].block]) {
+				block = seeds[next_seed].block;
+			}
+			next_seed++;
+		}
+	}
+	free(seeds);
+}
+
+static void link_method_order(struct blocks *blocks, size_t from, size_t to)
+{
+	for (size_t i = from; i < to; i++) {
+		struct block *block = &blocks->items[blocks->order[i]];
+		block->next = i + 1 < to ? blocks->order[i + 1] : blocks->size;
+		block->inverted = block->conditional &&
+				  block->target == block->next &&
+				  block->next != blocks->order[i] + 1;
+	}
+}
+
+/*
+ * Names the blocks the layout jumps to before code for any of them exists,
+ * a block may be laid out before the one that jumps to it.
+ */
+static void name_layout_targets(struct blocks *blocks)
+{
+	for (size_t i = 0; i < blocks->size; i++) {
+		struct block *block = &blocks->items[i];
+		if (block->entered_from_other_method) {
+			block_name(blocks, i);
+		}
+		if (block->falls_through && block->next != i + 1 &&
+		    i + 1 < blocks->size) {
+			block_name(blocks, i + 1);
+		}
+	}
+}
+
+/*
+ * Lays the blocks out in source order, or when there is a profile, in
+ * chains along the hottest edges with the blocks that never ran in a
+ * method of their own.
+ */
+void layout_blocks(struct blocks *blocks, uint64_t *profile)
+{
+	blocks->order = malloc(blocks->size * sizeof(*blocks->order) + 1);
+	if (blocks->order == NULL) {
+		fail("Failed to allocate memory for block order.");
+	}
+	// a profile of a run that never started says nothing
+	if (profile == NULL || blocks->size == 0 ||
+	    executions(profile, blocks->entry) == 0) {
+		for (size_t i = 0; i < blocks->size; i++) {
+			blocks->order[i] = i;
+		}
+		blocks->hot = blocks->size;
+		link_method_order(blocks, 0, blocks->size);
+		name_layout_targets(blocks);
+		return;
+	}
+
+	for (size_t i = 0; i < blocks->size; i++) {
+		if (executions(profile, i) == 0) {
+			blocks->items[i].placement = BLOCK_COLD;
+		}
+	}
+	bool *placed = calloc(blocks->size, sizeof(*placed));
+	if (placed == NULL) {
+		fail("Failed to allocate memory for block order.");
+	}
+	order_hot_blocks(blocks, profile, placed);
+	size_t size = blocks->hot;
+	for (size_t i = 0; i < blocks->size; i++) {
+		if (!placed[i]) {
+			blocks->order[size++] = i;
+		}
+	}
+	free(placed);
+	link_method_order(blocks, 0, blocks->hot);
+	link_method_order(blocks, blocks->hot, blocks->size);
+
+	for (size_t i = 0; i < blocks->size; i++) {
+		struct block *block = &blocks->items[i];
+		size_t successors[] = {
+			block->falls_through && i + 1 < blocks->size ? i + 1
+								     : NO_BLOCK,
+			block->target
+		};
+		for (size_t j = 0; j < 2; j++) {
+			size_t successor = successors[j];
+			if (successor != NO_BLOCK &&
+			    blocks->items[successor].placement != block->placement) {
+				blocks->items[successor].entered_from_other_method = true;
+			}
+		}
+	}
+	name_layout_targets(blocks);
+}
+
+void free_blocks(struct blocks *blocks)
+{
+	for (size_t i = 0; i < blocks->size; i++) {
+		if (blocks->items[i].name_allocated) {
+			free(blocks->items[i].name);
+		}
+	}
+	darray_free((*blocks));
+	table_free(blocks->by_label);
+	free(blocks->order);
+}
@@ -0,0 +1,76 @@
+#ifndef RV2JVM_PROFILE_H
+#define RV2JVM_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ir.h"
+#include "table.h"
+
+/*
+ * Blocks end at branches and direct jumps, and at EBREAK in programs that
+ * snapshot there, and start at labels. simplify_blocks() then threads
+ * jumps past blocks that only jump on and joins blocks only reached by
+ * falling through, which leaves labels in the middle of blocks. The
+ * profile of a program holds two counters per block, how often it ran and
+ * how often its branch was taken, as big endian 64 bit integers.
+ */
+#define PROFILE_COUNTERS_PER_BLOCK 2
+
+#define NO_BLOCK SIZE_MAX
+
+enum block_placement {
+	BLOCK_HOT,
+	// never ran while profiling, moved to a method of its own
+	BLOCK_COLD
+};
+
+struct block {
+	// IR elements of the block, labels first and of joined blocks inside
+	size_t first;
+	size_t end;
+	// guest address of its first instruction
+	uint32_t address;
+	// block a branch or jump at the end goes to, NO_BLOCK if none
+	size_t target;
+	bool conditional;
+	bool falls_through;
+	// first label of the block or a name made up for it, NULL until needed
+	char *name;
+	bool name_allocated;
+	enum block_placement placement;
+	// the other method transfers control to the block
+	bool entered_from_other_method;
+	// block laid out after it in the same method, the number of blocks at
+	// the end of the method
+	size_t next;
+	// the hot path takes the conditional branch, which then falls through
+	bool inverted;
+};
+
+struct blocks {
+	struct block *items;
+	size_t size;
+	size_t capacity;
+	// blocks of the labels
+	struct table *by_label;
+	// block the program starts in
+	size_t entry;
+	// blocks in the order the hot and then the cold method lay them out
+	size_t *order;
+	size_t hot;
+};
+
+void find_blocks(struct ir_element *ir, char *entry_label,
+		 bool ebreak_ends_block, struct blocks *blocks);
+// entry_labels name the blocks other files enter
+void simplify_blocks(struct ir_element *ir, char **entry_labels,
+		     size_t entry_labels_n, struct blocks *blocks);
+size_t block_of_label(struct blocks *blocks, char *label);
+char *block_name(struct blocks *blocks, size_t block);
+uint64_t *read_profile(char *path, struct blocks *blocks);
+void layout_blocks(struct blocks *blocks, uint64_t *profile);
+void free_blocks(struct blocks *blocks);
+
+#endif
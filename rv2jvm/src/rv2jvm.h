@@ -0,0 +1,64 @@
+#ifndef RV2JVM_H
+#define RV2JVM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * librv2jvm compiles RISC-V assembly held in memory into a class file
+ * within the calling process. It never exits: errors come back as
+ * diagnostics and everything a call allocated is freed again, except the
+ * result, which rv2jvm_free_result() releases. Calls on different threads
+ * are independent.
+ */
+#define RV2JVM_API __attribute__((visibility("default")))
+
+struct rv2jvm_source {
+	// name diagnostics refer to the source by
+	const char *name;
+	// need not be NUL terminated
+	const char *text;
+	size_t length;
+};
+
+struct rv2jvm_options {
+	// binary name of the class, RvRuntime when NULL
+	const char *class_name;
+	// number of harts main starts, one when 0
+	int harts;
+};
+
+enum rv2jvm_severity {
+	RV2JVM_WARNING,
+	RV2JVM_ERROR
+};
+
+struct rv2jvm_diagnostic {
+	enum rv2jvm_severity severity;
+	// source and line the message is about, NULL and 0 if none
+	const char *file;
+	size_t line;
+	const char *message;
+};
+
+struct rv2jvm_result {
+	// 0 on success, else the exit status the command line tool gives
+	int status;
+	// the class file, NULL if compilation failed
+	uint8_t *class_bytes;
+	size_t class_length;
+	struct rv2jvm_diagnostic *diagnostics;
+	size_t diagnostics_n;
+};
+
+/*
+ * Compiles the sources into one class like the command line tool does with
+ * files. Returns result->status. options may be NULL.
+ */
+RV2JVM_API int rv2jvm_compile(const struct rv2jvm_source *sources,
+			      size_t sources_n,
+			      const struct rv2jvm_options *options,
+			      struct rv2jvm_result *result);
+RV2JVM_API void rv2jvm_free_result(struct rv2jvm_result *result);
+
+#endif
@@ -1,5 +1,6 @@
 #include "seman.h"
 
+#include "error.h"
 #include "ir.h"
 #include "table.h"
 
@@ -11,8 +12,7 @@ void referenced_labels_exist(struct ir_element *ir)
 			bool new = table_set(declared_labels, 
 					     to_string_key(it->as.label.name), it);
 			if (!new) {
-				fprintf(stderr, "Error: Label '%s' already declared.\n", it->as.label.name);
-				exit(EXIT_FAILURE);
+				fail("Error: Label '%s' already declared.", it->as.label.name);
 			}
 		}	
     	}
@@ -25,13 +25,13 @@ void referenced_labels_exist(struct ir_element *ir)
 		char *label;
 		switch (instruction.type) {
 		case TYPE_R2_OP:
-			if (instruction.as.r2op.op_type != OPERAND_LABEL) {
+			if (instruction.as.r2op.op_type == OPERAND_IMM) {
 				continue;
 			}
 			label = instruction.as.r2op.op.label;
 			break;
 		case TYPE_R1_OP:
-			if (instruction.as.r1op.op_type != OPERAND_LABEL) {
+			if (instruction.as.r1op.op_type == OPERAND_IMM) {
 				continue;
 			}
 			label = instruction.as.r1op.op.label;
@@ -40,10 +40,11 @@ void referenced_labels_exist(struct ir_element *ir)
 			continue;
 		}
 		if (table_get(declared_labels, to_string_key(label)) == NULL) {
-			fprintf(stderr, "Error: Referenced label '%s' not found.\n", label);
-			exit(EXIT_FAILURE);
+			fail("Error: Referenced label '%s' not found.", label);
 		}
 	}
+	// the values are the labels in ir
+	table_free_shallow(declared_labels);
 }
 
 void seman(struct ir_element *ir)
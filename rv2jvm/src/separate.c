@@ -0,0 +1,287 @@
+#include "separate.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "data.h"
+#include "darray.h"
+#include "error.h"
+#include "ir.h"
+#include "table.h"
+
+#define INSTRUCTION_SIZE 4
+// exported whether it is declared .globl or not, hart starts there
+#define ENTRY_LABEL "_start"
+
+struct label_unit {
+	size_t unit;
+};
+
+struct entry_points {
+	struct entry_point *items;
+	size_t size;
+	size_t capacity;
+};
+
+/*
+ * Runtime class, '$' and the name of the file without directories and
+ * extension, with the characters a Java name cannot have replaced by '_'.
+ */
+static char *unit_class_name(char *runtime_class, char *path)
+{
+	char *base = strrchr(path, '/');
+	base = base != NULL ? base + 1 : path;
+	char *extension = strrchr(base, '.');
+	size_t length = extension != NULL && extension != base
+			? (size_t)(extension - base) : strlen(base);
+	size_t prefix = strlen(runtime_class) + 1;
+	char *name = malloc(prefix + length + 1);
+	if (name == NULL) {
+		fail("Failed to allocate memory for class name.");
+	}
+	snprintf(name, prefix + 1, "%s$", runtime_class);
+	for (size_t i = 0; i < length; i++) {
+		char c = base[i];
+		bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+			     (c >= '0' && c <= '9') || c == '_';
+		name[prefix + i] = valid ? c : '_';
+	}
+	name[prefix + length] = '\0';
+	return name;
+}
+
+static void set_unit(struct table *labels, char *label, size_t unit)
+{
+	struct label_unit *value = malloc(sizeof(*value));
+	if (value == NULL) {
+		fail("Failed to allocate memory for label_unit.");
+	}
+	value->unit = unit;
+	table_set(labels, to_string_key(label), value);
+}
+
+static size_t get_unit(struct table *labels, char *label)
+{
+	struct table_value *value = table_get(labels, to_string_key(label));
+	return value != NULL ? ((struct label_unit*)value->value)->unit
+			     : SIZE_MAX;
+}
+
+/*
+ * Copies the code of every file out of ir, in the order link_units() put
+ * it there, and records the files the code labels are in.
+ */
+static void split_code(struct ir_element *ir, struct ir_element **unit_irs,
+		       struct separate_program *program,
+		       struct table *code_labels)
+{
+	struct ir_element *it = ir;
+	uint32_t address = 0;
+	for (size_t u = 0; u < program->units_n; u++) {
+		struct separate_unit *unit = &program->units[u];
+		size_t elements = code_elements(unit_irs[u]);
+		unit->ir = malloc((elements + 1) * sizeof(*unit->ir));
+		if (unit->ir == NULL) {
+			fail("Failed to allocate memory for IR.");
+		}
+		memcpy(unit->ir, it, elements * sizeof(*unit->ir));
+		unit->ir[elements].type = IR_EOF;
+		// continues after the previous unit, see separate.h
+		unit->address = address;
+		for (size_t i = 0; i < elements; i++, it++) {
+			if (it->type == IR_LABEL) {
+				set_unit(code_labels, it->as.label.name, u);
+			} else {
+				address += INSTRUCTION_SIZE;
+			}
+		}
+	}
+}
+
+static bool valid_method_name(char *name)
+{
+	return strpbrk(name, ".;[/<>") == NULL;
+}
+
+static int compare_entry_points(const void *a, const void *b)
+{
+	return strcmp(((const struct entry_point*)a)->label,
+		      ((const struct entry_point*)b)->label);
+}
+
+/*
+ * The .globl code labels of every file, which have to be defined in it.
+ * Data labels need no entry point, their addresses are constants.
+ */
+static void find_entry_points(struct ir_element **unit_irs,
+			      struct separate_program *program,
+			      struct table *code_labels)
+{
+	struct entry_points entries = { 0 };
+	size_t entry_unit = get_unit(code_labels, ENTRY_LABEL);
+	if (entry_unit != SIZE_MAX) {
+		struct entry_point entry = { ENTRY_LABEL, entry_unit };
+		darray_append(entries, entry);
+	}
+	for (size_t u = 0; u < program->units_n; u++) {
+		struct table *defined = table_create();
+		for (struct ir_element *it = unit_irs[u]; it->type != IR_EOF; it++) {
+			if (it->type == IR_LABEL) {
+				set_unit(defined, it->as.label.name, u);
+			}
+		}
+		for (struct ir_element *it = unit_irs[u]; it->type != IR_EOF; it++) {
+			if (!is_global_directive(it)) {
+				continue;
+			}
+			for (size_t i = 0; i < it->as.directive.operands.size; i++) {
+				char *label = it->as.directive.operands.items[i];
+				if (get_unit(defined, label) == SIZE_MAX) {
+					fail("Error: Global label '%s' is not defined in %s.",
+						label, program->units[u].path);
+				}
+				if (get_unit(code_labels, label) != u ||
+				    strcmp(label, ENTRY_LABEL) == 0) {
+					continue;
+				}
+				if (!valid_method_name(label)) {
+					fail("Error: Global label '%s' is not a valid method name.",
+						label);
+				}
+				struct entry_point entry = { label, u };
+				darray_append(entries, entry);
+			}
+		}
+		table_free(defined);
+	}
+
+	qsort(entries.items, entries.size, sizeof(*entries.items),
+	      compare_entry_points);
+	// a label may be declared .globl more than once
+	size_t size = 0;
+	for (size_t i = 0; i < entries.size; i++) {
+		if (size == 0 || strcmp(entries.items[size - 1].label,
+					entries.items[i].label) != 0) {
+			entries.items[size++] = entries.items[i];
+		}
+	}
+	program->entries = entries.items;
+	program->entries_n = size;
+}
+
+static char *label_operand(struct ir_instruction *instruction)
+{
+	switch (instruction->type) {
+	case TYPE_R1_OP:
+		return instruction->as.r1op.op_type == OPERAND_LABEL
+		       ? instruction->as.r1op.op.label : NULL;
+	case TYPE_R2_OP:
+		return instruction->as.r2op.op_type == OPERAND_LABEL
+		       ? instruction->as.r2op.op.label : NULL;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Code may only go to labels of other files that have an entry point.
+ */
+static void check_references(struct separate_program *program,
+			     struct table *code_labels)
+{
+	for (size_t u = 0; u < program->units_n; u++) {
+		struct separate_unit *unit = &program->units[u];
+		for (struct ir_element *it = unit->ir; it->type != IR_EOF; it++) {
+			if (it->type != IR_INSTRUCTION) {
+				continue;
+			}
+			char *label = label_operand(&it->as.instruction);
+			if (label == NULL || get_unit(code_labels, label) == u ||
+			    entry_id(program, label) >= 0) {
+				continue;
+			}
+			fail("Error: Label '%s' used in %s is not declared .globl in its file.",
+				label, unit->path);
+		}
+	}
+}
+
+/*
+ * Harts start at _start or else at the first instruction of the program.
+ */
+static void find_start(struct separate_program *program)
+{
+	program->start = entry_id(program, ENTRY_LABEL);
+	program->start_unit = 0;
+	if (program->start >= 0) {
+		program->start_unit = program->entries[program->start].unit;
+		return;
+	}
+	for (size_t u = 0; u < program->units_n; u++) {
+		struct ir_element *it = program->units[u].ir;
+		while (it->type == IR_LABEL) {
+			it++;
+		}
+		if (it->type == IR_INSTRUCTION) {
+			program->start = program->entries_n;
+			program->start_unit = u;
+			return;
+		}
+	}
+}
+
+void separate_units(struct ir_element *ir, int units_n,
+		    struct ir_element **unit_irs, char **paths,
+		    char *runtime_class, struct separate_program *res)
+{
+	res->runtime_class = runtime_class;
+	res->units_n = units_n;
+	res->units = calloc(units_n, sizeof(*res->units));
+	if (res->units == NULL) {
+		fail("Failed to allocate memory for units.");
+	}
+	struct table *class_names = table_create();
+	for (int u = 0; u < units_n; u++) {
+		res->units[u].path = paths[u];
+		res->units[u].class_name = unit_class_name(runtime_class,
+							   paths[u]);
+		size_t other = get_unit(class_names, res->units[u].class_name);
+		if (other != SIZE_MAX) {
+			fail("Error: Files %s and %s both compile to class %s.",
+				paths[other], paths[u], res->units[u].class_name);
+		}
+		set_unit(class_names, res->units[u].class_name, u);
+	}
+	table_free(class_names);
+
+	struct table *code_labels = table_create();
+	split_code(ir, unit_irs, res, code_labels);
+	find_entry_points(unit_irs, res, code_labels);
+	check_references(res, code_labels);
+	table_free(code_labels);
+	find_start(res);
+}
+
+int32_t entry_id(struct separate_program *program, char *label)
+{
+	struct entry_point key = { .label = label };
+	struct entry_point *entry = bsearch(&key, program->entries,
+					    program->entries_n,
+					    sizeof(*program->entries),
+					    compare_entry_points);
+	return entry != NULL ? entry - program->entries : -1;
+}
+
+void free_separate_program(struct separate_program *program)
+{
+	for (size_t u = 0; u < program->units_n; u++) {
+		free(program->units[u].class_name);
+		free(program->units[u].ir);
+	}
+	free(program->units);
+	free(program->entries);
+}
@@ -0,0 +1,61 @@
+#ifndef RV2JVM_SEPARATE_H
+#define RV2JVM_SEPARATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ir.h"
+
+/*
+ * Separate compilation turns every input file into a class of its own next
+ * to the runtime class, which keeps memory, main, the harts and the helpers.
+ * The labels a file declares .globl become public static int label(long[])
+ * methods of its class. Code leaves a class by returning the id of the entry
+ * point to continue at, hart calls it with invokestatic and loops until one
+ * returns -1 at the end of the program.
+ *
+ * The program is still checked and laid out as a whole, so code and data
+ * keep the addresses they have in a single class. This only splits the
+ * class files: a unit's code addresses follow the code of the units before
+ * it and all units share the data segment, so a change to one file changes
+ * the classes of the files after it.
+ */
+struct separate_unit {
+	char *path;
+	char *class_name;
+	// the code of the file, terminated by IR_EOF
+	struct ir_element *ir;
+	// guest address of its first instruction
+	uint32_t address;
+};
+
+struct entry_point {
+	char *label;
+	size_t unit;
+};
+
+struct separate_program {
+	char *runtime_class;
+	struct separate_unit *units;
+	size_t units_n;
+	// .globl code labels sorted by name, ids are indices into entries
+	struct entry_point *entries;
+	size_t entries_n;
+	// id hart starts at, entries_n when it is the first instruction of
+	// start_unit and -1 for a program without code
+	int32_t start;
+	size_t start_unit;
+};
+
+/*
+ * Splits the checked and laid out program ir into the files unit_irs were
+ * parsed from, which own its strings.
+ */
+void separate_units(struct ir_element *ir, int units_n,
+		    struct ir_element **unit_irs, char **paths,
+		    char *runtime_class, struct separate_program *res);
+// id of the entry point of label, -1 if it has none
+int32_t entry_id(struct separate_program *program, char *label);
+void free_separate_program(struct separate_program *program);
+
+#endif
@@ -0,0 +1,498 @@
+#include "server.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "compiler.h"
+#include "darray.h"
+#include "error.h"
+#include "file.h"
+
+/*
+ * Resident compile server.
+ *
+ * Protocol, all integers are big endian u32:
+ *   request:  file count, then for every file name length, name,
+ *             text length, text
+ *   response: status (0 success, 1 error), payload length, payload
+ * The payload is the class file on success and the diagnostics on error.
+ *
+ * The server pre-forks a pool of worker processes that accept connections
+ * on the same listening socket. Every request compiles under a recovery,
+ * so a failing one sends its diagnostics and the worker serves the next.
+ * A worker that dies anyway is replaced.
+ */
+#define MAX_FILES 65536
+#define MAX_LENGTH (1u << 30)
+// pause of a worker out of descriptors or buffers before it accepts again
+#define ACCEPT_BACKOFF_US 100000
+// seconds between attempts to start the workers fork() failed for
+#define RESPAWN_DELAY 1
+
+enum response_status {
+	RESPONSE_OK,
+	RESPONSE_ERROR
+};
+
+struct request {
+	struct source *items;
+	size_t size;
+	size_t capacity;
+};
+
+struct pids {
+	pid_t *items;
+	size_t size;
+	size_t capacity;
+};
+
+static volatile sig_atomic_t stopping;
+
+static bool read_full(int fd, void *buffer, size_t length)
+{
+	uint8_t *b = buffer;
+	while (length > 0) {
+		ssize_t n = read(fd, b, length);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		b += n;
+		length -= n;
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void *buffer, size_t length)
+{
+	const uint8_t *b = buffer;
+	while (length > 0) {
+		ssize_t n = send(fd, b, length, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		b += n;
+		length -= n;
+	}
+	return true;
+}
+
+static bool read_u32(int fd, uint32_t *value)
+{
+	uint8_t b[4];
+	if (!read_full(fd, b, sizeof(b))) {
+		return false;
+	}
+	*value = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 |
+		 (uint32_t)b[2] << 8 | b[3];
+	return true;
+}
+
+static bool write_u32(int fd, uint32_t value)
+{
+	uint8_t b[4] = { value >> 24, value >> 16, value >> 8, value };
+	return write_full(fd, b, sizeof(b));
+}
+
+static char *read_string(int fd, size_t *length)
+{
+	uint32_t n;
+	if (!read_u32(fd, &n) || n > MAX_LENGTH) {
+		return NULL;
+	}
+	char *string = malloc(n + 1);
+	if (string == NULL) {
+		return NULL;
+	}
+	if (!read_full(fd, string, n)) {
+		free(string);
+		return NULL;
+	}
+	string[n] = '\0';
+	*length = n;
+	return string;
+}
+
+static bool write_string(int fd, const char *string, size_t length)
+{
+	return write_u32(fd, length) && write_full(fd, string, length);
+}
+
+static void free_request(struct request *request)
+{
+	for (size_t i = 0; i < request->size; i++) {
+		free(request->items[i].name);
+		free(request->items[i].text);
+	}
+	darray_free((*request));
+}
+
+static bool read_request(int fd, struct request *request)
+{
+	uint32_t files;
+	if (!read_u32(fd, &files) || files == 0 || files > MAX_FILES) {
+		return false;
+	}
+	for (uint32_t i = 0; i < files; i++) {
+		size_t name_length;
+		struct source source = { 0 };
+		source.name = read_string(fd, &name_length);
+		if (source.name == NULL) {
+			return false;
+		}
+		source.text = read_string(fd, &source.length);
+		if (source.text == NULL) {
+			free(source.name);
+			return false;
+		}
+		darray_append((*request), source);
+	}
+	return true;
+}
+
+static bool write_response(int fd, enum response_status status,
+			   const void *payload, size_t length)
+{
+	return write_u32(fd, status) && write_string(fd, payload, length);
+}
+
+/*
+ * Sends the diagnostics of a failed request, or a generic message if there
+ * are none.
+ */
+static void report_failed_request(int client, struct diagnostics *diagnostics)
+{
+	char *message = NULL;
+	size_t length = 0;
+	FILE *stream = open_memstream(&message, &length);
+	if (stream != NULL) {
+		print_diagnostics(stream, NULL, diagnostics);
+		fclose(stream);
+	}
+	if (length > 0) {
+		write_response(client, RESPONSE_ERROR, message, length);
+	} else {
+		const char *failed = "Compilation failed.\n";
+		write_response(client, RESPONSE_ERROR, failed, strlen(failed));
+	}
+	free(message);
+}
+
+static void serve(int client, struct compile_options *options)
+{
+	struct request request = { 0 };
+	if (!read_request(client, &request)) {
+		const char *message = "Malformed request.\n";
+		write_response(client, RESPONSE_ERROR, message, strlen(message));
+		free_request(&request);
+		return;
+	}
+
+	struct bytecode bytecode = { 0 };
+	struct recovery recovery;
+	begin_recovery(&recovery);
+	if (setjmp(recovery.env) == 0) {
+		compile_sources(request.size, request.items, options,
+				&bytecode);
+	}
+	end_recovery(&recovery);
+
+	// the server log gets the diagnostics of every request
+	print_diagnostics(stderr, NULL, &recovery.diagnostics);
+	if (recovery.status == 0) {
+		write_response(client, RESPONSE_OK, bytecode.items,
+			       bytecode.size);
+		darray_free(bytecode);
+	} else {
+		report_failed_request(client, &recovery.diagnostics);
+	}
+	free_diagnostics(&recovery.diagnostics);
+	free_request(&request);
+}
+
+static void worker(int listen_fd, struct compile_options *options)
+{
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		int client = accept(listen_fd, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			perror("accept");
+			// exiting would only make the server fork another one
+			if (errno == EMFILE || errno == ENFILE ||
+			    errno == ENOBUFS || errno == ENOMEM) {
+				usleep(ACCEPT_BACKOFF_US);
+				continue;
+			}
+			exit(EX_OSERR);
+		}
+		serve(client, options);
+		close(client);
+	}
+}
+
+static pid_t spawn_worker(int listen_fd, struct compile_options *options)
+{
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return pid;
+	}
+	if (pid == 0) {
+		worker(listen_fd, options);
+		exit(EXIT_SUCCESS);
+	}
+	return pid;
+}
+
+static void on_stop(int signal)
+{
+	(void)signal;
+	stopping = 1;
+}
+
+// only interrupts wait() so that missing workers are started again
+static void on_alarm(int signal)
+{
+	(void)signal;
+}
+
+/*
+ * Starts a worker in every slot that has none and returns how many are
+ * still missing because fork() failed.
+ */
+static size_t spawn_missing(struct pids *pids, int listen_fd,
+			    struct compile_options *options)
+{
+	size_t missing = 0;
+	for (size_t i = 0; i < pids->size; i++) {
+		if (pids->items[i] <= 0) {
+			pids->items[i] = spawn_worker(listen_fd, options);
+			missing += pids->items[i] <= 0;
+		}
+	}
+	return missing;
+}
+
+static int listen_on(char *socket_path)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Socket path \"%s\" is too long.\n", socket_path);
+		return -1;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	unlink(socket_path);
+	if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+	    listen(fd, SOMAXCONN) != 0) {
+		fprintf(stderr, "Could not listen on \"%s\": %s\n", socket_path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int run_server(char *socket_path, int workers, struct compile_options *options)
+{
+	if (workers <= 0) {
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	int listen_fd = listen_on(socket_path);
+	if (listen_fd < 0) {
+		return EX_UNAVAILABLE;
+	}
+
+	struct sigaction action = { .sa_handler = on_stop };
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	struct sigaction alarm_action = { .sa_handler = on_alarm };
+	sigemptyset(&alarm_action.sa_mask);
+	sigaction(SIGALRM, &alarm_action, NULL);
+
+	struct pids pids = { 0 };
+	for (int i = 0; i < workers; i++) {
+		darray_append(pids, 0);
+	}
+	size_t missing = spawn_missing(&pids, listen_fd, options);
+	fprintf(stderr, "Listening on %s with %zu workers.\n", socket_path,
+		pids.size - missing);
+
+	while (!stopping) {
+		if (missing > 0) {
+			alarm(RESPAWN_DELAY);
+		}
+		int status;
+		pid_t pid = wait(&status);
+		if (pid < 0 && errno == ECHILD && missing > 0) {
+			// every fork() failed, wait for the alarm instead
+			pause();
+		} else if (pid < 0 && errno != EINTR) {
+			break;
+		}
+		for (size_t i = 0; pid > 0 && i < pids.size; i++) {
+			if (pids.items[i] == pid) {
+				// a worker only ends when it crashed
+				pids.items[i] = 0;
+				break;
+			}
+		}
+		if (!stopping) {
+			missing = spawn_missing(&pids, listen_fd, options);
+		}
+	}
+	alarm(0);
+
+	for (size_t i = 0; i < pids.size; i++) {
+		if (pids.items[i] > 0) {
+			kill(pids.items[i], SIGTERM);
+		}
+	}
+	while (wait(NULL) > 0 || errno == EINTR) {
+	}
+	darray_free(pids);
+	close(listen_fd);
+	unlink(socket_path);
+	return 0;
+}
+
+static int connect_to(char *socket_path)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Socket path \"%s\" is too long.\n", socket_path);
+		return -1;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+		fprintf(stderr, "Could not connect to \"%s\": %s\n", socket_path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool send_request(int fd, int filepaths_n, char **filepaths)
+{
+	if (!write_u32(fd, filepaths_n)) {
+		return false;
+	}
+	for (int i = 0; i < filepaths_n; i++) {
+		char *text = read_file(filepaths[i]);
+		bool sent = write_string(fd, filepaths[i], strlen(filepaths[i])) &&
+			write_string(fd, text, strlen(text));
+		free(text);
+		if (!sent) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int run_client(char *socket_path, int filepaths_n, char **filepaths,
+	       char *output_path)
+{
+	int fd = connect_to(socket_path);
+	if (fd < 0) {
+		return EX_UNAVAILABLE;
+	}
+
+	uint32_t status;
+	size_t length;
+	char *payload = NULL;
+	if (!send_request(fd, filepaths_n, filepaths) ||
+	    !read_u32(fd, &status) ||
+	    (payload = read_string(fd, &length)) == NULL) {
+		fprintf(stderr, "Server closed the connection without a response.\n");
+		close(fd);
+		return EX_PROTOCOL;
+	}
+	close(fd);
+
+	int exit_code = EXIT_SUCCESS;
+	if (status == RESPONSE_OK) {
+		write_file(output_path, (uint8_t*)payload, length);
+	} else {
+		fwrite(payload, 1, length, stderr);
+		exit_code = EXIT_FAILURE;
+	}
+	free(payload);
+	return exit_code;
+}
+
+/*
+ * Sends the classes to the resident runner in runner/RvRunner.java, which
+ * runs main of the first one. Its output is copied to ours and the exit
+ * status of the program returned.
+ */
+int run_on_runner(char *socket_path, struct class_files *classes)
+{
+	int fd = connect_to(socket_path);
+	if (fd < 0) {
+		return EX_UNAVAILABLE;
+	}
+
+	bool sent = write_u32(fd, classes->size);
+	for (size_t i = 0; sent && i < classes->size; i++) {
+		struct class_file *class = &classes->items[i];
+		sent = write_string(fd, class->name, strlen(class->name)) &&
+			write_string(fd, (char*)class->bytecode.items,
+				     class->bytecode.size);
+	}
+	uint32_t status;
+	size_t out_length, err_length;
+	char *out = NULL, *err = NULL;
+	if (!sent || !read_u32(fd, &status) ||
+	    (out = read_string(fd, &out_length)) == NULL ||
+	    (err = read_string(fd, &err_length)) == NULL) {
+		fprintf(stderr, "Runner closed the connection without a response.\n");
+		free(out);
+		close(fd);
+		return EX_PROTOCOL;
+	}
+	close(fd);
+
+	fwrite(out, 1, out_length, stdout);
+	fwrite(err, 1, err_length, stderr);
+	free(out);
+	free(err);
+	return status;
+}
@@ -0,0 +1,12 @@
+#ifndef RV2JVM_SERVER_H
+#define RV2JVM_SERVER_H
+
+#include "compiler.h"
+#include "options.h"
+
+int run_server(char *socket_path, int workers, struct compile_options *options);
+int run_client(char *socket_path, int filepaths_n, char **filepaths,
+	       char *output_path);
+int run_on_runner(char *socket_path, struct class_files *classes);
+
+#endif
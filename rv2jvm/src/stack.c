@@ -0,0 +1,512 @@
+#include "stack.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coalesce.h"
+#include "darray.h"
+#include "error.h"
+#include "idiom.h"
+#include "ir.h"
+#include "profile.h"
+
+#define SP X2
+#define WORD_SIZE 4
+#define REGISTERS 32
+
+enum sp_kind {
+	// no path from the start of the hart gets there
+	SP_UNREACHED,
+	SP_KNOWN,
+	// paths get there with different values of sp, or one it lost track of
+	SP_UNKNOWN
+};
+
+/*
+ * A known sp holds address, which the program moved it to from base, the
+ * value it got from li or 0 at the start.
+ */
+struct sp_value {
+	enum sp_kind kind;
+	uint32_t address;
+	uint32_t base;
+};
+
+/*
+ * Registers other than sp whose value is the same on every path, which is
+ * how accesses through them are known to stay clear of the slots.
+ */
+struct register_values {
+	// bit r is set when register r holds value[r]
+	uint32_t known;
+	uint32_t value[REGISTERS];
+};
+
+struct stack_state {
+	struct sp_value sp;
+	struct register_values registers;
+};
+
+struct stack_access {
+	size_t element;
+	uint32_t address;
+	uint8_t size;
+	// lw or sw through sp of a word in a frame below base, which a local
+	// can stand in for
+	bool local;
+};
+
+struct stack_accesses {
+	struct stack_access *items;
+	size_t size;
+	size_t capacity;
+};
+
+struct stack_analysis {
+	struct ir_element *ir;
+	struct blocks *blocks;
+	// values of the registers at the start of every block
+	struct stack_state *entry;
+	struct stack_accesses accesses;
+	bool record;
+	// sp went somewhere the analysis does not follow it, code uses it where
+	// its value is not known, or an access through another register may
+	// reach any address, and no word of the stack is a slot
+	bool escaped;
+};
+
+static struct sp_value join(struct sp_value a, struct sp_value b)
+{
+	if (a.kind == SP_UNREACHED) {
+		return b;
+	}
+	if (b.kind == SP_UNREACHED) {
+		return a;
+	}
+	if (a.kind == SP_KNOWN && b.kind == SP_KNOWN &&
+	    a.address == b.address && a.base == b.base) {
+		return a;
+	}
+	return (struct sp_value) { .kind = SP_UNKNOWN };
+}
+
+static struct register_values join_registers(struct register_values a,
+					     struct register_values b)
+{
+	for (size_t r = 0; r < REGISTERS; r++) {
+		if (a.value[r] != b.value[r]) {
+			a.known &= ~((uint32_t)1 << r);
+		}
+	}
+	a.known &= b.known;
+	return a;
+}
+
+static struct stack_state join_states(struct stack_state a,
+				      struct stack_state b)
+{
+	if (a.sp.kind == SP_UNREACHED) {
+		return b;
+	}
+	if (b.sp.kind == SP_UNREACHED) {
+		return a;
+	}
+	return (struct stack_state) {
+		.sp = join(a.sp, b.sp),
+		.registers = join_registers(a.registers, b.registers)
+	};
+}
+
+static bool same_states(struct stack_state *a, struct stack_state *b)
+{
+	if (a->sp.kind != b->sp.kind || a->sp.address != b->sp.address ||
+	    a->sp.base != b->sp.base ||
+	    a->registers.known != b->registers.known) {
+		return false;
+	}
+	for (size_t r = 0; r < REGISTERS; r++) {
+		if ((a->registers.known >> r & 1) &&
+		    a->registers.value[r] != b->registers.value[r]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static struct sp_value known(uint32_t base)
+{
+	return (struct sp_value) {
+		.kind = SP_KNOWN,
+		.address = base,
+		.base = base
+	};
+}
+
+static bool is_store(enum ir_instruction_mnemonic mnemonic)
+{
+	return mnemonic == SW || mnemonic == SH || mnemonic == SB;
+}
+
+static void record(struct stack_analysis *a, size_t element,
+		   uint32_t address, uint8_t size, bool local)
+{
+	if (!a->record) {
+		return;
+	}
+	struct stack_access access = {
+		.element = element,
+		.address = address,
+		.size = size,
+		.local = local
+	};
+	darray_append(a->accesses, access);
+}
+
+static void access(struct stack_analysis *a, size_t element,
+		   struct sp_value sp, int32_t offset, uint8_t size, bool local)
+{
+	if (sp.kind != SP_KNOWN) {
+		a->escaped = true;
+		return;
+	}
+	uint32_t address = sp.address + offset;
+	record(a, element, address, size, local && address < sp.base);
+}
+
+// an access through base, which no slot overlapping it can stand in for
+static void access_through(struct stack_analysis *a, size_t element,
+			   struct register_values *registers,
+			   enum ir_instruction_register base, int32_t offset,
+			   uint8_t size)
+{
+	if (!(registers->known >> base & 1)) {
+		a->escaped = true;
+		return;
+	}
+	record(a, element, registers->value[base] + offset, size, false);
+}
+
+/*
+ * Whether the instruction leaves a value known from the registers in
+ * value, which only addi reads.
+ */
+static bool constant_result(struct ir_instruction *instruction,
+			    struct register_values *registers, uint32_t *value)
+{
+	switch (instruction->mnemonic) {
+	case LI:
+		if (instruction->as.r1op.op_type != OPERAND_IMM) {
+			return false;
+		}
+		*value = instruction->as.r1op.op.value;
+		return true;
+	case LUI:
+		*value = (uint32_t)instruction->as.r1op.op.imm << 12;
+		return true;
+	case ADDI: {
+		struct ir_instruction_r2op r2op = instruction->as.r2op;
+		if (r2op.op_type != OPERAND_IMM ||
+		    !(registers->known >> r2op.rs1 & 1)) {
+			return false;
+		}
+		*value = registers->value[r2op.rs1] + r2op.op.imm;
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+/*
+ * Value of sp after the instruction of the element. Addresses wrap at 32
+ * bits like the ones code computes from sp do.
+ */
+static struct sp_value step(struct stack_analysis *a, size_t element,
+			    struct sp_value sp)
+{
+	struct ir_instruction *instruction = &a->ir[element].as.instruction;
+	struct sp_value unknown = { .kind = SP_UNKNOWN };
+	switch (instruction->type) {
+	case TYPE_MEM: {
+		struct ir_instruction_mem mem = instruction->as.mem;
+		bool store = is_store(instruction->mnemonic);
+		if (store && mem.rd == SP) {
+			a->escaped = true;
+			return sp;
+		}
+		if (mem.rs1 == SP) {
+			uint8_t size = access_size(instruction->mnemonic);
+			access(a, element, sp, mem.offset, size,
+			       size == WORD_SIZE);
+		}
+		return !store && mem.rd == SP ? unknown : sp;
+	}
+	case TYPE_AMO: {
+		struct ir_instruction_amo amo = instruction->as.amo;
+		if (amo.rs2 == SP) {
+			a->escaped = true;
+			return sp;
+		}
+		if (amo.rs1 == SP) {
+			// atomics keep their word in memory
+			access(a, element, sp, 0, WORD_SIZE, false);
+		}
+		return amo.rd == SP ? unknown : sp;
+	}
+	case TYPE_R2_OP: {
+		struct ir_instruction_r2op r2op = instruction->as.r2op;
+		if (instruction->mnemonic != ADDI || r2op.rd != SP ||
+		    r2op.op_type != OPERAND_IMM) {
+			// the environment gets the argument registers, not sp
+			if (instruction->mnemonic == ECALL ||
+			    instruction->mnemonic == EBREAK) {
+				return sp;
+			}
+			break;
+		}
+		if (r2op.rs1 == SP) {
+			if (sp.kind == SP_KNOWN) {
+				sp.address += r2op.op.imm;
+			}
+			return sp;
+		}
+		// li sp of a small constant is addi sp, x0
+		if (r2op.rs1 == X0) {
+			return known(r2op.op.imm);
+		}
+		break;
+	}
+	case TYPE_R1_OP: {
+		// li sp of a constant with no low bits is lui sp
+		uint32_t value;
+		if (instruction->as.r1op.rd == SP &&
+		    constant_result(instruction, NULL, &value)) {
+			return known(value);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	if (reads_register(instruction, SP)) {
+		a->escaped = true;
+	}
+	return writes_register(instruction, SP) ? unknown : sp;
+}
+
+/*
+ * Values of the registers other than sp after the instruction of the
+ * element, whose accesses through them it records.
+ */
+static void step_registers(struct stack_analysis *a, size_t element,
+			   struct register_values *registers)
+{
+	struct ir_instruction *instruction = &a->ir[element].as.instruction;
+	if (instruction->type == TYPE_MEM && instruction->as.mem.rs1 != SP) {
+		access_through(a, element, registers, instruction->as.mem.rs1,
+			       instruction->as.mem.offset,
+			       access_size(instruction->mnemonic));
+	}
+	if (instruction->type == TYPE_AMO && instruction->as.amo.rs1 != SP) {
+		access_through(a, element, registers, instruction->as.amo.rs1,
+			       0, WORD_SIZE);
+	}
+	uint32_t value = 0;
+	bool constant = constant_result(instruction, registers, &value);
+	for (size_t r = X1; r < REGISTERS; r++) {
+		if (!writes_register(instruction, r)) {
+			continue;
+		}
+		registers->known &= ~((uint32_t)1 << r);
+		if (constant && r != SP) {
+			registers->known |= (uint32_t)1 << r;
+			registers->value[r] = value;
+		}
+	}
+}
+
+static struct stack_state step_block(struct stack_analysis *a, size_t b)
+{
+	struct block *block = &a->blocks->items[b];
+	struct stack_state state = a->entry[b];
+	for (size_t i = block->first; i < block->end && !a->escaped; i++) {
+		if (a->ir[i].type == IR_INSTRUCTION) {
+			state.sp = step(a, i, state.sp);
+			step_registers(a, i, &state.registers);
+		}
+	}
+	return state;
+}
+
+/*
+ * Values of the registers at the starts of the blocks, from 0 at the entry.
+ * A value only ever changes from unreached to known to unknown, so the
+ * worklist runs dry.
+ */
+static void find_sp_values(struct stack_analysis *a)
+{
+	struct blocks *blocks = a->blocks;
+	size_t *work = malloc(blocks->size * sizeof(*work) + 1);
+	bool *queued = calloc(blocks->size + 1, sizeof(*queued));
+	if (work == NULL || queued == NULL) {
+		fail("Failed to allocate memory for block worklist.");
+	}
+	a->entry[blocks->entry] = (struct stack_state) {
+		.sp = known(0),
+		// sp has a value of its own
+		.registers.known = ~((uint32_t)1 << SP)
+	};
+	size_t work_size = 0;
+	work[work_size++] = blocks->entry;
+	queued[blocks->entry] = true;
+	while (work_size > 0 && !a->escaped) {
+		size_t b = work[--work_size];
+		queued[b] = false;
+		struct stack_state state = step_block(a, b);
+		struct block *block = &blocks->items[b];
+		size_t successors[] = {
+			block->falls_through ? b + 1 : NO_BLOCK,
+			block->target
+		};
+		for (size_t j = 0; j < 2; j++) {
+			size_t successor = successors[j];
+			if (successor >= blocks->size) {
+				continue;
+			}
+			struct stack_state joined =
+				join_states(a->entry[successor], state);
+			if (same_states(&joined, &a->entry[successor])) {
+				continue;
+			}
+			a->entry[successor] = joined;
+			if (!queued[successor]) {
+				queued[successor] = true;
+				work[work_size++] = successor;
+			}
+		}
+	}
+	free(work);
+	free(queued);
+}
+
+static int compare_accesses(const void *a, const void *b)
+{
+	const struct stack_access *x = a;
+	const struct stack_access *y = b;
+	if (x->address != y->address) {
+		return x->address < y->address ? -1 : 1;
+	}
+	return x->element < y->element ? -1 : x->element > y->element;
+}
+
+/*
+ * The accesses at address, which starts at accesses[i], are to a slot when
+ * all of them and the ones overlapping them are lw and sw of the word at
+ * address, in memory past the data segment. Returns one past the last
+ * access at address.
+ */
+static size_t slot_accesses(struct stack_accesses *accesses, size_t i,
+			    uint32_t data_size, uint32_t memory_size,
+			    bool *slot)
+{
+	uint32_t address = accesses->items[i].address;
+	*slot = address >= data_size && memory_size >= WORD_SIZE &&
+		address <= memory_size - WORD_SIZE;
+	for (size_t j = i; j > 0; j--) {
+		struct stack_access *before = &accesses->items[j - 1];
+		if ((uint64_t)before->address + WORD_SIZE <= address) {
+			break;
+		}
+		if ((uint64_t)before->address + before->size > address) {
+			*slot = false;
+		}
+	}
+	size_t end = i;
+	for (; end < accesses->size &&
+	       accesses->items[end].address == address; end++) {
+		*slot = *slot && accesses->items[end].local;
+	}
+	for (size_t j = end; j < accesses->size &&
+	     accesses->items[j].address < (uint64_t)address + WORD_SIZE; j++) {
+		*slot = false;
+	}
+	return end;
+}
+
+static void choose_slots(struct stack_analysis *a, uint32_t data_size,
+			 uint32_t memory_size, size_t elements,
+			 struct stack_slots *slots)
+{
+	struct stack_accesses *accesses = &a->accesses;
+	if (accesses->size == 0) {
+		return;
+	}
+	qsort(accesses->items, accesses->size, sizeof(*accesses->items),
+	      compare_accesses);
+	for (size_t i = 0; i < accesses->size;) {
+		bool slot;
+		size_t end = slot_accesses(accesses, i, data_size, memory_size,
+					   &slot);
+		if (!slot || slots->size == STACK_SLOTS_MAX) {
+			i = end;
+			continue;
+		}
+		if (slots->of_element == NULL) {
+			slots->of_element = malloc(elements);
+			if (slots->of_element == NULL) {
+				fail("Failed to allocate memory for stack slots.");
+			}
+			memset(slots->of_element, NO_STACK_SLOT, elements);
+		}
+		for (; i < end; i++) {
+			slots->of_element[accesses->items[i].element] =
+				slots->size;
+		}
+		slots->size++;
+	}
+}
+
+void find_stack_slots(struct ir_element *ir, struct blocks *blocks,
+		      uint32_t data_size, uint32_t memory_size,
+		      struct stack_slots *slots)
+{
+	*slots = (struct stack_slots) { 0 };
+	if (blocks->size == 0) {
+		return;
+	}
+	struct stack_analysis a = {
+		.ir = ir,
+		.blocks = blocks,
+		.entry = calloc(blocks->size, sizeof(*a.entry))
+	};
+	if (a.entry == NULL) {
+		fail("Failed to allocate memory for stack analysis.");
+	}
+	find_sp_values(&a);
+
+	// the values are final, the accesses at them are what code does
+	a.record = true;
+	for (size_t b = 0; b < blocks->size && !a.escaped; b++) {
+		if (a.entry[b].sp.kind != SP_UNREACHED) {
+			step_block(&a, b);
+		}
+	}
+	if (!a.escaped) {
+		size_t elements = 0;
+		while (ir[elements].type != IR_EOF) {
+			elements++;
+		}
+		choose_slots(&a, data_size, memory_size, elements, slots);
+	}
+	free(a.entry);
+	darray_free(a.accesses);
+}
+
+void free_stack_slots(struct stack_slots *slots)
+{
+	free(slots->of_element);
+	*slots = (struct stack_slots) { 0 };
+}
@@ -0,0 +1,39 @@
+#ifndef RV2JVM_STACK_H
+#define RV2JVM_STACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ir.h"
+#include "profile.h"
+
+/*
+ * Stack slots are words of memory that a program only reaches with lw and
+ * sw at offsets of sp. sp is 0 when a hart starts and the program moves it
+ * with li sp and addi sp, sp only, so it holds a known address at every
+ * instruction that uses it. Its value never goes to another register or to
+ * memory. Every other load, store and atomic goes through a register that
+ * holds the same constant on every path, and none of them overlaps a slot,
+ * so nothing else reads or writes the slots and hart keeps them in locals.
+ * Memory past the data segment starts zeroed, and so do the locals.
+ */
+#define STACK_SLOTS_MAX 64
+#define NO_STACK_SLOT UINT8_MAX
+
+struct stack_slots {
+	size_t size;
+	// slot the lw or sw of every IR element accesses, NO_STACK_SLOT if
+	// none, NULL when there are no slots
+	uint8_t *of_element;
+};
+
+/*
+ * Finds the slots of the blocks of a program that runs in one method,
+ * between the data segment and the end of memory.
+ */
+void find_stack_slots(struct ir_element *ir, struct blocks *blocks,
+		      uint32_t data_size, uint32_t memory_size,
+		      struct stack_slots *slots);
+void free_stack_slots(struct stack_slots *slots);
+
+#endif
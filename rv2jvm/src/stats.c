@@ -0,0 +1,197 @@
+#include "stats.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "alloc.h"
+#include "darray.h"
+
+static const char *phase_names[STATS_PHASE_COUNT] = {
+	[STATS_LEX] = "lex",
+	[STATS_PARSE] = "parse",
+	[STATS_SEMAN] = "seman",
+	[STATS_CODEGEN] = "generate_bytecode",
+};
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void stats_begin(struct compile_stats *stats, struct stats_timer *timer)
+{
+	if (stats == NULL) {
+		return;
+	}
+	timer->wall_ns = clock_ns(CLOCK_MONOTONIC);
+	timer->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	timer->allocations = alloc_count();
+	timer->allocated_bytes = alloc_bytes();
+}
+
+/*
+ * ru_maxrss is a high-water mark, so the value recorded for a phase is the
+ * peak of the whole process up to and including that phase.
+ */
+void stats_end(struct compile_stats *stats, enum stats_phase phase,
+	       struct stats_timer *timer, size_t output_size)
+{
+	if (stats == NULL) {
+		return;
+	}
+	struct phase_stats *p = &stats->phases[phase];
+	p->wall_ns = clock_ns(CLOCK_MONOTONIC) - timer->wall_ns;
+	p->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - timer->cpu_ns;
+	p->allocations = alloc_count() - timer->allocations;
+	p->allocated_bytes = alloc_bytes() - timer->allocated_bytes;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	p->peak_rss_kb = usage.ru_maxrss;
+	p->output_size = output_size;
+}
+
+/*
+ * Adds the totals of earlier runs of the same phase to phase.
+ */
+void stats_accumulate(struct phase_stats *phase, struct phase_stats *earlier)
+{
+	phase->wall_ns += earlier->wall_ns;
+	phase->cpu_ns += earlier->cpu_ns;
+	phase->allocations += earlier->allocations;
+	phase->allocated_bytes += earlier->allocated_bytes;
+	phase->output_size += earlier->output_size;
+}
+
+void stats_add_method(struct compile_stats *stats, struct method_stats method)
+{
+	if (stats == NULL) {
+		return;
+	}
+	stats->codegen.stack_map_frames += method.stack_map_frames;
+	darray_append(stats->codegen.methods, method);
+}
+
+void free_stats(struct compile_stats *stats)
+{
+	darray_free(stats->codegen.methods);
+}
+
+static size_t bytecode_bytes(struct compile_stats *stats)
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < stats->codegen.methods.size; i++) {
+		bytes += stats->codegen.methods.items[i].code_length;
+	}
+	return bytes;
+}
+
+static double bytes_per_instruction(struct compile_stats *stats)
+{
+	if (stats->codegen.guest_instructions == 0) {
+		return 0;
+	}
+	return (double)bytecode_bytes(stats) / stats->codegen.guest_instructions;
+}
+
+static void print_text(FILE *out, struct compile_stats *stats)
+{
+	fprintf(out, "%-18s %10s %10s %10s %12s %12s %12s\n", "phase",
+		"wall ms", "cpu ms", "allocs", "alloc KB", "peak RSS KB",
+		"output B");
+	for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+		struct phase_stats *p = &stats->phases[i];
+		fprintf(out, "%-18s %10.3f %10.3f %10lu %12.1f %12ld %12zu\n",
+			phase_names[i], p->wall_ns / 1e6, p->cpu_ns / 1e6,
+			p->allocations, p->allocated_bytes / 1024.0,
+			p->peak_rss_kb, p->output_size);
+	}
+	fprintf(out, "\n");
+	fprintf(out, "%-30s %zu\n", "input bytes", stats->input_bytes);
+	fprintf(out, "%-30s %zu\n", "tokens", stats->tokens);
+	fprintf(out, "%-30s %zu\n", "ir elements", stats->ir_elements);
+	fprintf(out, "%-30s %zu\n", "cache hits", stats->cache_hits);
+	fprintf(out, "%-30s %zu\n", "cache misses", stats->cache_misses);
+	fprintf(out, "%-30s %zu\n", "fused idioms", stats->fused_idioms);
+	fprintf(out, "%-30s %zu\n", "guest instructions",
+		stats->codegen.guest_instructions);
+	fprintf(out, "%-30s %u\n", "constant pool entries",
+		stats->codegen.constant_pool_entries);
+	fprintf(out, "%-30s %zu\n", "bytecode bytes", bytecode_bytes(stats));
+	fprintf(out, "%-30s %.2f\n", "bytecode bytes per instruction",
+		bytes_per_instruction(stats));
+	fprintf(out, "%-30s %zu\n", "branches", stats->codegen.branches);
+	fprintf(out, "%-30s %zu\n", "stack map frames",
+		stats->codegen.stack_map_frames);
+	fprintf(out, "%-30s %zu\n", "stack slots in locals",
+		stats->codegen.stack_slots);
+	fprintf(out, "%-30s %zu\n", "access runs",
+		stats->codegen.access_runs);
+	fprintf(out, "%-30s %zu\n", "class bytes", stats->class_bytes);
+	fprintf(out, "\n%-18s %10s %10s %10s %10s\n", "method", "code B",
+		"max stack", "max locals", "frames");
+	for (size_t i = 0; i < stats->codegen.methods.size; i++) {
+		struct method_stats *m = &stats->codegen.methods.items[i];
+		fprintf(out, "%-18s %10u %10u %10u %10u\n", m->name,
+			m->code_length, m->max_stack, m->max_locals,
+			m->stack_map_frames);
+	}
+}
+
+static void print_json(FILE *out, struct compile_stats *stats)
+{
+	fprintf(out, "{\"phases\":{");
+	for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+		struct phase_stats *p = &stats->phases[i];
+		fprintf(out, "%s\"%s\":{\"wall_ns\":%lu,\"cpu_ns\":%lu,"
+			"\"allocations\":%lu,\"allocated_bytes\":%lu,"
+			"\"peak_rss_kb\":%ld,\"output_bytes\":%zu}",
+			i == 0 ? "" : ",", phase_names[i], p->wall_ns,
+			p->cpu_ns, p->allocations, p->allocated_bytes,
+			p->peak_rss_kb, p->output_size);
+	}
+	fprintf(out, "},\"input_bytes\":%zu,\"tokens\":%zu,\"ir_elements\":%zu",
+		stats->input_bytes, stats->tokens, stats->ir_elements);
+	fprintf(out, ",\"cache_hits\":%zu,\"cache_misses\":%zu",
+		stats->cache_hits, stats->cache_misses);
+	fprintf(out, ",\"fused_idioms\":%zu", stats->fused_idioms);
+	fprintf(out, ",\"guest_instructions\":%zu,\"constant_pool_entries\":%u",
+		stats->codegen.guest_instructions,
+		stats->codegen.constant_pool_entries);
+	fprintf(out, ",\"bytecode_bytes\":%zu,"
+		"\"bytecode_bytes_per_instruction\":%.4f",
+		bytecode_bytes(stats), bytes_per_instruction(stats));
+	fprintf(out, ",\"branches\":%zu,\"stack_map_frames\":%zu,"
+		"\"stack_slots\":%zu,\"access_runs\":%zu,\"class_bytes\":%zu,"
+		"\"methods\":[",
+		stats->codegen.branches, stats->codegen.stack_map_frames,
+		stats->codegen.stack_slots, stats->codegen.access_runs,
+		stats->class_bytes);
+	for (size_t i = 0; i < stats->codegen.methods.size; i++) {
+		struct method_stats *m = &stats->codegen.methods.items[i];
+		fprintf(out, "%s{\"name\":\"%s\",\"code_length\":%u,"
+			"\"max_stack\":%u,\"max_locals\":%u,"
+			"\"stack_map_frames\":%u}",
+			i == 0 ? "" : ",", m->name, m->code_length,
+			m->max_stack, m->max_locals, m->stack_map_frames);
+	}
+	fprintf(out, "]}\n");
+}
+
+void print_stats(FILE *out, struct compile_stats *stats,
+		 enum stats_format format)
+{
+	switch (format) {
+	case STATS_TEXT:
+		print_text(out, stats);
+		break;
+	case STATS_JSON:
+		print_json(out, stats);
+		break;
+	}
+}
@@ -0,0 +1,82 @@
+#ifndef RV2JVM_STATS_H
+#define RV2JVM_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum stats_phase {
+	STATS_LEX,
+	STATS_PARSE,
+	STATS_SEMAN,
+	STATS_CODEGEN,
+	STATS_PHASE_COUNT
+};
+
+enum stats_format {
+	STATS_TEXT,
+	STATS_JSON
+};
+
+struct phase_stats {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	uint64_t allocations;
+	uint64_t allocated_bytes;
+	long peak_rss_kb;
+	size_t output_size;
+};
+
+struct method_stats {
+	char *name;
+	uint32_t code_length;
+	uint16_t max_stack;
+	uint16_t max_locals;
+	uint32_t stack_map_frames;
+};
+
+struct codegen_stats {
+	uint32_t constant_pool_entries;
+	size_t guest_instructions;
+	size_t branches;
+	size_t stack_map_frames;
+	// words of the stack kept in locals
+	size_t stack_slots;
+	// runs of loads or stores written as one access
+	size_t access_runs;
+	struct {
+		struct method_stats *items;
+		size_t size;
+		size_t capacity;
+	} methods;
+};
+
+struct compile_stats {
+	struct phase_stats phases[STATS_PHASE_COUNT];
+	size_t input_bytes;
+	size_t tokens;
+	size_t ir_elements;
+	size_t class_bytes;
+	size_t cache_hits;
+	size_t cache_misses;
+	size_t fused_idioms;
+	struct codegen_stats codegen;
+};
+
+struct stats_timer {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	uint64_t allocations;
+	uint64_t allocated_bytes;
+};
+
+void stats_begin(struct compile_stats *stats, struct stats_timer *timer);
+void stats_end(struct compile_stats *stats, enum stats_phase phase,
+	       struct stats_timer *timer, size_t output_size);
+void stats_accumulate(struct phase_stats *phase, struct phase_stats *earlier);
+void stats_add_method(struct compile_stats *stats, struct method_stats method);
+void print_stats(FILE *out, struct compile_stats *stats,
+		 enum stats_format format);
+void free_stats(struct compile_stats *stats);
+
+#endif
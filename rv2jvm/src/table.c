@@ -7,6 +7,8 @@
 #include <string.h>
 #include <sysexits.h>
 
+#include "error.h"
+
 #define TABLE_MAX_LOAD 0.75
 
 struct table_key to_number_key(int32_t number)
@@ -31,8 +33,7 @@ struct table *table_create()
 {
 	struct table *t = malloc(sizeof(*t));
 	if (t == NULL) {
-		fprintf(stderr, "Failed to allocate memory for table.\n");
-		exit(EXIT_FAILURE);
+		fail("Failed to allocate memory for table.");
 	}
 	t->capacity = 0;
 	t->size = 0;
@@ -42,12 +43,17 @@ struct table *table_create()
 
 void table_free(struct table *table)
 {
-	for (size_t i = 0; i < table->size; i++) {
+	for (size_t i = 0; i < table->capacity; i++) {
 		if (table->values[i].value == NULL) {
 			continue;
 		}
 		free(table->values[i].value);
 	}
+	table_free_shallow(table);
+}
+
+void table_free_shallow(struct table *table)
+{
 	free(table->values);
 	free(table);
 }
@@ -131,8 +137,7 @@ static void grow_capacity(struct table *table)
 	size_t alloc_size = sizeof(*table->values) * table->capacity;
 	struct table_value *values = malloc(alloc_size);
 	if (values == NULL) {
-		fprintf(stderr, "Failed to allocate memory for table of capacity %lu.\n", table->capacity);
-		exit(EXIT_FAILURE);
+		fail("Failed to allocate memory for table of capacity %lu.", table->capacity);
 	}
 	memset(values, 0, alloc_size);
 	for (size_t i = 0; i < old_capacity; i++) {
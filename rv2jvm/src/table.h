@@ -40,5 +40,7 @@ struct table *table_create();
 bool table_set(struct table *table, struct table_key key, void *value);
 struct table_value *table_get(struct table *table, struct table_key key);
 void table_free(struct table *table);
+// frees the table but not the values, which belong to someone else
+void table_free_shallow(struct table *table);
 
 #endif
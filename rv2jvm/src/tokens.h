@@ -10,8 +10,11 @@ enum token_type {
 	TOKEN_LPAREN,
 	TOKEN_RPAREN,
 	TOKEN_MINUS,
+	TOKEN_PERCENT,
 	TOKEN_IDENTIFIER,
 	TOKEN_DECIMAL,
+	// a string literal of .string, the lexeme keeps its quotes and escapes
+	TOKEN_STRING,
 	TOKEN_EOF
 };
 
@@ -0,0 +1,46 @@
+_start:
+	addi x9, x0, 256
+	addi x5, x0, 11
+	sc.w x10, x5, (x9)
+	lr.w x11, (x9)
+	sc.w x12, x5, (x9)
+	sc.w x13, x5, (x9)
+	addi x14, x9, 4
+	addi x6, x0, -5
+	sw x6, 0(x14)
+	addi x7, x0, 3
+	amomin.w x15, x7, (x14)
+	addi x7, x0, -7
+	amomin.w x16, x7, (x14)
+	addi x18, x9, 8
+	addi x6, x0, -1
+	sw x6, 0(x18)
+	addi x7, x0, 5
+	amomaxu.w x19, x7, (x18)
+	addi x20, x9, 12
+	sw x7, 0(x20)
+	addi x7, x0, -2
+	amomaxu.w x21, x7, (x20)
+	addi x22, x9, 16
+	sw x6, 0(x22)
+	addi x7, x0, 5
+	amominu.w x23, x7, (x22)
+	addi x24, x9, 20
+	sw x6, 0(x24)
+	addi x7, x0, -3
+	amomax.w x25, x7, (x24)
+	sw x10, 24(x9)
+	sw x12, 28(x9)
+	sw x13, 32(x9)
+	sw x15, 36(x9)
+	sw x16, 40(x9)
+	sw x19, 44(x9)
+	sw x21, 48(x9)
+	sw x23, 52(x9)
+	sw x25, 56(x9)
+	lw x26, 0(x9)
+	lw x27, 4(x9)
+	lw x28, 8(x9)
+	lw x29, 12(x9)
+	lw x30, 16(x9)
+	lw x31, 20(x9)
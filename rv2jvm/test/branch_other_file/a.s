@@ -0,0 +1,7 @@
+_start:
+	addi x5, x0, 1
+	blt x5, x0, ext
+	addi x5, x5, 2
+	bne x5, x0, ext
+	addi x5, x0, 99
+	sw x5, 260(x0)
@@ -0,0 +1,4 @@
+.globl ext
+ext:
+	addi x5, x5, 20
+	sw x5, 256(x0)
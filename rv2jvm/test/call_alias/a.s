@@ -0,0 +1,3 @@
+_start:
+	addi x5, x0, 1
+	call foo
@@ -0,0 +1,5 @@
+.globl foo
+bar:
+foo:
+	addi x5, x5, 7
+	sw x5, 256(x0)
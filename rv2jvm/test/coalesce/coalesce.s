@@ -0,0 +1,18 @@
+_start:
+	addi x9, x0, 256
+	addi x5, x0, 1
+	addi x6, x0, 2
+	addi x7, x0, 3
+	addi x8, x0, 4
+	sb x5, 0(x9)
+	sb x6, 1(x9)
+	sb x7, 2(x9)
+	sb x8, 3(x9)
+	lbu x10, 0(x9)
+	lbu x11, 1(x9)
+	add x10, x10, x11
+	sw x10, 4(x9)
+	lh x12, 0(x9)
+	lh x13, 2(x9)
+	add x12, x13, x12
+	sw x12, 8(x9)
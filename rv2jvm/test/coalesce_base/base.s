@@ -0,0 +1,11 @@
+_start:
+	addi x9, x0, 256
+	addi x5, x0, 272
+	sw x5, 0(x9)
+	addi x6, x0, 5
+	sw x6, 4(x9)
+	addi x7, x0, 11
+	sw x7, 20(x9)
+	lw x9, 0(x9)
+	lw x10, 4(x9)
+	sw x10, 280(x0)
@@ -0,0 +1,7 @@
+_start:
+	addi x9, x0, 256
+	addi x5, x0, 7
+	addi x6, x0, 9
+	sw x5, 0(x9)
+	sw x6, 4(x9)
+	j sum
@@ -0,0 +1,6 @@
+.globl sum
+sum:
+	lw x10, 0(x9)
+	lw x11, 4(x9)
+	add x12, x11, x10
+	sw x12, 8(x9)
@@ -0,0 +1,8 @@
+_start:
+	addi x5, x0, 3
+	j foo
+	addi x5, x0, 99
+bar:
+foo:
+	addi x5, x5, 4
+	sw x5, 256(x0)
@@ -0,0 +1,119 @@
+/*
+ * Checks that librv2jvm reports failed compilations instead of exiting.
+ *
+ * Every case is compiled through rv2jvm_compile() and must come back with
+ * an error diagnostic naming the file and line it is about. An exit from
+ * within the library fails the test, and make test-lib builds it with the
+ * address sanitizer, whose leak check fails it when a call left anything
+ * allocated.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rv2jvm.h"
+
+struct failure {
+	const char *name;
+	const char *text;
+	size_t line;
+	// part of the message that names the problem
+	const char *message;
+};
+
+static const struct failure failures[] = {
+	{
+		"parse_error",
+		"_start:\n"
+		"\taddi x5, x0, 1\n"
+		"\taddi x5, , 1\n",
+		3, "Invalid register"
+	},
+	{
+		"unknown_directive",
+		"\t.text\n"
+		"_start:\n"
+		"\taddi x5, x0, 1\n"
+		"\t.bogus 4\n",
+		4, "Unknown directive"
+	},
+};
+
+static const char *good =
+	"_start:\n"
+	"\taddi x5, x0, 23\n";
+
+static bool returned;
+
+static void on_exit_check(void)
+{
+	if (!returned) {
+		fprintf(stderr, "FAIL the library exited\n");
+		_Exit(1);
+	}
+}
+
+static bool check_failure(const struct failure *failure)
+{
+	struct rv2jvm_source source = {
+		failure->name, failure->text, strlen(failure->text)
+	};
+	struct rv2jvm_result result;
+	int status = rv2jvm_compile(&source, 1, NULL, &result);
+
+	bool found = false;
+	for (size_t i = 0; i < result.diagnostics_n; i++) {
+		struct rv2jvm_diagnostic *d = &result.diagnostics[i];
+		found = found || (d->severity == RV2JVM_ERROR &&
+				  d->file != NULL &&
+				  strcmp(d->file, failure->name) == 0 &&
+				  d->line == failure->line &&
+				  strstr(d->message, failure->message) != NULL);
+	}
+	bool ok = status != 0 && status == result.status &&
+		  result.class_bytes == NULL && found;
+	if (!ok) {
+		printf("FAIL %s: status %d,", failure->name, status);
+		for (size_t i = 0; i < result.diagnostics_n; i++) {
+			struct rv2jvm_diagnostic *d = &result.diagnostics[i];
+			printf(" %s:%zu: %s;", d->file != NULL ? d->file : "-",
+			       d->line, d->message);
+		}
+		printf("\n");
+	} else {
+		printf("ok   %s\n", failure->name);
+	}
+	rv2jvm_free_result(&result);
+	return ok;
+}
+
+// a compilation after failed ones still works
+static bool check_success(void)
+{
+	struct rv2jvm_source source = { "good", good, strlen(good) };
+	struct rv2jvm_result result;
+	int status = rv2jvm_compile(&source, 1, NULL, &result);
+	bool ok = status == 0 && result.class_bytes != NULL &&
+		  result.class_length >= 4 &&
+		  memcmp(result.class_bytes, "\xca\xfe\xba\xbe", 4) == 0;
+	printf("%s good\n", ok ? "ok  " : "FAIL");
+	rv2jvm_free_result(&result);
+	return ok;
+}
+
+int main(void)
+{
+	atexit(on_exit_check);
+	size_t failed = 0;
+	for (size_t i = 0; i < sizeof(failures) / sizeof(*failures); i++) {
+		failed += !check_failure(&failures[i]);
+	}
+	failed += !check_success();
+	returned = true;
+	if (failed > 0) {
+		fprintf(stderr, "%zu failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,32 @@
+_start:
+	addi x9, x0, 256
+	addi x5, x0, 7
+	div x10, x5, x0
+	divu x11, x5, x0
+	rem x12, x5, x0
+	remu x13, x5, x0
+	li x6, -2147483648
+	addi x7, x0, -1
+	div x14, x6, x7
+	rem x15, x6, x7
+	addi x8, x0, -3
+	mul x16, x8, x6
+	mulh x17, x8, x6
+	mulhsu x18, x8, x6
+	mulhu x19, x8, x6
+	mulh x20, x7, x7
+	mulhsu x21, x7, x7
+	mulhu x22, x7, x7
+	sw x10, 0(x9)
+	sw x11, 4(x9)
+	sw x12, 8(x9)
+	sw x13, 12(x9)
+	sw x14, 16(x9)
+	sw x15, 20(x9)
+	sw x16, 24(x9)
+	sw x17, 28(x9)
+	sw x18, 32(x9)
+	sw x19, 36(x9)
+	sw x20, 40(x9)
+	sw x21, 44(x9)
+	sw x22, 48(x9)
@@ -0,0 +1,119 @@
+#!/bin/sh
+#
+# Compile every case in test/ and check what came out. A case is a
+# directory of .s files, compiled in name order, and a file expect with one
+# check per line:
+#
+#   flags --separate        options to compile the case with
+#   stats stack_slots 2     a value of --stats=json
+#   memory 1024 12          the word at an address after the program ran
+#   register 0 x5 0x17      a register of a hart after --run interpreted it
+#
+# Memory checks run the class on the local JVM with memory mapped from a
+# file. When there is no java they are skipped, and so are cases that have
+# them. Register checks need flags that --run takes. Cases can be narrowed
+# from the environment, e.g. TEST_CASES="stack_alias coalesce" make test.
+
+set -e
+
+cd "$(dirname "$0")"
+
+cases=${TEST_CASES:-$(for dir in */; do [ -f "$dir/expect" ] && \
+	echo "${dir%/}"; done)}
+java=${JAVA:-java}
+work=${TEST_WORK:-out}
+
+if ! command -v "$java" > /dev/null; then
+	echo "No $java, memory checks skipped" >&2
+	java=
+fi
+
+# prints the value of key in the JSON object on stdin
+field() {
+	sed -n "s/.*\"$1\":\([^,}]*\).*/\1/p"
+}
+
+# prints the value of register $2 of hart $1 in the --run output on stdin,
+# which leaves out the registers that are zero
+register() {
+	awk -v hart="$1" -v reg="$2" '$1 == hart && $2 == reg { v = $3 }
+		END { print v == "" ? 0 : v }'
+}
+
+failed=0
+skipped=0
+for case in $cases; do
+	dir="$work/$case"
+	rm -rf "$dir"
+	mkdir -p "$dir"
+	flags=$(awk '$1 == "flags" { $1 = ""; print }' "$case/expect")
+	errors=
+	skip=
+
+	# shellcheck disable=SC2086
+	stats=$(../rv2jvm $flags --stats=json --output="$dir/RvRuntime.class" \
+		"$case"/*.s) || errors="$errors compile"
+	checks=$(awk '$1 == "stats" { print $2 "=" $3 }' "$case/expect")
+	for check in $checks; do
+		actual=$(printf '%s\n' "$stats" | field "${check%%=*}")
+		if [ "$actual" != "${check#*=}" ]; then
+			errors="$errors ${check%%=*}=$actual"
+		fi
+	done
+
+	checks=$(awk '$1 == "register" { print $2 ":" $3 "=" $4 }' \
+		"$case/expect")
+	if [ -n "$checks" ]; then
+		# shellcheck disable=SC2086
+		registers=$(timeout 10 ../rv2jvm $flags --run "$case"/*.s) ||
+			errors="$errors interpret"
+		for check in $checks; do
+			hart=${check%%:*}
+			reg=${check#*:}
+			reg=${reg%%=*}
+			actual=$(printf '%s\n' "$registers" | register "$hart" "$reg")
+			# compared as 32 bit words, so -1 matches 0xffffffff
+			if [ $((actual & 0xffffffff)) -ne \
+			     $((${check#*=} & 0xffffffff)) ]; then
+				errors="$errors $hart:$reg=$actual"
+			fi
+		done
+	fi
+
+	checks=$(awk '$1 == "memory" { print $2 "=" $3 }' "$case/expect")
+	if [ -n "$checks" ] && [ -z "$java" ]; then
+		skip=yes
+	elif [ -n "$checks" ]; then
+		rm -rf "$dir"
+		mkdir -p "$dir"
+		# shellcheck disable=SC2086
+		../rv2jvm $flags --memory-file="$dir/memory" --share-memory-file \
+			--output="$dir/RvRuntime.class" "$case"/*.s &&
+			"$java" -cp "$dir" RvRuntime || errors="$errors run"
+		for check in $checks; do
+			actual=$(od -An -t d4 --endian=little -j "${check%%=*}" -N 4 \
+				"$dir/memory" 2> /dev/null | tr -d ' ')
+			if [ "$actual" != "${check#*=}" ]; then
+				errors="$errors [${check%%=*}]=$actual"
+			fi
+		done
+	fi
+
+	if [ -n "$errors" ]; then
+		echo "FAIL $case:$errors"
+		failed=$((failed + 1))
+	elif [ -n "$skip" ]; then
+		echo "skip $case"
+		skipped=$((skipped + 1))
+	else
+		echo "ok   $case"
+	fi
+done
+
+if [ "$skipped" -gt 0 ]; then
+	echo "$skipped skipped" >&2
+fi
+if [ "$failed" -gt 0 ]; then
+	echo "$failed failed" >&2
+	exit 1
+fi
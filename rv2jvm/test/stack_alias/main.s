@@ -0,0 +1,8 @@
+_start:
+	addi x2, x0, 1024
+	addi x2, x2, -16
+	sw x1, 12(x2)
+	li x5, 1020
+	lw x6, 0(x5)
+	lw x1, 12(x2)
+	addi x2, x2, 16
@@ -0,0 +1,12 @@
+_start:
+	addi x2, x0, 1024
+	addi x2, x2, -16
+	sw x1, 12(x2)
+	li x5, 100
+	li x7, 200
+copy:
+	lw x6, 0(x5)
+	addi x5, x5, 4
+	bne x5, x7, copy
+	lw x1, 12(x2)
+	addi x2, x2, 16
@@ -0,0 +1,8 @@
+.globl back
+_start:
+	addi x5, x0, 5
+	j ext
+back:
+	sw x5, 256(x0)
+	addi x5, x0, 5
+	j twice
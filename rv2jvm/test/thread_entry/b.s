@@ -0,0 +1,12 @@
+.globl ext
+.globl twice
+twice:
+	addi x5, x5, 1
+ext:
+	addi x5, x5, 10
+	addi x7, x7, 1
+	addi x8, x0, 1
+	bne x7, x8, done
+	j back
+done:
+	sw x5, 260(x0)
@@ -0,0 +1,23 @@
+_start:
+	addi x8, x0, 2
+	addi x9, x0, 256
+pass:
+	addi x5, x0, 0
+	addi x6, x0, 4
+loop:
+	addi x5, x5, 3
+	addi x6, x6, -1
+	bne x6, x8, next
+tramp:
+	j finish
+next:
+	bne x6, x0, loop
+	addi x5, x5, 100
+	blt x0, x5, tramp
+	j finish
+finish:
+	sw x5, 0(x9)
+	addi x9, x9, 4
+	addi x8, x8, 5
+	addi x10, x0, 264
+	bne x9, x10, pass
@@ -0,0 +1,6 @@
+.globl ext
+ext:
+	j inner
+inner:
+	addi x5, x5, 10
+	sw x5, 256(x0)